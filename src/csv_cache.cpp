@@ -1,11 +1,21 @@
 #include "csv_cache.h"
 
+#include "csv_scan.h"
+
 #include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <cerrno>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iterator>
+#include <unordered_map>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -16,11 +26,21 @@ namespace {
 // Bumped whenever the layout below changes, so an old cache is missed rather
 // than misread.
 constexpr char kMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'I', 'X'};
-constexpr std::uint32_t kVersion = 1;
-
-// A file has to be worth indexing. Below this, a rebuild is imperceptible and
-// caching would only litter the cache directory.
-constexpr long long kMinimumFileSize = 32ll * 1024 * 1024;
+constexpr std::uint32_t kVersion = 3;
+constexpr char kProfileMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'P', 'F'};
+constexpr std::uint32_t kProfileVersion = 1;
+constexpr char kZoneMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'Z', 'M'};
+constexpr std::uint32_t kZoneVersion = 1;
+constexpr char kGramMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'G', 'F'};
+constexpr std::uint32_t kGramVersion = 1;
+constexpr char kGramIndexMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'G', 'I'};
+constexpr std::uint32_t kGramIndexVersion = 1;
+constexpr char kSumMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'C', 'S'};
+constexpr std::uint32_t kSumVersion = 1;
+constexpr char kLayoutMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'L', 'Y'};
+constexpr std::uint32_t kLayoutVersion = 1;
+constexpr char kCopyMagic[8] = {'C', 'S', 'V', 'T', 'U', 'I', 'C', 'P'};
+constexpr std::uint32_t kCopyVersion = 1;
 
 std::string Environment(const char *name) {
   const char *value = std::getenv(name);
@@ -74,8 +94,593 @@ template <typename T> bool Read(std::istream &in, T &value) {
       in.read(reinterpret_cast<char *>(&value), sizeof(value)));
 }
 
+// Everything that would change what a cached file means, in the order both
+// kinds of file store it.
+void WriteKey(std::ostream &out, const Key &key) {
+  Write(out, static_cast<std::int64_t>(key.size));
+  Write(out, static_cast<std::int64_t>(key.mtime));
+  Write(out, static_cast<std::uint8_t>(key.delimiter));
+  Write(out, static_cast<std::uint8_t>(key.has_header ? 1 : 0));
+  Write(out, static_cast<std::uint64_t>(key.chunk_size));
+}
+
+// Reads a stored key as it was written, leaving the path to the caller.
+bool ReadStoredKey(std::istream &in, Key &stored) {
+  std::int64_t size = 0;
+  std::int64_t mtime = 0;
+  std::uint8_t delimiter = 0;
+  std::uint8_t has_header = 0;
+  std::uint64_t chunk_size = 0;
+  if (!Read(in, size) || !Read(in, mtime) || !Read(in, delimiter) ||
+      !Read(in, has_header) || !Read(in, chunk_size))
+    return false;
+  stored.size = size;
+  stored.mtime = mtime;
+  stored.delimiter = static_cast<char>(delimiter);
+  stored.has_header = has_header != 0;
+  stored.chunk_size = static_cast<size_t>(chunk_size);
+  return true;
+}
+
+// The same file read the same way, though it may since have changed.
+bool SameReading(const Key &a, const Key &b) {
+  return a.delimiter == b.delimiter && a.has_header == b.has_header &&
+         a.chunk_size == b.chunk_size;
+}
+
+bool ReadKey(std::istream &in, const Key &key) {
+  Key stored;
+  return ReadStoredKey(in, stored) && stored.size == key.size &&
+         stored.mtime == key.mtime && SameReading(stored, key);
+}
+
+void WritePath(std::ostream &out, const Key &key) {
+  Write(out, static_cast<std::uint64_t>(key.path.size()));
+  out.write(key.path.data(), static_cast<std::streamsize>(key.path.size()));
+}
+
+bool ReadPath(std::istream &in, const Key &key) {
+  std::uint64_t path_length = 0;
+  if (!Read(in, path_length) || path_length > 4096)
+    return false;
+  std::string stored_path(static_cast<size_t>(path_length), '\0');
+  if (path_length != 0 &&
+      !in.read(&stored_path[0], static_cast<std::streamsize>(path_length)))
+    return false;
+  return stored_path == key.path; // else a hash collision, or a shared cache
+}
+
+bool ReadMagic(std::istream &in, const char (&expected)[8]) {
+  char magic[8] = {0};
+  return in.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, expected, sizeof(magic)) == 0;
+}
+
+// A lock on the cache directory, shared by every process writing to it and
+// taken outright by one trimming it, so that a trim never removes what is
+// being written, nor two trims race to remove the same files. Advisory, on a
+// file of its own: the cache files themselves are replaced, not locked.
+class DirectoryLock {
+public:
+  DirectoryLock(const std::string &directory, int operation) {
+    fd_ = ::open((directory + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                 0600);
+    if (fd_ >= 0 && ::flock(fd_, operation) != 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+  ~DirectoryLock() {
+    if (fd_ >= 0)
+      ::close(fd_); // which releases the lock
+  }
+  DirectoryLock(const DirectoryLock &) = delete;
+  DirectoryLock &operator=(const DirectoryLock &) = delete;
+
+  bool held() const { return fd_ >= 0; }
+
+private:
+  int fd_ = -1;
+};
+
+// Writes beside `path` and renames, so a cache file is never half written — a
+// reader that found one would reject it, but only after being handed
+// something that looked plausible. The name written to is this writer's own,
+// so two processes saving the same file each finish theirs, and the last
+// rename wins whole.
+template <typename Body> bool WriteReplacing(const std::string &path, Body &&body) {
+  static std::atomic<unsigned> writes{0};
+  const std::string temporary = path + "." + std::to_string(::getpid()) + "-" +
+                                std::to_string(writes++) + ".tmp";
+  // Blocks only while another process trims, which takes milliseconds. A
+  // directory that cannot be locked is written to regardless.
+  const DirectoryLock lock(path.substr(0, path.rfind('/')), LOCK_SH);
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+      return false;
+    body(out);
+    out.flush();
+    if (!out) {
+      ::unlink(temporary.c_str());
+      return false;
+    }
+  }
+
+  if (::rename(temporary.c_str(), path.c_str()) != 0) {
+    ::unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string CachePath(const Key &key, const char *extension) {
+  const std::string directory = Directory();
+  if (directory.empty())
+    return std::string();
+  return directory + "/" + HexOf(Hash(key.path)) + extension;
+}
+
+// Notes that a cache file has just been read from, which is what Trim goes
+// by: its modification time is otherwise only when it was written, and a
+// file indexed once and opened every day since is the last one to let go.
+void MarkUsed(const std::string &path) {
+  ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+}
+
+// The offset table of an index is in blocks of this many offsets, each kept
+// as its distance past the least of them in as few bits as the largest needs,
+// so any one is found without decoding the others. A block spans about 32 000
+// rows, a few megabytes of a typical file, which takes 22 bits or so an offset
+// against the 64 a plain one does.
+constexpr size_t kOffsetsPerBlock = 64;
+// A block's entry in the directory before the packed offsets: the least of
+// them, and where its bits start in words shifted up past their width.
+constexpr size_t kBlockEntryBytes = 16;
+
+std::uint64_t Load64(const unsigned char *at) {
+  std::uint64_t value = 0;
+  std::memcpy(&value, at, sizeof(value));
+  return value;
+}
+
+// Not cryptographic: it only has to notice a table cut short or written
+// over, which would otherwise decode to offsets that look like any others.
+std::uint64_t Checksum(const unsigned char *data, size_t size,
+                       std::uint64_t seed) {
+  std::uint64_t hash = seed ^ 0x9e3779b97f4a7c15ull;
+  for (size_t at = 0; at + 8 <= size; at += 8) {
+    hash = (hash ^ Load64(data + at)) * 0xff51afd7ed558ccdull;
+    hash ^= hash >> 32;
+  }
+  for (size_t at = size - size % 8; at < size; ++at)
+    hash = (hash ^ data[at]) * 0x100000001b3ull;
+  return hash;
+}
+
+std::uint64_t TableSeed(std::uint64_t total_rows, std::uint64_t count,
+                        std::uint64_t words) {
+  return (total_rows * 0x9e3779b97f4a7c15ull) ^ (count << 17) ^ (words << 41) ^
+         count;
+}
+
+size_t BitWidth(std::uint64_t value) {
+  size_t bits = 0;
+  while (value != 0) {
+    ++bits;
+    value >>= 1;
+  }
+  return bits;
+}
+
+std::uint64_t Unpack(const unsigned char *words, std::uint64_t bit,
+                     size_t width) {
+  if (width == 0)
+    return 0;
+  const std::uint64_t word = bit / 64;
+  const unsigned shift = static_cast<unsigned>(bit % 64);
+  std::uint64_t value = Load64(words + word * 8) >> shift;
+  if (shift + width > 64)
+    value |= Load64(words + (word + 1) * 8) << (64 - shift);
+  return width == 64 ? value : value & ((std::uint64_t{1} << width) - 1);
+}
+
+void Pack(std::vector<std::uint64_t> &words, std::uint64_t bit,
+          size_t width, std::uint64_t value) {
+  if (width == 0)
+    return;
+  const size_t word = static_cast<size_t>(bit / 64);
+  const unsigned shift = static_cast<unsigned>(bit % 64);
+  words[word] |= value << shift;
+  if (shift + width > 64)
+    words[word + 1] |= value >> (64 - shift);
+}
+
+// How much of what an index describes its fingerprint covers at either end:
+// the header and first rows, and the last chunk or so before the final offset.
+constexpr std::uint64_t kFingerprintBytes = 64 * 1024;
+
+// Fingerprints the bytes before `end` as `path` holds them now — the first
+// and last kFingerprintBytes of them, since hashing gigabytes to open a file
+// would cost what the index saves. False when they cannot all be read, as
+// when the file is now shorter than `end`.
+bool Fingerprint(const std::string &path, std::uint64_t end,
+                 std::uint64_t &out) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open())
+    return false;
+  const std::uint64_t head = std::min(end, kFingerprintBytes);
+  const std::uint64_t tail =
+      std::max(head, end > kFingerprintBytes ? end - kFingerprintBytes : 0);
+  std::vector<unsigned char> bytes(static_cast<size_t>(head + end - tail));
+  if (head > 0 &&
+      !in.read(reinterpret_cast<char *>(bytes.data()),
+               static_cast<std::streamsize>(head)))
+    return false;
+  if (end > tail) {
+    in.seekg(static_cast<std::streamoff>(tail));
+    if (!in.read(reinterpret_cast<char *>(bytes.data() + head),
+                 static_cast<std::streamsize>(end - tail)))
+      return false;
+  }
+  out = Checksum(bytes.data(), bytes.size(), end);
+  return true;
+}
+
+// A chunk as LoadEdited recognises it: its length, its first and last
+// kSampleBytes, and the first `after` bytes past its end, where the next chunk
+// begins. Not the whole of it, which would be reading the file to save
+// reading the file; an edit that keeps a chunk's length and leaves its ends
+// alone goes unseen, where almost any edit that adds or removes a byte moves
+// every end after it. The bytes past the end are what vouch for the boundary
+// itself: a chunk's last bytes are often a padded column, the same wherever
+// they are, while the next begins with a row of its own. False when the bytes
+// cannot all be read.
+bool SumOf(int fd, std::uint64_t begin, std::uint64_t end, std::uint64_t after,
+           std::uint32_t &out) {
+  if (end < begin)
+    return false;
+  const std::uint64_t length = end - begin;
+  const std::uint64_t head = std::min<std::uint64_t>(length, kSampleBytes);
+  const std::uint64_t tail = std::min<std::uint64_t>(length - head, kSampleBytes);
+  after = std::min<std::uint64_t>(after, kSampleBytes);
+  unsigned char bytes[3 * kSampleBytes];
+  const auto read = [fd, &bytes](std::uint64_t into, std::uint64_t count,
+                                 std::uint64_t from) {
+    return count == 0 ||
+           ::pread(fd, bytes + into, static_cast<size_t>(count),
+                   static_cast<off_t>(from)) == static_cast<ssize_t>(count);
+  };
+  if (!read(0, head, begin) || !read(head, tail, end - tail) ||
+      !read(head + tail, after, end))
+    return false;
+  const std::uint64_t hash =
+      Checksum(bytes, static_cast<size_t>(head + tail + after), length);
+  out = static_cast<std::uint32_t>(hash ^ (hash >> 32));
+  return true;
+}
+
+// What a copy of a file has in common with it, wherever it is and however
+// recently it was written: its size, and kContentBlocks blocks of it from the
+// first byte to the last at an even stride. Reading a megabyte of a 12 GB
+// file finds its index wherever it was made; a file that differs in one of
+// those blocks, or in length, finds none.
+constexpr size_t kContentBlocks = 16;
+constexpr size_t kContentBlockBytes = 4096;
+
+bool ContentOf(const std::string &path, long long size, std::uint64_t &out) {
+  if (size <= 0)
+    return false;
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  const std::uint64_t length = static_cast<std::uint64_t>(size);
+  const std::uint64_t block = std::min<std::uint64_t>(length, kContentBlockBytes);
+  unsigned char bytes[kContentBlockBytes];
+  std::uint64_t hash = length;
+  bool read = true;
+  for (size_t b = 0; b < kContentBlocks && read; ++b) {
+    const std::uint64_t at = (length - block) * b / (kContentBlocks - 1);
+    read = ::pread(fd, bytes, static_cast<size_t>(block),
+                   static_cast<off_t>(at)) == static_cast<ssize_t>(block);
+    hash = Checksum(bytes, static_cast<size_t>(block), hash ^ b);
+  }
+  ::close(fd);
+  out = hash;
+  return read;
+}
+
+// Where the path an index of such a file was filed under is kept.
+std::string CopyPathFor(std::uint64_t content) {
+  const std::string directory = Directory();
+  if (directory.empty())
+    return std::string();
+  return directory + "/" + HexOf(content) + ".copy";
+}
+
+// Reads the header of a trigram filter file, leaving `in` at the first word.
+bool ReadGramHeader(std::istream &in, const Key &key, std::uint64_t &bits,
+                    std::uint64_t &chunks) {
+  std::uint32_t version = 0;
+  if (!ReadMagic(in, kGramMagic) || !Read(in, version) ||
+      version != kGramVersion || !ReadKey(in, key) || !ReadPath(in, key) ||
+      !Read(in, bits) || !Read(in, chunks))
+    return false;
+  // Bounded by the chunks a file of this size could have, as the offsets are,
+  // and each filter by a generous ceiling on what anyone would choose.
+  const std::uint64_t chunk_ceiling =
+      key.chunk_size == 0
+          ? 0
+          : static_cast<std::uint64_t>(key.size) / key.chunk_size + 2;
+  return bits != 0 && bits % 64 == 0 && bits <= (std::uint64_t{1} << 24) &&
+         chunks <= chunk_ceiling;
+}
+
+// Reads the header of a search index file, leaving `in` at its trigrams.
+bool ReadGramIndexHeader(std::istream &in, const Key &key, std::uint64_t &zones,
+                         std::uint64_t &grams, std::uint64_t &bytes) {
+  std::uint32_t version = 0;
+  if (!ReadMagic(in, kGramIndexMagic) || !Read(in, version) ||
+      version != kGramIndexVersion || !ReadKey(in, key) ||
+      !ReadPath(in, key) || !Read(in, zones) || !Read(in, grams) ||
+      !Read(in, bytes))
+    return false;
+  // A zone enters a list once for each distinct trigram it holds, which is
+  // fewer than its bytes, and no gap takes more than five bytes to write.
+  const std::uint64_t zone_ceiling =
+      key.chunk_size == 0 ? 0
+                          : static_cast<std::uint64_t>(key.size) /
+                                    (key.chunk_size * kChunksPerZone) +
+                                2;
+  return zones <= zone_ceiling && grams <= (std::uint64_t{1} << 24) &&
+         bytes <= static_cast<std::uint64_t>(key.size) * 5;
+}
+
+void PutVarint(std::vector<std::uint8_t> &out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<std::uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<std::uint8_t>(value));
+}
+
+// An ascending list of numbers, each written as its distance past the one
+// before, plus one, so that the first may be zero.
+class AscendingWriter {
+public:
+  explicit AscendingWriter(std::vector<std::uint8_t> &out) : out_(out) {}
+  void Put(std::uint64_t value) {
+    PutVarint(out_, value - next_);
+    next_ = value + 1;
+  }
+
+private:
+  std::vector<std::uint8_t> &out_;
+  std::uint64_t next_ = 0;
+};
+
+// Reads one back. A damaged list ends early, at the first byte that cannot
+// continue it, or the first value at or past `limit`.
+class AscendingReader {
+public:
+  AscendingReader(const std::uint8_t *at, const std::uint8_t *end,
+                  std::uint64_t limit)
+      : at_(at), end_(end), limit_(limit) {}
+  bool Next(std::uint64_t &value) {
+    std::uint64_t gap = 0;
+    for (int shift = 0;; shift += 7) {
+      if (at_ == end_ || shift > 63)
+        return false;
+      const std::uint8_t byte = *at_++;
+      gap |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        break;
+    }
+    if (gap >= limit_ - next_)
+      return false;
+    value = next_ + gap;
+    next_ = value + 1;
+    return true;
+  }
+
+private:
+  const std::uint8_t *at_;
+  const std::uint8_t *end_;
+  std::uint64_t limit_;
+  std::uint64_t next_ = 0;
+};
+
+std::vector<std::uint32_t> Decode(const std::vector<std::uint8_t> &bytes) {
+  std::vector<std::uint32_t> out;
+  AscendingReader reader(bytes.data(), bytes.data() + bytes.size(),
+                         std::uint64_t{1} << 24);
+  std::uint64_t value = 0;
+  while (reader.Next(value))
+    out.push_back(static_cast<std::uint32_t>(value));
+  return out;
+}
+
+std::vector<std::uint8_t> Encode(const std::vector<std::uint32_t> &values) {
+  std::vector<std::uint8_t> out;
+  AscendingWriter writer(out);
+  for (std::uint32_t value : values)
+    writer.Put(value);
+  return out;
+}
+
 } // namespace
 
+// A cached offset table, mapped: the directory of blocks, then their bits.
+struct ChunkOffsets::Mapping {
+  void *base = nullptr;
+  size_t length = 0;
+  size_t count = 0;
+  const unsigned char *directory = nullptr;
+  const unsigned char *words = nullptr;
+
+  Mapping() = default;
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+  ~Mapping() {
+    if (base != nullptr)
+      ::munmap(base, length);
+  }
+
+  std::int64_t At(size_t index) const {
+    const unsigned char *entry =
+        directory + index / kOffsetsPerBlock * kBlockEntryBytes;
+    const std::uint64_t least = Load64(entry);
+    const std::uint64_t place = Load64(entry + 8);
+    const size_t width = static_cast<size_t>(place & 0xff);
+    const std::uint64_t bit =
+        (place >> 8) * 64 + (index % kOffsetsPerBlock) * width;
+    return static_cast<std::int64_t>(least + Unpack(words, bit, width));
+  }
+};
+
+ChunkOffsets::ChunkOffsets(const std::vector<std::streampos> &offsets) {
+  plain_.reserve(offsets.size());
+  for (const std::streampos &offset : offsets)
+    plain_.push_back(static_cast<std::int64_t>(offset));
+}
+
+size_t ChunkOffsets::size() const {
+  return mapping_ ? mapping_->count : plain_.size();
+}
+
+std::streampos ChunkOffsets::operator[](size_t chunk) const {
+  return std::streampos(mapping_ ? mapping_->At(chunk) : plain_[chunk]);
+}
+
+void ChunkOffsets::push_back(std::streampos offset) {
+  if (mapping_) {
+    std::vector<std::int64_t> copied(mapping_->count);
+    for (size_t i = 0; i < copied.size(); ++i)
+      copied[i] = mapping_->At(i);
+    plain_ = std::move(copied);
+    mapping_.reset();
+  }
+  plain_.push_back(static_cast<std::int64_t>(offset));
+}
+
+void ChunkOffsets::clear() {
+  plain_.clear();
+  mapping_.reset();
+}
+
+bool ChunkOffsets::operator==(const ChunkOffsets &other) const {
+  if (size() != other.size())
+    return false;
+  for (size_t i = 0; i < size(); ++i)
+    if ((*this)[i] != other[i])
+      return false;
+  return true;
+}
+
+std::vector<size_t>
+GramIndex::ZonesHolding(const std::vector<std::uint32_t> &trigrams) const {
+  std::vector<size_t> out;
+  if (trigrams.empty()) {
+    out.resize(zones);
+    for (size_t z = 0; z < zones; ++z)
+      out[z] = z;
+    return out;
+  }
+
+  // A trigram nowhere in the file rules out everything. Otherwise the lists
+  // are intersected shortest first, so that the rarest trigram sets how much
+  // work the rest are.
+  std::vector<size_t> lists;
+  for (std::uint32_t gram : trigrams) {
+    const auto at = std::lower_bound(grams.begin(), grams.end(), gram);
+    if (at == grams.end() || *at != gram)
+      return out;
+    lists.push_back(static_cast<size_t>(at - grams.begin()));
+  }
+  const auto length = [this](size_t list) {
+    return starts[list + 1] - starts[list];
+  };
+  std::sort(lists.begin(), lists.end(),
+            [&](size_t a, size_t b) { return length(a) < length(b); });
+
+  const auto reader = [this](size_t list) {
+    return AscendingReader(postings.data() + starts[list],
+                           postings.data() + starts[list + 1], zones);
+  };
+  AscendingReader first = reader(lists.front());
+  std::uint64_t zone = 0;
+  while (first.Next(zone))
+    out.push_back(static_cast<size_t>(zone));
+
+  for (size_t i = 1; i < lists.size() && !out.empty(); ++i) {
+    AscendingReader next = reader(lists[i]);
+    bool more = next.Next(zone);
+    size_t kept = 0;
+    for (size_t candidate : out) {
+      while (more && zone < candidate)
+        more = next.Next(zone);
+      if (!more)
+        break;
+      if (zone == candidate)
+        out[kept++] = candidate;
+    }
+    out.resize(kept);
+  }
+  return out;
+}
+
+void GramIndexBuilder::Add(size_t zone, const std::vector<std::uint32_t> &grams) {
+  if (grams.empty())
+    return;
+  if (zone >= zones_.size())
+    zones_.resize(zone + 1);
+  if (zones_[zone].empty()) {
+    zones_[zone] = Encode(grams);
+    return;
+  }
+  const std::vector<std::uint32_t> held = Decode(zones_[zone]);
+  std::vector<std::uint32_t> both;
+  both.reserve(held.size() + grams.size());
+  std::set_union(held.begin(), held.end(), grams.begin(), grams.end(),
+                 std::back_inserter(both));
+  zones_[zone] = Encode(both);
+}
+
+GramIndex GramIndexBuilder::Finish(size_t zones) {
+  // Zone by zone, each trigram's list grows at its end, which is what keeps
+  // it ascending whatever order the zones were added in.
+  struct Posting {
+    std::vector<std::uint8_t> bytes;
+    std::uint64_t next = 0;
+  };
+  std::unordered_map<std::uint32_t, Posting> lists;
+  for (size_t z = 0; z < std::min(zones, zones_.size()); ++z) {
+    for (std::uint32_t gram : Decode(zones_[z])) {
+      Posting &posting = lists[gram];
+      PutVarint(posting.bytes, z - posting.next);
+      posting.next = z + 1;
+    }
+    std::vector<std::uint8_t>().swap(zones_[z]);
+  }
+  zones_.clear();
+
+  GramIndex index;
+  index.zones = zones;
+  index.grams.reserve(lists.size());
+  for (const auto &entry : lists)
+    index.grams.push_back(entry.first);
+  std::sort(index.grams.begin(), index.grams.end());
+  index.starts.reserve(index.grams.size() + 1);
+  index.starts.push_back(0);
+  for (std::uint32_t gram : index.grams) {
+    std::vector<std::uint8_t> &bytes = lists[gram].bytes;
+    index.postings.insert(index.postings.end(), bytes.begin(), bytes.end());
+    std::vector<std::uint8_t>().swap(bytes);
+    index.starts.push_back(index.postings.size());
+  }
+  return index;
+}
+
 bool DescribeFile(const std::string &path, char delimiter, bool has_header,
                   size_t chunk_size, Key &out) {
   char resolved[PATH_MAX];
@@ -111,87 +716,361 @@ std::string Directory() {
   return std::string();
 }
 
-std::string PathFor(const Key &key) {
-  const std::string directory = Directory();
-  if (directory.empty())
-    return std::string();
-  return directory + "/" + HexOf(Hash(key.path)) + ".idx";
-}
+std::string PathFor(const Key &key) { return CachePath(key, ".idx"); }
 
-bool Load(const Key &key, Index &out) {
+std::string ProfilePathFor(const Key &key) { return CachePath(key, ".prof"); }
+
+std::string LayoutPathFor(const Key &key) { return CachePath(key, ".cols"); }
+
+std::string ZonePathFor(const Key &key) { return CachePath(key, ".zone"); }
+
+std::string GramPathFor(const Key &key) { return CachePath(key, ".gram"); }
+
+std::string GramIndexPathFor(const Key &key) { return CachePath(key, ".tri"); }
+
+std::string SumPathFor(const Key &key) { return CachePath(key, ".sum"); }
+
+// Maps the index filed under `key`. Unless `match` is Exact it may describe
+// the file as it was at another time — when shorter, for Grown — and the
+// caller must then check that `stored` and `fingerprint`, or the chunk
+// hashes, still describe the bytes the table covers.
+bool MapIndex(const Key &key, Match match, Index &out, Key &stored,
+              std::uint64_t &fingerprint) {
   const std::string path = PathFor(key);
   if (path.empty())
     return false;
 
   std::ifstream in(path, std::ios::binary);
-  if (!in.is_open())
-    return false;
-
-  char magic[sizeof(kMagic)] = {0};
-  if (!in.read(magic, sizeof(magic)) ||
-      std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+  if (!in.is_open() || !ReadMagic(in, kMagic))
     return false;
 
   std::uint32_t version = 0;
-  std::int64_t size = 0;
-  std::int64_t mtime = 0;
-  std::uint8_t delimiter = 0;
-  std::uint8_t has_header = 0;
-  std::uint64_t chunk_size = 0;
+  if (!Read(in, version) || version != kVersion)
+    return false;
+  // Everything that would change what the offsets mean.
+  if (!ReadStoredKey(in, stored) || !SameReading(stored, key))
+    return false;
+  if (match == Match::Exact
+          ? stored.size != key.size || stored.mtime != key.mtime
+          : match == Match::Grown && stored.size >= key.size)
+    return false;
   std::uint64_t total_rows = 0;
-  std::uint64_t path_length = 0;
+  if (!Read(in, total_rows) || !ReadPath(in, key))
+    return false;
+
   std::uint64_t count = 0;
+  std::uint64_t words = 0;
+  std::uint64_t checksum = 0;
+  if (!Read(in, count) || !Read(in, words) || !Read(in, checksum) ||
+      !Read(in, fingerprint))
+    return false;
+  // A record cannot be shorter than one byte, so the file's size divided by
+  // the rows per chunk bounds how many offsets could possibly be real, and
+  // none needs more than 64 bits. Without this a corrupt count would describe
+  // a table of any size it liked.
+  const std::uint64_t ceiling =
+      stored.chunk_size == 0
+          ? 0
+          : static_cast<std::uint64_t>(stored.size) / stored.chunk_size + 2;
+  const std::uint64_t blocks = (count + kOffsetsPerBlock - 1) / kOffsetsPerBlock;
+  if (count == 0 || count > ceiling || words > count + blocks)
+    return false;
+  const std::streamoff header = in.tellg();
+  if (header < 0)
+    return false;
+  in.close();
 
-  if (!Read(in, version) || version != kVersion)
+  // The table starts on an eight-byte boundary, and the file ends with it.
+  const std::uint64_t table = (static_cast<std::uint64_t>(header) + 7) / 8 * 8;
+  const std::uint64_t length = table + blocks * kBlockEntryBytes + words * 8;
+
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
     return false;
-  if (!Read(in, size) || !Read(in, mtime) || !Read(in, delimiter) ||
-      !Read(in, has_header) || !Read(in, chunk_size) || !Read(in, total_rows) ||
-      !Read(in, path_length))
+  struct stat info {};
+  if (::fstat(fd, &info) != 0 ||
+      static_cast<std::uint64_t>(info.st_size) != length) {
+    ::close(fd);
+    return false;
+  }
+  auto mapping = std::make_shared<ChunkOffsets::Mapping>();
+  void *base = ::mmap(nullptr, static_cast<size_t>(length), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
     return false;
+  mapping->base = base;
+  mapping->length = static_cast<size_t>(length);
+  mapping->count = static_cast<size_t>(count);
+  mapping->directory = static_cast<const unsigned char *>(base) + table;
+  mapping->words = mapping->directory + blocks * kBlockEntryBytes;
 
-  // Everything that would change what the offsets mean.
-  if (size != key.size || mtime != key.mtime ||
-      delimiter != static_cast<std::uint8_t>(key.delimiter) ||
-      (has_header != 0) != key.has_header || chunk_size != key.chunk_size)
+  // One read of the table, a megabyte for 12 GB, before anything trusts it.
+  // After that the directory is what decoding follows, so each block's bits
+  // must lie within the words.
+  if (Checksum(mapping->directory, static_cast<size_t>(length - table),
+               TableSeed(total_rows, count, words)) != checksum)
     return false;
+  for (std::uint64_t b = 0; b < blocks; ++b) {
+    const unsigned char *entry = mapping->directory + b * kBlockEntryBytes;
+    const std::uint64_t place = Load64(entry + 8);
+    const std::uint64_t width = place & 0xff;
+    const std::uint64_t entries =
+        std::min<std::uint64_t>(kOffsetsPerBlock, count - b * kOffsetsPerBlock);
+    if (Load64(entry) > static_cast<std::uint64_t>(stored.size) ||
+        width > 63 || (place >> 8) > words ||
+        (place >> 8) * 64 + entries * width > words * 64)
+      return false;
+  }
 
-  if (path_length > 4096)
+  // Used even when the caller goes on to find it no longer fits: the file is
+  // being opened, and whatever it saves next lands under the same name.
+  MarkUsed(path);
+  out.total_rows = static_cast<size_t>(total_rows);
+  out.offsets.plain_.clear();
+  out.offsets.mapping_ = std::move(mapping);
+  return true;
+}
+
+bool Load(const Key &key, Index &out) {
+  Key stored;
+  std::uint64_t fingerprint = 0;
+  return MapIndex(key, Match::Exact, out, stored, fingerprint);
+}
+
+bool LoadGrown(const Key &key, Index &out) {
+  Key stored;
+  std::uint64_t fingerprint = 0;
+  Index index;
+  if (!MapIndex(key, Match::Grown, index, stored, fingerprint))
     return false;
-  std::string stored_path(static_cast<size_t>(path_length), '\0');
-  if (path_length != 0 &&
-      !in.read(&stored_path[0], static_cast<std::streamsize>(path_length)))
+
+  // Every offset but the last starts a chunk the file still has whole, if
+  // the bytes before the last are those the index was made from. The last
+  // may start a chunk the appended rows finish, or be the old end of the
+  // file, and must then have ended a record for rows to follow it: a final
+  // line with no newline would run on into what was appended.
+  const std::uint64_t end = static_cast<std::uint64_t>(
+      static_cast<std::streamoff>(index.offsets.back()));
+  if (end > static_cast<std::uint64_t>(stored.size))
+    return false;
+  std::uint64_t now = 0;
+  if (!Fingerprint(key.path, end, now) || now != fingerprint)
     return false;
-  if (stored_path != key.path)
-    return false; // a hash collision, or the cache directory is shared
+  if (end > static_cast<std::uint64_t>(
+                static_cast<std::streamoff>(index.offsets.front()))) {
+    std::ifstream file(key.path, std::ios::binary);
+    char before = 0;
+    if (!file.seekg(static_cast<std::streamoff>(end - 1)) ||
+        !file.get(before) || before != '\n')
+      return false;
+  }
+  out = std::move(index);
+  return true;
+}
+
+namespace {
 
-  if (!Read(in, count))
+// Reads the chunk hashes Save wrote with the index filed under `key`, whose
+// own key was `stored`, for its `count` chunks.
+bool LoadSums(const Key &key, const Key &stored, size_t count,
+              std::vector<std::uint32_t> &out) {
+  const std::string path = SumPathFor(key);
+  if (path.empty())
     return false;
-  // A record cannot be shorter than one byte, so the file's size divided by
-  // the rows per chunk bounds how many offsets could possibly be real. Without
-  // this a corrupt count would ask for an allocation of any size it liked.
-  const std::uint64_t ceiling =
-      chunk_size == 0 ? 0
-                      : static_cast<std::uint64_t>(size) / chunk_size + 2;
-  if (count > ceiling)
-    return false;
-
-  Index loaded;
-  loaded.total_rows = static_cast<size_t>(total_rows);
-  // Reserve what a plausible file needs and let the rest grow: the ceiling
-  // above is generous enough that trusting it outright would still allow a
-  // damaged cache to claim a few hundred megabytes.
-  loaded.offsets.reserve(
-      static_cast<size_t>(std::min<std::uint64_t>(count, 1u << 20)));
-  for (std::uint64_t i = 0; i < count; ++i) {
-    std::int64_t offset = 0;
-    if (!Read(in, offset) || offset < 0 || offset > size)
+  std::ifstream in(path, std::ios::binary);
+  Key summed;
+  std::uint32_t version = 0;
+  std::uint64_t stored_count = 0;
+  if (!in.is_open() || !ReadMagic(in, kSumMagic) || !Read(in, version) ||
+      version != kSumVersion || !ReadStoredKey(in, summed) ||
+      summed.size != stored.size || summed.mtime != stored.mtime ||
+      !SameReading(summed, stored) || !ReadPath(in, key) ||
+      !Read(in, stored_count) || stored_count != count)
+    return false;
+  std::vector<std::uint32_t> sums(count);
+  std::uint64_t checksum = 0;
+  if (!in.read(reinterpret_cast<char *>(sums.data()),
+               static_cast<std::streamsize>(count * sizeof(std::uint32_t))) ||
+      !Read(in, checksum) ||
+      Checksum(reinterpret_cast<const unsigned char *>(sums.data()),
+               sums.size() * sizeof(std::uint32_t), count) != checksum)
+    return false;
+  out = std::move(sums);
+  return true;
+}
+
+// How many of the first chunks of `index` the index already filed under
+// `key`, of the file before it grew, has hashed: those it places the same,
+// whose hashes cover only bytes before its last offset, which its fingerprint
+// vouches for. Their hashes are left in `out`.
+size_t EarlierSums(const Key &key, const Index &index,
+                   std::vector<std::uint32_t> &out) {
+  Key stored;
+  std::uint64_t fingerprint = 0;
+  Index earlier;
+  if (!MapIndex(key, Match::Grown, earlier, stored, fingerprint))
+    return 0;
+  const std::int64_t end = static_cast<std::int64_t>(earlier.offsets.back());
+  std::uint64_t now = 0;
+  std::vector<std::uint32_t> sums;
+  if (end > static_cast<std::int64_t>(stored.size) ||
+      !Fingerprint(key.path, static_cast<std::uint64_t>(end), now) ||
+      now != fingerprint ||
+      !LoadSums(key, stored, earlier.offsets.size(), sums))
+    return 0;
+  const size_t chunks = std::min(earlier.offsets.size(), index.offsets.size());
+  size_t same = 0;
+  while (same + 1 < chunks && earlier.offsets[same] == index.offsets[same] &&
+         earlier.offsets[same + 1] == index.offsets[same + 1] &&
+         static_cast<std::int64_t>(earlier.offsets[same + 1]) +
+                 static_cast<std::int64_t>(kSampleBytes) <=
+             end)
+    ++same;
+  sums.resize(same);
+  out = std::move(sums);
+  return same;
+}
+
+} // namespace
+
+bool LoadEdited(const Key &key, Index &out, Splice &splice) {
+  Key stored;
+  std::uint64_t fingerprint = 0;
+  Index index;
+  if (!MapIndex(key, Match::Any, index, stored, fingerprint))
+    return false;
+  if (stored.size == key.size && stored.mtime == key.mtime)
+    return false; // then it is no edit, and Load would have had it
+
+  std::vector<std::uint32_t> sums;
+  if (!LoadSums(key, stored, index.offsets.size(), sums))
+    return false;
+
+  const int fd = ::open(key.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  const size_t chunks = sums.size();
+  const auto start = [&index](size_t chunk) {
+    return static_cast<std::int64_t>(index.offsets[chunk]);
+  };
+  const auto end = [&](size_t chunk) {
+    return chunk + 1 < chunks ? start(chunk + 1)
+                              : static_cast<std::int64_t>(stored.size);
+  };
+  // Whether chunk `chunk` is in the file as it was, `shift` bytes on.
+  const auto unchanged = [&](size_t chunk, std::int64_t shift) {
+    const std::int64_t from = start(chunk) + shift;
+    const std::int64_t to = end(chunk) + shift;
+    const std::uint64_t after = static_cast<std::uint64_t>(
+        static_cast<std::int64_t>(stored.size) - end(chunk));
+    std::uint32_t sum = 0;
+    return from >= 0 &&
+           to + static_cast<std::int64_t>(std::min<std::uint64_t>(
+                    after, kSampleBytes)) <=
+               static_cast<std::int64_t>(key.size) &&
+           SumOf(fd, static_cast<std::uint64_t>(from),
+                 static_cast<std::uint64_t>(to), after, sum) &&
+           sum == sums[chunk];
+  };
+
+  // The chunks before the edit are where they were, and those after it have
+  // moved by the change in length. Each run stops at the first that differs,
+  // so the edit is the chunks between, found without reading them.
+  const std::int64_t shift =
+      static_cast<std::int64_t>(key.size) - static_cast<std::int64_t>(stored.size);
+  size_t first = 0;
+  while (first < chunks && unchanged(first, 0))
+    ++first;
+  size_t last = chunks;
+  if (first < chunks)
+    while (last > first + 1 && unchanged(last - 1, shift))
+      --last;
+  ::close(fd);
+  if (first == 0 && last == chunks)
+    return false; // nothing of it is any use
+
+  std::vector<std::streampos> kept;
+  kept.reserve(std::min(first + 1, chunks));
+  for (size_t c = 0; c <= first && c < chunks; ++c)
+    kept.push_back(index.offsets[c]);
+  splice = Splice{};
+  const size_t tail_first = static_cast<size_t>(last) * stored.chunk_size;
+  // The tail must begin past where counting starts again, or the count
+  // could never meet it.
+  if (last < chunks && index.total_rows > tail_first &&
+      start(last) + shift > static_cast<std::int64_t>(kept.back())) {
+    splice.tail.reserve(chunks - last);
+    for (size_t c = last; c < chunks; ++c)
+      splice.tail.push_back(std::streampos(start(c) + shift));
+    splice.tail_rows = index.total_rows - tail_first;
+  }
+  out.offsets = kept;
+  out.total_rows = index.total_rows;
+  return true;
+}
+
+bool LoadCopy(const Key &key, Index &out) {
+  std::uint64_t content = 0;
+  if (key.size < kMinimumFileSize || !ContentOf(key.path, key.size, content))
+    return false;
+  const std::string path = CopyPathFor(content);
+  if (path.empty())
+    return false;
+
+  // The file the index was made from, as it was then: the same size and
+  // reading, though at another path and time.
+  Key original;
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::uint32_t version = 0;
+    std::uint64_t path_length = 0;
+    if (!in.is_open() || !ReadMagic(in, kCopyMagic) || !Read(in, version) ||
+        version != kCopyVersion || !ReadStoredKey(in, original) ||
+        original.size != key.size || !SameReading(original, key) ||
+        !Read(in, path_length) || path_length == 0 || path_length > 4096)
+      return false;
+    original.path.assign(static_cast<size_t>(path_length), '\0');
+    if (!in.read(&original.path[0], static_cast<std::streamsize>(path_length)))
       return false;
-    loaded.offsets.push_back(std::streampos(offset));
   }
-  if (loaded.offsets.empty())
+  if (original.path == key.path)
+    return false; // Load would have had it, were it still this file
+
+  Key stored;
+  std::uint64_t fingerprint = 0;
+  Index index;
+  std::vector<std::uint32_t> sums;
+  if (!MapIndex(original, Match::Exact, index, stored, fingerprint) ||
+      !LoadSums(original, stored, index.offsets.size(), sums))
     return false;
 
-  out = std::move(loaded);
+  // Sixteen blocks agreeing is good evidence, not proof: before the offsets
+  // are trusted, a spread of the chunks they describe must be where they say,
+  // down to the bytes either side of each boundary.
+  const int fd = ::open(key.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  const size_t chunks = sums.size();
+  const size_t checks = std::min(chunks, kCopyChecks);
+  bool same = true;
+  for (size_t i = 0; i < checks && same; ++i) {
+    const size_t c = checks == 1 ? 0 : (chunks - 1) * i / (checks - 1);
+    const std::int64_t begin = static_cast<std::int64_t>(index.offsets[c]);
+    const std::int64_t end = c + 1 < chunks
+                                 ? static_cast<std::int64_t>(index.offsets[c + 1])
+                                 : static_cast<std::int64_t>(key.size);
+    std::uint32_t sum = 0;
+    same = SumOf(fd, static_cast<std::uint64_t>(begin),
+                 static_cast<std::uint64_t>(end),
+                 static_cast<std::uint64_t>(key.size - end), sum) &&
+           sum == sums[c];
+  }
+  ::close(fd);
+  if (!same)
+    return false;
+  MarkUsed(path);
+  out = std::move(index);
   return true;
 }
 
@@ -199,46 +1078,752 @@ bool Save(const Key &key, const Index &index) {
   if (index.offsets.empty() || key.size < kMinimumFileSize)
     return false;
 
-  const std::string directory = Directory();
   const std::string path = PathFor(key);
-  if (path.empty() || !MakeDirectories(directory))
+  if (path.empty() || !MakeDirectories(Directory()))
     return false;
+  // Read before the index they go with is replaced.
+  std::vector<std::uint32_t> sums;
+  const size_t hashed = EarlierSums(key, index, sums);
 
-  // Write beside the target and rename, so a cache file is never half written
-  // — a reader that found one would reject it, but only after being handed
-  // something that looked plausible.
-  const std::string temporary = path + ".tmp";
-  {
-    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
-    if (!out.is_open())
-      return false;
+  // Each block takes as many bits an offset as its widest needs, and starts
+  // on a word of its own.
+  const size_t count = index.offsets.size();
+  const size_t blocks = (count + kOffsetsPerBlock - 1) / kOffsetsPerBlock;
+  std::vector<std::uint64_t> directory;
+  directory.reserve(blocks * 2);
+  std::vector<std::uint64_t> words;
+  for (size_t b = 0; b < blocks; ++b) {
+    const size_t first = b * kOffsetsPerBlock;
+    const size_t last = std::min(count, first + kOffsetsPerBlock);
+    std::int64_t least = static_cast<std::int64_t>(index.offsets[first]);
+    std::int64_t most = least;
+    for (size_t i = first; i < last; ++i) {
+      const std::int64_t offset = static_cast<std::int64_t>(index.offsets[i]);
+      if (offset < 0)
+        return false;
+      least = std::min(least, offset);
+      most = std::max(most, offset);
+    }
+    const size_t width = BitWidth(static_cast<std::uint64_t>(most - least));
+    const size_t start = words.size();
+    words.resize(start + ((last - first) * width + 63) / 64, 0);
+    for (size_t i = first; i < last; ++i)
+      Pack(words, std::uint64_t{start} * 64 + (i - first) * width, width,
+           static_cast<std::uint64_t>(
+               static_cast<std::int64_t>(index.offsets[i]) - least));
+    directory.push_back(static_cast<std::uint64_t>(least));
+    directory.push_back(std::uint64_t{start} << 8 | width);
+  }
+
+  std::vector<unsigned char> table((directory.size() + words.size()) * 8);
+  if (!directory.empty())
+    std::memcpy(table.data(), directory.data(), directory.size() * 8);
+  if (!words.empty())
+    std::memcpy(table.data() + directory.size() * 8, words.data(),
+                words.size() * 8);
+  const std::uint64_t checksum =
+      Checksum(table.data(), table.size(),
+               TableSeed(index.total_rows, count, words.size()));
+  // Of the file as it is now, which is what the offsets were just read from.
+  std::uint64_t fingerprint = 0;
+  if (!Fingerprint(key.path,
+                   static_cast<std::uint64_t>(
+                       static_cast<std::streamoff>(index.offsets.back())),
+                   fingerprint))
+    return false;
 
+  const bool saved = WriteReplacing(path, [&](std::ostream &out) {
     out.write(kMagic, sizeof(kMagic));
     Write(out, kVersion);
-    Write(out, static_cast<std::int64_t>(key.size));
-    Write(out, static_cast<std::int64_t>(key.mtime));
-    Write(out, static_cast<std::uint8_t>(key.delimiter));
-    Write(out, static_cast<std::uint8_t>(key.has_header ? 1 : 0));
-    Write(out, static_cast<std::uint64_t>(key.chunk_size));
+    WriteKey(out, key);
     Write(out, static_cast<std::uint64_t>(index.total_rows));
-    Write(out, static_cast<std::uint64_t>(key.path.size()));
-    out.write(key.path.data(), static_cast<std::streamsize>(key.path.size()));
-    Write(out, static_cast<std::uint64_t>(index.offsets.size()));
-    for (const std::streampos &offset : index.offsets)
-      Write(out, static_cast<std::int64_t>(offset));
+    WritePath(out, key);
+    Write(out, static_cast<std::uint64_t>(count));
+    Write(out, static_cast<std::uint64_t>(words.size()));
+    Write(out, checksum);
+    Write(out, fingerprint);
+    const std::streamoff header = out.tellp();
+    static const char zeros[8] = {0};
+    if (header > 0 && header % 8 != 0)
+      out.write(zeros, 8 - header % 8);
+    out.write(reinterpret_cast<const char *>(table.data()),
+              static_cast<std::streamsize>(table.size()));
+  });
+  if (!saved)
+    return false;
 
-    out.flush();
-    if (!out) {
-      ::unlink(temporary.c_str());
+  // The chunk hashes are read while the file is still in the page cache from
+  // the pass that just read it. Without them an edit costs a full count, as
+  // it always did, so failing to write them fails nothing.
+  const int fd = ::open(key.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return true;
+  sums.resize(count);
+  bool summed = true;
+  for (size_t c = hashed; c < count && summed; ++c) {
+    const std::int64_t end = c + 1 < count
+                                 ? static_cast<std::int64_t>(index.offsets[c + 1])
+                                 : static_cast<std::int64_t>(key.size);
+    summed = SumOf(fd,
+                   static_cast<std::uint64_t>(
+                       static_cast<std::int64_t>(index.offsets[c])),
+                   static_cast<std::uint64_t>(end),
+                   static_cast<std::uint64_t>(key.size - end), sums[c]);
+  }
+  ::close(fd);
+  const std::string sum_path = SumPathFor(key);
+  if (summed && !sum_path.empty())
+    WriteReplacing(sum_path, [&](std::ostream &out) {
+      out.write(kSumMagic, sizeof(kSumMagic));
+      Write(out, kSumVersion);
+      WriteKey(out, key);
+      WritePath(out, key);
+      Write(out, static_cast<std::uint64_t>(count));
+      out.write(reinterpret_cast<const char *>(sums.data()),
+                static_cast<std::streamsize>(count * sizeof(std::uint32_t)));
+      Write(out, Checksum(reinterpret_cast<const unsigned char *>(sums.data()),
+                          count * sizeof(std::uint32_t), count));
+    });
+
+  // And for LoadCopy, where to find all this from a copy of the file. The
+  // last file indexed with these contents wins, which is as good as any.
+  std::uint64_t content = 0;
+  const std::string copy_path =
+      summed && ContentOf(key.path, key.size, content) ? CopyPathFor(content)
+                                                       : std::string();
+  if (!copy_path.empty())
+    WriteReplacing(copy_path, [&](std::ostream &out) {
+      out.write(kCopyMagic, sizeof(kCopyMagic));
+      Write(out, kCopyVersion);
+      WriteKey(out, key);
+      WritePath(out, key);
+    });
+  return true;
+}
+
+Writer::~Writer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void Writer::Save(const Key &key, Index index) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+                                  [&key](const std::pair<Key, Index> &waiting) {
+                                    return waiting.first.path == key.path &&
+                                           SameReading(waiting.first, key);
+                                  }),
+                   pending_.end());
+    pending_.emplace_back(key, std::move(index));
+    if (!thread_.joinable())
+      thread_ = std::thread(&Writer::Run, this);
+  }
+  wake_.notify_all();
+}
+
+void Writer::Trim(std::uint64_t limit) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trim_ = limit;
+    if (!thread_.joinable())
+      thread_ = std::thread(&Writer::Run, this);
+  }
+  wake_.notify_all();
+}
+
+void Writer::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock,
+             [this] { return pending_.empty() && !trim_ && !busy_; });
+}
+
+void Writer::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [this] { return stop_ || !pending_.empty() || trim_; });
+    busy_ = true;
+    // Stopping still saves what is waiting: the point of handing it over
+    // was to keep it. A trim not yet begun is not worth waiting for on the
+    // way out; the next session's will do.
+    if (!pending_.empty()) {
+      std::pair<Key, Index> next = std::move(pending_.front());
+      pending_.erase(pending_.begin());
+      lock.unlock();
+      csvcache::Save(next.first, next.second);
+      lock.lock();
+    } else if (trim_ && !stop_) {
+      const std::uint64_t limit = *trim_;
+      trim_.reset();
+      lock.unlock();
+      csvcache::Trim(limit);
+      lock.lock();
+    } else {
+      busy_ = false;
+      trim_.reset();
+      idle_.notify_all();
+      return;
+    }
+    busy_ = false;
+    idle_.notify_all();
+  }
+}
+
+bool LoadProfile(const Key &key, std::vector<csvscan::ColumnProfile> &out) {
+  const std::string path = ProfilePathFor(key);
+  if (path.empty())
+    return false;
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open() || !ReadMagic(in, kProfileMagic))
+    return false;
+
+  std::uint32_t version = 0;
+  std::uint64_t count = 0;
+  if (!Read(in, version) || version != kProfileVersion ||
+      !ReadKey(in, key) || !ReadPath(in, key) || !Read(in, count))
+    return false;
+  // Every column takes at least a delimiter's byte in the header row.
+  if (count == 0 || count > static_cast<std::uint64_t>(key.size) + 1)
+    return false;
+
+  std::vector<csvscan::ColumnProfile> loaded;
+  loaded.reserve(static_cast<size_t>(std::min<std::uint64_t>(count, 4096)));
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t fields[8] = {0};
+    double numbers[3] = {0, 0, 0};
+    for (std::uint64_t &field : fields)
+      if (!Read(in, field))
+        return false;
+    for (double &number : numbers)
+      if (!Read(in, number))
+        return false;
+
+    csvscan::ColumnProfile column;
+    column.stats.total = static_cast<size_t>(fields[0]);
+    column.stats.empty = static_cast<size_t>(fields[1]);
+    column.stats.numeric = static_cast<size_t>(fields[2]);
+    column.integers = static_cast<size_t>(fields[3]);
+    column.dates = static_cast<size_t>(fields[4]);
+    column.min_length = static_cast<size_t>(fields[5]);
+    column.max_length = static_cast<size_t>(fields[6]);
+    column.distinct = static_cast<size_t>(fields[7]);
+    column.stats.min = numbers[0];
+    column.stats.max = numbers[1];
+    column.stats.mean = numbers[2];
+    loaded.push_back(column);
+  }
+
+  out = std::move(loaded);
+  return true;
+}
+
+bool SaveProfile(const Key &key,
+                 const std::vector<csvscan::ColumnProfile> &profile) {
+  if (profile.empty() || key.size < kMinimumFileSize)
+    return false;
+
+  const std::string path = ProfilePathFor(key);
+  if (path.empty() || !MakeDirectories(Directory()))
+    return false;
+
+  return WriteReplacing(path, [&](std::ostream &out) {
+    out.write(kProfileMagic, sizeof(kProfileMagic));
+    Write(out, kProfileVersion);
+    WriteKey(out, key);
+    WritePath(out, key);
+    Write(out, static_cast<std::uint64_t>(profile.size()));
+    for (const csvscan::ColumnProfile &column : profile) {
+      const std::uint64_t fields[8] = {
+          column.stats.total, column.stats.empty,      column.stats.numeric,
+          column.integers,    column.dates,            column.min_length,
+          column.max_length,  column.distinct};
+      for (std::uint64_t field : fields)
+        Write(out, field);
+      Write(out, column.stats.min);
+      Write(out, column.stats.max);
+      Write(out, column.stats.mean);
+    }
+  });
+}
+
+bool LoadLayout(const Key &key, ColumnLayout &out) {
+  const std::string path = LayoutPathFor(key);
+  if (path.empty())
+    return false;
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open() || !ReadMagic(in, kLayoutMagic))
+    return false;
+
+  std::uint32_t version = 0;
+  std::uint64_t count = 0;
+  if (!Read(in, version) || version != kLayoutVersion || !ReadKey(in, key) ||
+      !ReadPath(in, key) || !Read(in, count))
+    return false;
+  // As for a profile: every column takes a byte of the header row at least.
+  if (count == 0 || count > static_cast<std::uint64_t>(key.size) + 1)
+    return false;
+
+  ColumnLayout loaded;
+  loaded.widths.reserve(static_cast<size_t>(std::min<std::uint64_t>(count, 4096)));
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::int32_t width = 0;
+    std::uint8_t numeric = 0;
+    if (!Read(in, width) || !Read(in, numeric) || width < 1)
       return false;
+    loaded.widths.push_back(width);
+    loaded.numeric.push_back(numeric != 0);
+  }
+  if (!Read(in, loaded.record_bytes) || !(loaded.record_bytes > 0.0))
+    return false;
+
+  // Read on every open, with an index or without one.
+  MarkUsed(path);
+  out = std::move(loaded);
+  return true;
+}
+
+bool SaveLayout(const Key &key, const ColumnLayout &layout) {
+  if (layout.widths.empty() || layout.widths.size() != layout.numeric.size() ||
+      !(layout.record_bytes > 0.0) || key.size < kMinimumFileSize)
+    return false;
+
+  const std::string path = LayoutPathFor(key);
+  if (path.empty() || !MakeDirectories(Directory()))
+    return false;
+
+  return WriteReplacing(path, [&](std::ostream &out) {
+    out.write(kLayoutMagic, sizeof(kLayoutMagic));
+    Write(out, kLayoutVersion);
+    WriteKey(out, key);
+    WritePath(out, key);
+    Write(out, static_cast<std::uint64_t>(layout.widths.size()));
+    for (size_t i = 0; i < layout.widths.size(); ++i) {
+      Write(out, static_cast<std::int32_t>(layout.widths[i]));
+      Write(out, static_cast<std::uint8_t>(layout.numeric[i] ? 1 : 0));
     }
+    Write(out, layout.record_bytes);
+  });
+}
+
+bool LoadZones(const Key &key, std::vector<ZoneMap> &out) {
+  const std::string path = ZonePathFor(key);
+  if (path.empty())
+    return false;
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open() || !ReadMagic(in, kZoneMagic))
+    return false;
+
+  std::uint32_t version = 0;
+  std::uint64_t count = 0;
+  if (!Read(in, version) || version != kZoneVersion || !ReadKey(in, key) ||
+      !ReadPath(in, key) || !Read(in, count))
+    return false;
+  // Two maps a column at most, and columns are bounded as for a profile. The
+  // zones of each are bounded by the chunks, as the offsets are.
+  const std::uint64_t zone_ceiling =
+      key.chunk_size == 0 ? 0
+                          : static_cast<std::uint64_t>(key.size) /
+                                    (key.chunk_size * kChunksPerZone) +
+                                2;
+  if (count == 0 || count > 2 * (static_cast<std::uint64_t>(key.size) + 1))
+    return false;
+
+  std::vector<ZoneMap> loaded;
+  loaded.reserve(static_cast<size_t>(std::min<std::uint64_t>(count, 64)));
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t column = 0;
+    std::uint8_t times = 0;
+    std::uint64_t zones = 0;
+    if (!Read(in, column) || !Read(in, times) || !Read(in, zones) ||
+        zones > zone_ceiling)
+      return false;
+    ZoneMap map;
+    map.column = static_cast<size_t>(column);
+    map.times = times != 0;
+    map.min.resize(static_cast<size_t>(zones));
+    map.max.resize(static_cast<size_t>(zones));
+    for (size_t z = 0; z < map.min.size(); ++z)
+      if (!Read(in, map.min[z]) || !Read(in, map.max[z]))
+        return false;
+    loaded.push_back(std::move(map));
   }
 
-  if (::rename(temporary.c_str(), path.c_str()) != 0) {
-    ::unlink(temporary.c_str());
+  out = std::move(loaded);
+  return true;
+}
+
+bool SaveZones(const Key &key, const std::vector<ZoneMap> &zones) {
+  if (zones.empty() || key.size < kMinimumFileSize)
+    return false;
+
+  const std::string path = ZonePathFor(key);
+  if (path.empty() || !MakeDirectories(Directory()))
+    return false;
+
+  return WriteReplacing(path, [&](std::ostream &out) {
+    out.write(kZoneMagic, sizeof(kZoneMagic));
+    Write(out, kZoneVersion);
+    WriteKey(out, key);
+    WritePath(out, key);
+    Write(out, static_cast<std::uint64_t>(zones.size()));
+    for (const ZoneMap &map : zones) {
+      Write(out, static_cast<std::uint64_t>(map.column));
+      Write(out, static_cast<std::uint8_t>(map.times ? 1 : 0));
+      Write(out, static_cast<std::uint64_t>(map.min.size()));
+      for (size_t z = 0; z < map.min.size(); ++z) {
+        Write(out, map.min[z]);
+        Write(out, map.max[z]);
+      }
+    }
+  });
+}
+
+bool HasGramFilters(const Key &key) {
+  const std::string path = GramPathFor(key);
+  if (path.empty())
+    return false;
+  std::ifstream in(path, std::ios::binary);
+  std::uint64_t bits = 0;
+  std::uint64_t chunks = 0;
+  return in.is_open() && ReadGramHeader(in, key, bits, chunks);
+}
+
+bool LoadGramFilters(const Key &key, GramFilters &out) {
+  const std::string path = GramPathFor(key);
+  if (path.empty())
+    return false;
+
+  std::ifstream in(path, std::ios::binary);
+  std::uint64_t bits = 0;
+  std::uint64_t chunks = 0;
+  if (!in.is_open() || !ReadGramHeader(in, key, bits, chunks))
+    return false;
+
+  GramFilters loaded;
+  loaded.bits = static_cast<size_t>(bits);
+  loaded.words.resize(static_cast<size_t>(chunks * (bits / 64)));
+  if (!loaded.words.empty() &&
+      !in.read(reinterpret_cast<char *>(loaded.words.data()),
+               static_cast<std::streamsize>(loaded.words.size() *
+                                            sizeof(std::uint64_t))))
+    return false;
+
+  out = std::move(loaded);
+  return true;
+}
+
+bool SaveGramFilters(const Key &key, const GramFilters &filters) {
+  if (filters.words.empty() || key.size < kMinimumFileSize)
+    return false;
+
+  const std::string path = GramPathFor(key);
+  if (path.empty() || !MakeDirectories(Directory()))
+    return false;
+
+  const bool saved = WriteReplacing(path, [&](std::ostream &out) {
+    out.write(kGramMagic, sizeof(kGramMagic));
+    Write(out, kGramVersion);
+    WriteKey(out, key);
+    WritePath(out, key);
+    Write(out, static_cast<std::uint64_t>(filters.bits));
+    Write(out, static_cast<std::uint64_t>(filters.chunks()));
+    out.write(reinterpret_cast<const char *>(filters.words.data()),
+              static_cast<std::streamsize>(filters.words.size() *
+                                           sizeof(std::uint64_t)));
+  });
+  return saved;
+}
+
+bool HasGramIndex(const Key &key) {
+  const std::string path = GramIndexPathFor(key);
+  if (path.empty())
+    return false;
+  std::ifstream in(path, std::ios::binary);
+  std::uint64_t zones = 0;
+  std::uint64_t grams = 0;
+  std::uint64_t bytes = 0;
+  return in.is_open() && ReadGramIndexHeader(in, key, zones, grams, bytes);
+}
+
+bool LoadGramIndex(const Key &key, GramIndex &out) {
+  const std::string path = GramIndexPathFor(key);
+  if (path.empty())
+    return false;
+
+  std::ifstream in(path, std::ios::binary);
+  std::uint64_t zones = 0;
+  std::uint64_t grams = 0;
+  std::uint64_t bytes = 0;
+  if (!in.is_open() || !ReadGramIndexHeader(in, key, zones, grams, bytes))
+    return false;
+
+  GramIndex loaded;
+  loaded.zones = static_cast<size_t>(zones);
+  loaded.grams.resize(static_cast<size_t>(grams));
+  loaded.starts.resize(static_cast<size_t>(grams) + 1);
+  loaded.postings.resize(static_cast<size_t>(bytes));
+  const auto read_all = [&in](auto &values) {
+    return values.empty() ||
+           in.read(reinterpret_cast<char *>(values.data()),
+                   static_cast<std::streamsize>(values.size() *
+                                                sizeof(values[0])));
+  };
+  if (!read_all(loaded.grams) || !read_all(loaded.starts) ||
+      !read_all(loaded.postings))
     return false;
+
+  // What the lists are searched by has to hold, or a lookup could read past
+  // them: trigrams ascending, and each list within the bytes and after the
+  // one before.
+  for (size_t i = 1; i < loaded.grams.size(); ++i)
+    if (loaded.grams[i] <= loaded.grams[i - 1])
+      return false;
+  if (loaded.starts.front() != 0 || loaded.starts.back() != bytes)
+    return false;
+  for (size_t i = 1; i < loaded.starts.size(); ++i)
+    if (loaded.starts[i] < loaded.starts[i - 1])
+      return false;
+
+  out = std::move(loaded);
+  return true;
+}
+
+bool SaveGramIndex(const Key &key, const GramIndex &index) {
+  if (index.zones == 0 || key.size < kMinimumFileSize ||
+      index.starts.size() != index.grams.size() + 1)
+    return false;
+
+  const std::string path = GramIndexPathFor(key);
+  if (path.empty() || !MakeDirectories(Directory()))
+    return false;
+
+  const bool saved = WriteReplacing(path, [&](std::ostream &out) {
+    out.write(kGramIndexMagic, sizeof(kGramIndexMagic));
+    Write(out, kGramIndexVersion);
+    WriteKey(out, key);
+    WritePath(out, key);
+    Write(out, static_cast<std::uint64_t>(index.zones));
+    Write(out, static_cast<std::uint64_t>(index.grams.size()));
+    Write(out, static_cast<std::uint64_t>(index.postings.size()));
+    out.write(reinterpret_cast<const char *>(index.grams.data()),
+              static_cast<std::streamsize>(index.grams.size() *
+                                           sizeof(std::uint32_t)));
+    out.write(reinterpret_cast<const char *>(index.starts.data()),
+              static_cast<std::streamsize>(index.starts.size() *
+                                           sizeof(std::uint64_t)));
+    out.write(reinterpret_cast<const char *>(index.postings.data()),
+              static_cast<std::streamsize>(index.postings.size()));
+  });
+  return saved;
+}
+
+namespace {
+
+// Every kind of file kept, by the magic it starts with: the version a current
+// one has, and whether a row count comes between its key and its path.
+struct Kind {
+  const char *magic;
+  std::uint32_t version;
+  bool counts_rows;
+};
+constexpr Kind kKinds[] = {
+    {kMagic, kVersion, true},
+    {kProfileMagic, kProfileVersion, false},
+    {kZoneMagic, kZoneVersion, false},
+    {kGramMagic, kGramVersion, false},
+    {kGramIndexMagic, kGramIndexVersion, false},
+    {kSumMagic, kSumVersion, false},
+    {kLayoutMagic, kLayoutVersion, false},
+    {kCopyMagic, kCopyVersion, false},
+};
+
+// Whether `name` is one of the files this namespace writes: sixteen hex
+// digits, then an extension — and, while it is being written, a writer's
+// suffix ending in ".tmp". The directory may be one the user named and shares
+// with other things, so nothing else in it is ever touched.
+bool IsCacheFile(const std::string &name, bool &temporary) {
+  if (name.size() < 18 || name[16] != '.')
+    return false;
+  for (size_t i = 0; i < 16; ++i) {
+    const char c = name[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+      return false;
   }
+  temporary = name.size() > 21 && name.compare(name.size() - 4, 4, ".tmp") == 0;
   return true;
 }
 
+// What a cache file says it describes. `current` is false for a file of a
+// layout this version no longer reads, which nothing will read again; false
+// altogether for one that cannot be made out, which is left alone.
+bool DescribedBy(const std::string &file, std::string &path, bool &current) {
+  std::ifstream in(file, std::ios::binary);
+  char magic[8] = {0};
+  if (!in.is_open() || !in.read(magic, sizeof(magic)))
+    return false;
+  const Kind *kind = nullptr;
+  for (const Kind &candidate : kKinds)
+    if (std::memcmp(magic, candidate.magic, sizeof(magic)) == 0)
+      kind = &candidate;
+  std::uint32_t version = 0;
+  if (kind == nullptr || !Read(in, version))
+    return false;
+  current = version == kind->version;
+  if (!current)
+    return true;
+
+  Key stored;
+  std::uint64_t total_rows = 0;
+  std::uint64_t path_length = 0;
+  if (!ReadStoredKey(in, stored) ||
+      (kind->counts_rows && !Read(in, total_rows)) ||
+      !Read(in, path_length) || path_length == 0 || path_length > 4096)
+    return false;
+  path.assign(static_cast<size_t>(path_length), '\0');
+  return static_cast<bool>(
+      in.read(&path[0], static_cast<std::streamsize>(path_length)));
+}
+
+} // namespace
+
+std::uint64_t Limit() {
+  const char *limit = std::getenv("CSVTUI_CACHE_LIMIT");
+  if (limit == nullptr || !std::isdigit(static_cast<unsigned char>(*limit)))
+    return kDefaultLimit;
+  char *stop = nullptr;
+  errno = 0;
+  const unsigned long long value = std::strtoull(limit, &stop, 10);
+  if (errno != 0 || value == 0)
+    return kDefaultLimit;
+  // "2G" read as two bytes would empty the cache on the next save, so a
+  // suffix is either one of these or the whole setting is ignored.
+  int shift = 0;
+  switch (std::toupper(static_cast<unsigned char>(*stop))) {
+  case 'K':
+    shift = 10;
+    break;
+  case 'M':
+    shift = 20;
+    break;
+  case 'G':
+    shift = 30;
+    break;
+  case 'T':
+    shift = 40;
+    break;
+  }
+  if (shift != 0)
+    ++stop;
+  if (*stop != '\0' || value > (UINT64_MAX >> shift))
+    return kDefaultLimit;
+  return static_cast<std::uint64_t>(value) << shift;
+}
+
+std::uint64_t Trim(std::uint64_t limit) {
+  const std::string directory = Directory();
+  if (directory.empty())
+    return 0;
+  DIR *listing = ::opendir(directory.c_str());
+  if (listing == nullptr)
+    return 0;
+
+  // Everything kept for one file shares a name up to its extension, and goes
+  // together: a profile is no use without the index it sits beside, and
+  // keeping half of several files' worth helps none of them.
+  struct Entry {
+    std::vector<std::string> files;
+    std::uint64_t bytes = 0;
+    long long used = 0;
+    bool stale = false;
+  };
+  std::unordered_map<std::string, Entry> entries;
+  // Files to go whoever last used them: writes abandoned part-way, and
+  // layouts nothing reads any more.
+  std::vector<std::pair<std::string, std::uint64_t>> dead;
+  while (const dirent *found = ::readdir(listing)) {
+    const std::string name = found->d_name;
+    bool temporary = false;
+    if (!IsCacheFile(name, temporary))
+      continue;
+    const std::string file = directory + "/" + name;
+    struct stat info {};
+    if (::stat(file.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+      continue;
+    const std::uint64_t bytes = static_cast<std::uint64_t>(info.st_size);
+    if (temporary) {
+      dead.emplace_back(file, bytes);
+      continue;
+    }
+    std::string described;
+    bool current = true;
+    if (DescribedBy(file, described, current) && !current) {
+      dead.emplace_back(file, bytes);
+      continue;
+    }
+
+    Entry &entry = entries[name.substr(0, 16)];
+    entry.files.push_back(file);
+    entry.bytes += bytes;
+    entry.used = std::max(entry.used, static_cast<long long>(info.st_mtime));
+    // Gone, rather than merely unreadable just now, as a file on a mount
+    // that is down would be. A file since changed is kept: its index may
+    // still be counted on from (see LoadGrown and LoadEdited).
+    struct stat original {};
+    if (!described.empty() && ::stat(described.c_str(), &original) != 0 &&
+        errno == ENOENT)
+      entry.stale = true;
+  }
+  ::closedir(listing);
+
+  // Looking is what takes the time — a read of every file kept and a stat of
+  // every file they describe, any of which can hang on a mount that is down —
+  // so it is done without the lock, and saves wait only for the removals.
+  // Whoever is already trimming will leave the directory as this would. A
+  // temporary seen above and still there now has no writer: every writer
+  // holds the lock while its file exists.
+  const DirectoryLock lock(directory, LOCK_EX | LOCK_NB);
+  if (!lock.held())
+    return 0;
+  std::uint64_t freed = 0;
+  auto remove = [&](const std::string &file, std::uint64_t bytes) {
+    if (::unlink(file.c_str()) == 0)
+      freed += bytes;
+  };
+  for (const auto &file : dead)
+    remove(file.first, file.second);
+
+  std::vector<Entry *> kept;
+  std::uint64_t total = 0;
+  for (auto &named : entries) {
+    Entry &entry = named.second;
+    if (entry.stale) {
+      for (const std::string &file : entry.files)
+        remove(file, 0);
+      freed += entry.bytes;
+      continue;
+    }
+    kept.push_back(&entry);
+    total += entry.bytes;
+  }
+
+  // Then the least recently used, until the rest fits.
+  std::sort(kept.begin(), kept.end(),
+            [](const Entry *a, const Entry *b) { return a->used < b->used; });
+  for (size_t i = 0; i < kept.size() && total > limit; ++i) {
+    for (const std::string &file : kept[i]->files)
+      remove(file, 0);
+    freed += kept[i]->bytes;
+    total -= kept[i]->bytes;
+  }
+  return freed;
+}
+
 } // namespace csvcache
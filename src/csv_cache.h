@@ -1,16 +1,22 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // Remembering where the rows are, between one session and the next.
 //
 // The chunk offset table is one entry per 512 rows, so a complete index of a
-// 12 GB export is about 2.5 MB — small enough to keep, and expensive enough to
-// rebuild that keeping it is worth doing. Every full pass produces one as a
+// 12 GB export is about a megabyte — small enough to keep, and expensive
+// enough to rebuild that keeping it is worth doing. Every full pass produces one as a
 // by-product, so the second time a file is opened the row count can be exact
 // before the first frame is drawn.
 //
@@ -19,6 +25,10 @@
 // a header — is recorded and checked, and a mismatch simply misses rather than
 // being repaired: rebuilding an index costs seconds, and trusting a stale one
 // would put the viewer on the wrong rows with no sign anything was amiss.
+namespace csvscan {
+struct ColumnProfile;
+}
+
 namespace csvcache {
 
 struct Key {
@@ -30,11 +40,126 @@ struct Key {
   size_t chunk_size = 0;
 };
 
+struct Index;
+
+// How closely a cached index must describe the file as it is now to be read:
+// exactly, as an index of it before it grew, or as one of it read the same way
+// at any time, to be checked chunk by chunk.
+enum class Match { Exact, Grown, Any };
+
+// Where each chunk of rows starts. Built in memory as a file is read, at
+// eight bytes a chunk, or mapped from a cached index and read where it lies:
+// opening a 12 GB file with its index then decodes nothing, and holds no copy
+// of a table the page cache has already. Appending to a mapped table copies
+// it into memory first, which a complete one never needs.
+//
+// Copies are cheap when mapped, sharing the one mapping, and it is never
+// written, so a worker may read it while the interface does.
+class ChunkOffsets {
+public:
+  ChunkOffsets() = default;
+  // Implicit, so that a pass's offsets go wherever a table is wanted.
+  ChunkOffsets(const std::vector<std::streampos> &offsets);
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  std::streampos operator[](size_t chunk) const;
+  std::streampos front() const { return (*this)[0]; }
+  std::streampos back() const { return (*this)[size() - 1]; }
+  void push_back(std::streampos offset);
+  void clear();
+  bool mapped() const { return mapping_ != nullptr; }
+
+  bool operator==(const ChunkOffsets &other) const;
+  bool operator!=(const ChunkOffsets &other) const { return !(*this == other); }
+
+private:
+  friend bool MapIndex(const Key &key, Match match, Index &out, Key &stored,
+                       std::uint64_t &fingerprint);
+  struct Mapping;
+  std::vector<std::int64_t> plain_;
+  std::shared_ptr<const Mapping> mapping_;
+};
+
 struct Index {
-  std::vector<std::streampos> offsets;
+  ChunkOffsets offsets;
   size_t total_rows = 0;
 };
 
+// Zones are this many chunks: 8 192 rows at the usual chunk size. Finer would
+// skip more precisely and cost more to keep, for every column, on files of
+// hundreds of thousands of chunks.
+constexpr size_t kChunksPerZone = 16;
+
+// The least and greatest value of one column in each zone of rows, so that a
+// range filter can pass over the zones that cannot hold a match without
+// reading them (see csvpredicate). Numbers and timestamps are kept apart,
+// being on different scales; `times` says which these are. A zone that held
+// none has min > max.
+struct ZoneMap {
+  size_t column = 0;
+  bool times = false;
+  std::vector<double> min;
+  std::vector<double> max;
+};
+
+// Which trigrams each chunk's text holds, as one Bloom filter of `bits` bits
+// per chunk (see csvsketch::Trigrams), so that a search or filter can pass
+// over the chunks that cannot contain its pattern without reading them.
+// Chunk c's filter is the `bits / 64` words starting at c * bits / 64.
+struct GramFilters {
+  size_t bits = 0; // a multiple of 64
+  std::vector<std::uint64_t> words;
+
+  size_t chunks() const { return bits == 0 ? 0 : words.size() * 64 / bits; }
+  const std::uint64_t *Chunk(size_t chunk) const {
+    return words.data() + chunk * (bits / 64);
+  }
+};
+
+// Where each trigram occurs, inverted: for every trigram the file holds (see
+// csvsketch::Trigrams), the zones holding it. Unlike the filters above it is
+// exact — a zone is listed if and only if its text has the trigram — and a
+// search costs the lists of its pattern's trigrams rather than a test of every
+// chunk, so it is the one to keep for files that are searched every day.
+//
+// The lists are compressed: each zone is written as its distance past the one
+// before, in seven-bit groups, low first, the top bit set on all but the last.
+// Common trigrams, which occur in most zones, then take a byte a zone, and rare
+// ones next to nothing, which is where a search finds its answer.
+struct GramIndex {
+  size_t zones = 0;
+  std::vector<std::uint32_t> grams;  // sorted
+  std::vector<std::uint64_t> starts; // grams.size() + 1 offsets into postings
+  std::vector<std::uint8_t> postings;
+
+  // The zones holding every one of `trigrams`, in order. All of them when
+  // `trigrams` is empty, which rules nothing out.
+  std::vector<size_t> ZonesHolding(const std::vector<std::uint32_t> &trigrams) const;
+};
+
+// Gathers an index zone by zone, in any order: a pass that joined a read
+// part-way reaches the top of the file last, and may see the zone it joined in
+// twice, in two halves.
+class GramIndexBuilder {
+public:
+  // Notes that `zone` holds `grams`, which are sorted and distinct.
+  void Add(size_t zone, const std::vector<std::uint32_t> &grams);
+  // Inverts what was added into an index of `zones` zones. Leaves the builder
+  // empty.
+  GramIndex Finish(size_t zones);
+
+private:
+  // Each zone's trigrams, compressed the same way as the postings: held for
+  // every zone at once, they are the larger part of what building costs.
+  std::vector<std::vector<std::uint8_t>> zones_;
+};
+
+// A file smaller than this is read in well under a second, so nothing is
+// cached for it: a rebuild is imperceptible, and caching would only litter the
+// cache directory.
+constexpr long long kMinimumFileSize = 32ll * 1024 * 1024;
+
 // Resolves `path` and stats it. False when the file cannot be described, in
 // which case nothing should be cached for it.
 bool DescribeFile(const std::string &path, char delimiter, bool has_header,
@@ -48,12 +173,167 @@ std::string Directory();
 // The file an index for `key` would live in. Empty when Directory() is.
 std::string PathFor(const Key &key);
 
-// Reads a matching index. False when there is none, when it describes a
-// different file, or when it is damaged.
+// Reads a matching index, mapping its offsets rather than reading them. False
+// when there is none, when it describes a different file, or when it is
+// damaged, which its checksum catches whatever the damage says of the counts.
 bool Load(const Key &key, Index &out);
 
-// Writes the index, creating the cache directory if needed. False on any I/O
-// problem, which callers should ignore: failing to cache is not a failure.
+// Reads an index of this file from before it grew: kept under the same path,
+// shorter then, and read the same way. Its offsets still place every row
+// they counted if the file has only been appended to, which a fingerprint of
+// the bytes before the last offset, stored with it, is checked against — so
+// a log that grew by 50 MB is counted on from where the index stops rather
+// than from the top. `out.total_rows` is the count as it was, and no longer
+// the file's. False for anything else, as Load is.
+bool LoadGrown(const Key &key, Index &out);
+
+// How much of each end of a chunk, and of what follows it, its hash covers.
+constexpr size_t kSampleBytes = 64;
+
+// The chunks found unchanged past an edit: where each starts now, and the
+// rows from the first of them to the end.
+struct Splice {
+  std::vector<std::streampos> tail;
+  size_t tail_rows = 0;
+};
+
+// The file the chunk hashes for `key` live in, beside its index.
+std::string SumPathFor(const Key &key);
+
+// What an index still says of a file edited in its middle, such as a report
+// with one partition regenerated in place: the chunks before the edit, where
+// they were, and those after it, moved by however much the edit changed the
+// file's length. Each chunk is recognised by a hash of its length, its first
+// and last kSampleBytes and the kSampleBytes after it, kept beside the index,
+// so recognising them costs a few small reads a chunk rather than reading the
+// file.
+//
+// `out.offsets` runs up to and including the start of the first chunk that
+// differs, which is where counting must begin again; `tail` is where the
+// chunks found unchanged past the edit start now, and `tail_rows` the rows
+// from the first of them to the end. A count that meets the first of them on
+// a chunk boundary has the rest (see csvscan::Request::resume_tail). One
+// that does not — the edit added or removed rows other than in whole chunks —
+// counts on to the end, which still spares the part before the edit. False
+// when the index describes a different reading of the file, has no hashes,
+// or matches too little of it to be worth anything.
+bool LoadEdited(const Key &key, Index &out, Splice &splice);
+
+// Reads the index of another file with the same contents — this one copied
+// to another directory, or to another machine along with the cache — when
+// there is none filed under this one's path. The two are matched by size and
+// a hash of blocks spread across them, and the match is then checked against
+// the hashes of a spread of kCopyChecks chunks before the offsets are used.
+// False for anything less.
+constexpr size_t kCopyChecks = 32;
+bool LoadCopy(const Key &key, Index &out);
+
+// Writes the index, creating the cache directory if needed, and reads the
+// ends of the file to fingerprint it for LoadGrown, the ends of every chunk
+// to hash them for LoadEdited, and blocks across it to file it for LoadCopy.
+// An index of the file from before it grew lends the hashes of the chunks it
+// still places the same, so saving after an append hashes only what was
+// appended. False on any I/O problem, which callers should ignore: failing to
+// cache is not a failure.
 bool Save(const Key &key, const Index &index);
 
+// Saves on a thread of its own. Hashing every chunk is three small reads a
+// chunk, seconds for a file of hundreds of thousands of them, which the
+// interface would otherwise spend frozen after every count.
+class Writer {
+public:
+  Writer() = default;
+  // Finishes whatever was handed over first, so that an index counted just
+  // before quitting is still kept.
+  ~Writer();
+
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  // Saves `index` as Save does, later. One of the same file still waiting is
+  // dropped: this one describes at least as much of it.
+  void Save(const Key &key, Index index);
+  // Brings the directory within `limit` bytes, as Trim does, once nothing
+  // is waiting to be saved.
+  void Trim(std::uint64_t limit);
+  // Blocks until everything handed over has been done.
+  void Wait();
+
+private:
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::vector<std::pair<Key, Index>> pending_;
+  std::optional<std::uint64_t> trim_;
+  bool busy_ = false;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+// A column profile of the whole file, kept beside its index under the same
+// key: a profile reads every row, and the answer does not change until the
+// file does.
+std::string ProfilePathFor(const Key &key);
+bool LoadProfile(const Key &key, std::vector<csvscan::ColumnProfile> &out);
+bool SaveProfile(const Key &key,
+                 const std::vector<csvscan::ColumnProfile> &profile);
+
+// What opening a file measures of its first rows: the width each column is
+// shown at, whether it holds numbers, and the bytes an average record takes,
+// which the row estimate divides the file's size by. The same every time for
+// a file that has not changed, so it is kept beside the index, and a file
+// opened again parses nothing past its first screen.
+struct ColumnLayout {
+  std::vector<int> widths;
+  std::vector<bool> numeric;
+  double record_bytes = 0.0;
+};
+std::string LayoutPathFor(const Key &key);
+bool LoadLayout(const Key &key, ColumnLayout &out);
+bool SaveLayout(const Key &key, const ColumnLayout &layout);
+
+// Zone maps of the whole file, likewise kept beside its index: they describe
+// the rows the offsets point at, and are only ever built by passes that read
+// all of them.
+std::string ZonePathFor(const Key &key);
+bool LoadZones(const Key &key, std::vector<ZoneMap> &out);
+bool SaveZones(const Key &key, const std::vector<ZoneMap> &zones);
+
+// Trigram filters of every chunk, kept the same way. They run to about a
+// thirtieth of the file, so HasGramFilters says whether a matching set exists
+// without reading it, and the caller loads it only when a search comes.
+std::string GramPathFor(const Key &key);
+bool HasGramFilters(const Key &key);
+bool LoadGramFilters(const Key &key, GramFilters &out);
+bool SaveGramFilters(const Key &key, const GramFilters &filters);
+
+// The search index, likewise: built only when asked for, and loaded on the
+// first search after it exists.
+std::string GramIndexPathFor(const Key &key);
+bool HasGramIndex(const Key &key);
+bool LoadGramIndex(const Key &key, GramIndex &out);
+bool SaveGramIndex(const Key &key, const GramIndex &index);
+
+// The cache directory is kept to Limit() bytes: $CSVTUI_CACHE_LIMIT, a count
+// of bytes with an optional K, M, G or T suffix for powers of 1024, else
+// kDefaultLimit when unset or not in that form. Without one it only ever
+// grows — a search index is a tenth of its file, and a year of daily exports
+// leaves gigabytes of indexes to files long deleted.
+constexpr std::uint64_t kDefaultLimit = 2ull * 1024 * 1024 * 1024;
+std::uint64_t Limit();
+
+// Brings the directory within `limit` bytes: first removes what was kept for
+// files that no longer exist, writes abandoned part-way and files of layouts
+// this version no longer reads, then what was kept for the files used least
+// recently — a file's indexes, profile and the rest going together — until
+// the rest fits. Reading an index or a file's columns counts as using it.
+// Only files this namespace writes are removed, whatever else the directory
+// holds. Returns the bytes freed; nothing when another process is trimming
+// already. Looking over the directory reads every file in it and stats every
+// file they describe, so the viewer runs it once a session, on its Writer's
+// thread; saves wait only while it removes.
+std::uint64_t Trim(std::uint64_t limit);
+
 } // namespace csvcache
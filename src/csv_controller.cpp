@@ -2,6 +2,8 @@
 
 #include "csv_model.h"
 #include "csv_parser.h"
+#include "csv_sketch.h"
+#include "csv_sortrun.h"
 #include "csv_system.h"
 #include "csv_view.h"
 
@@ -35,6 +37,15 @@ constexpr size_t kMaxCount = 1'000'000'000ULL;
 const char *const kSpinner[] = {"⠋", "⠙", "⠹", "⠸", "⠼", "⠴", "⠦", "⠧", "⠇", "⠏"};
 constexpr size_t kSpinnerFrames = sizeof(kSpinner) / sizeof(kSpinner[0]);
 
+// How much of a sort to show before it finishes: a few screens, enough to look
+// at and page through while the rest is read and merged.
+constexpr size_t kProvisionalRows = 2000;
+
+// Column statistics start from a sample of the file when it is at least this
+// large. Below it the whole read takes a second or so, and the exact figures
+// arrive about as soon as an estimate would be worth reading.
+constexpr long long kEstimateStatsBytes = 64LL << 20;
+
 const char *const kCtrlB = "\x02";
 const char *const kCtrlD = "\x04";
 const char *const kCtrlF = "\x06";
@@ -96,6 +107,11 @@ CSVController::CSVController(CSVModel &model, CSVView &view,
                              ScreenInteractive &screen)
     : model_(model), view_(view), screen_(screen) {
   SyncView();
+  StartResume();
+  StartSearchIndex();
+  // Once a session is enough to keep the cache in bounds, and off this
+  // thread, since it looks at every file the cache describes.
+  cache_writer_.Trim(csvcache::Limit());
 
   component_ = CatchEvent(Renderer([this] {
                             // While a search runs the model belongs to the
@@ -109,10 +125,15 @@ CSVController::CSVController(CSVModel &model, CSVView &view,
                             // when the terminal is resized: FTXUI re-renders on
                             // SIGWINCH without delivering a key event.
                             PollScanner();
+                            PollFollow();
+                            PollSpool();
+                            FollowRenumbering();
                             ClampToView();
                             SyncView();
                             const auto size = Terminal::Size();
-                            return view_.Render(size.dimx, size.dimy);
+                            Element frame = view_.Render(size.dimx, size.dimy);
+                            StartIdleIndex();
+                            return frame;
                           }),
                           [this](Event event) { return OnEvent(event); });
 }
@@ -120,8 +141,14 @@ CSVController::CSVController(CSVModel &model, CSVView &view,
 CSVController::~CSVController() {
   // The worker holds a reference to the model and posts to the screen; both
   // outlive it only if it is stopped first.
+  watcher_.reset();
+  if (spool_)
+    spool_->SetNotify(nullptr);
   blocking_cancel_.store(true, std::memory_order_release);
   JoinBlocking();
+  AbandonTasks();
+  if (!derived_path_.empty())
+    ::unlink(derived_path_.c_str());
 }
 
 Component CSVController::GetComponent() { return component_; }
@@ -204,6 +231,38 @@ void CSVController::GoToRow(size_t row) {
   ClampToView();
 }
 
+void CSVController::GoToFraction(double fraction) {
+  if (fraction >= 1.0) {
+    // The end is a row like any other once the file is counted, and counting
+    // it is what finds the end otherwise.
+    if (model_.RowCountKnown())
+      GoToRow(KnownLastRow());
+    else
+      RequestExactCount(Task::End);
+    return;
+  }
+  const std::optional<size_t> row = model_.LandAt(fraction);
+  if (!row) {
+    SetMessage("no row starts there", true);
+    return;
+  }
+  cursor_row_ = *row;
+  ClampToView();
+}
+
+void CSVController::FollowRenumbering() {
+  long long shift = 0;
+  if (!model_.TakeRenumbering(shift))
+    return;
+  // The same rows under their real numbers, so the screen stays where it is.
+  const auto moved = [shift](size_t row) {
+    const long long to = static_cast<long long>(row) + shift;
+    return to < 0 ? size_t{0} : static_cast<size_t>(to);
+  };
+  cursor_row_ = moved(cursor_row_);
+  start_row_ = moved(start_row_);
+}
+
 // --- background passes ------------------------------------------------------
 //
 // Counting, sorting, filtering and column statistics all need to read every
@@ -212,20 +271,80 @@ void CSVController::GoToRow(size_t row) {
 
 void CSVController::StartScan(Task task, const csvscan::Request &request,
                               const std::string &label) {
-  // A second request supersedes the first rather than queueing behind it.
-  if (scanner_.running()) {
-    scanner_.Cancel();
-    scanner_.Join();
+  // A second request for the same thing supersedes the first rather than
+  // queueing behind it. Anything else runs alongside, on the read already
+  // under way where it can share it: asking for statistics mid-sort no
+  // longer throws the sort away.
+  Supersede(task);
+  if (task != Task::Index)
+    finished_note_.clear();
+
+  // Piped input still arriving is only part of the file (see PollSpool).
+  if (model_.arriving()) {
+    spool_scans_.push_back({task, request, label});
+    SetMessage(label + " once stdin ends… Esc to stop waiting");
+    return;
   }
 
-  task_ = task;
-  task_label_ = label;
-  scanner_.Start(request, [this] {
-    // Called from the worker thread; waking the loop is the only cross-thread
+  PendingTask pending;
+  pending.task = task;
+  pending.label = label;
+  pending.filtering = request.filter && !request.filter_pattern.empty();
+  if (request.want_groups)
+    pending.output = request.group_output;
+  pending.pass = scanner_.Start(request, [this] {
+    // Called from a worker thread; waking the loop is the only cross-thread
     // interaction, and PostEvent is the one FTXUI call that allows it.
     screen_.PostEvent(ftxui::Event::Custom);
   });
-  SetMessage(label + "… Esc to cancel");
+  tasks_.push_back(std::move(pending));
+  if (task != Task::Index)
+    SetMessage(label + "… Esc to cancel");
+}
+
+bool CSVController::Replaces(Task newer, Task older) {
+  // The view can be built only one way at a time and the cursor sent only
+  // one place. Everything else answers a question still worth answering.
+  const auto view = [](Task t) { return t == Task::Sort || t == Task::Filter; };
+  const auto jump = [](Task t) { return t == Task::End || t == Task::Row; };
+  return newer == older || (view(newer) && view(older)) ||
+         (jump(newer) && jump(older));
+}
+
+void CSVController::Supersede(Task task) {
+  spool_scans_.erase(std::remove_if(spool_scans_.begin(), spool_scans_.end(),
+                                    [task](const WaitingScan &waiting) {
+                                      return Replaces(task, waiting.task);
+                                    }),
+                     spool_scans_.end());
+  for (size_t i = 0; i < tasks_.size();) {
+    if (!Replaces(task, tasks_[i].task)) {
+      ++i;
+      continue;
+    }
+    // The worker reads only its own request, so it can wind down unwatched.
+    scanner_.Forget(tasks_[i].pass);
+    if (!tasks_[i].output.empty())
+      ::unlink(tasks_[i].output.c_str());
+    if (tasks_[i].task == Task::Sort || tasks_[i].task == Task::Filter)
+      model_.DropProvisional();
+    tasks_.erase(tasks_.begin() + static_cast<std::ptrdiff_t>(i));
+  }
+}
+
+const CSVController::PendingTask *CSVController::FindTask(Task task) const {
+  for (const PendingTask &pending : tasks_) {
+    if (pending.task == task && !pending.stopping)
+      return &pending;
+  }
+  return nullptr;
+}
+
+size_t CSVController::AskedTasks() const {
+  return static_cast<size_t>(
+      std::count_if(tasks_.begin(), tasks_.end(), [](const PendingTask &t) {
+        return t.task != Task::Index;
+      }));
 }
 
 void CSVController::RequestExactCount(Task task, size_t row) {
@@ -233,141 +352,391 @@ void CSVController::RequestExactCount(Task task, size_t row) {
 
   if (model_.RowCountKnown()) {
     // Nothing to read; apply straight away.
-    task_ = task;
     csvscan::Result empty;
-    FinishScan(empty);
+    SetMessage(FinishScan(task, empty));
+    return;
+  }
+
+  // Piped input still arriving is counted as it arrives; a pass would count
+  // only what is there now, and finish before the spooler does.
+  if (model_.arriving()) {
+    spool_task_ = task;
+    SetMessage("counting rows as stdin arrives… Esc to stop waiting");
+    return;
+  }
+
+  // The count already under way at idle priority becomes this one, rather
+  // than starting again from the top.
+  if (FindTask(Task::Index)) {
+    Supersede(task);
+    for (PendingTask &pending : tasks_) {
+      if (pending.task != Task::Index)
+        continue;
+      scanner_.Promote(pending.pass);
+      pending.task = task;
+      pending.label = "counting rows";
+    }
+    finished_note_.clear();
+    SetMessage("counting rows… Esc to cancel");
     return;
   }
 
   csvscan::Request request;
-  model_.DescribeScan(request);
+  if (model_.IndexOutgrown())
+    model_.DescribeResume(request);
+  else
+    model_.DescribeScan(request);
   StartScan(task, request, "counting rows");
 }
 
+void CSVController::AbandonTasks() {
+  for (const PendingTask &pending : tasks_) {
+    scanner_.Forget(pending.pass);
+    if (!pending.output.empty())
+      ::unlink(pending.output.c_str());
+  }
+  tasks_.clear();
+  spool_task_.reset();
+  spool_scans_.clear();
+  finished_note_.clear();
+}
+
 bool CSVController::CancelScan() {
-  if (!scanner_.running())
+  // Nothing is running for a pass that waits on stdin, so nothing has to
+  // wind down.
+  if (spool_task_ || !spool_scans_.empty()) {
+    spool_task_.reset();
+    spool_scans_.clear();
+    if (AskedTasks() == 0) {
+      SetMessage("stopped waiting for the end of stdin");
+      return true;
+    }
+  }
+
+  size_t stopped = 0;
+  std::string label;
+  for (PendingTask &pending : tasks_) {
+    if (pending.stopping || pending.task == Task::Index)
+      continue;
+    scanner_.Cancel(pending.pass);
+    pending.stopping = true;
+    label = pending.label;
+    ++stopped;
+  }
+  if (stopped == 0)
     return false;
-  // The worker only notices between rows, so it keeps running for a moment
+  // The workers only notice between rows, so they keep running for a moment
   // yet. Say so now: pressing Esc and watching the percentage climb on is
   // indistinguishable from Esc not working.
-  scanner_.Cancel();
-  task_ = Task::None;
-  cancel_requested_ = true;
-  SetMessage("stopping " + task_label_ + "…");
+  finished_note_.clear();
+  // The sort is not coming, so neither is the rest of its first screen.
+  if (model_.showing_provisional()) {
+    model_.DropProvisional();
+    cursor_row_ = 0;
+    start_row_ = 0;
+    ClampToView();
+  }
+  SetMessage("stopping " + label +
+             (stopped > 1 ? " and " + std::to_string(stopped - 1) + " more"
+                          : std::string()) +
+             "…");
   return true;
 }
 
 void CSVController::PollScanner() {
-  if (scanner_.running()) {
-    // Leave the "stopping" message alone rather than overwriting it with a
-    // progress reading the user has just asked to be rid of.
-    if (cancel_requested_)
-      return;
-
-    const int percent = static_cast<int>(scanner_.progress() * 100.0);
-    const bool merging = scanner_.phase() == csvscan::Phase::Merging;
-    const bool filtering = scanner_.request().filter &&
-                           !scanner_.request().filter_pattern.empty();
-    // While filtering, the useful number is how many rows survived, not how
-    // many were read; while merging it is how many are in their final place.
-    const std::string count =
-        merging ? csv::HumanCount(scanner_.rows_kept()) + " placed"
-        : filtering ? csv::HumanCount(scanner_.rows_kept()) + " matched"
-                    : csv::HumanCount(scanner_.rows_seen()) + " rows";
-
-    // The spinner turns on every frame, not on every percent. A file whose
-    // rows are cheap to read can sit on one number for a while, and a static
-    // number is indistinguishable from a program that has stopped.
-    spinner_frame_ = (spinner_frame_ + 1) % kSpinnerFrames;
-    const std::string spinner(kSpinner[spinner_frame_]);
-
-    SetMessage(spinner + " " + task_label_ +
-               (merging ? " — merging " : "… ") + std::to_string(percent) +
-               "%  (" + count + ", Esc to cancel)");
+  // Whatever has ended is dealt with first, oldest first, so that a count
+  // and a sort finishing together land in the order they were asked for.
+  for (size_t i = 0; i < tasks_.size();) {
+    if (scanner_.running(tasks_[i].pass)) {
+      ++i;
+      continue;
+    }
+    const PendingTask ended = tasks_[i];
+    tasks_.erase(tasks_.begin() + static_cast<std::ptrdiff_t>(i));
+    SettleTask(ended);
+  }
+  if (AskedTasks() == 0)
     return;
+
+  // The readout follows the newest task. Leave the "stopping" message alone
+  // rather than overwriting it with a progress reading the user has just
+  // asked to be rid of.
+  const PendingTask *shown = nullptr;
+  for (auto it = tasks_.rbegin(); it != tasks_.rend() && !shown; ++it) {
+    if (!it->stopping && it->task != Task::Index)
+      shown = &*it;
   }
+  if (!shown)
+    return;
 
-  if (scanner_.state() == CSVScanner::State::Failed) {
-    scanner_.Join();
+  const int percent = static_cast<int>(scanner_.progress(shown->pass) * 100.0);
+  const bool merging =
+      scanner_.phase(shown->pass) == csvscan::Phase::Merging;
+  // While filtering, the useful number is how many rows survived, not how
+  // many were read; while merging it is how many are in their final place.
+  const std::string count =
+      merging ? csv::HumanCount(scanner_.rows_kept(shown->pass)) + " placed"
+      : shown->filtering
+          ? csv::HumanCount(scanner_.rows_kept(shown->pass)) + " matched"
+          : csv::HumanCount(scanner_.rows_seen(shown->pass)) + " rows";
+  const std::string label = shown->label;
+  const size_t others = AskedTasks() - 1;
+
+  // The spinner turns on every frame, not on every percent. A file whose
+  // rows are cheap to read can sit on one number for a while, and a static
+  // number is indistinguishable from a program that has stopped.
+  spinner_frame_ = (spinner_frame_ + 1) % kSpinnerFrames;
+  const std::string spinner(kSpinner[spinner_frame_]);
+
+  ShowProvisionalSort();
+  ShowStreamedMatches();
+  TakeStatsEstimate();
+  // Statistics on the way say what they look like so far, which on a large
+  // file is most of what anyone wanted to know, long before the read ends.
+  const std::string estimate =
+      shown->task == Task::Stats && stats_estimated_
+          ? "  " + DescribeEstimate(stats_estimate_)
+          : std::string();
+  const std::string showing =
+      !model_.showing_provisional()
+          ? std::string()
+      : FindTask(Task::Filter)
+          ? " — showing " + csv::HumanCount(model_.RowCount()) + " so far"
+      : provisional_exact_
+          ? " — first " + csv::HumanCount(model_.RowCount()) + " final"
+          : " — first " + csv::HumanCount(model_.RowCount()) + " provisional";
+
+  SetMessage((finished_note_.empty() ? std::string() : finished_note_ + "  ·  ") +
+             spinner + " " + label + (merging ? " — merging " : "… ") +
+             std::to_string(percent) + "%  (" + count +
+             (others > 0 ? ", " + std::to_string(others) + " more running"
+                         : std::string()) +
+             ", Esc to cancel)" + showing + estimate);
+}
+
+void CSVController::SettleTask(const PendingTask &task) {
+  const bool builds_view = task.task == Task::Sort || task.task == Task::Filter;
+  std::string message;
+  bool is_error = false;
+  // A file the pass wrote is wanted only if it finished and was still
+  // wanted; FinishScan takes it over then, and otherwise it goes.
+  struct RemoveOutput {
+    const std::string &path;
+    bool keep = false;
+    ~RemoveOutput() {
+      if (!keep && !path.empty())
+        ::unlink(path.c_str());
+    }
+  } output{task.output};
+
+  switch (scanner_.state(task.pass)) {
+  case CSVScanner::State::Failed: {
+    // Nobody asked for it, so nobody is told; the file is counted when they
+    // do ask, and fails then if it still cannot be read.
+    if (task.task == Task::Index) {
+      scanner_.Forget(task.pass);
+      idle_index_failed_ = true;
+      return;
+    }
+    if (builds_view)
+      model_.DropProvisional();
     // A sort that ran out of temporary disk space has something specific to
     // say; anything else was a problem reading the file itself.
-    const std::string &reason = scanner_.error();
-    SetMessage(reason.empty() ? "could not read " + model_.path() : reason, true);
-    task_ = Task::None;
-    cancel_requested_ = false;
-    return;
+    const std::string reason = scanner_.error(task.pass);
+    scanner_.Forget(task.pass);
+    message = reason.empty() ? "could not read " + model_.path() : reason;
+    is_error = true;
+    break;
   }
-
-  if (cancel_requested_ && scanner_.state() == CSVScanner::State::Cancelled) {
-    scanner_.Join();
-    cancel_requested_ = false;
-    SetMessage(task_label_ + " cancelled", true);
+  case CSVScanner::State::Cancelled:
+    scanner_.Forget(task.pass);
+    if (!task.stopping)
+      return;
+    message = task.label + " cancelled";
+    is_error = true;
+    break;
+  case CSVScanner::State::Done: {
+    csvscan::Result result;
+    if (!scanner_.Take(task.pass, result))
+      return;
+    // Every full pass yields the offset table and the exact row count,
+    // whatever it was actually asked for. Keeping it means the next session
+    // starts with the file already counted — even for a pass whose result
+    // nobody is waiting for any more, because Esc came too late.
+    if (task.task == Task::Follow)
+      follow_pinned_ =
+          model_.RowCountKnown() && cursor_row_ == KnownLastRow();
+    model_.AdoptIndex(std::move(result.offsets), result.total_rows);
+    // A count short of a record still being written is not the count of the
+    // file as it stands, which is what the cache would file it as.
+    if (!result.partial)
+      model_.SaveIndex(&cache_writer_);
+    model_.AdoptZones(std::move(result.zones));
+    model_.AdoptGrams(std::move(result.grams));
+    model_.AdoptGramIndex(std::move(result.gram_index));
+    // Which leaves an idle count with nothing to add.
+    if (model_.RowCountKnown() && task.task != Task::Index)
+      Supersede(Task::Index);
+    if (task.stopping || task.task == Task::Index)
+      return;
+    output.keep = true;
+    if (task.task == Task::Group) {
+      OpenDerivedTable(task.output, task_group_title_);
+      message = model_.path() + ": " + csv::HumanCount(result.groups) +
+                " group(s)" +
+                (result.group_spills > 0 ? ", partitioned to disk" : "") +
+                " — Esc to return";
+      break;
+    }
+    message = FinishScan(task.task, result);
+    break;
+  }
+  case CSVScanner::State::Idle:
+  case CSVScanner::State::Running:
     return;
   }
 
-  csvscan::Result result;
-  if (!scanner_.Take(result))
-    return; // idle, or cancelled before finishing
-  if (task_ == Task::None) {
-    // A pass whose result nobody is waiting for — but it still counted the
-    // file on its way through, so keep that much.
-    model_.AdoptIndex(std::move(result.offsets), result.total_rows);
-    model_.SaveIndex();
-    cancel_requested_ = false;
+  // With other passes still running, the readout would overwrite this at
+  // once; it rides along in front of it instead.
+  if (AskedTasks() == 0)
+    SetMessage(message, is_error);
+  else
+    finished_note_ = message;
+}
+
+void CSVController::ShowProvisionalSort() {
+  const PendingTask *sort = FindTask(Task::Sort);
+  std::vector<size_t> rows;
+  bool exact = false;
+  if (!sort || !scanner_.TakeProvisional(sort->pass, rows, exact))
     return;
+  // Only the first arrival moves the cursor. Later ones refine the rows under
+  // it, and yanking it back to the top each time would make them unreadable.
+  const bool first = !model_.showing_provisional();
+  model_.ShowProvisional(task_view_, std::move(rows));
+  provisional_exact_ = exact;
+  if (first) {
+    cursor_row_ = 0;
+    start_row_ = 0;
   }
+  ClampToView();
+}
 
-  // Every full pass yields the offset table and the exact row count, whatever
-  // it was actually asked for. Keeping it means the next session starts with
-  // the file already counted.
-  model_.AdoptIndex(std::move(result.offsets), result.total_rows);
-  model_.SaveIndex();
-  FinishScan(result);
+void CSVController::TakeStatsEstimate() {
+  const PendingTask *stats = FindTask(Task::Stats);
+  if (stats && scanner_.TakeEstimate(stats->pass, stats_estimate_))
+    stats_estimated_ = true;
 }
 
-void CSVController::FinishScan(csvscan::Result &result) {
-  const Task task = task_;
-  task_ = Task::None;
+void CSVController::ShowStreamedMatches() {
+  const PendingTask *filter = FindTask(Task::Filter);
+  std::vector<size_t> rows;
+  if (!filter || !scanner_.TakeMatches(filter->pass, rows))
+    return;
+  // As with a sort, the cursor goes to the top once. The rows arriving later
+  // all come after it, so nothing under it ever moves.
+  const bool first = !model_.showing_provisional();
+  model_.AppendProvisional(task_view_, rows);
+  if (first) {
+    cursor_row_ = 0;
+    start_row_ = 0;
+  }
+  ClampToView();
+}
 
+std::string CSVController::FinishScan(Task task, csvscan::Result &result) {
+  std::string message;
   switch (task) {
   case Task::End:
     cursor_row_ = KnownLastRow();
-    SetMessage(csv::HumanCount(model_.RowCount()) + " rows");
+    message = csv::HumanCount(model_.RowCount()) + " rows";
     break;
   case Task::Row:
     cursor_row_ = std::min(task_row_, KnownLastRow());
-    SetMessage(std::string());
     break;
-  case Task::Sort:
-    model_.AdoptView(task_view_, std::move(result.order), result.has_order);
-    cursor_row_ = 0;
-    start_row_ = 0;
-    SetMessage("sorted by " + model_.ColumnName(task_view_.sort_column) +
-               (task_view_.sort_descending ? " (desc)" : " (asc)"));
+  case Task::Sort: {
+    // Someone already reading the first screen stays where they are: the
+    // finished sort begins with exactly the rows they were looking at.
+    const bool keep_place = model_.showing_provisional() && provisional_exact_;
+    model_.AdoptView(task_view_, result);
+    if (!keep_place) {
+      cursor_row_ = 0;
+      start_row_ = 0;
+    }
+    message = "sorted by " + model_.ColumnName(task_view_.sort_column) +
+              (task_view_.sort_descending ? " (desc)" : " (asc)");
     break;
-  case Task::Filter:
-    model_.AdoptView(task_view_, std::move(result.order), result.has_order);
-    cursor_row_ = 0;
-    start_row_ = 0;
-    SetMessage(task_view_.filter_active
-                   ? csv::HumanCount(model_.RowCount()) + " row(s) match"
-                   : std::string("filter cleared"));
+  }
+  case Task::Filter: {
+    // The finished set begins with the matches already streamed in, so
+    // whoever was reading them keeps their place.
+    const bool keep_place = model_.showing_provisional();
+    model_.AdoptView(task_view_, result);
+    if (!keep_place) {
+      cursor_row_ = 0;
+      start_row_ = 0;
+    }
+    message = task_view_.filter_active
+                  ? csv::HumanCount(model_.RowCount()) + " row(s) match"
+              : task_view_.sort_active
+                  ? "sorted by " + model_.ColumnName(task_view_.sort_column)
+                  : std::string("filter cleared");
     break;
+  }
   case Task::Stats:
-    SetMessage(DescribeStats(task_column_, result.stats));
+    message = DescribeStats(task_column_, result.stats);
     break;
+  case Task::Profile:
+    if (task_profile_whole_)
+      model_.SaveProfile(result.profile);
+    message = "profiled " + std::to_string(result.profile.size()) + " column(s)";
+    view_.ShowProfile(std::move(result.profile));
+    break;
+  case Task::Frequencies: {
+    const std::string name = model_.ColumnName(task_frequency_column_);
+    if (!result.frequencies_exact)
+      message = name + ": too many distinct values to count exactly";
+    else if (result.distinct_values > result.frequencies.size())
+      message = name + ": " + csv::HumanCount(result.distinct_values) +
+                " distinct values, showing the " +
+                std::to_string(result.frequencies.size()) + " most frequent";
+    else
+      message = name + ": " + csv::HumanCount(result.distinct_values) +
+                " distinct value(s)";
+    view_.ShowFrequencies(task_frequency_column_,
+                          std::move(result.frequencies),
+                          result.frequencies_exact, result.frequency_rows);
+    break;
+  }
+  case Task::Group:
+    break; // settled in SettleTask, since it replaces the model's file
+  case Task::Index:
+    break; // settled in SettleTask, unannounced
   case Task::MatchCount:
     match_total_ = result.matches;
     match_total_known_ = true;
     // Said rather than shouted: the jump already happened, and this is the
     // number that could not be known at the time.
-    SetMessage(csv::HumanCount(match_total_) + " match(es) for '" +
-               match_pattern_ + "'");
+    message = csv::HumanCount(match_total_) + " match(es) for '" +
+              match_pattern_ + "'";
     break;
-  case Task::None:
+  case Task::SearchIndex:
+    message = "indexed " + model_.path() + " for search";
+    break;
+  case Task::Resume:
+    message = csv::HumanCount(model_.TotalRowCount()) +
+              " rows, counted on from the last index";
+    break;
+  case Task::Follow:
+    model_.AdoptAppended(follow_view_, result);
+    if (follow_pinned_)
+      cursor_row_ = KnownLastRow();
+    message = "following " + model_.path() + ": " +
+              csv::HumanCount(model_.RowCount()) + " rows";
     break;
   }
   ClampToView();
+  return message;
 }
 
 void CSVController::ClampToView() {
@@ -395,6 +764,9 @@ void CSVController::UpdateCommandLine() {
   case InputMode::Filter:
     view_.SetCommandLine("filter: " + input_buffer_);
     break;
+  case InputMode::Predicate:
+    view_.SetCommandLine("where: " + input_buffer_);
+    break;
   case InputMode::Export:
     view_.SetCommandLine("write to: " + input_buffer_);
     break;
@@ -706,30 +1078,63 @@ void CSVController::RepeatSearch(bool forward) {
   StartSearch(*last_search_, forward, true);
 }
 
-void CSVController::ApplyFilter(const std::string &pattern) {
+void CSVController::ApplyFilter(const std::string &pattern, bool predicate) {
   CSVModel::ViewState target = model_.CurrentViewState();
   target.filter_active = !pattern.empty();
   target.filter_pattern = pattern;
+  target.filter_predicate = predicate && !pattern.empty();
+  target.filter_built = csvpredicate::Predicate{};
+  ApplyFilter(std::move(target));
+}
 
-  // Dropping the filter from an otherwise unordered view needs no work at all:
-  // the view becomes the file again.
-  if (!target.filter_active && !target.sort_active) {
-    model_.AdoptView(target, {}, false);
-    cursor_row_ = 0;
-    start_row_ = 0;
-    ClampToView();
-    SetMessage("filter cleared");
+void CSVController::ApplyFilter(CSVModel::ViewState target) {
+  const CSVModel::ViewState current = model_.CurrentViewState();
+  if (target.filter_active && current.filter_active &&
+      target.filter_pattern == current.filter_pattern &&
+      target.filter_predicate == current.filter_predicate &&
+      target.filter_built.clauses == current.filter_built.clauses) {
+    SetMessage(csv::HumanCount(model_.RowCount()) + " row(s) match");
     return;
   }
 
+  // Dropping the filter from an otherwise unordered view needs no work at all,
+  // and neither does going back to a view shown a moment ago.
+  if (RecallView(target, target.filter_active
+                             ? std::string()
+                             : std::string("filter cleared")))
+    return;
+
   csvscan::Request request;
   model_.DescribeScan(request);
-  request.filter = target.filter_active;
-  request.filter_pattern = target.filter_pattern;
+
+  // Typing more of a pattern, or filtering a sorted view, keeps a subset of
+  // the rows already on screen. Only those are read again, and a sort they
+  // are in survives.
+  if (model_.DescribeRefinement(target, request)) {
+    task_view_ = target;
+    StartScan(Task::Filter, request, "narrowing filter");
+    return;
+  }
+
+  // A fresh filter holds an index entry for every row it keeps, which on a
+  // very large file can be more than the machine has. A refinement cannot
+  // outgrow the view it starts from, so only this path needs asking.
+  if (target.filter_active) {
+    const std::string blocked = model_.CheckFilterFeasible();
+    if (!blocked.empty()) {
+      SetMessage(blocked, true);
+      return;
+    }
+  }
+
+  model_.DescribeFilter(target, request);
   request.sort = target.sort_active;
   request.sort_column = target.sort_column;
   request.sort_descending = target.sort_descending;
   request.want_order = true;
+  // An unsorted filter's rows are final the moment they are found, so they
+  // can go on screen while the rest of the file is still being read.
+  request.stream_matches = target.filter_active && !target.sort_active;
 
   task_view_ = target;
   StartScan(Task::Filter, request,
@@ -742,25 +1147,53 @@ void CSVController::SortByCursorColumn(bool descending) {
   target.sort_column = cursor_col_;
   target.sort_descending = descending;
 
+  if (RecallView(target, "sorted by " + model_.ColumnName(cursor_col_)))
+    return;
+
+  // Sorting holds an index for every row, so on a very large file it can ask
+  // for more memory than the machine has. Refuse with numbers rather than
+  // letting the allocator take the process down. A recalled sort is already
+  // paid for, which is why this comes second.
+  const std::string blocked = model_.CheckSortFeasible();
+  if (!blocked.empty()) {
+    SetMessage(blocked, true);
+    return;
+  }
+
   csvscan::Request request;
   model_.DescribeScan(request);
-  request.filter = target.filter_active;
-  request.filter_pattern = target.filter_pattern;
+  model_.DescribeFilter(target, request);
   request.sort = true;
   request.sort_column = target.sort_column;
   request.sort_descending = descending;
   request.want_order = true;
+  request.provisional_rows = kProvisionalRows;
 
   task_view_ = target;
   StartScan(Task::Sort, request, "sorting by " + model_.ColumnName(cursor_col_));
 }
 
+bool CSVController::RecallView(const CSVModel::ViewState &target,
+                               const std::string &message) {
+  if (!model_.RecallView(target))
+    return false;
+  // A sort or filter still running would land on top of the recalled view
+  // when it finished. The worker reads only its own request, so dropping it
+  // after the swap is safe, and a miss leaves it running for the caller to
+  // replace. Counts and statistics carry on.
+  Supersede(Task::Sort);
+
+  cursor_row_ = 0;
+  start_row_ = 0;
+  ClampToView();
+  SetMessage(!message.empty()
+                 ? message
+                 : csv::HumanCount(model_.RowCount()) + " row(s) match");
+  return true;
+}
+
 void CSVController::ClearOrdering() {
-  if (scanner_.running()) {
-    scanner_.Cancel();
-    scanner_.Join();
-    task_ = Task::None;
-  }
+  Supersede(Task::Sort);
   model_.AdoptView(CSVModel::ViewState{}, {}, false);
   view_.ShowAllColumns();
   cursor_row_ = 0;
@@ -777,9 +1210,10 @@ void CSVController::YankCurrentCell() {
 }
 
 void CSVController::StartMatchCount(const std::string &pattern) {
-  // Only worth doing once per pattern, and never at the cost of interrupting
-  // something the user actually asked for.
-  if (pattern.empty() || scanner_.running())
+  // Only worth doing once per pattern. It shares the read of anything already
+  // running, so it no longer has to wait for the file to be quiet — and never
+  // interrupts what the user actually asked for.
+  if (pattern.empty())
     return;
   if (match_total_known_ && match_pattern_ == pattern)
     return;
@@ -790,13 +1224,185 @@ void CSVController::StartMatchCount(const std::string &pattern) {
   csvscan::Request request;
   model_.DescribeScan(request);
   const CSVModel::ViewState view = model_.CurrentViewState();
-  request.filter = view.filter_active;
-  request.filter_pattern = view.filter_pattern;
-  request.count_pattern = pattern;
+  model_.DescribeFilter(view, request);
+  model_.DescribeCount(pattern, request);
 
   StartScan(Task::MatchCount, request, "counting matches for '" + pattern + "'");
 }
 
+void CSVController::StartSearchIndex() {
+  // Asked for on the command line, and then only once per file: it is kept
+  // with the index, and every later session finds it there. Anything the
+  // user starts meanwhile shares its read.
+  if (!model_.WantsSearchIndex())
+    return;
+  csvscan::Request request;
+  model_.DescribeScan(request);
+  request.want_gram_index = true;
+  StartScan(Task::SearchIndex, request, "indexing text for search");
+}
+
+void CSVController::StartResume() {
+  // A file that has grown since its last session is counted on from where
+  // its index stops, which costs what was appended: little enough to do
+  // straight away, so that the count is exact by the time anyone asks. One
+  // edited in place is counted from the edit, as far as the chunks past it.
+  if (!model_.IndexOutgrown())
+    return;
+  csvscan::Request request;
+  model_.DescribeResume(request);
+  StartScan(Task::Resume, request,
+            model_.IndexEdited() ? "counting rows edited since the last index"
+                                 : "counting appended rows");
+}
+
+void CSVController::StartIdleIndex() {
+  // Only for a file still uncounted with nothing else reading it: any full
+  // pass the user starts yields the same table, and the resumed count of a
+  // grown file is already doing the same thing more cheaply, as is the
+  // spooler of piped input. Asked after every frame, so a file busy with
+  // something else when the first one went up is indexed once it is idle,
+  // or once a pass that would have counted it is cancelled. Not again after
+  // one has failed, which would only fail again.
+  if (idle_index_failed_ || !tasks_.empty() || source_ ||
+      model_.RowCountKnown() || model_.IndexOutgrown() || model_.arriving())
+    return;
+  csvscan::Request request;
+  model_.DescribeScan(request);
+  request.background = true;
+  StartScan(Task::Index, request, "indexing");
+}
+
+void CSVController::Follow() {
+  watcher_ = std::make_unique<csvwatch::Watcher>(model_.real_path(), [this] {
+    // From the watcher's thread, like the scanner's notifications.
+    screen_.PostEvent(ftxui::Event::Custom);
+  });
+  SetMessage("following " + model_.path());
+}
+
+void CSVController::PollFollow() {
+  if (!watcher_)
+    return;
+  // A table of groups is on screen in place of the file; what was appended
+  // meanwhile is found when it is back.
+  if (!source_ && watcher_->TakeChange()) {
+    switch (model_.CheckGrowth()) {
+    case CSVModel::Growth::None:
+      break;
+    case CSVModel::Growth::Grown:
+      follow_again_ = true;
+      break;
+    case CSVModel::Growth::Shrunk:
+      ReopenTruncated();
+      return;
+    }
+  }
+  if (follow_again_ && !source_ && !FindTask(Task::Follow)) {
+    follow_again_ = false;
+    StartFollow();
+  }
+}
+
+void CSVController::StartFollow() {
+  csvscan::Request request;
+  model_.DescribeAppended(request);
+  follow_view_ = model_.CurrentViewState();
+  StartScan(Task::Follow, request, "reading appended rows");
+}
+
+void CSVController::Spool(csvspool::Spooler &spooler) {
+  spool_ = &spooler;
+  spooler.SetNotify([this] {
+    // From the spooler's thread, like the watcher's notifications.
+    screen_.PostEvent(ftxui::Event::Custom);
+  });
+  SetMessage("reading stdin…");
+}
+
+void CSVController::PollSpool() {
+  // As with following, a table of groups on screen is not the file; the
+  // change waits until the file is back.
+  if (!spool_ || source_ || !spool_->TakeChange())
+    return;
+  model_.CheckGrowth();
+  if (!spool_->finished())
+    return;
+
+  model_.SetArriving(false);
+  const std::string error = spool_->error();
+  std::vector<std::streampos> offsets;
+  size_t rows = 0;
+  // The table is for the header setting it was asked with, which SetHasHeader
+  // may have changed since the spooler began; both are kept for that.
+  if (spool_->Index(model_.has_header(), offsets, rows) &&
+      offsets.front() == model_.DataOffset()) {
+    model_.AdoptIndex(std::move(offsets), rows);
+    Supersede(Task::Index);
+  }
+  spool_->SetNotify(nullptr);
+  spool_ = nullptr;
+
+  std::string message =
+      !error.empty()            ? error
+      : model_.RowCountIsExact() ? "read " + csv::HumanCount(rows) +
+                                       " rows from stdin"
+                                 : "read all of stdin";
+  if (spool_task_) {
+    const Task task = *spool_task_;
+    spool_task_.reset();
+    csvscan::Result empty;
+    const std::string finished = FinishScan(task, empty);
+    if (error.empty() && !finished.empty())
+      message = finished;
+  }
+  // Described while the file was shorter; what they read is all of it now.
+  std::vector<WaitingScan> waiting;
+  waiting.swap(spool_scans_);
+  for (WaitingScan &scan : waiting) {
+    scan.request.file_size = model_.FileSize();
+    StartScan(scan.task, scan.request, scan.label);
+  }
+  if (AskedTasks() == 0)
+    SetMessage(message, !error.empty());
+  else
+    finished_note_ = message;
+}
+
+void CSVController::ReopenTruncated() {
+  // Rotated by copying and truncating, most likely, and what is there now is
+  // another file. Until it has a first row there is nothing to open, and the
+  // old rows stay on screen.
+  const std::string path = model_.real_path();
+  const std::string display = model_.path();
+  const char delimiter = model_.delimiter();
+  const bool has_header = model_.has_header();
+  {
+    CSVModel probe;
+    if (!probe.Open(path, delimiter, has_header).empty()) {
+      SetMessage(display + " was truncated; waiting for rows", true);
+      return;
+    }
+  }
+
+  AbandonTasks();
+  follow_again_ = false;
+  const std::string error = model_.Open(path, delimiter, has_header);
+  if (!error.empty()) {
+    SetMessage(error, true);
+    return;
+  }
+  if (display != path)
+    model_.SetDisplayName(display);
+  view_.ResetColumns();
+  view_.SetSearch(std::string());
+  view_.SetCurrentMatch(std::nullopt, std::nullopt);
+  cursor_row_ = 0;
+  start_row_ = 0;
+  ClampToView();
+  SetMessage(display + " was truncated; following it from the top");
+}
+
 void CSVController::ShowColumnStats() {
   const CSVModel::ViewState view = model_.CurrentViewState();
 
@@ -804,15 +1410,208 @@ void CSVController::ShowColumnStats() {
   model_.DescribeScan(request);
   // Statistics describe the rows on screen, so an active filter applies. A
   // sort does not: it reorders the same set.
-  request.filter = view.filter_active;
-  request.filter_pattern = view.filter_pattern;
+  model_.DescribeFilter(view, request);
   request.want_stats = true;
   request.stats_column = cursor_col_;
+  request.estimate_stats = request.skim_chunks.empty() &&
+                           model_.FileSize() >= kEstimateStatsBytes;
 
   task_column_ = cursor_col_;
+  stats_estimated_ = false;
   StartScan(Task::Stats, request, "scanning " + model_.ColumnName(cursor_col_));
 }
 
+void CSVController::ShowColumnProfile() {
+  const CSVModel::ViewState view = model_.CurrentViewState();
+  // Like the statistics of one column, a profile describes the rows on screen.
+  // Only the whole file's is cached, and so only it is looked for.
+  std::vector<csvscan::ColumnProfile> cached;
+  if (!view.filter_active && model_.LoadProfile(cached)) {
+    view_.ShowProfile(std::move(cached));
+    SetMessage("profile from cache", false);
+    return;
+  }
+
+  csvscan::Request request;
+  model_.DescribeScan(request);
+  model_.DescribeFilter(view, request);
+  request.want_profile = true;
+
+  task_profile_whole_ = !view.filter_active;
+  StartScan(Task::Profile, request, "profiling columns");
+}
+
+void CSVController::ShowValueFrequencies() {
+  const CSVModel::ViewState view = model_.CurrentViewState();
+
+  csvscan::Request request;
+  model_.DescribeScan(request);
+  // Like the statistics, these count the rows the filter leaves.
+  model_.DescribeFilter(view, request);
+  request.want_frequencies = true;
+  request.frequency_column = cursor_col_;
+
+  task_frequency_column_ = cursor_col_;
+  StartScan(Task::Frequencies, request,
+            "counting values of " + model_.ColumnName(cursor_col_));
+}
+
+void CSVController::GroupByMarkedColumn() {
+  if (source_) {
+    SetMessage("a table of groups cannot be grouped again — Esc to return",
+               true);
+    return;
+  }
+  // Two presses: the first picks the column to group by, the second the one
+  // to summarise, wherever the cursor has moved in between.
+  if (!group_key_column_) {
+    group_key_column_ = cursor_col_;
+    SetMessage("grouping by " + model_.ColumnName(cursor_col_) +
+               " — press a on the column to summarise, Esc to cancel");
+    return;
+  }
+  const size_t key = *group_key_column_;
+  group_key_column_.reset();
+
+  // The output is created here, not by the pass, so that removing it is
+  // enough to abandon it whatever the pass is doing.
+  std::string output = csvsort::TempDirectory() + "/csvtui-groups-XXXXXX";
+  const int fd = ::mkstemp(&output[0]);
+  if (fd < 0) {
+    SetMessage("cannot create a temporary file in " +
+                   csvsort::TempDirectory() + ": " + std::strerror(errno),
+               true);
+    return;
+  }
+  ::close(fd);
+
+  const CSVModel::ViewState view = model_.CurrentViewState();
+  csvscan::Request request;
+  model_.DescribeScan(request);
+  // Groups summarise the rows the filter leaves, as statistics do.
+  model_.DescribeFilter(view, request);
+  request.want_groups = true;
+  request.group_column = key;
+  request.group_value_column = cursor_col_;
+  request.group_key_name = model_.ColumnName(key);
+  request.group_value_name = model_.ColumnName(cursor_col_);
+  request.group_output = output;
+
+  task_group_title_ = model_.path() + " by " + request.group_key_name;
+  StartScan(Task::Group, request, "grouping by " + request.group_key_name);
+}
+
+void CSVController::OpenDerivedTable(const std::string &path,
+                                     const std::string &title) {
+  SourceTable source;
+  source.path = model_.real_path();
+  source.display = model_.path();
+  source.delimiter = model_.delimiter();
+  source.has_header = model_.has_header();
+  source.view = model_.CurrentViewState();
+  source.cursor_row = cursor_row_;
+  source.cursor_col = cursor_col_;
+
+  // Every other pass is reading the source file, and would hand its offsets
+  // to a model that has moved on.
+  AbandonTasks();
+  // The table is written whole; only the source may still be arriving.
+  model_.SetArriving(false);
+  const std::string error = model_.Open(path, source.delimiter, true);
+  if (!error.empty()) {
+    ::unlink(path.c_str());
+    model_.SetArriving(spool_ != nullptr);
+    model_.Open(source.path, source.delimiter, source.has_header);
+    if (source.display != source.path)
+      model_.SetDisplayName(source.display);
+    SetMessage(error, true);
+    return;
+  }
+  model_.SetDisplayName(title);
+  source_ = std::move(source);
+  derived_path_ = path;
+
+  view_.ResetColumns();
+  view_.SetSearch(std::string());
+  view_.SetCurrentMatch(std::nullopt, std::nullopt);
+  cursor_row_ = 0;
+  cursor_col_ = 0;
+  start_row_ = 0;
+}
+
+bool CSVController::CloseDerivedTable() {
+  if (!source_)
+    return false;
+  const SourceTable source = std::move(*source_);
+  source_.reset();
+
+  AbandonTasks();
+  model_.SetArriving(spool_ != nullptr);
+  const std::string error =
+      model_.Open(source.path, source.delimiter, source.has_header);
+  ::unlink(derived_path_.c_str());
+  derived_path_.clear();
+  if (!error.empty()) {
+    SetMessage(error, true);
+    return true;
+  }
+  if (source.display != source.path)
+    model_.SetDisplayName(source.display);
+
+  view_.ResetColumns();
+  view_.SetSearch(std::string());
+  view_.SetCurrentMatch(std::nullopt, std::nullopt);
+  cursor_row_ = source.cursor_row;
+  cursor_col_ = source.cursor_col;
+  start_row_ = 0;
+  ClampToView();
+
+  StartResume();
+  StartSearchIndex();
+  // The sort and filter were the model's, and went with it. Build them
+  // again; the rows they leave start from the top.
+  if (source.view.sort_active || source.view.filter_active) {
+    csvscan::Request request;
+    model_.DescribeScan(request);
+    model_.DescribeFilter(source.view, request);
+    request.sort = source.view.sort_active;
+    request.sort_column = source.view.sort_column;
+    request.sort_descending = source.view.sort_descending;
+    request.want_order = true;
+    task_view_ = source.view;
+    StartScan(Task::Filter, request, "restoring the view");
+    return true;
+  }
+  SetMessage("back to " + model_.path());
+  return true;
+}
+
+void CSVController::FilterOnSelectedValue() {
+  const csvsketch::Frequency *selected = view_.SelectedFrequency();
+  if (selected == nullptr) {
+    view_.CloseOverlays();
+    return;
+  }
+  // The cell equal to the value, in the column counted, and nothing else: not
+  // the text anywhere in the row, and not the value as a number, which would
+  // keep "1.0" with "1". Built rather than parsed, so a value holding quotes
+  // or " and " is taken as it is, and an empty one picks out empty cells.
+  csvpredicate::Clause clause;
+  clause.column = view_.FrequencyColumn();
+  clause.op = csvpredicate::Op::Equal;
+  clause.kind = csvpredicate::Kind::Text;
+  clause.text = selected->value;
+  view_.CloseOverlays();
+
+  CSVModel::ViewState target = model_.CurrentViewState();
+  target.filter_active = true;
+  target.filter_pattern =
+      model_.ColumnName(clause.column) + " = \"" + clause.text + "\"";
+  target.filter_predicate = true;
+  target.filter_built.clauses = {std::move(clause)};
+  ApplyFilter(std::move(target));
+}
+
 std::string CSVController::DescribeStats(size_t col,
                                          const csvscan::Stats &stats) const {
   std::ostringstream out;
@@ -820,13 +1619,37 @@ std::string CSVController::DescribeStats(size_t col,
       << " rows, " << csv::HumanCount(stats.empty) << " empty";
   if (stats.numeric > 0) {
     out << ", min " << FormatDouble(stats.min) << ", max "
-        << FormatDouble(stats.max) << ", mean " << FormatDouble(stats.mean);
+        << FormatDouble(stats.max) << ", mean " << FormatDouble(stats.mean)
+        << ", p50 " << FormatDouble(stats.p50) << ", p90 "
+        << FormatDouble(stats.p90) << ", p99 " << FormatDouble(stats.p99)
+        << ", p99.9 " << FormatDouble(stats.p999);
+    // Percentiles past the sketch's capacity are approximate in rank, and
+    // say by how much.
+    if (!stats.quantiles_exact)
+      out << " (±" << std::setprecision(2)
+          << 100.0 * csvsketch::QuantileSketch::RankError() << "% rank)";
   } else {
     out << ", non-numeric";
   }
   return out.str();
 }
 
+std::string CSVController::DescribeEstimate(
+    const csvscan::StatsEstimate &estimate) const {
+  if (!estimate.numeric)
+    return "no numbers yet";
+  // Each figure with its 95% interval. The extremes are only ever bounds:
+  // the rows not yet read can hold smaller and larger.
+  const auto interval = [](const char *name, const csvscan::Interval &value) {
+    return std::string(name) + " ≈" + FormatDouble(value.value) + " [" +
+           FormatDouble(value.low) + ", " + FormatDouble(value.high) + "]";
+  };
+  return interval("mean", estimate.mean) + ", " +
+         interval("p50", estimate.p50) + ", " + interval("p90", estimate.p90) +
+         ", " + interval("p99", estimate.p99) + ", min ≤" +
+         FormatDouble(estimate.min) + ", max ≥" + FormatDouble(estimate.max);
+}
+
 // --- event handling ---------------------------------------------------------
 
 bool CSVController::OnEvent(Event event) {
@@ -856,11 +1679,36 @@ bool CSVController::OnOverlayEvent(Event event) {
     screen_.Exit();
     return true;
   }
+  if (view_.FrequenciesVisible()) {
+    if (event == Event::Return) {
+      FilterOnSelectedValue();
+      return true;
+    }
+    if (event == Event::Character('j') || event == Event::ArrowDown)
+      view_.MoveFrequencySelection(1);
+    else if (event == Event::Character('k') || event == Event::ArrowUp)
+      view_.MoveFrequencySelection(-1);
+    else if (event == Event::PageDown || event == Event::Character(' '))
+      view_.MoveFrequencySelection(10);
+    else if (event == Event::PageUp)
+      view_.MoveFrequencySelection(-10);
+  }
   if (event == Event::Escape || event == Event::Return ||
-      event == Event::Character('?')) {
+      event == Event::Character('?') || event == Event::Character('p') ||
+      event == Event::Character('v')) {
     view_.CloseOverlays();
     return true;
   }
+  if (view_.ProfileVisible()) {
+    if (event == Event::Character('j') || event == Event::ArrowDown)
+      view_.ScrollProfile(1);
+    else if (event == Event::Character('k') || event == Event::ArrowUp)
+      view_.ScrollProfile(-1);
+    else if (event == Event::PageDown || event == Event::Character(' '))
+      view_.ScrollProfile(10);
+    else if (event == Event::PageUp)
+      view_.ScrollProfile(-10);
+  }
   return true; // swallow everything else while an overlay is up
 }
 
@@ -876,14 +1724,17 @@ bool CSVController::OnTextInputEvent(Event event) {
       StartExport(pattern);
     } else if (mode == InputMode::Search) {
       StartSearch(pattern, true, true);
-    } else if (pattern.empty()) {
-      ApplyFilter(pattern); // clearing never costs anything
-    } else {
-      const std::string blocked = model_.CheckFilterFeasible();
-      if (!blocked.empty())
-        SetMessage(blocked, true);
+    } else if (mode == InputMode::Predicate && !pattern.empty()) {
+      // Parsed here as well as in the pass so that a typo is reported at
+      // once, rather than as a scan that fails after being started.
+      csvpredicate::Predicate parsed;
+      std::string error;
+      if (!model_.ParsePredicate(pattern, parsed, error))
+        SetMessage(error, true);
       else
-        ApplyFilter(pattern);
+        ApplyFilter(pattern, true);
+    } else {
+      ApplyFilter(pattern);
     }
     return true;
   }
@@ -945,7 +1796,15 @@ bool CSVController::OnNormalEvent(Event event) {
   }
   if (event == Event::Character('f')) {
     input_mode_ = InputMode::Filter;
-    input_buffer_ = model_.filter_pattern();
+    input_buffer_ =
+        model_.filter_predicate() ? std::string() : model_.filter_pattern();
+    UpdateCommandLine();
+    return true;
+  }
+  if (event == Event::Character('F')) {
+    input_mode_ = InputMode::Predicate;
+    input_buffer_ =
+        model_.filter_predicate() ? model_.filter_pattern() : std::string();
     UpdateCommandLine();
     return true;
   }
@@ -979,6 +1838,13 @@ bool CSVController::OnNormalEvent(Event event) {
   if (event == Event::Escape) {
     if (CancelScan())
       return true;
+    if (group_key_column_) {
+      group_key_column_.reset();
+      SetMessage("grouping cancelled");
+      return true;
+    }
+    if (CloseDerivedTable())
+      return true;
     view_.SetSearch(std::string());
     view_.SetCurrentMatch(std::nullopt, std::nullopt);
     SetMessage(std::string());
@@ -1014,6 +1880,15 @@ bool CSVController::OnNormalEvent(Event event) {
     return true;
   }
 
+  if (event == Event::Character('%')) {
+    const size_t count = pending_count_;
+    pending_count_ = 0;
+    awaiting_second_g_ = false;
+    if (count != 0)
+      GoToFraction(static_cast<double>(std::min<size_t>(count, 100)) / 100.0);
+    return true;
+  }
+
   if (event == Event::Character('j') || event == Event::ArrowDown) {
     MoveCursorRows(static_cast<long long>(ConsumeCount()));
     return true;
@@ -1070,16 +1945,7 @@ bool CSVController::OnNormalEvent(Event event) {
   }
 
   if (event == Event::Character('s') || event == Event::Character('S')) {
-    const bool descending = event == Event::Character('S');
-    // Sorting holds an index for every row, so on a very large file it can ask
-    // for more memory than the machine has. Refuse with numbers rather than
-    // letting the allocator take the process down.
-    const std::string blocked = model_.CheckSortFeasible();
-    if (!blocked.empty()) {
-      SetMessage(blocked, true);
-      return true;
-    }
-    SortByCursorColumn(descending);
+    SortByCursorColumn(event == Event::Character('S'));
     return true;
   }
   if (event == Event::Character('u')) {
@@ -1130,6 +1996,18 @@ bool CSVController::OnNormalEvent(Event event) {
     ShowColumnStats();
     return true;
   }
+  if (event == Event::Character('p')) {
+    ShowColumnProfile();
+    return true;
+  }
+  if (event == Event::Character('v')) {
+    ShowValueFrequencies();
+    return true;
+  }
+  if (event == Event::Character('a')) {
+    GroupByMarkedColumn();
+    return true;
+  }
 
   pending_count_ = 0;
   awaiting_second_g_ = false;
@@ -1153,6 +2031,15 @@ bool CSVController::OnMouseEvent(Event event) {
       view_.CloseOverlays();
       return true;
     }
+    // The status bar, one line up from the bottom, stands in for a scrollbar
+    // laid on its side: where it is pressed says how far through the file to
+    // go. A drag arrives as more presses, so dragging along it scrubs.
+    const auto size = Terminal::Size();
+    if (mouse.y == size.dimy - 2) {
+      GoToFraction(static_cast<double>(std::max(mouse.x, 0)) /
+                   static_cast<double>(std::max(size.dimx, 1)));
+      return true;
+    }
     const int header_rows =
         (view_.HeaderPinned() && !model_.Header().empty()) ? 2 : 0;
     const int clicked = mouse.y - header_rows;
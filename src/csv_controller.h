@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <vector>
 #include <ftxui/component/component.hpp>
 #include <optional>
@@ -10,6 +11,8 @@
 
 #include "csv_model.h"
 #include "csv_scan.h"
+#include "csv_spool.h"
+#include "csv_watch.h"
 
 namespace ftxui {
 class ScreenInteractive;
@@ -25,8 +28,20 @@ public:
 
   ftxui::Component GetComponent();
 
+  // Watches the file for rows appended to it, as `tail -f` does, and shows
+  // them as they come: counted from where the table stops, matched against
+  // an unsorted filter, and followed by a cursor left on the last row. A
+  // file cut shorter is opened again from the top.
+  void Follow();
+  // Shows piped input while `spooler` is still reading it into the model's
+  // file, which must have been opened arriving (see CSVModel::SetArriving):
+  // rows appear as they come, the count is an estimate until input ends and
+  // exact from then on, and anything that needs it waits for that. The
+  // spooler must outlive the controller.
+  void Spool(csvspool::Spooler &spooler);
+
 private:
-  enum class InputMode { Normal, Search, Filter, Export };
+  enum class InputMode { Normal, Search, Filter, Predicate, Export };
 
   CSVModel &model_;
   CSVView &view_;
@@ -44,17 +59,87 @@ private:
   std::string input_buffer_;
   std::optional<std::string> last_search_;
 
-  // Work that needs a full pass over the file. It runs on a worker thread, so
-  // the UI stays live and Esc cancels; `task_` says what to do with the result.
-  enum class Task { None, End, Row, Sort, Filter, Stats, MatchCount };
+  // Work that needs a full pass over the file. It runs on worker threads, so
+  // the UI stays live and Esc cancels. Several can be under way at once, on
+  // one shared read of the file; each pending task says what to do with its
+  // pass's result.
+  enum class Task {
+    End,
+    Row,
+    Sort,
+    Filter,
+    Stats,
+    Profile,
+    Frequencies,
+    Group,
+    MatchCount,
+    SearchIndex,
+    Resume,
+    Follow,
+    Index
+  };
+  struct PendingTask {
+    Task task = Task::End;
+    CSVScanner::PassId pass = 0;
+    std::string label;      // "sorting by price", shown while it runs
+    bool filtering = false; // keeps only matching rows, so counts those
+    bool stopping = false;  // Esc pressed; the worker is winding down
+    std::string output;     // a file the pass writes; removed unless wanted
+  };
   CSVScanner scanner_;
-  Task task_ = Task::None;
+  // Where the indexes those passes yield are saved, and the cache trimmed,
+  // off the UI thread.
+  csvcache::Writer cache_writer_;
+  std::vector<PendingTask> tasks_;    // oldest first
   size_t task_row_ = 0;               // target row, for Task::Row
   size_t task_column_ = 0;            // subject column, for Task::Stats
-  CSVModel::ViewState task_view_;     // the view the pass is building
-  std::string task_label_;            // "sorting by price", shown while it runs
-  bool cancel_requested_ = false;     // Esc pressed; the worker is winding down
+  bool task_profile_whole_ = false;   // unfiltered, so worth caching
+  size_t task_frequency_column_ = 0;  // subject column, for Task::Frequencies
+  std::string task_group_title_;      // names the table a Task::Group writes
+  CSVModel::ViewState task_view_;     // the view a Sort or Filter is building
+  std::string finished_note_;         // what ended while others ran on
   size_t spinner_frame_ = 0;          // advances every frame a pass is running
+  bool provisional_exact_ = false;    // the leading rows shown are final
+  csvscan::StatsEstimate stats_estimate_; // the latest from a Task::Stats
+  bool stats_estimated_ = false;          // and whether there is one yet
+  bool idle_index_failed_ = false;        // see StartIdleIndex
+
+  // Following the file (see Follow). One pass reads what was appended at a
+  // time; more appended meanwhile waits for it, rather than restarting it
+  // and perhaps never finishing on a file written to without pause.
+  std::unique_ptr<csvwatch::Watcher> watcher_;
+  bool follow_again_ = false;
+  bool follow_pinned_ = false;         // the cursor was on the last row
+  CSVModel::ViewState follow_view_;    // the view a Task::Follow matches for
+
+  // Reading piped input (see Spool), until it has ended. A count asked for
+  // meanwhile waits for the end rather than counting what has arrived, and
+  // so does any other pass, which would read only that much and call it the
+  // file: it is kept here, request and all, and started once the input ends.
+  struct WaitingScan {
+    Task task = Task::End;
+    csvscan::Request request;
+    std::string label;
+  };
+  csvspool::Spooler *spool_ = nullptr;
+  std::optional<Task> spool_task_;
+  std::vector<WaitingScan> spool_scans_; // oldest first
+
+  // A table of groups is shown in the grid in place of the file it came
+  // from, by reopening the model on it. What is needed to go back is kept
+  // here; Esc does so. One level deep: a table of groups cannot be grouped.
+  struct SourceTable {
+    std::string path;
+    std::string display;
+    char delimiter = ',';
+    bool has_header = true;
+    CSVModel::ViewState view;
+    size_t cursor_row = 0;
+    size_t cursor_col = 0;
+  };
+  std::optional<size_t> group_key_column_; // marked with the first 'a'
+  std::optional<SourceTable> source_;      // set while a derived table shows
+  std::string derived_path_;               // that table, removed on return
 
   // Work that has to read rows through the model rather than through its own
   // file handle — searching, and writing the view out. CSVModel is not
@@ -107,18 +192,42 @@ private:
   // Last existing row in [low, high], found with probes instead of a scan.
   size_t LastRowBetween(size_t low, size_t high);
 
-  // Starts a background pass, replacing any pass already in flight.
+  // Starts a background pass, replacing any pending one it makes pointless
+  // and running alongside the rest.
   void StartScan(Task task, const csvscan::Request &request,
                  const std::string &label);
+  // Whether a pass for `newer` makes a pending one for `older` pointless.
+  static bool Replaces(Task newer, Task older);
+  // Abandons every pending task that `task` replaces.
+  void Supersede(Task task);
+  // The pending task of that kind, if there is one.
+  const PendingTask *FindTask(Task task) const;
+  // Pending tasks the user asked for, which a Task::Index is not: it runs
+  // unannounced, and neither shows in the readout nor stops on Esc.
+  size_t AskedTasks() const;
   // Starts a pass that only counts rows, remembering what to do afterwards.
   void RequestExactCount(Task task, size_t row = 0);
   void PollScanner();
+  // Puts the leading rows of a running sort on screen, if new ones arrived.
+  void ShowProvisionalSort();
+  // Adds the matches a running filter has found since the last frame.
+  void ShowStreamedMatches();
+  // Takes the latest estimate from running column statistics, if any.
+  void TakeStatsEstimate();
   bool CancelScan();
-  void FinishScan(csvscan::Result &result);
+  // Deals with a task whose pass has ended, however it ended.
+  void SettleTask(const PendingTask &task);
+  // Applies a finished pass's result; returns what to tell the user.
+  std::string FinishScan(Task task, csvscan::Result &result);
 
   void MoveCursorRows(long long delta);
   void MoveCursorColumns(long long delta);
   void GoToRow(size_t row);
+  // Goes `fraction` of the way through the file, by bytes when its rows have
+  // not been counted (see CSVModel::LandAt).
+  void GoToFraction(double fraction);
+  // Moves the cursor along with rows the model has renumbered.
+  void FollowRenumbering();
   void SyncView();
   void ClampToView();
   void SetMessage(const std::string &message, bool is_error = false);
@@ -147,12 +256,44 @@ private:
   std::function<void(size_t)> BlockingReporter();
   ftxui::Element RenderWhileBlocked();
   void RepeatSearch(bool forward);
-  void ApplyFilter(const std::string &pattern);
+  // `predicate` reads `pattern` as a comparison on a column's values rather
+  // than as text to find anywhere in the row.
+  void ApplyFilter(const std::string &pattern, bool predicate = false);
+  // Applies `target`, whatever its filter, over the view on screen.
+  void ApplyFilter(CSVModel::ViewState target);
   void SortByCursorColumn(bool descending);
   void ClearOrdering();
+  // Shows `target` straight from the model's recent views when it can, and
+  // says so with `message` (or the match count when that is empty).
+  bool RecallView(const CSVModel::ViewState &target, const std::string &message);
   void YankCurrentCell();
   void StartMatchCount(const std::string &pattern);
+  // Builds the search index in the background, when the model wants one.
+  void StartSearchIndex();
+  // Counts the rows appended since the file was indexed, when it has been.
+  void StartResume();
+  // Counts and indexes a file no earlier session did, as soon as a frame is
+  // up and nothing else is reading it, at idle priority (see
+  // csvscan::Request::background), so that the count and the table are there
+  // before anyone asks for them.
+  void StartIdleIndex();
+  // Reads what was appended to a followed file, when the watcher saw any.
+  void PollFollow();
+  void StartFollow();
+  // Takes in what the spooler has read since the last frame, and once input
+  // has ended, the count and table it built.
+  void PollSpool();
+  void ReopenTruncated();
   void ShowColumnStats();
   std::string DescribeStats(size_t col, const csvscan::Stats &stats) const;
+  std::string DescribeEstimate(const csvscan::StatsEstimate &estimate) const;
+  void ShowColumnProfile();
+  void ShowValueFrequencies();
+  void GroupByMarkedColumn();
+  void OpenDerivedTable(const std::string &path, const std::string &title);
+  bool CloseDerivedTable();
+  // Forgets every pass: they read a file the model is about to stop showing.
+  void AbandonTasks();
+  void FilterOnSelectedValue();
   std::string CurrentCellValue();
 };
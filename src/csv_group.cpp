@@ -0,0 +1,264 @@
+#include "csv_group.h"
+
+#include "csv_parser.h"
+#include "csv_sketch.h"
+#include "csv_sortrun.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace csvgroup {
+namespace {
+
+// What a table entry costs beyond its key: node, bucket, the string's header
+// and the aggregate, near enough.
+constexpr size_t kEntryOverhead = 96;
+
+template <typename T> void Put(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool Get(std::istream &in, T &value) {
+  return static_cast<bool>(
+      in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+// Enough digits that a sum read back is the sum written.
+std::string FormatNumber(double value) {
+  std::ostringstream out;
+  out.precision(15);
+  out << value;
+  return out.str();
+}
+
+} // namespace
+
+void Aggregate::Add(const std::string &value) {
+  ++count;
+  double number = 0.0;
+  if (!csv::ParseNumber(value, number))
+    return;
+  if (numeric == 0) {
+    min = max = number;
+  } else {
+    min = std::min(min, number);
+    max = std::max(max, number);
+  }
+  ++numeric;
+  sum += number;
+}
+
+void Aggregate::Merge(const Aggregate &other) {
+  if (other.numeric > 0) {
+    if (numeric == 0) {
+      min = other.min;
+      max = other.max;
+    } else {
+      min = std::min(min, other.min);
+      max = std::max(max, other.max);
+    }
+  }
+  count += other.count;
+  numeric += other.numeric;
+  sum += other.sum;
+}
+
+Aggregator::Aggregator(std::string directory, size_t memory_budget)
+    : directory_(std::move(directory)), budget_(memory_budget) {}
+
+Aggregator::~Aggregator() {
+  for (const std::string &path : partitions_)
+    ::unlink(path.c_str());
+}
+
+bool Aggregator::Add(const std::string &key, const std::string &value) {
+  auto found = table_.find(key);
+  if (found == table_.end()) {
+    found = table_.emplace(key, Aggregate{}).first;
+    bytes_ += key.size() + kEntryOverhead;
+  }
+  found->second.Add(value);
+  if (budget_ > 0 && bytes_ >= budget_)
+    return Spill();
+  return true;
+}
+
+bool Aggregator::Spill() {
+  if (partitions_.empty()) {
+    for (size_t i = 0; i < kPartitions; ++i) {
+      std::string pattern = directory_ + "/csvtui-group-XXXXXX";
+      const int fd = ::mkstemp(&pattern[0]);
+      if (fd < 0) {
+        error_ = "cannot create a temporary file in " + directory_ + ": " +
+                 std::strerror(errno);
+        return false;
+      }
+      ::close(fd);
+      partitions_.push_back(pattern);
+    }
+  }
+
+  std::vector<std::ofstream> files;
+  files.reserve(kPartitions);
+  for (const std::string &path : partitions_)
+    files.emplace_back(path, std::ios::binary | std::ios::app);
+
+  for (const auto &entry : table_) {
+    std::ofstream &out =
+        files[csvsketch::Hash(entry.first) % kPartitions];
+    Put(out, static_cast<std::uint64_t>(entry.first.size()));
+    out.write(entry.first.data(),
+              static_cast<std::streamsize>(entry.first.size()));
+    Put(out, static_cast<std::uint64_t>(entry.second.count));
+    Put(out, static_cast<std::uint64_t>(entry.second.numeric));
+    Put(out, entry.second.sum);
+    Put(out, entry.second.min);
+    Put(out, entry.second.max);
+  }
+  for (std::ofstream &out : files) {
+    out.flush();
+    if (!out) {
+      error_ = "cannot write to " + directory_ +
+               " (is the disk full?) — set CSVTUI_TMPDIR to somewhere with "
+               "more space";
+      return false;
+    }
+  }
+
+  table_.clear();
+  bytes_ = 0;
+  ++spills_;
+  return true;
+}
+
+bool Aggregator::Load(size_t partition) {
+  // A partition holds about a sixteenth of the keys, which fits unless the
+  // groups outnumber sixteen budgets' worth. That is read anyway: past it a
+  // viewer's group-by is no longer the tool for the job, and finishing slowly
+  // beats refusing.
+  std::ifstream in(partitions_[partition], std::ios::binary);
+  if (!in.is_open()) {
+    error_ = "cannot read back " + partitions_[partition];
+    return false;
+  }
+  for (;;) {
+    std::uint64_t length = 0;
+    if (!Get(in, length))
+      return in.eof();
+    std::string key(static_cast<size_t>(length), '\0');
+    std::uint64_t count = 0;
+    std::uint64_t numeric = 0;
+    Aggregate aggregate;
+    if ((length != 0 &&
+         !in.read(&key[0], static_cast<std::streamsize>(length))) ||
+        !Get(in, count) || !Get(in, numeric) || !Get(in, aggregate.sum) ||
+        !Get(in, aggregate.min) || !Get(in, aggregate.max)) {
+      error_ = "temporary file " + partitions_[partition] + " is damaged";
+      return false;
+    }
+    aggregate.count = static_cast<size_t>(count);
+    aggregate.numeric = static_cast<size_t>(numeric);
+    table_[key].Merge(aggregate);
+  }
+}
+
+bool Aggregator::WriteTable(std::ostream &out, char delimiter) {
+  // Sorted as a sort would sort the key column: csvsort's keys and order,
+  // with the row standing for the entry.
+  std::vector<const std::pair<const std::string, Aggregate> *> entries;
+  std::vector<csvsort::Key> keys;
+  entries.reserve(table_.size());
+  keys.reserve(table_.size());
+  for (const auto &entry : table_) {
+    csvsort::Key key;
+    key.text = entry.first;
+    key.numeric = csv::ParseNumber(entry.first, key.number);
+    key.row = entries.size();
+    entries.push_back(&entry);
+    keys.push_back(std::move(key));
+  }
+  std::sort(keys.begin(), keys.end(), csvsort::Order{});
+
+  std::string line;
+  for (const csvsort::Key &key : keys) {
+    const Aggregate &aggregate = entries[key.row]->second;
+    line.clear();
+    csv::AppendQuoted(line, entries[key.row]->first, delimiter);
+    line.push_back(delimiter);
+    line += std::to_string(aggregate.count);
+    if (aggregate.numeric > 0) {
+      const double mean = aggregate.sum / static_cast<double>(aggregate.numeric);
+      for (double value : {aggregate.sum, mean, aggregate.min, aggregate.max}) {
+        line.push_back(delimiter);
+        line += FormatNumber(value);
+      }
+    } else {
+      line.append(4, delimiter);
+    }
+    line.push_back('\n');
+    out << line;
+  }
+  groups_ += table_.size();
+  table_.clear();
+  bytes_ = 0;
+  return static_cast<bool>(out);
+}
+
+bool Aggregator::Write(const std::string &path, const std::string &key_name,
+                       const std::string &value_name, char delimiter,
+                       const std::function<bool()> &cancelled) {
+  // Neither call creates the file. One removed while this ran was removed
+  // because nobody wants the table any more, and must stay removed.
+  if (::truncate(path.c_str(), 0) != 0) {
+    error_ = "cannot write " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  std::ofstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+  if (!out.is_open()) {
+    error_ = "cannot write " + path + ": " + std::strerror(errno);
+    return false;
+  }
+
+  std::string header;
+  const std::string fields[] = {key_name,
+                                "count",
+                                "sum(" + value_name + ")",
+                                "mean(" + value_name + ")",
+                                "min(" + value_name + ")",
+                                "max(" + value_name + ")"};
+  for (const std::string &field : fields) {
+    if (!header.empty())
+      header.push_back(delimiter);
+    csv::AppendQuoted(header, field, delimiter);
+  }
+  out << header << '\n';
+
+  groups_ = 0;
+  bool ok = true;
+  if (partitions_.empty()) {
+    ok = WriteTable(out, delimiter);
+  } else {
+    // What is still in memory joins its partitions, so that each key is
+    // summarised in exactly one place.
+    ok = Spill();
+    for (size_t i = 0; ok && i < partitions_.size(); ++i) {
+      if (cancelled && cancelled())
+        return false;
+      ok = Load(i) && WriteTable(out, delimiter);
+      ::unlink(partitions_[i].c_str());
+    }
+  }
+
+  out.flush();
+  if (ok && !out)
+    error_ = "cannot write " + path + " (is the disk full?)";
+  return ok && static_cast<bool>(out);
+}
+
+} // namespace csvgroup
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Grouping rows by one column and summarising another, as a table of its own.
+//
+// The number of groups is the number of distinct keys, which is anything from
+// three to the number of rows. A hash table answers the first case; the
+// second is a multi-gigabyte file of unique IDs, and a table of those would
+// not fit. So the table has a memory budget, as a sort's buffer does, and
+// when it is exceeded every group is written out to one of a few partition
+// files chosen by its key's hash. Each partition then holds a fraction of the
+// keys, all of any given key, and is folded back into a table small enough to
+// summarise on its own. The partitions are temporary files, removed however
+// the pass ends.
+namespace csvgroup {
+
+// What one group's values add up to.
+struct Aggregate {
+  size_t count = 0;   // rows in the group
+  size_t numeric = 0; // of which the value was a number
+  double sum = 0.0;
+  double min = 0.0;
+  double max = 0.0;
+
+  void Add(const std::string &value);
+  void Merge(const Aggregate &other);
+};
+
+class Aggregator {
+public:
+  // Spills are split this many ways.
+  static constexpr size_t kPartitions = 16;
+
+  // `memory_budget` zero keeps every group in memory, whatever it costs.
+  Aggregator(std::string directory, size_t memory_budget);
+  ~Aggregator();
+
+  Aggregator(const Aggregator &) = delete;
+  Aggregator &operator=(const Aggregator &) = delete;
+
+  // False when a spill could not be written; error() says why.
+  bool Add(const std::string &key, const std::string &value);
+
+  // Writes one row per group to `path`, which must already exist, with the
+  // header
+  //   key_name,count,sum(value_name),mean(value_name),min(…),max(…)
+  // numeric aggregates left empty for a group with no numbers. Groups come
+  // in key order — numbers before text, as a sort puts them — within each
+  // partition, and partitions one after another. False on failure or
+  // cancellation; error() is empty for the latter.
+  bool Write(const std::string &path, const std::string &key_name,
+             const std::string &value_name, char delimiter,
+             const std::function<bool()> &cancelled);
+
+  size_t groups() const { return groups_; }
+  // How many times the table was written out. Zero means it always fit.
+  size_t spills() const { return spills_; }
+  const std::string &error() const { return error_; }
+
+private:
+  bool Spill();
+  bool Load(size_t partition);
+  bool WriteTable(std::ostream &out, char delimiter);
+
+  std::string directory_;
+  size_t budget_;
+  std::unordered_map<std::string, Aggregate> table_;
+  size_t bytes_ = 0;
+  std::vector<std::string> partitions_; // created by the first spill
+  size_t spills_ = 0;
+  size_t groups_ = 0;
+  std::string error_;
+};
+
+} // namespace csvgroup
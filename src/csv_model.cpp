@@ -2,12 +2,14 @@
 
 #include "csv_cache.h"
 #include "csv_parser.h"
+#include "csv_sketch.h"
 #include "csv_system.h"
 
 #include <algorithm>
 #include <cerrno>
 #include <cmath>
 #include <cstring>
+#include <limits>
 #include <numeric>
 #include <sys/stat.h>
 
@@ -32,6 +34,21 @@ long long SizeOf(const std::string &path) {
   return static_cast<long long>(info.st_size);
 }
 
+// Which of the ascending `offsets` the chunk holding `byte` starts at: the
+// last at or before it.
+template <typename Offsets>
+size_t ChunkHolding(const Offsets &offsets, long long byte) {
+  size_t low = 0, high = offsets.size();
+  while (high - low > 1) {
+    const size_t mid = low + (high - low) / 2;
+    if (static_cast<long long>(offsets[mid]) <= byte)
+      low = mid;
+    else
+      high = mid;
+  }
+  return low;
+}
+
 } // namespace
 
 CSVModel::~CSVModel() { Close(); }
@@ -81,15 +98,45 @@ std::string CSVModel::Open(const std::string &path,
   chunk_offsets_.clear();
   chunk_offsets_.push_back(data_offset_);
 
-  SampleColumnMetadata();
-  // A previous session may already have counted this file. Loading its index
-  // makes the row count exact before the first frame is drawn; failing to
-  // costs nothing but the estimate.
-  if (!LoadIndex())
+  // A previous session may already have measured this file, and counted it.
+  // Loading its index makes the row count exact before the first frame is
+  // drawn; failing to costs nothing but the estimate, which the measurements
+  // make as well as they did then.
+  const bool measured = LoadColumnMetadata();
+  if (!measured)
+    SampleColumnMetadata();
+  if (!LoadIndex() && !measured)
     RefineAverageRecordBytes();
+  if (!measured)
+    SaveColumnMetadata();
   return std::string();
 }
 
+bool CSVModel::LoadColumnMetadata() {
+  csvcache::Key key;
+  csvcache::ColumnLayout layout;
+  // Fewer columns than the header has would be some other file's.
+  if (!CacheKey(key) || !csvcache::LoadLayout(key, layout) ||
+      layout.widths.size() < column_count_)
+    return false;
+  column_widths_ = std::move(layout.widths);
+  column_numeric_ = std::move(layout.numeric);
+  average_record_bytes_ = layout.record_bytes;
+  column_count_ = column_widths_.size();
+  return true;
+}
+
+void CSVModel::SaveColumnMetadata() const {
+  csvcache::Key key;
+  if (!CacheKey(key))
+    return;
+  csvcache::ColumnLayout layout;
+  layout.widths = column_widths_;
+  layout.numeric = column_numeric_;
+  layout.record_bytes = average_record_bytes_;
+  csvcache::SaveLayout(key, layout);
+}
+
 void CSVModel::RefineAverageRecordBytes() {
   if (total_rows_known_ || file_size_ <= 0 || !file_.is_open())
     return;
@@ -107,18 +154,11 @@ void CSVModel::RefineAverageRecordBytes() {
 
   for (double fraction : probes) {
     const long long at = start + static_cast<long long>(span * fraction);
-    file_.clear();
-    file_.seekg(at);
-    if (!file_)
-      continue;
-
-    std::string discard;
-    if (!std::getline(file_, discard)) // resync onto a record boundary
-      continue;
-
-    const std::streampos begin = file_.tellg();
+    const std::streampos begin = Resync(at);
     if (begin == std::streampos(-1))
       continue;
+    file_.clear();
+    file_.seekg(begin);
 
     std::string record;
     size_t records = 0;
@@ -158,24 +198,47 @@ void CSVModel::ResetDerivedState() {
   lru_pos_.clear();
   total_rows_ = 0;
   total_rows_known_ = false;
+  short_chunk_.reset();
   count_from_cache_ = false;
+  index_saved_ = false;
+  index_outgrown_ = false;
+  index_edited_ = false;
+  index_splice_ = csvcache::Splice{};
   file_size_ = 0;
   average_record_bytes_ = 0.0;
   column_widths_.clear();
   column_numeric_.clear();
-  order_.clear();
+  zones_.clear();
+  grams_.reset();
+  grams_cached_ = false;
+  gram_index_.reset();
+  gram_index_cached_ = false;
+  order_.reset();
+  rows_.reset();
+  recent_views_.clear();
+  view_from_cache_ = false;
+  provisional_ = false;
+  beneath_provisional_ = CachedView{};
+  growing_rows_.reset();
   sort_active_ = false;
   filter_active_ = false;
   filter_pattern_.clear();
+  filter_predicate_ = false;
+  filter_built_ = csvpredicate::Predicate{};
+  landing_.reset();
+  renumbered_ = 0;
 }
 
 void CSVModel::SetHasHeader(bool value) {
   if (value == has_header_ || !file_.is_open())
     return;
 
-  const std::string path = display_path_;
+  // The real path: piped input shows under a name that is not a file.
+  const std::string path = real_path_;
+  const std::string display = display_path_;
   const char delim = delimiter_;
-  Open(path, delim, value);
+  if (Open(path, delim, value).empty())
+    display_path_ = display;
 }
 
 // --- physical row access ----------------------------------------------------
@@ -228,7 +291,10 @@ void CSVModel::EnsureOffsetsUpTo(size_t target_chunk) {
       ++rows_seen;
 
     if (records < kChunkSize) {
-      // Hit EOF: the file has exactly `rows_seen` rows.
+      // Hit EOF: the file has exactly `rows_seen` rows, unless more are on
+      // the way.
+      if (arriving_)
+        return;
       total_rows_ = rows_seen;
       total_rows_known_ = true;
       return;
@@ -264,6 +330,10 @@ bool CSVModel::LoadChunk(size_t chunk_index) {
   size_t row_number = chunk_index * kChunkSize;
   for (size_t i = 0; i < kChunkSize; ++i) {
     if (!csv::ReadRecord(file_, record)) {
+      if (arriving_) {
+        short_chunk_ = chunk_index;
+        break;
+      }
       total_rows_ = row_number;
       total_rows_known_ = true;
       break;
@@ -314,20 +384,28 @@ bool CSVModel::GetPhysicalRow(size_t index, std::vector<std::string> &out) {
 }
 
 size_t CSVModel::ToPhysical(size_t view_index) const {
-  if (order_.empty())
+  if (!Ordered())
     return view_index;
-  if (view_index >= order_.size())
+  if (view_index >= OrderedRows())
     return static_cast<size_t>(-1);
-  return order_[view_index];
+  return order_ ? (*order_)[view_index] : rows_->Select(view_index);
 }
 
 bool CSVModel::GetRow(size_t view_index, std::vector<std::string> &out) {
-  if (!order_.empty()) {
-    if (view_index >= order_.size())
+  if (Ordered()) {
+    const size_t physical = ToPhysical(view_index);
+    if (physical == static_cast<size_t>(-1))
       return false;
-    return GetPhysicalRow(order_[view_index], out);
+    return GetPhysicalRow(physical, out);
   }
-  return GetPhysicalRow(view_index, out);
+  if (!landing_)
+    return GetPhysicalRow(view_index, out);
+  if (Lands(view_index / kChunkSize))
+    return GetLandedRow(view_index, out);
+  // Reading on from the counted rows may have reached the landing.
+  const bool found = GetPhysicalRow(view_index, out);
+  ReconcileLanding();
+  return found;
 }
 
 std::vector<std::vector<std::string>> CSVModel::GetRows(size_t start,
@@ -350,6 +428,9 @@ size_t CSVModel::EnsureTotalRowCount() {
     return total_rows_;
   if (!file_.is_open())
     return 0;
+  // Counting what has arrived would be counting the wrong thing.
+  if (arriving_)
+    return EstimatedRowCount();
 
   file_.clear();
   file_.seekg(chunk_offsets_.empty() ? data_offset_ : chunk_offsets_.back());
@@ -363,19 +444,20 @@ size_t CSVModel::EnsureTotalRowCount() {
 
   total_rows_ = rows;
   total_rows_known_ = true;
+  ReconcileLanding();
   return total_rows_;
 }
 
 size_t CSVModel::TotalRowCount() { return EnsureTotalRowCount(); }
 
 size_t CSVModel::RowCount() {
-  if (!order_.empty() || filter_active_)
-    return order_.size();
+  if (Ordered() || filter_active_)
+    return OrderedRows();
   return EnsureTotalRowCount();
 }
 
 bool CSVModel::RowCountKnown() const {
-  return filter_active_ || !order_.empty() || total_rows_known_;
+  return filter_active_ || Ordered() || total_rows_known_;
 }
 
 // --- column metadata --------------------------------------------------------
@@ -462,19 +544,33 @@ size_t CSVModel::EstimatedRowCount() const {
 double CSVModel::PositionFraction(size_t view_index) const {
   // With a sort or filter in play the byte position is meaningless, so fall
   // back to the position within the view.
-  if (!order_.empty())
-    return order_.empty() ? 0.0
-                          : static_cast<double>(view_index) /
-                                static_cast<double>(std::max<size_t>(order_.size(), 1));
+  if (Ordered())
+    return static_cast<double>(view_index) /
+           static_cast<double>(std::max<size_t>(OrderedRows(), 1));
 
   if (file_size_ <= 0)
     return 0.0;
+
+  // A landing knows bytes rather than rows, which is what this wants anyway.
+  const size_t chunk = view_index / kChunkSize;
+  if (Lands(chunk)) {
+    const Landing &landing = *landing_;
+    const long long local = static_cast<long long>(chunk) -
+                            static_cast<long long>(landing.first_chunk);
+    const long long known = std::clamp<long long>(
+        local, 0, static_cast<long long>(landing.offsets.size()) - 1);
+    const double offset =
+        static_cast<double>(landing.offsets[static_cast<size_t>(known)]) +
+        static_cast<double>((local - known) * static_cast<long long>(kChunkSize)) *
+            average_record_bytes_;
+    return std::clamp(offset / static_cast<double>(file_size_), 0.0, 1.0);
+  }
+
   if (total_rows_known_ && total_rows_ > 0)
     return static_cast<double>(view_index) / static_cast<double>(total_rows_);
 
   // Use the nearest chunk offset we have already resolved: it is an exact byte
   // position, so this is accurate wherever the user has actually been.
-  const size_t chunk = view_index / kChunkSize;
   if (chunk < chunk_offsets_.size()) {
     const double offset = static_cast<double>(chunk_offsets_[chunk]);
     return std::min(1.0, offset / static_cast<double>(file_size_));
@@ -487,14 +583,332 @@ double CSVModel::PositionFraction(size_t view_index) const {
                            static_cast<double>(estimate));
 }
 
+// --- landing by position ----------------------------------------------------
+
+std::streampos CSVModel::Resync(std::streampos from) {
+  if (static_cast<long long>(from) <= static_cast<long long>(data_offset_))
+    return data_offset_;
+  // Reading from the byte before shows a boundary right at `from` as the line
+  // break that ends the record before it.
+  const long long begin = static_cast<long long>(from) - 1;
+  std::string text;
+  for (size_t window = kResyncBytes; window <= kMaxResyncBytes; window *= 2) {
+    file_.clear();
+    file_.seekg(begin);
+    if (!file_)
+      return std::streampos(-1);
+    text.assign(window, '\0');
+    file_.read(&text[0], static_cast<std::streamsize>(window));
+    text.resize(static_cast<size_t>(file_.gcount()));
+    size_t start = 0;
+    if (csv::FindRecordStart(text, delimiter_, start))
+      return start < text.size() || text.size() == window
+                 ? std::streampos(begin + static_cast<long long>(start))
+                 : std::streampos(-1); // the line break that ends the file
+    if (text.size() < window)
+      break;
+  }
+  return std::streampos(-1);
+}
+
+std::optional<size_t> CSVModel::LandAt(double fraction) {
+  if (!file_.is_open() || chunk_offsets_.empty())
+    return std::nullopt;
+  fraction = std::clamp(fraction, 0.0, 1.0);
+
+  if (Ordered() ||
+      (total_rows_known_ && chunk_offsets_.size() * kChunkSize > total_rows_)) {
+    const size_t rows = Ordered() ? OrderedRows() : total_rows_;
+    if (rows == 0)
+      return std::nullopt;
+    return std::min(rows - 1, static_cast<size_t>(fraction * static_cast<double>(rows)));
+  }
+
+  const long long first = static_cast<long long>(data_offset_);
+  const long long target =
+      first + static_cast<long long>(fraction * static_cast<double>(file_size_ - first));
+
+  // Close enough to the counted rows to count on to it, which gives a row
+  // number that needs no ~.
+  if (target - static_cast<long long>(chunk_offsets_.back()) <= kSettleBytes) {
+    while (!total_rows_known_ &&
+           static_cast<long long>(chunk_offsets_.back()) < target) {
+      const size_t resolved = chunk_offsets_.size();
+      EnsureOffsetsUpTo(resolved);
+      if (chunk_offsets_.size() == resolved)
+        break;
+    }
+    ReconcileLanding();
+    const size_t row = ChunkHolding(chunk_offsets_, target) * kChunkSize;
+    if (!total_rows_known_)
+      return row;
+    if (total_rows_ == 0)
+      return std::nullopt;
+    return std::min(row, total_rows_ - 1);
+  }
+
+  if (landing_ && static_cast<long long>(landing_->offsets.front()) <= target &&
+      target <= static_cast<long long>(landing_->offsets.back())) {
+    const size_t row =
+        (landing_->first_chunk + ChunkHolding(landing_->offsets, target)) * kChunkSize;
+    if (landing_->end_known && row >= landing_->end_row)
+      return landing_->end_row == 0 ? 0 : landing_->end_row - 1;
+    return row;
+  }
+
+  const std::streampos start = Resync(target);
+  if (start == std::streampos(-1))
+    return std::nullopt;
+
+  DropLanding();
+  const double average = average_record_bytes_ > 0.0 ? average_record_bytes_ : 1.0;
+  const size_t counted = (chunk_offsets_.size() - 1) * kChunkSize;
+  const long long unread =
+      static_cast<long long>(start) - static_cast<long long>(chunk_offsets_.back());
+  const size_t estimate =
+      counted + static_cast<size_t>(static_cast<double>(unread) / average);
+
+  Landing landing;
+  landing.first_chunk = std::max(estimate / kChunkSize, chunk_offsets_.size());
+  landing.offsets.push_back(start);
+  landing_ = std::move(landing);
+  // Whatever an earlier landing owed belongs to rows nobody is looking at now.
+  renumbered_ = 0;
+  return landing_->first_chunk * kChunkSize;
+}
+
+bool CSVModel::RowIsApproximate(size_t view_index) const {
+  return Lands(view_index / kChunkSize);
+}
+
+bool CSVModel::TakeRenumbering(long long &shift) {
+  if (landing_ && file_.is_open()) {
+    const long long start = static_cast<long long>(landing_->offsets.front());
+    if (start - static_cast<long long>(chunk_offsets_.back()) <= kSettleBytes) {
+      while (!total_rows_known_ &&
+             static_cast<long long>(chunk_offsets_.back()) < start) {
+        const size_t resolved = chunk_offsets_.size();
+        EnsureOffsetsUpTo(resolved);
+        if (chunk_offsets_.size() == resolved)
+          break;
+      }
+    }
+    ReconcileLanding();
+  }
+  if (renumbered_ == 0)
+    return false;
+  shift = renumbered_;
+  renumbered_ = 0;
+  return true;
+}
+
+bool CSVModel::Lands(size_t chunk_index) const {
+  if (!landing_ || Ordered() || chunk_index < chunk_offsets_.size())
+    return false;
+  if (chunk_index >= landing_->first_chunk)
+    return true;
+  return landing_->first_chunk - chunk_index <
+         chunk_index - (chunk_offsets_.size() - 1);
+}
+
+bool CSVModel::GetLandedRow(size_t index, std::vector<std::string> &out) {
+  const size_t chunk_index = index / kChunkSize;
+  if (!LoadLandedChunk(chunk_index))
+    return false;
+
+  auto it = chunk_cache_.find(landing_->key_base +
+                              (chunk_index - landing_->first_chunk));
+  if (it == chunk_cache_.end())
+    return false;
+
+  const size_t offset_in_chunk = index - chunk_index * kChunkSize;
+  if (offset_in_chunk >= it->second.size())
+    return false;
+
+  out = it->second[offset_in_chunk];
+  return true;
+}
+
+bool CSVModel::LoadLandedChunk(size_t chunk_index) {
+  while (chunk_index < landing_->first_chunk)
+    if (!PrependLandedChunk())
+      return false;
+
+  Landing &landing = *landing_;
+  const size_t local = chunk_index - landing.first_chunk;
+  const size_t key = landing.key_base + local;
+  if (chunk_cache_.count(key)) {
+    TouchChunk(key);
+    return true;
+  }
+  if (landing.end_known && chunk_index * kChunkSize >= landing.end_row)
+    return false;
+
+  // The same walk as EnsureOffsetsUpTo and LoadChunk make through the counted
+  // rows, from the last offset the landing has.
+  size_t current = std::min(local, landing.offsets.size() - 1);
+  file_.clear();
+  file_.seekg(landing.offsets[current]);
+  if (!file_)
+    return false;
+
+  std::string record;
+  for (; current < local; ++current) {
+    size_t records = 0;
+    while (records < kChunkSize && csv::ReadRecord(file_, record))
+      ++records;
+    if (records < kChunkSize) {
+      landing.end_row = (landing.first_chunk + current) * kChunkSize + records;
+      landing.end_known = true;
+      return false;
+    }
+    const std::streampos offset = file_.tellg();
+    if (offset == std::streampos(-1))
+      return false;
+    landing.offsets.push_back(offset);
+  }
+
+  std::vector<std::vector<std::string>> rows;
+  rows.reserve(kChunkSize);
+  while (rows.size() < kChunkSize && csv::ReadRecord(file_, record))
+    rows.push_back(csv::SplitRecord(record, delimiter_));
+  if (rows.size() < kChunkSize) {
+    landing.end_row = chunk_index * kChunkSize + rows.size();
+    landing.end_known = true;
+  }
+  if (rows.empty())
+    return false;
+
+  const std::streampos next_offset = file_.tellg();
+  if (rows.size() == kChunkSize && next_offset != std::streampos(-1) &&
+      landing.offsets.size() == local + 1)
+    landing.offsets.push_back(next_offset);
+
+  for (const auto &row : rows)
+    column_count_ = std::max(column_count_, row.size());
+
+  chunk_cache_[key] = std::move(rows);
+  TouchChunk(key);
+  EvictIfNeeded();
+  return true;
+}
+
+bool CSVModel::PrependLandedChunk() {
+  Landing &landing = *landing_;
+  // Its numbers stop short of the counted rows'; past that the gap is for
+  // TakeRenumbering to close.
+  if (landing.first_chunk <= chunk_offsets_.size())
+    return false;
+
+  const long long floor = static_cast<long long>(chunk_offsets_.back());
+  const long long start = static_cast<long long>(landing.offsets.front());
+  const double average = average_record_bytes_ > 0.0 ? average_record_bytes_ : 1.0;
+  std::vector<std::streampos> starts;
+  std::string record;
+
+  // Step back twice the chunk's expected length, resync, and read up to the
+  // landing; a chunk of long records, or one misread, needs a longer step.
+  for (long long span = static_cast<long long>(2.0 * average * kChunkSize) + 1;;
+       span *= 2) {
+    const long long from = std::max(floor, start - span);
+    const std::streampos resynced =
+        from == floor ? std::streampos(floor) : Resync(from);
+    if (resynced != std::streampos(-1) &&
+        static_cast<long long>(resynced) < start) {
+      starts.clear();
+      file_.clear();
+      file_.seekg(resynced);
+      long long at = static_cast<long long>(resynced);
+      while (at < start && csv::ReadRecord(file_, record)) {
+        starts.push_back(at);
+        at = static_cast<long long>(file_.tellg());
+        if (at < 0)
+          break;
+      }
+      if (at == start && starts.size() >= kChunkSize) {
+        landing.offsets.insert(landing.offsets.begin(),
+                               starts[starts.size() - kChunkSize]);
+        --landing.first_chunk;
+        --landing.key_base;
+        return true;
+      }
+    }
+    if (from == floor)
+      return false;
+  }
+}
+
+void CSVModel::ReconcileLanding() {
+  if (!landing_)
+    return;
+  Landing &landing = *landing_;
+  const long long start = static_cast<long long>(landing.offsets.front());
+  const size_t numbered = landing.first_chunk * kChunkSize;
+
+  if (static_cast<long long>(chunk_offsets_.back()) >= start) {
+    // Counted rows reach it: find the chunk it begins in, and count the rows
+    // of that chunk before it.
+    const size_t chunk = ChunkHolding(chunk_offsets_, start);
+    file_.clear();
+    file_.seekg(chunk_offsets_[chunk]);
+    size_t row = chunk * kChunkSize;
+    std::string record;
+    while (file_ && static_cast<long long>(file_.tellg()) < start &&
+           csv::ReadRecord(file_, record))
+      ++row;
+    Renumber(static_cast<long long>(row) - static_cast<long long>(numbered));
+    DropLanding();
+    return;
+  }
+  if (total_rows_known_ && landing.end_known && total_rows_ >= landing.end_row) {
+    // Counted to the end, and so was the landing: numbered from there, its
+    // rows are exact.
+    Renumber(static_cast<long long>(total_rows_) -
+             static_cast<long long>(landing.end_row));
+    DropLanding();
+    return;
+  }
+  if (chunk_offsets_.size() > landing.first_chunk) {
+    const size_t ahead = chunk_offsets_.size() - landing.first_chunk;
+    landing.first_chunk += ahead;
+    landing.end_row += landing.end_known ? ahead * kChunkSize : 0;
+    Renumber(static_cast<long long>(ahead * kChunkSize));
+  }
+}
+
+void CSVModel::Renumber(long long shift) {
+  // Rows on screen go by the landing's numbers only in file order.
+  if (!Ordered())
+    renumbered_ += shift;
+}
+
+void CSVModel::DropLanding() {
+  if (!landing_)
+    return;
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    if (*it < kLandedKey) {
+      ++it;
+      continue;
+    }
+    lru_pos_.erase(*it);
+    chunk_cache_.erase(*it);
+    it = lru_.erase(it);
+  }
+  landing_.reset();
+}
+
 size_t CSVModel::EstimatedSortBytes() const {
-  // What a sort must hold no matter how large the file is: the answer. Keys
+  // What a sort would hold no matter how large the file is: the answer. Keys
   // spill to disk once the buffer is full, so they no longer scale the cost.
-  return EstimatedRowCount() * kSortOutputBytesPerRow;
+  const size_t rows = EstimatedRowCount();
+  const bool narrow = rows <= std::numeric_limits<uint32_t>::max();
+  return rows * (narrow ? kSortOutputBytesPerRow : sizeof(uint64_t));
 }
 
 size_t CSVModel::EstimatedFilterBytes() const {
-  return EstimatedRowCount() * kFilterBytesPerRow;
+  // Priced at its worst, every row kept, since which rows a pattern keeps is
+  // not known until the pass is over.
+  return EstimatedRowCount() / 8 * kFilterBitsPerRow;
 }
 
 size_t CSVModel::SortMemoryBudget(size_t available_bytes) const {
@@ -516,6 +930,21 @@ size_t CSVModel::SortMemoryBudget() const {
   return SortMemoryBudget(csv::AvailableMemoryBytes());
 }
 
+size_t CSVModel::OrderMemoryBudget(size_t available_bytes) const {
+  if (available_bytes == 0)
+    return 0;
+  const size_t budget =
+      static_cast<size_t>(static_cast<double>(available_bytes) * kMemoryBudgetShare);
+  const size_t buffer = SortMemoryBudget(available_bytes);
+  // One byte rather than nothing: zero would mean "no limit" to the scan,
+  // which is the opposite of a budget that has run out.
+  return budget > buffer ? budget - buffer : 1;
+}
+
+size_t CSVModel::OrderMemoryBudget() const {
+  return OrderMemoryBudget(csv::AvailableMemoryBytes());
+}
+
 namespace {
 
 std::string RefusalMessage(const char *operation, size_t rows, size_t needed,
@@ -533,10 +962,10 @@ std::string CSVModel::CheckSortFeasible(size_t available_bytes) const {
     return std::string(); // unknown: do not stand in the user's way
   const size_t budget =
       static_cast<size_t>(static_cast<double>(available_bytes) * kMemoryBudgetShare);
-  // Only the resulting order has to fit: the keys go to disk as they are made.
-  // A sort that would once have been refused for wanting 9 GB of keys now asks
-  // for the eight bytes a row that the answer costs.
-  const size_t needed = EstimatedSortBytes() + kMinSortBufferBytes;
+  // Only the working buffer has to fit. The keys go to disk as they are made,
+  // and the resulting order follows them into a mapped file when it is too
+  // big to hold, so a sort larger than memory is slow rather than impossible.
+  const size_t needed = kMinSortBufferBytes;
   if (needed <= budget)
     return std::string();
   return RefusalMessage("sorting", EstimatedRowCount(), needed, budget,
@@ -567,26 +996,83 @@ void CSVModel::AdoptIndex(std::vector<std::streampos> offsets,
                           size_t total_rows) {
   if (offsets.empty())
     return;
+  if (arriving_) {
+    // Every offset is a record boundary for good, because the file only ever
+    // grows by whole records; the count is only where the input had got to.
+    if (offsets.size() > chunk_offsets_.size())
+      chunk_offsets_ = std::move(offsets);
+    return;
+  }
+  // A pass that began before the rest of the file arrived counted fewer rows
+  // than are known now, and has nothing to add.
+  if (total_rows_known_ && total_rows < total_rows_)
+    return;
+  if (total_rows_known_ && total_rows > total_rows_) {
+    // The chunk that ended the file was read short and has rows now. Zone
+    // maps and trigrams stop at the old end, and the views remembered lack
+    // what came after it.
+    const size_t stale = total_rows_ / kChunkSize;
+    if (chunk_cache_.erase(stale) != 0) {
+      lru_.erase(lru_pos_[stale]);
+      lru_pos_.erase(stale);
+    }
+    zones_.clear();
+    grams_.reset();
+    grams_cached_ = false;
+    gram_index_.reset();
+    gram_index_cached_ = false;
+    recent_views_.clear();
+  }
+  // Every full pass yields the table, so most are the one already kept.
+  if (!total_rows_known_ || total_rows != total_rows_ ||
+      offsets.size() != chunk_offsets_.size())
+    index_saved_ = false;
   chunk_offsets_ = std::move(offsets);
   total_rows_ = total_rows;
   total_rows_known_ = true;
   count_from_cache_ = false;
+  index_splice_ = csvcache::Splice{};
+  ReconcileLanding();
 }
 
-bool CSVModel::LoadIndex() {
-  // Piped input lives in a temporary file that will not exist next time, and
-  // whose name says nothing about what it held.
-  if (!file_.is_open() || real_path_.empty() || real_path_ != display_path_)
+bool CSVModel::CacheKey(csvcache::Key &key) const {
+  if (real_path_.empty() || real_path_ != display_path_)
     return false;
+  return csvcache::DescribeFile(real_path_, delimiter_, has_header_, kChunkSize,
+                                key);
+}
 
+bool CSVModel::LoadIndex() {
   csvcache::Key key;
-  if (!csvcache::DescribeFile(real_path_, delimiter_, has_header_, kChunkSize,
-                              key))
+  if (!file_.is_open() || !CacheKey(key))
     return false;
 
   csvcache::Index index;
-  if (!csvcache::Load(key, index))
+  // A copy of a file indexed elsewhere — moved, or rsynced here with the
+  // cache — is as good as the original.
+  if (!csvcache::Load(key, index) && !csvcache::LoadCopy(key, index)) {
+    // A log or export that has grown since its last session keeps the
+    // offsets it had: every row they place is where it was, and only what
+    // was appended is left to count. The count itself is no longer exact.
+    if (csvcache::LoadGrown(key, index) &&
+        index.offsets.front() == data_offset_) {
+      chunk_offsets_ = std::move(index.offsets);
+      index_outgrown_ = true;
+      return false;
+    }
+    // One rewritten in the middle keeps the chunks either side of the edit,
+    // and only the edit is left to count, when it added or removed rows in
+    // whole chunks or none at all; otherwise everything after it is.
+    csvcache::Splice splice;
+    if (csvcache::LoadEdited(key, index, splice) &&
+        index.offsets.front() == data_offset_) {
+      chunk_offsets_ = std::move(index.offsets);
+      index_splice_ = std::move(splice);
+      index_outgrown_ = true;
+      index_edited_ = true;
+    }
     return false;
+  }
   // The first offset must be where this model thinks the data starts, or the
   // two disagree about the header.
   if (index.offsets.front() != data_offset_)
@@ -596,24 +1082,150 @@ bool CSVModel::LoadIndex() {
   total_rows_ = index.total_rows;
   total_rows_known_ = true;
   count_from_cache_ = true;
+  index_saved_ = true;
+  // Zone maps describe the same rows, so are only any use beside the index.
+  if (!csvcache::LoadZones(key, zones_))
+    zones_.clear();
+  grams_cached_ = csvcache::HasGramFilters(key);
+  gram_index_cached_ = csvcache::HasGramIndex(key);
   return true;
 }
 
-bool CSVModel::SaveIndex() const {
-  if (!total_rows_known_ || count_from_cache_ || chunk_offsets_.empty())
+bool CSVModel::SaveIndex(csvcache::Writer *writer) {
+  if (!total_rows_known_ || index_saved_ || chunk_offsets_.empty())
     return false; // nothing new to record
-  if (real_path_.empty() || real_path_ != display_path_)
-    return false;
 
   csvcache::Key key;
-  if (!csvcache::DescribeFile(real_path_, delimiter_, has_header_, kChunkSize,
-                              key))
+  if (!CacheKey(key))
     return false;
 
   csvcache::Index index;
   index.offsets = chunk_offsets_;
   index.total_rows = total_rows_;
-  return csvcache::Save(key, index);
+  if (writer != nullptr)
+    writer->Save(key, std::move(index));
+  else if (!csvcache::Save(key, index))
+    return false;
+  index_saved_ = true;
+  return true;
+}
+
+void CSVModel::AdoptZones(std::vector<csvcache::ZoneMap> zones) {
+  if (zones.empty())
+    return;
+  for (csvcache::ZoneMap &map : zones) {
+    auto same = std::find_if(zones_.begin(), zones_.end(),
+                             [&map](const csvcache::ZoneMap &held) {
+                               return held.column == map.column &&
+                                      held.times == map.times;
+                             });
+    if (same != zones_.end())
+      *same = std::move(map);
+    else
+      zones_.push_back(std::move(map));
+  }
+  csvcache::Key key;
+  if (CacheKey(key))
+    csvcache::SaveZones(key, zones_);
+}
+
+void CSVModel::AdoptGrams(std::shared_ptr<const csvcache::GramFilters> grams) {
+  if (!grams || grams->words.empty())
+    return;
+  grams_ = std::move(grams);
+  csvcache::Key key;
+  if (CacheKey(key) && csvcache::SaveGramFilters(key, *grams_))
+    grams_cached_ = true;
+}
+
+const csvcache::GramFilters *CSVModel::Grams() const {
+  if (!grams_ && grams_cached_) {
+    auto loaded = std::make_shared<csvcache::GramFilters>();
+    csvcache::Key key;
+    if (CacheKey(key) && csvcache::LoadGramFilters(key, *loaded))
+      grams_ = std::move(loaded);
+    else
+      grams_cached_ = false; // gone or damaged since: build them again
+  }
+  return grams_.get();
+}
+
+bool CSVModel::WantsSearchIndex() const {
+  csvcache::Key key;
+  return build_search_index_ && !has_gram_index() &&
+         file_size_ >= csvcache::kMinimumFileSize && CacheKey(key);
+}
+
+void CSVModel::AdoptGramIndex(std::shared_ptr<const csvcache::GramIndex> index) {
+  if (!index || index->zones == 0)
+    return;
+  gram_index_ = std::move(index);
+  csvcache::Key key;
+  if (CacheKey(key) && csvcache::SaveGramIndex(key, *gram_index_))
+    gram_index_cached_ = true;
+}
+
+const csvcache::GramIndex *CSVModel::SearchIndex() const {
+  if (!gram_index_ && gram_index_cached_) {
+    auto loaded = std::make_shared<csvcache::GramIndex>();
+    csvcache::Key key;
+    if (CacheKey(key) && csvcache::LoadGramIndex(key, *loaded))
+      gram_index_ = std::move(loaded);
+    else
+      gram_index_cached_ = false;
+  }
+  return gram_index_.get();
+}
+
+CSVModel::TextSieve CSVModel::SieveFor(const std::string &text) const {
+  TextSieve sieve;
+  sieve.trigrams = csvsketch::Trigrams(text);
+  const csvcache::GramIndex *index =
+      sieve.trigrams.empty() ? nullptr : SearchIndex();
+  if (index != nullptr) {
+    sieve.zones.assign(index->zones, false);
+    for (size_t zone : index->ZonesHolding(sieve.trigrams))
+      sieve.zones[zone] = true;
+  }
+  return sieve;
+}
+
+bool CSVModel::ChunkRulesOut(size_t physical_row, const TextSieve &sieve) const {
+  if (sieve.trigrams.empty())
+    return false;
+  const size_t chunk = physical_row / kChunkSize;
+  // A landed row's number says nothing about which chunk of the index it is.
+  if (Lands(chunk))
+    return false;
+  const size_t zone = chunk / csvcache::kChunksPerZone;
+  if (zone < sieve.zones.size() && !sieve.zones[zone])
+    return true;
+  const csvcache::GramFilters *grams = Grams();
+  return grams != nullptr && chunk < grams->chunks() &&
+         !csvsketch::MayHoldTrigrams(grams->Chunk(chunk), grams->bits,
+                                     sieve.trigrams);
+}
+
+size_t CSVModel::GramBits() const {
+  if (file_size_ < csvcache::kMinimumFileSize || average_record_bytes_ <= 0.0)
+    return 0;
+  const double chunk_bytes = average_record_bytes_ * kChunkSize;
+  size_t bits = static_cast<size_t>(chunk_bytes / kBytesPerGramBit);
+  const size_t chunks = EstimatedRowCount() / kChunkSize + 1;
+  bits = std::min(bits, kMaxGramBytes * 8 / chunks);
+  bits -= bits % 64;
+  return bits < kMinGramBits ? 0 : bits;
+}
+
+bool CSVModel::LoadProfile(std::vector<csvscan::ColumnProfile> &out) const {
+  csvcache::Key key;
+  return CacheKey(key) && csvcache::LoadProfile(key, out);
+}
+
+bool CSVModel::SaveProfile(
+    const std::vector<csvscan::ColumnProfile> &profile) const {
+  csvcache::Key key;
+  return CacheKey(key) && csvcache::SaveProfile(key, profile);
 }
 
 bool CSVModel::ColumnIsNumeric(size_t col) const {
@@ -641,11 +1253,15 @@ CSVModel::FindNext(const std::string &pattern, size_t row, size_t col,
     return std::nullopt;
 
   size_t examined = 0;
+  size_t next_check = kSearchWatchRows;
   bool abandoned = false;
-  // Returns false when the search should stop.
-  const auto keep_going = [&] {
-    if (++examined % kSearchWatchRows != 0)
+  // Returns false when the search should stop. Rows passed over unread count
+  // as examined: they were, by their chunk's trigrams.
+  const auto keep_going = [&](size_t rows) {
+    examined += rows;
+    if (examined < next_check)
       return true;
+    next_check = examined + kSearchWatchRows;
     if (watch.report)
       watch.report(examined);
     if (watch.cancelled && watch.cancelled()) {
@@ -656,17 +1272,28 @@ CSVModel::FindNext(const std::string &pattern, size_t row, size_t col,
   };
 
   const bool ci = csv::SmartCaseInsensitive(pattern);
+  const TextSieve sieve = SieveFor(pattern);
   // Searching walks forward until a row read fails, so it never needs the row
   // count and therefore never triggers a full scan just to get started.
-  const bool bounded = !order_.empty();
-  const size_t bound = order_.size();
+  const bool bounded = Ordered();
+  const size_t bound = OrderedRows();
 
   std::vector<std::string> fields;
 
   for (size_t current = row;; ++current) {
     if (bounded && current >= bound)
       break;
-    if (!keep_going())
+    // A chunk that cannot hold the pattern is not read. In file order that
+    // is the rest of the chunk at once; in a view's order, one row at a time.
+    if (ChunkRulesOut(bounded ? ToPhysical(current) : current, sieve)) {
+      const size_t skipped =
+          bounded ? 1 : kChunkSize - current % kChunkSize;
+      current += skipped - 1;
+      if (!keep_going(skipped))
+        return std::nullopt;
+      continue;
+    }
+    if (!keep_going(1))
       return std::nullopt;
     if (!GetRow(current, fields))
       break;
@@ -681,7 +1308,15 @@ CSVModel::FindNext(const std::string &pattern, size_t row, size_t col,
     return std::nullopt;
 
   for (size_t current = 0; current <= row; ++current) {
-    if (!keep_going())
+    if (ChunkRulesOut(bounded ? ToPhysical(current) : current, sieve)) {
+      const size_t skipped =
+          bounded ? 1 : kChunkSize - current % kChunkSize;
+      current += skipped - 1;
+      if (!keep_going(skipped))
+        return std::nullopt;
+      continue;
+    }
+    if (!keep_going(1))
       return std::nullopt;
     if (!GetRow(current, fields))
       break;
@@ -703,25 +1338,39 @@ CSVModel::FindPrev(const std::string &pattern, size_t row, size_t col,
     return std::nullopt;
 
   size_t examined = 0;
-  const auto keep_going = [&] {
-    if (++examined % kSearchWatchRows != 0)
+  size_t next_check = kSearchWatchRows;
+  const auto keep_going = [&](size_t rows) {
+    examined += rows;
+    if (examined < next_check)
       return true;
+    next_check = examined + kSearchWatchRows;
     if (watch.report)
       watch.report(examined);
     return !(watch.cancelled && watch.cancelled());
   };
 
   const bool ci = csv::SmartCaseInsensitive(pattern);
+  const TextSieve sieve = SieveFor(pattern);
+  const bool bounded = Ordered();
   // Walking backwards only needs a bound when wrapping round to the end, so
   // the common case costs no scan.
-  if (!order_.empty() && row >= order_.size())
-    row = order_.empty() ? 0 : order_.size() - 1;
+  if (bounded && row >= OrderedRows())
+    row = OrderedRows() == 0 ? 0 : OrderedRows() - 1;
 
   std::vector<std::string> fields;
 
   for (size_t step = 0; step <= row; ++step) {
     const size_t current = row - step;
-    if (!keep_going())
+    // Backwards, a chunk that cannot hold the pattern is passed down to its
+    // first row in one go.
+    if (ChunkRulesOut(bounded ? ToPhysical(current) : current, sieve)) {
+      const size_t skipped = bounded ? 1 : current % kChunkSize + 1;
+      step += skipped - 1;
+      if (!keep_going(skipped))
+        return std::nullopt;
+      continue;
+    }
+    if (!keep_going(1))
       return std::nullopt;
     if (!GetRow(current, fields))
       break;
@@ -748,7 +1397,15 @@ CSVModel::FindPrev(const std::string &pattern, size_t row, size_t col,
 
   const size_t total = RowCount();
   for (size_t current = total; current-- > row;) {
-    if (!keep_going())
+    if (ChunkRulesOut(bounded ? ToPhysical(current) : current, sieve)) {
+      const size_t skipped =
+          bounded ? 1 : std::min(current % kChunkSize, current - row - 1) + 1;
+      current -= skipped - 1;
+      if (!keep_going(skipped))
+        return std::nullopt;
+      continue;
+    }
+    if (!keep_going(1))
       return std::nullopt;
     if (!GetRow(current, fields))
       continue;
@@ -772,6 +1429,8 @@ CSVModel::ViewState CSVModel::CurrentViewState() const {
   state.sort_descending = sort_descending_;
   state.filter_active = filter_active_;
   state.filter_pattern = filter_pattern_;
+  state.filter_predicate = filter_predicate_;
+  state.filter_built = filter_built_;
   return state;
 }
 
@@ -783,72 +1442,509 @@ void CSVModel::DescribeScan(csvscan::Request &request) const {
   request.chunk_size = kChunkSize;
   request.expected_rows = EstimatedRowCount();
   request.sort_memory_budget = SortMemoryBudget();
+  request.order_memory_budget = OrderMemoryBudget();
+  // Counting values is working memory of the same kind as a sort's buffer,
+  // and is bounded the same way.
+  request.frequency_memory_budget = request.sort_memory_budget;
+  request.group_memory_budget = request.sort_memory_budget;
+  // Only the first full pass need build them; after that they are here or in
+  // the cache.
+  request.gram_bits = has_grams() ? 0 : GramBits();
+}
+
+void CSVModel::DescribeResume(csvscan::Request &request) const {
+  DescribeScan(request);
+  request.gram_bits = 0;
+  request.resume_offsets = chunk_offsets_;
+  request.resume_tail = index_splice_.tail;
+  request.resume_tail_rows = index_splice_.tail_rows;
+}
+
+CSVModel::Growth CSVModel::CheckGrowth() {
+  const long long size = SizeOf(real_path_);
+  if (size == file_size_)
+    return Growth::None;
+  if (size < file_size_)
+    return Growth::Shrunk;
+  file_size_ = size;
+  if (short_chunk_) {
+    if (chunk_cache_.erase(*short_chunk_) != 0) {
+      lru_.erase(lru_pos_[*short_chunk_]);
+      lru_pos_.erase(*short_chunk_);
+    }
+    short_chunk_.reset();
+  }
+  if (landing_ && landing_->end_known) {
+    // The landing's last chunk was read short; it has more rows now.
+    const size_t stale = landing_->key_base +
+                         (landing_->end_row / kChunkSize - landing_->first_chunk);
+    if (chunk_cache_.erase(stale) != 0) {
+      lru_.erase(lru_pos_[stale]);
+      lru_pos_.erase(stale);
+    }
+    landing_->end_known = false;
+  }
+  return Growth::Grown;
+}
+
+void CSVModel::SetArriving(bool arriving) {
+  arriving_ = arriving;
+  if (!arriving)
+    short_chunk_.reset();
+}
+
+void CSVModel::DescribeAppended(csvscan::Request &request) const {
+  DescribeResume(request);
+  // The writer may be part way through a record; it is read once finished.
+  request.whole_records = true;
+  if (!rows_ || provisional_ || !filter_active_ || sort_active_)
+    return;
+  DescribeFilter(CurrentViewState(), request);
+  // Resuming reads only what follows the table, which is all a skim could
+  // have narrowed.
+  request.skim_chunks.clear();
+  request.refine_offsets.clear();
+  request.want_order = true;
+}
+
+void CSVModel::AdoptAppended(const ViewState &view, csvscan::Result &result) {
+  if (!result.has_rows || !rows_ || provisional_ ||
+      !SameView(view, CurrentViewState()))
+    return;
+  // The rows of the chunk the resumed read began in may be in both.
+  rows_ = std::make_shared<const csvrows::RowSet>(
+      csvrows::RowSet::Union(*rows_, result.rows));
+}
+
+void CSVModel::DescribeFilter(const ViewState &view,
+                              csvscan::Request &request) const {
+  request.filter = view.filter_active;
+  request.filter_pattern = view.filter_pattern;
+  request.filter_predicate = view.filter_active && view.filter_predicate;
+  // Checked when it was typed, against the same columns; a failure now would
+  // mean the header changed under it, and no filter is the safe reading.
+  std::string error;
+  if (request.filter_predicate && !view.filter_built.clauses.empty())
+    request.predicate = view.filter_built;
+  else if (request.filter_predicate &&
+           !ParsePredicate(view.filter_pattern, request.predicate, error)) {
+    request.filter = false;
+    request.filter_predicate = false;
+  }
+  DescribeSkim(request);
+}
+
+void CSVModel::DescribeCount(const std::string &pattern,
+                             csvscan::Request &request) const {
+  request.count_pattern = pattern;
+  DescribeSkim(request);
+}
+
+bool CSVModel::ParsePredicate(const std::string &text,
+                              csvpredicate::Predicate &out,
+                              std::string &error) const {
+  std::vector<std::string> names;
+  for (size_t col = 0; col < column_count_; ++col)
+    names.push_back(ColumnName(col));
+  return csvpredicate::Parse(text, names, out, error);
+}
+
+void CSVModel::DescribeSkim(csvscan::Request &request) const {
+  request.skim_chunks.clear();
+  // Skipping needs every chunk's offset, to seek past the ones it skips.
+  if (!total_rows_known_ || total_rows_ == 0 ||
+      (total_rows_ - 1) / kChunkSize >= chunk_offsets_.size())
+    return;
+  const size_t chunk_count = (total_rows_ + kChunkSize - 1) / kChunkSize;
+  std::vector<bool> wanted(chunk_count, true);
+  bool narrowed = false;
+
+  // A range rules out the zones whose values all fall outside it.
+  const size_t zone_count =
+      (chunk_count + csvcache::kChunksPerZone - 1) / csvcache::kChunksPerZone;
+  const bool ranging = request.filter && request.filter_predicate;
+  for (const csvpredicate::Clause &clause : request.predicate.clauses) {
+    if (!ranging || clause.kind == csvpredicate::Kind::Text)
+      continue;
+    const bool times = clause.kind == csvpredicate::Kind::Time;
+    for (const csvcache::ZoneMap &map : zones_) {
+      if (map.column != clause.column || map.times != times ||
+          map.min.size() != zone_count)
+        continue;
+      for (size_t z = 0; z < zone_count; ++z) {
+        if (csvpredicate::CouldMatch(clause, map.min[z], map.max[z]))
+          continue;
+        const size_t last =
+            std::min(chunk_count, (z + 1) * csvcache::kChunksPerZone);
+        for (size_t c = z * csvcache::kChunksPerZone; c < last; ++c)
+          wanted[c] = false;
+        narrowed = true;
+      }
+    }
+  }
+
+  // Text that every kept row must contain rules out the chunks whose
+  // trigrams lack it: a substring filter's pattern, the value a predicate
+  // wants a column to equal, and the pattern being counted.
+  std::vector<std::string> needles;
+  if (request.filter && !request.filter_predicate)
+    needles.push_back(request.filter_pattern);
+  for (const csvpredicate::Clause &clause : request.predicate.clauses)
+    if (ranging && clause.kind == csvpredicate::Kind::Text &&
+        clause.op == csvpredicate::Op::Equal)
+      needles.push_back(clause.text);
+  if (!request.count_pattern.empty())
+    needles.push_back(request.count_pattern);
+  for (const std::string &needle : needles) {
+    const TextSieve sieve = SieveFor(needle);
+    for (size_t c = 0; c < chunk_count; ++c) {
+      if (wanted[c] && ChunkRulesOut(c * kChunkSize, sieve)) {
+        wanted[c] = false;
+        narrowed = true;
+      }
+    }
+  }
+
+  if (!narrowed)
+    return;
+  request.skim_chunks = std::move(wanted);
+  request.refine_offsets = chunk_offsets_;
+  request.skim_total_rows = total_rows_;
 }
 
 void CSVModel::AdoptView(const ViewState &state, std::vector<size_t> order,
                          bool has_order) {
+  InstallView(state,
+              has_order ? std::make_shared<const csvrows::RowOrder>(order)
+                        : nullptr,
+              nullptr);
+  view_from_cache_ = false;
+}
+
+void CSVModel::AdoptView(const ViewState &state, csvscan::Result &result) {
+  if (result.has_rows)
+    InstallView(state, nullptr,
+                std::make_shared<const csvrows::RowSet>(std::move(result.rows)));
+  else
+    InstallView(state,
+                result.has_order ? std::make_shared<const csvrows::RowOrder>(
+                                       std::move(result.order))
+                                 : nullptr,
+                nullptr);
+  view_from_cache_ = false;
+}
+
+void CSVModel::ShowProvisional(const ViewState &state,
+                               std::vector<size_t> rows) {
+  if (!provisional_) {
+    beneath_provisional_ = CachedView{CurrentViewState(), order_, rows_};
+    provisional_ = true;
+  }
   sort_active_ = state.sort_active;
   sort_column_ = state.sort_column;
   sort_descending_ = state.sort_descending;
   filter_active_ = state.filter_active;
   filter_pattern_ = state.filter_pattern;
-  order_ = has_order ? std::move(order) : std::vector<size_t>();
+  filter_predicate_ = state.filter_predicate;
+  filter_built_ = state.filter_built;
+  order_ = std::make_shared<const csvrows::RowOrder>(rows);
+  rows_.reset();
+  growing_rows_.reset();
+}
+
+void CSVModel::AppendProvisional(const ViewState &state,
+                                 const std::vector<size_t> &rows) {
+  if (!provisional_ || !growing_rows_) {
+    ShowProvisional(state, {});
+    growing_rows_ = std::make_shared<csvrows::RowSet>();
+    order_.reset();
+    rows_ = growing_rows_;
+  }
+  for (size_t row : rows)
+    growing_rows_->Add(row);
+}
+
+void CSVModel::DropProvisional() {
+  if (!provisional_)
+    return;
+  provisional_ = false;
+  const ViewState &state = beneath_provisional_.state;
+  sort_active_ = state.sort_active;
+  sort_column_ = state.sort_column;
+  sort_descending_ = state.sort_descending;
+  filter_active_ = state.filter_active;
+  filter_pattern_ = state.filter_pattern;
+  filter_predicate_ = state.filter_predicate;
+  filter_built_ = state.filter_built;
+  order_ = std::move(beneath_provisional_.order);
+  rows_ = std::move(beneath_provisional_.rows);
+  beneath_provisional_ = CachedView{};
+  growing_rows_.reset();
+}
+
+void CSVModel::InstallView(const ViewState &state,
+                           std::shared_ptr<const csvrows::RowOrder> order,
+                           std::shared_ptr<const csvrows::RowSet> rows) {
+  // What is remembered is the view the user actually had, not a glimpse of
+  // the one that was on its way.
+  DropProvisional();
+  RememberView();
+  sort_active_ = state.sort_active;
+  sort_column_ = state.sort_column;
+  sort_descending_ = state.sort_descending;
+  filter_active_ = state.filter_active;
+  filter_pattern_ = state.filter_pattern;
+  filter_predicate_ = state.filter_predicate;
+  filter_built_ = state.filter_built;
+  order_ = std::move(order);
+  rows_ = std::move(rows);
+  // On screen now, so no longer merely remembered.
+  recent_views_.remove_if(
+      [&state](const CachedView &cached) { return SameView(cached.state, state); });
+}
+
+// --- recently shown views ----------------------------------------------------
+
+bool CSVModel::SameView(const ViewState &a, const ViewState &b) {
+  // A column or a pattern that is not in effect does not make two views
+  // different: the ordering they produce is the same.
+  if (a.sort_active != b.sort_active || a.filter_active != b.filter_active)
+    return false;
+  if (a.sort_active && (a.sort_column != b.sort_column ||
+                        a.sort_descending != b.sort_descending))
+    return false;
+  return !a.filter_active ||
+         (a.filter_pattern == b.filter_pattern &&
+          a.filter_predicate == b.filter_predicate &&
+          a.filter_built.clauses == b.filter_built.clauses);
+}
+
+void CSVModel::RememberView() {
+  // The file in its own order costs nothing to come back to.
+  if (!Ordered() && !filter_active_)
+    return;
+  const ViewState outgoing = CurrentViewState();
+  recent_views_.remove_if([&outgoing](const CachedView &cached) {
+    return SameView(cached.state, outgoing);
+  });
+  recent_views_.push_front(CachedView{outgoing, order_, rows_});
+  TrimRecentViews();
+}
+
+void CSVModel::TrimRecentViews() {
+  // Most recent first, so whatever falls past the budget is what has gone
+  // longest unused. A view too large for the budget on its own is dropped
+  // straight away rather than pushing everything else out.
+  const size_t budget = ViewCacheBudget();
+  size_t held = 0;
+  size_t kept = 0;
+  for (auto it = recent_views_.begin(); it != recent_views_.end();) {
+    const size_t bytes = ViewBytes(it->order, it->rows);
+    if (kept < kMaxRecentViews && held + bytes <= budget) {
+      held += bytes;
+      ++kept;
+      ++it;
+    } else {
+      it = recent_views_.erase(it);
+    }
+  }
+}
+
+bool CSVModel::RecallView(const ViewState &target) {
+  for (auto it = recent_views_.begin(); it != recent_views_.end(); ++it) {
+    if (!SameView(it->state, target))
+      continue;
+    std::shared_ptr<const csvrows::RowOrder> order = std::move(it->order);
+    std::shared_ptr<const csvrows::RowSet> rows = std::move(it->rows);
+    recent_views_.erase(it);
+    InstallView(target, std::move(order), std::move(rows));
+    view_from_cache_ = true;
+    return true;
+  }
+
+  // Nor does the file itself need remembering to be shown again.
+  if (!target.sort_active && !target.filter_active) {
+    InstallView(target, nullptr, nullptr);
+    view_from_cache_ = false;
+    return true;
+  }
+  return false;
+}
+
+size_t CSVModel::ViewBytes(const std::shared_ptr<const csvrows::RowOrder> &order,
+                           const std::shared_ptr<const csvrows::RowSet> &rows) {
+  if (order)
+    return order->MemoryBytes();
+  return rows ? rows->MemoryBytes() : 0;
 }
 
-void CSVModel::RebuildOrder() {
+size_t CSVModel::RecentViewBytes() const {
+  size_t bytes = 0;
+  for (const CachedView &cached : recent_views_)
+    bytes += ViewBytes(cached.order, cached.rows);
+  return bytes;
+}
+
+size_t CSVModel::ViewCacheBudget(size_t available_bytes) const {
+  if (available_bytes == 0)
+    return kMaxViewCacheBytes;
+  // The same share a sort is allowed, less the view on screen, which is
+  // already spent. Remembering old views is a convenience and never worth
+  // crowding out the one being looked at.
+  const size_t budget =
+      static_cast<size_t>(static_cast<double>(available_bytes) * kMemoryBudgetShare);
+  const size_t showing = ViewBytes(order_, rows_);
+  if (budget <= showing)
+    return 0;
+  return std::min(budget - showing, kMaxViewCacheBytes);
+}
+
+size_t CSVModel::ViewCacheBudget() const {
+  return ViewCacheBudget(csv::AvailableMemoryBytes());
+}
+
+bool CSVModel::Refines(const ViewState &target) const {
+  // Only a filter narrows, and only a view that exists can be narrowed. With
+  // no order at all the view is the whole file, and re-testing every row of it
+  // is the plain pass by another name.
+  if (!Ordered() || !target.filter_active || target.filter_pattern.empty())
+    return false;
+  // The first screen of an unfinished sort is not a view anything can be
+  // narrowed from: the rows it leaves out are still in the running.
+  if (provisional_)
+    return false;
+  if (target.sort_active != sort_active_ ||
+      (sort_active_ && (target.sort_column != sort_column_ ||
+                        target.sort_descending != sort_descending_)))
+    return false;
+
+  // Every row of the view has to be reachable by seeking, which needs the
+  // whole offset table; counting without one leaves only the total.
+  if (!total_rows_known_ ||
+      (total_rows_ > 0 && (total_rows_ - 1) / kChunkSize >= chunk_offsets_.size()))
+    return false;
+
+  if (!filter_active_)
+    return true; // a filter over a sort: every row, but no sorting again
+
+  // Whether one predicate keeps a subset of what another kept is not worth
+  // working out, and text tells nothing about values or the other way round.
+  if (target.filter_predicate || filter_predicate_)
+    return false;
+
+  // A field holding the new pattern holds the old one too, under the old
+  // pattern's own case rule. An all-lowercase pattern matched regardless of
+  // case, so "Error" narrows "err"; one with a capital matched exactly, and a
+  // pattern containing it has that capital too.
+  const bool was_ignoring_case = csv::SmartCaseInsensitive(filter_pattern_);
+  return csv::FindFrom(target.filter_pattern, filter_pattern_, 0,
+                       was_ignoring_case) != std::string::npos;
+}
+
+bool CSVModel::DescribeRefinement(const ViewState &target,
+                                  csvscan::Request &request) const {
+  if (!Refines(target))
+    return false;
+  DescribeFilter(target, request);
+  request.skim_chunks.clear(); // the view's rows say what to read instead
+  request.want_order = true;
+  request.refine_rows = order_;
+  request.refine_set = rows_;
+  request.refine_offsets = chunk_offsets_;
+  return true;
+}
+
+void CSVModel::RebuildOrder(const ViewState &target) {
+  if (RecallView(target))
+    return;
+
   // The same pass the background scanner runs, driven on this thread. Keeping
   // one implementation is what stops a foreground sort and a background sort
   // from ever disagreeing.
   csvscan::Request request;
   DescribeScan(request);
-  request.filter = filter_active_;
-  request.filter_pattern = filter_pattern_;
-  request.sort = sort_active_;
-  request.sort_column = sort_column_;
-  request.sort_descending = sort_descending_;
+  DescribeFilter(target, request);
+  request.sort = target.sort_active;
+  request.sort_column = target.sort_column;
+  request.sort_descending = target.sort_descending;
   request.want_order = true;
 
   csvscan::Result result;
   if (csvscan::Run(request, result, nullptr, nullptr) !=
       csvscan::Outcome::Done) {
-    order_.clear();
+    InstallView(target, nullptr, nullptr);
     return;
   }
 
   AdoptIndex(std::move(result.offsets), result.total_rows);
-  order_ = result.has_order ? std::move(result.order) : std::vector<size_t>();
+  AdoptZones(std::move(result.zones));
+  AdoptGrams(std::move(result.grams));
+  AdoptView(target, result);
 }
 
 void CSVModel::SortByColumn(size_t col, bool descending) {
-  sort_active_ = true;
-  sort_column_ = col;
-  sort_descending_ = descending;
-  RebuildOrder();
+  ViewState target = CurrentViewState();
+  target.sort_active = true;
+  target.sort_column = col;
+  target.sort_descending = descending;
+  RebuildOrder(target);
 }
 
 void CSVModel::ClearSort() {
-  sort_active_ = false;
-  RebuildOrder();
+  ViewState target = CurrentViewState();
+  target.sort_active = false;
+  RebuildOrder(target);
+}
+
+size_t CSVModel::ApplyFilter(const std::string &pattern, bool predicate) {
+  ViewState target = CurrentViewState();
+  target.filter_active = !pattern.empty();
+  target.filter_pattern = pattern;
+  target.filter_predicate = predicate && !pattern.empty();
+  target.filter_built = csvpredicate::Predicate{};
+  return ApplyFilter(target);
 }
 
-size_t CSVModel::ApplyFilter(const std::string &pattern) {
-  filter_pattern_ = pattern;
-  filter_active_ = !pattern.empty();
-  RebuildOrder();
-  return filter_active_ ? order_.size() : EnsureTotalRowCount();
+size_t CSVModel::ApplyFilter(const std::string &description,
+                             const csvpredicate::Predicate &built) {
+  ViewState target = CurrentViewState();
+  target.filter_active = true;
+  target.filter_pattern = description;
+  target.filter_predicate = true;
+  target.filter_built = built;
+  return ApplyFilter(target);
+}
+
+size_t CSVModel::ApplyFilter(const ViewState &target) {
+  if (RecallView(target))
+    return filter_active_ ? OrderedRows() : EnsureTotalRowCount();
+
+  csvscan::Request request;
+  DescribeScan(request);
+  csvscan::Result result;
+  if (DescribeRefinement(target, request) &&
+      csvscan::Run(request, result, nullptr, nullptr) ==
+          csvscan::Outcome::Done) {
+    AdoptView(target, result);
+    return OrderedRows();
+  }
+
+  RebuildOrder(target);
+  return filter_active_ ? OrderedRows() : EnsureTotalRowCount();
 }
 
 void CSVModel::ClearFilter() {
-  filter_active_ = false;
-  filter_pattern_.clear();
-  RebuildOrder();
+  ViewState target = CurrentViewState();
+  target.filter_active = false;
+  target.filter_pattern.clear();
+  target.filter_built = csvpredicate::Predicate{};
+  RebuildOrder(target);
 }
 
 CSVModel::ColumnStats CSVModel::ComputeColumnStats(size_t col) {
   csvscan::Request request;
   DescribeScan(request);
-  request.filter = filter_active_;
-  request.filter_pattern = filter_pattern_;
+  DescribeFilter(CurrentViewState(), request);
   request.want_stats = true;
   request.stats_column = col;
 
@@ -857,5 +1953,6 @@ CSVModel::ColumnStats CSVModel::ComputeColumnStats(size_t col) {
     return ColumnStats{};
 
   AdoptIndex(std::move(result.offsets), result.total_rows);
+  AdoptGrams(std::move(result.grams));
   return result.stats;
 }
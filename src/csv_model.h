@@ -1,12 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
 #include <list>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "csv_cache.h"
 #include "csv_scan.h"
 
 // Streams a CSV file from disk, keeping only a bounded window of parsed rows in
@@ -89,10 +92,19 @@ public:
   size_t sort_column() const { return sort_column_; }
   bool sort_descending() const { return sort_descending_; }
 
-  size_t ApplyFilter(const std::string &pattern);
+  // `predicate` reads the pattern as a csvpredicate comparison, which must
+  // already have parsed (see ParsePredicate).
+  size_t ApplyFilter(const std::string &pattern, bool predicate = false);
+  // Filters on clauses built rather than typed, such as a value picked from
+  // a column's frequencies, which a pattern cannot always say: one holding
+  // quotes or " and ", or none at all. `description` is what the view is
+  // shown as.
+  size_t ApplyFilter(const std::string &description,
+                     const csvpredicate::Predicate &built);
   void ClearFilter();
   bool filter_active() const { return filter_active_; }
   const std::string &filter_pattern() const { return filter_pattern_; }
+  bool filter_predicate() const { return filter_predicate_; }
 
   ColumnStats ComputeColumnStats(size_t col);
 
@@ -112,6 +124,23 @@ public:
   // nearest known chunk offset, so it costs nothing.
   double PositionFraction(size_t view_index) const;
 
+  // --- reaching a place by where it is in the file --------------------------
+  //
+  // Going to 40% of a file nobody has counted cannot say which row is there,
+  // only which byte. LandAt goes to that byte, finds the next record boundary
+  // and reads on from there, numbering what it finds by the average record
+  // length: the landing. Once the rows before it are known — the index
+  // arrives, or reading from the top reaches it — its rows take their real
+  // numbers, and TakeRenumbering hands over how far they moved so whoever
+  // holds a row number can move it along. Counted files and sorted or
+  // filtered views go to the row at `fraction` of the way down instead.
+  // Returns the row to show, or nothing when the file has no record there.
+  std::optional<size_t> LandAt(double fraction);
+  // Whether a row's number is the landing's estimate rather than a count.
+  bool RowIsApproximate(size_t view_index) const;
+  // False when no row has been renumbered since the last call.
+  bool TakeRenumbering(long long &shift);
+
   // Peak extra memory these operations would need, from the row estimate.
   size_t EstimatedSortBytes() const;
   size_t EstimatedFilterBytes() const;
@@ -121,6 +150,11 @@ public:
   // both ends.
   size_t SortMemoryBudget(size_t available_bytes) const;
   size_t SortMemoryBudget() const;
+  // How much the resulting order may take in memory before it is written to a
+  // mapped temporary file instead: what the budget has left beside the sort
+  // buffer. Zero, when memory is unknown, keeps it in memory.
+  size_t OrderMemoryBudget(size_t available_bytes) const;
+  size_t OrderMemoryBudget() const;
 
   // Empty when the operation fits in `available_bytes`, otherwise a sentence
   // explaining why it was refused. `available_bytes == 0` means "unknown",
@@ -131,17 +165,35 @@ public:
   std::string CheckFilterFeasible() const;
 
   // Replaces the chunk offset table and row count with the results of a scan
-  // performed elsewhere (see CSVScanner).
+  // performed elsewhere (see CSVScanner). More rows than were known means
+  // the file has grown, and what was learned of its old end goes; fewer means
+  // the pass began before the rest of it arrived, and changes nothing.
   void AdoptIndex(std::vector<std::streampos> offsets, size_t total_rows);
 
   // The offset table is expensive to build and small to keep, so it outlives
   // the session. LoadIndex is tried on open; SaveIndex is worth calling
-  // whenever a full pass has just made the count exact. Both are best-effort:
-  // a cache that cannot be read or written costs only the time it saved.
+  // whenever a full pass has just made the count exact, and writes only when
+  // the table is not the one loaded or saved already; given a `writer`, it
+  // hands the table over to be written there rather than writing it before
+  // returning. Both are best-effort: a cache that cannot be read or written
+  // costs only the time it saved.
   bool LoadIndex();
-  bool SaveIndex() const;
+  bool SaveIndex(csvcache::Writer *writer = nullptr);
+  // A profile of every column of the whole file is kept the same way, since
+  // it too reads every row and stays true until the file changes. A profile
+  // of a filtered view is not: the next filter will be a different one.
+  bool LoadProfile(std::vector<csvscan::ColumnProfile> &out) const;
+  bool SaveProfile(const std::vector<csvscan::ColumnProfile> &profile) const;
   // True when the row count came from a cache rather than from reading.
   bool row_count_came_from_cache() const { return count_from_cache_; }
+  // True when the offsets came from an index of this file before something
+  // was appended to it (see csvcache::LoadGrown), or before it was edited
+  // somewhere in the middle (see csvcache::LoadEdited), and the rows past the
+  // last of them are still to count. DescribeResume asks for just those —
+  // and, after an edit, hands on where the chunks past it have moved to, so
+  // that the count can stop once it reaches them.
+  bool IndexOutgrown() const { return index_outgrown_ && !total_rows_known_; }
+  bool IndexEdited() const { return IndexOutgrown() && index_edited_; }
 
   // The sort and filter currently in effect. Handed to CSVScanner to describe
   // the view a background pass should produce, and back to AdoptView with the
@@ -152,6 +204,12 @@ public:
     bool sort_descending = false;
     bool filter_active = false;
     std::string filter_pattern;
+    // The pattern is a predicate on column values (see csvpredicate), not
+    // text to find anywhere in the row.
+    bool filter_predicate = false;
+    // Clauses built rather than typed, which the pattern then only describes:
+    // they are used as they are, and the pattern is never parsed.
+    csvpredicate::Predicate filter_built;
   };
 
   ViewState CurrentViewState() const;
@@ -159,17 +217,115 @@ public:
   // is the file in its own order, which is stored as no index at all.
   void AdoptView(const ViewState &state, std::vector<size_t> order,
                  bool has_order);
+  // The same from a finished pass, taking whichever form its view came in.
+  void AdoptView(const ViewState &state, csvscan::Result &result);
+
+  // Following a file that is being appended to. CheckGrowth looks at its
+  // size again and says how it has changed since it was last looked at.
+  // DescribeAppended asks for the rows past the last offset known — testing
+  // them against the filter, when the view is filtered and not sorted — and
+  // once AdoptIndex has the table, AdoptAppended adds the matches to `view`
+  // if it is still the view on screen. A sorted view keeps the rows it had:
+  // placing new ones would be sorting again. A last record with no line
+  // break yet is left until the writer finishes it and CheckGrowth sees so.
+  enum class Growth { None, Grown, Shrunk };
+  Growth CheckGrowth();
+  // Piped input is shown while it is still being read into the file (see
+  // csvspool). Until SetArriving(false), the end of the file is not the end
+  // of the rows: reaching it counts nothing, a chunk read short there is read
+  // again once CheckGrowth sees more, and a pass adopts only the offsets it
+  // found, since its count stopped wherever the input had got to. The count
+  // stays an estimate until whoever is reading the input hands over the table
+  // it built on the way (see AdoptIndex).
+  void SetArriving(bool arriving);
+  bool arriving() const { return arriving_; }
+  void DescribeAppended(csvscan::Request &request) const;
+  void AdoptAppended(const ViewState &view, csvscan::Result &result);
+
+  // Shows the leading rows of a sort still in progress as if they were the
+  // whole view, keeping the view they replace underneath. AdoptView replaces
+  // them for good; DropProvisional puts back what was there, for a sort that
+  // was cancelled or failed. Neither is ever remembered as a recent view.
+  void ShowProvisional(const ViewState &state, std::vector<size_t> rows);
+  // The same for a filter still running: `rows` are the matches found since
+  // the last call, in file order, and are added to those already shown.
+  void AppendProvisional(const ViewState &state, const std::vector<size_t> &rows);
+  void DropProvisional();
+  bool showing_provisional() const { return provisional_; }
+  // Views shown recently are remembered, within a memory budget, so going
+  // back to one — clearing a sort to see the filter it was over, sorting again
+  // after `u` — is a pointer swap rather than another pass over the file.
+  // RecallView installs `target` and returns true when it can do so without
+  // reading anything; the file in its own order always qualifies.
+  bool RecallView(const ViewState &target);
+  // True when the view on screen was recalled rather than computed.
+  bool view_came_from_cache() const { return view_from_cache_; }
+  size_t RecentViewCount() const { return recent_views_.size(); }
+  size_t RecentViewBytes() const;
+  // What remembering old views may cost: the same share of available memory
+  // a sort works within, less the view on screen, and never past the cap.
+  size_t ViewCacheBudget(size_t available_bytes) const;
+  size_t ViewCacheBudget() const;
+
   // Fills a scan request describing this model, so callers do not have to know
   // which of its internals the scanner needs.
   void DescribeScan(csvscan::Request &request) const;
+  // Fills in the filter of `view`, parsing a predicate against this file's
+  // columns, and — when zone maps or trigram filters rule some chunks out —
+  // the chunks a pass need read at all.
+  void DescribeFilter(const ViewState &view, csvscan::Request &request) const;
+  // Asks the pass to count rows matching `pattern` too, narrowing the chunks
+  // it reads to those that might hold one.
+  void DescribeCount(const std::string &pattern,
+                     csvscan::Request &request) const;
+  // Describes a count that reads on from the last offset known, for a file
+  // whose index it has outgrown.
+  void DescribeResume(csvscan::Request &request) const;
+  // Parses a predicate filter against this file's column names. False with
+  // the reason in `error`.
+  bool ParsePredicate(const std::string &text, csvpredicate::Predicate &out,
+                      std::string &error) const;
+
+  // Zone maps of some columns, built by passes that read the whole file and
+  // kept with its index. Adopting replaces any map of the same column and
+  // kind, and saves the lot.
+  void AdoptZones(std::vector<csvcache::ZoneMap> zones);
+  const std::vector<csvcache::ZoneMap> &zones() const { return zones_; }
+  // Trigram filters of every chunk, built by the first full pass over a file
+  // large enough to cache and kept with its index. Null ones change nothing.
+  void AdoptGrams(std::shared_ptr<const csvcache::GramFilters> grams);
+  bool has_grams() const { return grams_ || grams_cached_; }
+  // The search index (see csvcache::GramIndex), which is built only when
+  // asked for: SetBuildSearchIndex says the user wants one, and
+  // WantsSearchIndex whether a pass should build it now — not for a file too
+  // small to cache, nor one that has it already. A search, filter or count
+  // then reads only the zones holding every trigram of its text, and within
+  // them only the chunks the trigram filters allow.
+  void SetBuildSearchIndex(bool build) { build_search_index_ = build; }
+  bool WantsSearchIndex() const;
+  void AdoptGramIndex(std::shared_ptr<const csvcache::GramIndex> index);
+  bool has_gram_index() const { return gram_index_ || gram_index_cached_; }
+
+  // True when `target` keeps a subset of the current view's rows in the same
+  // order — a filter narrowed by typing more of it, or one added over a sort —
+  // so it can be reached by re-testing those rows rather than reading the
+  // whole file. DescribeRefinement fills in the part of the request that says
+  // so, and returns false, leaving it alone, when the view cannot be narrowed.
+  bool Refines(const ViewState &target) const;
+  bool DescribeRefinement(const ViewState &target,
+                          csvscan::Request &request) const;
 
   static constexpr size_t kChunkSize = 512;
   // A sort holds one key per row while it works — measured at ~61 bytes — but
   // those spill to temporary files once the buffer is full, so the only cost
-  // that follows the row count is the answer: one row number per row.
+  // that follows the row count is the answer: one row number per row, in 32
+  // bits below four billion rows. Even that goes to a mapped file when it will
+  // not fit, so it is what a sort would like rather than what it must have.
   static constexpr size_t kSortKeyBytesPerRow = 61;
-  static constexpr size_t kSortOutputBytesPerRow = sizeof(size_t);
-  static constexpr size_t kFilterBytesPerRow = 10;
+  static constexpr size_t kSortOutputBytesPerRow = sizeof(uint32_t);
+  // A filter keeps a set of rows: at worst a bit for every row of the file,
+  // and far less when it keeps few. Two bits covers the bookkeeping.
+  static constexpr size_t kFilterBitsPerRow = 2;
   // How much a sort may hold before spilling. The floor is what makes an
   // enormous sort possible at all; the ceiling stops a roomy machine from
   // buffering far more than merging a few extra runs would have cost.
@@ -177,9 +333,38 @@ public:
   static constexpr size_t kMaxSortBufferBytes = 512u * 1024 * 1024;
   // Never spend more than this share of what is available.
   static constexpr double kMemoryBudgetShare = 0.6;
+  // Recently shown views kept for recall. A handful covers flipping between
+  // filtered, sorted and neither; the byte cap keeps a roomy machine from
+  // holding gigabytes of orderings nobody is going to ask for again.
+  static constexpr size_t kMaxRecentViews = 8;
+  static constexpr size_t kMaxViewCacheBytes = 512u * 1024 * 1024;
+  // Trigram filters take a bit for every four bytes of text, which leaves a
+  // fifth to a third of a typical chunk's bits set. A pattern is ruled out of
+  // a chunk by any one of its trigrams, so a five-letter word skips most of
+  // the chunks that lack it and a ten-letter one nearly all. Past the cap the
+  // bits per chunk shrink to fit, and below the floor they would rule nothing
+  // out.
+  static constexpr size_t kBytesPerGramBit = 4;
+  static constexpr size_t kMaxGramBytes = 256u * 1024 * 1024;
+  static constexpr size_t kMinGramBits = 512;
 
 private:
+  // What the cache files this file under. False for piped input, which lives
+  // in a temporary file that will not exist next time and whose name says
+  // nothing about what it held.
+  bool CacheKey(csvcache::Key &key) const;
   static constexpr size_t kMaxCachedChunks = 48; // ~24k rows resident
+  // How much is read to find the first record boundary past a byte, at first
+  // and at most: a record longer than that has no boundary to land on.
+  static constexpr size_t kResyncBytes = 64u * 1024;
+  static constexpr size_t kMaxResyncBytes = 4u * 1024 * 1024;
+  // A gap this small between the counted rows and a landing is read through
+  // rather than left for the index, which makes the landing's numbers exact.
+  static constexpr long long kSettleBytes = 4ll * 1024 * 1024;
+  // Landed chunks share the chunk cache under keys of their own, counted up
+  // from well inside this range so chunks found before them fit below.
+  static constexpr size_t kLandedKey = static_cast<size_t>(-1) / 2;
+  static constexpr size_t kLandedKeyBase = kLandedKey + kLandedKey / 2;
   static constexpr size_t kSampleRows = 1000;
   static constexpr int kMaxSampledWidth = 48;
 
@@ -194,11 +379,28 @@ private:
 
   size_t total_rows_ = 0;
   bool total_rows_known_ = false;
+  bool arriving_ = false;
+  // The chunk read short at the end of a file still arriving.
+  std::optional<size_t> short_chunk_;
   bool count_from_cache_ = false;
+  bool index_saved_ = false; // the table is the one in the cache
+  bool index_outgrown_ = false;
+  bool index_edited_ = false;
+  csvcache::Splice index_splice_; // what LoadEdited found past the edit
   long long file_size_ = 0;
   double average_record_bytes_ = 0.0;
 
-  std::vector<std::streampos> chunk_offsets_;
+  csvcache::ChunkOffsets chunk_offsets_;
+  std::vector<csvcache::ZoneMap> zones_; // for the rows chunk_offsets_ cover
+  // Loaded on first use rather than with the index: they run to a thirtieth
+  // of the file, which merely browsing it has no use for. `grams_cached_`
+  // says the cache has a set to load.
+  mutable std::shared_ptr<const csvcache::GramFilters> grams_;
+  mutable bool grams_cached_ = false;
+  // The search index, likewise.
+  mutable std::shared_ptr<const csvcache::GramIndex> gram_index_;
+  mutable bool gram_index_cached_ = false;
+  bool build_search_index_ = false;
   std::unordered_map<size_t, std::vector<std::vector<std::string>>> chunk_cache_;
   std::list<size_t> lru_;
   std::unordered_map<size_t, std::list<size_t>::iterator> lru_pos_;
@@ -206,12 +408,46 @@ private:
   std::vector<int> column_widths_;
   std::vector<bool> column_numeric_;
 
-  std::vector<size_t> order_; // view index -> physical index; empty = identity
+  // Where LandAt went. Its chunks go by numbers from `first_chunk` on, always
+  // past the counted ones; reading backwards from it adds chunks in front.
+  struct Landing {
+    size_t first_chunk = 0;
+    size_t key_base = kLandedKeyBase; // cache key of first_chunk
+    std::vector<std::streampos> offsets; // of first_chunk onwards
+    size_t end_row = 0;                  // once reading it reached the end
+    bool end_known = false;
+  };
+  std::optional<Landing> landing_;
+  long long renumbered_ = 0; // what TakeRenumbering has yet to hand over
+
+  // View index -> physical index; null means the identity. Never modified once
+  // built, only replaced, so a refinement running on a worker can read the
+  // very view it is narrowing while the UI goes on showing it.
+  std::shared_ptr<const csvrows::RowOrder> order_;
+  // A filtered view that is not sorted keeps its rows here instead, as a set:
+  // a bit or two a row rather than eight bytes. At most one of the two is set.
+  std::shared_ptr<const csvrows::RowSet> rows_;
+
+  struct CachedView {
+    ViewState state;
+    std::shared_ptr<const csvrows::RowOrder> order;
+    std::shared_ptr<const csvrows::RowSet> rows;
+  };
+  std::list<CachedView> recent_views_; // most recently replaced first
+  bool view_from_cache_ = false;
+  // The real view, while a provisional one is on screen in its place.
+  CachedView beneath_provisional_;
+  bool provisional_ = false;
+  // The filter matches shown so far, which rows_ points at while they grow.
+  // Only this thread ever touches it: the worker sends batches, not access.
+  std::shared_ptr<csvrows::RowSet> growing_rows_;
   bool sort_active_ = false;
   size_t sort_column_ = 0;
   bool sort_descending_ = false;
   bool filter_active_ = false;
   std::string filter_pattern_;
+  bool filter_predicate_ = false;
+  csvpredicate::Predicate filter_built_;
 
   bool LoadChunk(size_t chunk_index);
   void TouchChunk(size_t chunk_index);
@@ -219,10 +455,68 @@ private:
   std::streampos ResolveOffset(size_t chunk_index);
   void EnsureOffsetsUpTo(size_t chunk_index);
   bool GetPhysicalRow(size_t index, std::vector<std::string> &out);
+  // Whether a chunk of the unordered view is read from the landing: those at
+  // or past it, and those of the gap before it nearer it than the counted
+  // rows.
+  bool Lands(size_t chunk_index) const;
+  bool GetLandedRow(size_t index, std::vector<std::string> &out);
+  bool LoadLandedChunk(size_t chunk_index);
+  // Finds the chunk before the landing by reading backwards from it.
+  bool PrependLandedChunk();
+  // Once the counted rows reach the landing, gives its rows their real
+  // numbers; until then keeps it numbered past them.
+  void ReconcileLanding();
+  void Renumber(long long shift);
+  void DropLanding();
+  // The first record boundary at or after `from`, or -1.
+  std::streampos Resync(std::streampos from);
   size_t ToPhysical(size_t view_index) const;
+  // Rows in the view when it has an order of its own; zero when it does not.
+  bool Ordered() const { return order_ || rows_; }
+  size_t OrderedRows() const {
+    return order_ ? order_->size() : rows_ ? rows_->size() : 0;
+  }
   void SampleColumnMetadata();
+  // What SampleColumnMetadata and RefineAverageRecordBytes found, kept in the
+  // cache for a file large enough to have an index: reopening it then reads
+  // no rows until the first frame wants them.
+  bool LoadColumnMetadata();
+  void SaveColumnMetadata() const;
   void ResetDerivedState();
-  void RebuildOrder();
+  // Shows `target`, recalling it when it was seen recently and otherwise
+  // running the pass that builds it.
+  void RebuildOrder(const ViewState &target);
+  // Replaces the view on screen, remembering the one it replaces.
+  void InstallView(const ViewState &state,
+                   std::shared_ptr<const csvrows::RowOrder> order,
+                   std::shared_ptr<const csvrows::RowSet> rows);
+  static size_t ViewBytes(const std::shared_ptr<const csvrows::RowOrder> &order,
+                          const std::shared_ptr<const csvrows::RowSet> &rows);
+  void RememberView();
+  void TrimRecentViews();
+  static bool SameView(const ViewState &a, const ViewState &b);
+  size_t ApplyFilter(const ViewState &target);
+  // Narrows the request to the chunks its filter and count could find a row
+  // in, by the zone maps and the trigram filters. Leaves it reading the whole
+  // file when they rule nothing out.
+  void DescribeSkim(csvscan::Request &request) const;
+  // The trigram filters and the search index, loaded from the cache the
+  // first time one is wanted.
+  const csvcache::GramFilters *Grams() const;
+  const csvcache::GramIndex *SearchIndex() const;
+  // What is known of where some text can be: its trigrams, for the filters,
+  // and the zones the search index lists for all of them, when there is one.
+  // Worked out once for a search rather than for every row it passes.
+  struct TextSieve {
+    std::vector<std::uint32_t> trigrams;
+    std::vector<bool> zones; // empty: the index rules nothing out
+  };
+  TextSieve SieveFor(const std::string &text) const;
+  // Whether the chunk holding `physical_row` is shown to have none of the
+  // text `sieve` came from, so searching it is pointless.
+  bool ChunkRulesOut(size_t physical_row, const TextSieve &sieve) const;
+  // Bits per chunk to build trigram filters with, or zero for none.
+  size_t GramBits() const;
   // Samples record lengths at a few points in the file so the row estimate is
   // not skewed by an unrepresentative head.
   void RefineAverageRecordBytes();
@@ -20,6 +20,8 @@ inline char LowerAscii(char c) {
 
 inline bool IsContinuationByte(char c) { return (AsByte(c) & 0xC0) == 0x80; }
 
+inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
 } // namespace
 
 char DetectDelimiter(const std::string &line) {
@@ -135,6 +137,48 @@ bool ReadRecord(std::istream &in, std::string &out) {
   return read_any;
 }
 
+bool FindRecordStart(const std::string &text, char delimiter, size_t &start) {
+  auto is_break = [&](size_t i) {
+    return i < text.size() &&
+           (text[i] == delimiter || text[i] == '\n' || text[i] == '\r');
+  };
+  auto is_plain = [&](size_t i) {
+    return i < text.size() && text[i] != '"' && !is_break(i);
+  };
+
+  // Parity alone cannot say whether the window opened inside a quoted field,
+  // but the quotes themselves usually can: one with a field break before it
+  // and text after it opens a field, one with text before it and a break
+  // after it closes one. Each such quote, read against the parity counted up
+  // to it, is a vote for how the window began; "" escapes and empty fields
+  // sit on both sides and abstain. A bare quote inside an unquoted field can
+  // cast a wrong vote, so the majority decides, and no votes means outside.
+  long inside_votes = 0;
+  bool odd = false;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '"')
+      continue;
+    const bool opens = i > 0 && is_break(i - 1) && is_plain(i + 1);
+    const bool closes = i > 0 && is_plain(i - 1) && is_break(i + 1);
+    if (opens)
+      inside_votes += odd ? 1 : -1;
+    else if (closes)
+      inside_votes += odd ? -1 : 1;
+    odd = !odd;
+  }
+
+  bool in_quotes = inside_votes > 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '"')
+      in_quotes = !in_quotes;
+    else if (text[i] == '\n' && !in_quotes) {
+      start = i + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
 void StripBom(std::string &s) {
   if (s.size() >= 3 && AsByte(s[0]) == 0xEF && AsByte(s[1]) == 0xBB &&
       AsByte(s[2]) == 0xBF)
@@ -209,6 +253,124 @@ bool IsNumeric(const std::string &s) {
   return ParseNumber(s, ignored);
 }
 
+bool IsInteger(const std::string &s) {
+  const size_t begin = s.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+    return false;
+  const size_t end = s.find_last_not_of(" \t") + 1;
+  size_t i = begin;
+  if (s[i] == '-' || s[i] == '+')
+    ++i;
+  if (i == end)
+    return false;
+  for (; i < end; ++i) {
+    if (!IsDigit(s[i]))
+      return false;
+  }
+  return true;
+}
+
+bool IsDate(const std::string &s) {
+  // YYYY-MM-DD, then nothing or a time.
+  if (s.size() < 10)
+    return false;
+  for (size_t i : {0u, 1u, 2u, 3u, 5u, 6u, 8u, 9u}) {
+    if (!IsDigit(s[i]))
+      return false;
+  }
+  if (s[4] != '-' || s[7] != '-')
+    return false;
+  const int month = (s[5] - '0') * 10 + (s[6] - '0');
+  const int day = (s[8] - '0') * 10 + (s[9] - '0');
+  if (month < 1 || month > 12 || day < 1 || day > 31)
+    return false;
+  return s.size() == 10 || s[10] == 'T' || s[10] == ' ';
+}
+
+namespace {
+
+// Days from 1970-01-01 to a date in the proleptic Gregorian calendar, by
+// counting in 400-year eras that start on 1 March, which puts the leap day
+// at the end of the year where it does no harm.
+long long DaysFromCivil(int year, int month, int day) {
+  year -= month <= 2 ? 1 : 0;
+  const long long era = (year >= 0 ? year : year - 399) / 400;
+  const long long year_of_era = year - era * 400;
+  const long long day_of_year =
+      (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const long long day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// Two digits at `at`, if there are two.
+bool TwoDigits(const std::string &s, size_t at, int &out) {
+  if (at + 2 > s.size() || !IsDigit(s[at]) || !IsDigit(s[at + 1]))
+    return false;
+  out = (s[at] - '0') * 10 + (s[at + 1] - '0');
+  return true;
+}
+
+} // namespace
+
+bool ParseTime(const std::string &s, double &seconds) {
+  if (!IsDate(s))
+    return false;
+  const int year = (s[0] - '0') * 1000 + (s[1] - '0') * 100 +
+                   (s[2] - '0') * 10 + (s[3] - '0');
+  const int month = (s[5] - '0') * 10 + (s[6] - '0');
+  const int day = (s[8] - '0') * 10 + (s[9] - '0');
+  double total = static_cast<double>(DaysFromCivil(year, month, day)) * 86400.0;
+  if (s.size() == 10) {
+    seconds = total;
+    return true;
+  }
+
+  int hour = 0;
+  int minute = 0;
+  if (!TwoDigits(s, 11, hour) || s.size() < 16 || s[13] != ':' ||
+      !TwoDigits(s, 14, minute) || hour > 23 || minute > 59)
+    return false;
+  total += hour * 3600.0 + minute * 60.0;
+  size_t at = 16;
+  if (at < s.size() && s[at] == ':') {
+    int second = 0;
+    if (!TwoDigits(s, at + 1, second) || second > 60)
+      return false;
+    total += second;
+    at += 3;
+    if (at < s.size() && (s[at] == '.' || s[at] == ',')) {
+      double scale = 0.1;
+      for (++at; at < s.size() && IsDigit(s[at]); ++at, scale /= 10.0)
+        total += (s[at] - '0') * scale;
+    }
+  }
+  if (at < s.size() && s[at] == 'Z') {
+    ++at;
+  } else if (at < s.size() && (s[at] == '+' || s[at] == '-')) {
+    const bool ahead = s[at] == '+';
+    int offset_hours = 0;
+    int offset_minutes = 0;
+    if (!TwoDigits(s, at + 1, offset_hours))
+      return false;
+    at += 3;
+    if (at < s.size() && s[at] == ':')
+      ++at;
+    if (at < s.size()) {
+      if (!TwoDigits(s, at, offset_minutes))
+        return false;
+      at += 2;
+    }
+    // Local time ahead of UTC is the same instant earlier in UTC.
+    const double offset = offset_hours * 3600.0 + offset_minutes * 60.0;
+    total += ahead ? -offset : offset;
+  }
+  if (at != s.size())
+    return false;
+  seconds = total;
+  return true;
+}
+
 bool SmartCaseInsensitive(const std::string &pattern) {
   for (char c : pattern) {
     const unsigned char b = AsByte(c);
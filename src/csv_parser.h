@@ -92,6 +92,13 @@ bool RecordContains(const std::string &record, char delimiter,
 // fields. Trailing \r is stripped so CRLF files behave. Returns false at EOF.
 bool ReadRecord(std::istream &in, std::string &out);
 
+// Finds where the first whole record starts in `text`, a window read from an
+// arbitrary byte of a file, and stores its offset in `start`. The window may
+// open inside a quoted field, so this guesses the quote state from the quotes
+// it sees rather than assuming it. Returns false when no record boundary lies
+// inside the window.
+bool FindRecordStart(const std::string &text, char delimiter, size_t &start);
+
 // Removes a leading UTF-8 byte order mark, if present.
 void StripBom(std::string &s);
 
@@ -108,6 +115,16 @@ std::string SanitizeForDisplay(const std::string &s);
 // True when the value parses as a number (used for right alignment / stats).
 bool IsNumeric(const std::string &s);
 bool ParseNumber(const std::string &s, double &out);
+// A whole number as written: digits with at most a sign, so "3.0" is not.
+bool IsInteger(const std::string &s);
+// An ISO 8601 calendar date, 2024-03-07, optionally followed by a time after
+// a 'T' or a space. Only the date part is checked.
+bool IsDate(const std::string &s);
+// The same date as seconds since 1970-01-01 UTC, with its time if it has
+// one: HH:MM, then optionally :SS and a fraction, then optionally Z or an
+// offset such as +02:00. What a range filter compares timestamps by, since
+// they do not parse as numbers and do not sort as text once offsets differ.
+bool ParseTime(const std::string &s, double &seconds);
 
 // Smart case: a pattern without uppercase matches case-insensitively.
 bool SmartCaseInsensitive(const std::string &pattern);
@@ -0,0 +1,226 @@
+#include "csv_predicate.h"
+
+#include "csv_parser.h"
+
+#include <cctype>
+
+namespace csvpredicate {
+namespace {
+
+std::string Trim(const std::string &text) {
+  const size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+    return std::string();
+  const size_t end = text.find_last_not_of(" \t");
+  return text.substr(begin, end - begin + 1);
+}
+
+std::string Lower(std::string text) {
+  for (char &c : text)
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  return text;
+}
+
+// Splits on the word "and" standing on its own, in any case, outside quotes:
+// `city = "Bath and Wells"` is one clause. A quote opens a value only where a
+// value starts, right after the comparison, so the apostrophe in O'Brien
+// quotes nothing.
+std::vector<std::string> SplitClauses(const std::string &text) {
+  std::vector<std::string> parts;
+  const std::string lower = Lower(text);
+  size_t start = 0;
+  char quote = 0;
+  char before = 0; // the last character outside quotes that is not a space
+  for (size_t at = 0; at < lower.size(); ++at) {
+    const char c = lower[at];
+    if (quote != 0) {
+      if (c == quote)
+        quote = 0;
+      continue;
+    }
+    if ((c == '"' || c == '\'') &&
+        (before == '=' || before == '<' || before == '>')) {
+      quote = c;
+      continue;
+    }
+    const bool alone = lower.compare(at, 3, "and") == 0 && at > 0 &&
+                       lower[at - 1] == ' ' && at + 3 < lower.size() &&
+                       lower[at + 3] == ' ';
+    if (alone) {
+      parts.push_back(text.substr(start, at - start));
+      start = at + 3;
+      at += 2;
+    }
+    if (c != ' ')
+      before = c;
+  }
+  parts.push_back(text.substr(start));
+  return parts;
+}
+
+bool ParseClause(const std::string &text,
+                 const std::vector<std::string> &columns, Clause &out,
+                 std::string &error) {
+  const size_t at = text.find_first_of("<>=!");
+  if (at == std::string::npos) {
+    error = "'" + Trim(text) + "' has no comparison (< <= > >= = !=)";
+    return false;
+  }
+  const std::string name = Trim(text.substr(0, at));
+  const char first = text[at];
+  const bool two = at + 1 < text.size() && text[at + 1] == '=';
+  switch (first) {
+  case '<':
+    out.op = two ? Op::LessEqual : Op::Less;
+    break;
+  case '>':
+    out.op = two ? Op::GreaterEqual : Op::Greater;
+    break;
+  case '!':
+    if (!two) {
+      error = "'!' must be followed by '='";
+      return false;
+    }
+    out.op = Op::NotEqual;
+    break;
+  default:
+    out.op = Op::Equal;
+    break;
+  }
+  std::string value = Trim(text.substr(at + (two ? 2 : 1)));
+  if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') &&
+      value.back() == value.front())
+    value = value.substr(1, value.size() - 2);
+  if (name.empty()) {
+    error = "a comparison needs a column before it";
+    return false;
+  }
+  if (value.empty()) {
+    error = "'" + name + "' needs a value to compare with";
+    return false;
+  }
+
+  // The name as written, then regardless of case, then as a number.
+  size_t found = columns.size();
+  for (size_t i = 0; i < columns.size() && found == columns.size(); ++i)
+    if (columns[i] == name)
+      found = i;
+  for (size_t i = 0; i < columns.size() && found == columns.size(); ++i)
+    if (Lower(columns[i]) == Lower(name))
+      found = i;
+  if (found == columns.size() && name.size() < 10 &&
+      name.find_first_not_of("0123456789") == std::string::npos) {
+    const size_t number = static_cast<size_t>(std::stoull(name));
+    if (number >= 1 && number <= columns.size())
+      found = number - 1;
+  }
+  if (found == columns.size()) {
+    error = "no column '" + name + "'";
+    return false;
+  }
+  out.column = found;
+
+  if (csv::ParseNumber(value, out.bound))
+    out.kind = Kind::Number;
+  else if (csv::ParseTime(value, out.bound))
+    out.kind = Kind::Time;
+  else
+    out.kind = Kind::Text;
+  out.text = value;
+  return true;
+}
+
+template <typename T> bool Compare(Op op, const T &cell, const T &bound) {
+  switch (op) {
+  case Op::Less:
+    return cell < bound;
+  case Op::LessEqual:
+    return cell <= bound;
+  case Op::Greater:
+    return cell > bound;
+  case Op::GreaterEqual:
+    return cell >= bound;
+  case Op::Equal:
+    return cell == bound;
+  case Op::NotEqual:
+    return cell != bound;
+  }
+  return false;
+}
+
+} // namespace
+
+bool operator==(const Clause &a, const Clause &b) {
+  return a.column == b.column && a.op == b.op && a.kind == b.kind &&
+         (a.kind == Kind::Text ? a.text == b.text : a.bound == b.bound);
+}
+
+bool Parse(const std::string &text, const std::vector<std::string> &columns,
+           Predicate &out, std::string &error) {
+  Predicate parsed;
+  for (const std::string &part : SplitClauses(text)) {
+    Clause clause;
+    if (!ParseClause(part, columns, clause, error))
+      return false;
+    parsed.clauses.push_back(std::move(clause));
+  }
+  out = std::move(parsed);
+  return true;
+}
+
+bool Value(const Clause &clause, const std::string &cell, double &out) {
+  switch (clause.kind) {
+  case Kind::Number:
+    return csv::ParseNumber(cell, out);
+  case Kind::Time:
+    return csv::ParseTime(cell, out);
+  case Kind::Text:
+    break;
+  }
+  return false;
+}
+
+bool Holds(const Clause &clause, const std::string &cell) {
+  if (clause.kind == Kind::Text)
+    return Compare(clause.op, cell, clause.text);
+  double number = 0.0;
+  return Value(clause, cell, number) && Holds(clause, number);
+}
+
+bool Holds(const Clause &clause, double value) {
+  return Compare(clause.op, value, clause.bound);
+}
+
+bool Matches(const Predicate &predicate, const std::string &record,
+             char delimiter, std::string &value, std::string &scratch) {
+  for (const Clause &clause : predicate.clauses) {
+    csv::ExtractField(record, delimiter, clause.column, value, scratch);
+    if (!Holds(clause, value))
+      return false;
+  }
+  return true;
+}
+
+bool CouldMatch(const Clause &clause, double min, double max) {
+  if (clause.kind == Kind::Text)
+    return true;
+  if (min > max)
+    return false;
+  switch (clause.op) {
+  case Op::Less:
+    return min < clause.bound;
+  case Op::LessEqual:
+    return min <= clause.bound;
+  case Op::Greater:
+    return max > clause.bound;
+  case Op::GreaterEqual:
+    return max >= clause.bound;
+  case Op::Equal:
+    return min <= clause.bound && clause.bound <= max;
+  case Op::NotEqual:
+    return !(min == max && min == clause.bound);
+  }
+  return true;
+}
+
+} // namespace csvpredicate
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Filtering on what a column's values are, rather than on text anywhere in
+// the row: `price > 1000`, or `time >= 2024-03-01 and time < 2024-04-01`.
+//
+// A substring filter has to look at every row, since any row could hold the
+// text. A range on one column need not: if the file's index knows the least
+// and greatest value of that column in each zone of rows (see
+// csvcache::ZoneMap), a zone whose range misses the predicate holds no match
+// and is never read. On a log written in time order a time window then reads
+// the part of the file the window covers and little else.
+namespace csvpredicate {
+
+enum class Op { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+// How a clause compares: by number, by timestamp (csv::ParseTime), or as text
+// when the value given is neither. A cell that is not of the clause's kind
+// never matches it, whatever the operator.
+enum class Kind { Number, Time, Text };
+
+struct Clause {
+  size_t column = 0;
+  Op op = Op::Equal;
+  Kind kind = Kind::Text;
+  double bound = 0.0; // for Number and Time
+  std::string text;   // the value as written, for Text
+};
+
+// Clauses are the same when they test the same cells the same way.
+bool operator==(const Clause &a, const Clause &b);
+inline bool operator!=(const Clause &a, const Clause &b) { return !(a == b); }
+
+// Every clause must hold.
+struct Predicate {
+  std::vector<Clause> clauses;
+};
+
+// Parses clauses of the form `column op value` joined by `and`, where op is
+// one of < <= > >= = == != and the column is named as in `columns` — exactly,
+// or failing that regardless of case — or given by its number counting from
+// one. A value may be quoted. False with the reason in `error`.
+bool Parse(const std::string &text, const std::vector<std::string> &columns,
+           Predicate &out, std::string &error);
+
+// Whether the record satisfies every clause. `value` and `scratch` are
+// working buffers, reused across calls as csv::ExtractField's are.
+bool Matches(const Predicate &predicate, const std::string &record,
+             char delimiter, std::string &value, std::string &scratch);
+
+// Whether one cell satisfies one clause.
+bool Holds(const Clause &clause, const std::string &cell);
+// The same for a cell already read as Value() reads it, Number or Time.
+bool Holds(const Clause &clause, double value);
+
+// The cell as the clause compares it. False when it is not of its kind.
+bool Value(const Clause &clause, const std::string &cell, double &out);
+
+// Whether values ranging from `min` to `max` could include one satisfying a
+// Number or Time clause. A range with min > max holds no values at all. Text
+// clauses have no range and could always match.
+bool CouldMatch(const Clause &clause, double min, double max);
+
+} // namespace csvpredicate
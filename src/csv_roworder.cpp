@@ -0,0 +1,193 @@
+#include "csv_roworder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace csvrows {
+namespace {
+
+constexpr size_t kNarrowLimit = std::numeric_limits<uint32_t>::max();
+
+// Gives the file `bytes` of disk space now, so that a full disk is an error
+// here rather than a SIGBUS when the mapping first touches a page. Returns 0
+// or an errno value.
+int Preallocate(int fd, size_t bytes) {
+#ifdef __APPLE__
+  // No posix_fallocate on macOS. F_PREALLOCATE reserves the blocks, one run
+  // of them if it can, and ftruncate then makes them part of the file.
+  fstore_t store{};
+  store.fst_flags = F_ALLOCATECONTIG;
+  store.fst_posmode = F_PEOFPOSMODE;
+  store.fst_offset = 0;
+  store.fst_length = static_cast<off_t>(bytes);
+  if (::fcntl(fd, F_PREALLOCATE, &store) == -1) {
+    store.fst_flags = F_ALLOCATEALL;
+    if (::fcntl(fd, F_PREALLOCATE, &store) == -1)
+      return errno;
+  }
+  if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+    return errno;
+  return 0;
+#else
+  return ::posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+#endif
+}
+
+} // namespace
+
+RowOrder::RowOrder(const std::vector<size_t> &rows) {
+  size_t limit = 0;
+  for (size_t row : rows)
+    limit = std::max(limit, row);
+  wide_ = limit > kNarrowLimit;
+  if (wide_)
+    wide_rows_.assign(rows.begin(), rows.end());
+  else
+    narrow_rows_.assign(rows.begin(), rows.end());
+  size_ = rows.size();
+}
+
+RowOrder::~RowOrder() { Release(); }
+
+RowOrder::RowOrder(RowOrder &&other) noexcept { *this = std::move(other); }
+
+RowOrder &RowOrder::operator=(RowOrder &&other) noexcept {
+  if (this == &other)
+    return *this;
+  Release();
+  narrow_rows_ = std::move(other.narrow_rows_);
+  wide_rows_ = std::move(other.wide_rows_);
+  map_ = other.map_;
+  map_bytes_ = other.map_bytes_;
+  capacity_ = other.capacity_;
+  size_ = other.size_;
+  wide_ = other.wide_;
+  other.map_ = nullptr;
+  other.map_bytes_ = 0;
+  other.capacity_ = 0;
+  other.size_ = 0;
+  other.wide_ = false;
+  return *this;
+}
+
+void RowOrder::Release() {
+  if (map_ != nullptr)
+    ::munmap(map_, map_bytes_);
+  map_ = nullptr;
+  map_bytes_ = 0;
+  capacity_ = 0;
+  size_ = 0;
+  narrow_rows_.clear();
+  narrow_rows_.shrink_to_fit();
+  wide_rows_.clear();
+  wide_rows_.shrink_to_fit();
+}
+
+bool RowOrder::Reserve(size_t count, size_t row_limit, size_t memory_budget,
+                       const std::string &directory, std::string &error) {
+  Release();
+  wide_ = row_limit > kNarrowLimit + 1;
+  const size_t width = wide_ ? sizeof(uint64_t) : sizeof(uint32_t);
+  const size_t bytes = count * width;
+
+  if (memory_budget == 0 || bytes <= memory_budget || count == 0) {
+    if (wide_)
+      wide_rows_.reserve(count);
+    else
+      narrow_rows_.reserve(count);
+    return true;
+  }
+
+  std::string pattern =
+      (directory.empty() ? std::string(".") : directory) + "/csvtui-order-XXXXXX";
+  std::vector<char> name(pattern.begin(), pattern.end());
+  name.push_back('\0');
+
+  const int fd = ::mkstemp(name.data());
+  if (fd < 0) {
+    error = std::string("cannot write sort output to ") + directory + ": " +
+            std::strerror(errno);
+    return false;
+  }
+  // Gone from the directory at once; the mapping keeps the space alive for
+  // exactly as long as the order exists.
+  ::unlink(name.data());
+
+  // Allocated now rather than left sparse: a mapping that finds the disk full
+  // part way through is a SIGBUS, where this is an error message.
+  const int allocated = Preallocate(fd, bytes);
+  if (allocated != 0) {
+    error = "not enough space for sort output in " + directory + ": " +
+            std::strerror(allocated);
+    ::close(fd);
+    return false;
+  }
+  void *map =
+      ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  const int map_errno = errno;
+  ::close(fd); // the mapping holds its own reference
+  if (map == MAP_FAILED) {
+    error = "cannot map sort output in " + directory + ": " +
+            std::strerror(map_errno);
+    return false;
+  }
+
+  map_ = map;
+  map_bytes_ = bytes;
+  capacity_ = count;
+  return true;
+}
+
+void RowOrder::Widen() {
+  wide_rows_.assign(narrow_rows_.begin(), narrow_rows_.end());
+  narrow_rows_.clear();
+  narrow_rows_.shrink_to_fit();
+  wide_ = true;
+}
+
+bool RowOrder::push_back(size_t row) {
+  if (map_ != nullptr) {
+    if (size_ >= capacity_)
+      return false;
+    if (wide_)
+      static_cast<uint64_t *>(map_)[size_] = row;
+    else
+      static_cast<uint32_t *>(map_)[size_] = static_cast<uint32_t>(row);
+    ++size_;
+    return true;
+  }
+  if (!wide_ && row > kNarrowLimit)
+    Widen();
+  if (wide_)
+    wide_rows_.push_back(row);
+  else
+    narrow_rows_.push_back(static_cast<uint32_t>(row));
+  ++size_;
+  return true;
+}
+
+size_t RowOrder::MemoryBytes() const {
+  return narrow_rows_.capacity() * sizeof(uint32_t) +
+         wide_rows_.capacity() * sizeof(uint64_t);
+}
+
+std::vector<size_t> RowOrder::ToVector() const {
+  return std::vector<size_t>(begin(), end());
+}
+
+bool RowOrder::operator==(const RowOrder &other) const {
+  if (size_ != other.size_)
+    return false;
+  for (size_t i = 0; i < size_; ++i) {
+    if ((*this)[i] != other[i])
+      return false;
+  }
+  return true;
+}
+
+} // namespace csvrows
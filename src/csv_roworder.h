@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// The rows of a sorted view, in view order.
+//
+// A sort's answer is one row number per row, and it is the one part of a sort
+// that has to outlive it. Held as size_t that is eight bytes a row: 12 GB for
+// a billion and a half rows, which used to be refused before the first key was
+// read. Two things bring it down.
+//
+// Row numbers are stored in 32 bits whenever the file has fewer than four
+// billion rows, which is every file anyone has opened so far. That halves it.
+//
+// And when even that will not fit the memory budget, the array lives in a file
+// in the temporary directory, mapped into memory. Pages are written as the
+// merge produces them and read back as the view scrolls over them; the kernel
+// keeps what fits and evicts the rest to disk, where the file already is. The
+// file is unlinked the moment it is created, so nothing is left behind however
+// the process ends.
+namespace csvrows {
+
+class RowOrder {
+public:
+  RowOrder() = default;
+  // An in-memory copy of `rows`, narrow if they allow it.
+  explicit RowOrder(const std::vector<size_t> &rows);
+  ~RowOrder();
+
+  RowOrder(RowOrder &&other) noexcept;
+  RowOrder &operator=(RowOrder &&other) noexcept;
+  RowOrder(const RowOrder &) = delete;
+  RowOrder &operator=(const RowOrder &) = delete;
+
+  // Makes room for `count` rows, each below `row_limit`, which settles the
+  // width. If they would take more than `memory_budget` bytes (zero meaning no
+  // limit) they go to a mapped file in `directory` instead. Discards anything
+  // already held. Returns false, saying why in `error`, if the file cannot be
+  // made; the order is then empty and still usable in memory.
+  bool Reserve(size_t count, size_t row_limit, size_t memory_budget,
+               const std::string &directory, std::string &error);
+
+  // Appends a row. Once mapped, only as many as were reserved fit: one past
+  // that is not written off the end of the mapping, and returns false so
+  // the caller can fail rather than show a view with rows missing.
+  bool push_back(size_t row);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t operator[](size_t index) const {
+    if (map_ != nullptr)
+      return wide_ ? static_cast<const uint64_t *>(map_)[index]
+                   : static_cast<const uint32_t *>(map_)[index];
+    return wide_ ? wide_rows_[index] : narrow_rows_[index];
+  }
+
+  // Whether row numbers take 64 bits here rather than 32.
+  bool wide() const { return wide_; }
+  // Whether the rows live in a mapped file rather than on the heap.
+  bool mapped() const { return map_ != nullptr; }
+  // Heap held, for the model's accounting. A mapped order costs none: its
+  // pages belong to the page cache, which gives them back under pressure.
+  size_t MemoryBytes() const;
+
+  std::vector<size_t> ToVector() const;
+  bool operator==(const RowOrder &other) const;
+  bool operator!=(const RowOrder &other) const { return !(*this == other); }
+
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const size_t *;
+    using reference = size_t;
+
+    const_iterator(const RowOrder *order, size_t index)
+        : order_(order), index_(index) {}
+    size_t operator*() const { return (*order_)[index_]; }
+    const_iterator &operator++() {
+      ++index_;
+      return *this;
+    }
+    bool operator==(const const_iterator &other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const const_iterator &other) const {
+      return index_ != other.index_;
+    }
+
+  private:
+    const RowOrder *order_;
+    size_t index_;
+  };
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size_); }
+
+private:
+  void Release();
+  void Widen();
+
+  std::vector<uint32_t> narrow_rows_;
+  std::vector<uint64_t> wide_rows_;
+  void *map_ = nullptr;
+  size_t map_bytes_ = 0;
+  size_t capacity_ = 0; // rows the mapping holds
+  size_t size_ = 0;
+  bool wide_ = false;
+};
+
+} // namespace csvrows
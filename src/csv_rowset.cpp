@@ -0,0 +1,247 @@
+#include "csv_rowset.h"
+
+#include <algorithm>
+
+namespace csvrows {
+namespace {
+
+size_t PopCount(uint64_t word) {
+  return static_cast<size_t>(__builtin_popcountll(word));
+}
+
+// Position of the `n`th set bit (from zero) in `word`, which has more than n.
+size_t SelectInWord(uint64_t word, size_t n) {
+  for (; n > 0; --n)
+    word &= word - 1;
+  return static_cast<size_t>(__builtin_ctzll(word));
+}
+
+} // namespace
+
+void RowSet::Add(size_t row) {
+  const uint64_t key = static_cast<uint64_t>(row >> kContainerBits);
+  const uint16_t low = static_cast<uint16_t>(row & (kContainerRows - 1));
+
+  if (containers_.empty() || containers_.back().key != key) {
+    // The one before is finished: give back what its list grew into and will
+    // now never use.
+    if (!containers_.empty())
+      containers_.back().array.shrink_to_fit();
+    Container fresh;
+    fresh.key = key;
+    fresh.before = size_;
+    containers_.push_back(std::move(fresh));
+  }
+  Container &c = containers_.back();
+
+  if (c.bits.empty()) {
+    c.array.push_back(low);
+    if (c.array.size() > kMaxArrayEntries) {
+      // Denser than a list is worth: switch to the bitmap for good.
+      c.bits.assign(kBitmapWords, 0);
+      for (uint16_t v : c.array)
+        c.bits[v / 64] |= uint64_t{1} << (v % 64);
+      c.array.clear();
+      c.array.shrink_to_fit();
+    }
+  } else {
+    c.bits[low / 64] |= uint64_t{1} << (low % 64);
+  }
+  ++c.count;
+  ++size_;
+}
+
+size_t RowSet::Select(size_t rank) const {
+  // The last container starting at or before `rank`.
+  auto it = std::upper_bound(
+      containers_.begin(), containers_.end(), rank,
+      [](size_t r, const Container &c) { return r < c.before; });
+  if (it == containers_.begin())
+    return 0; // only reachable with rank >= size(), which callers rule out
+  const Container &c = *(it - 1);
+  const size_t base = static_cast<size_t>(c.key) << kContainerBits;
+  size_t within = rank - c.before;
+
+  if (c.bits.empty())
+    return within < c.array.size() ? base + c.array[within] : base;
+
+  for (size_t w = 0; w < c.bits.size(); ++w) {
+    const size_t here = PopCount(c.bits[w]);
+    if (within < here)
+      return base + w * 64 + SelectInWord(c.bits[w], within);
+    within -= here;
+  }
+  return base;
+}
+
+const RowSet::Container *RowSet::Find(uint64_t key) const {
+  auto it = std::lower_bound(
+      containers_.begin(), containers_.end(), key,
+      [](const Container &c, uint64_t k) { return c.key < k; });
+  return it != containers_.end() && it->key == key ? &*it : nullptr;
+}
+
+size_t RowSet::Rank(size_t row) const {
+  const uint64_t key = static_cast<uint64_t>(row >> kContainerBits);
+  const uint16_t low = static_cast<uint16_t>(row & (kContainerRows - 1));
+
+  auto it = std::lower_bound(
+      containers_.begin(), containers_.end(), key,
+      [](const Container &c, uint64_t k) { return c.key < k; });
+  if (it == containers_.end())
+    return size_;
+  if (it->key != key)
+    return it->before;
+
+  const Container &c = *it;
+  if (c.bits.empty())
+    return c.before + static_cast<size_t>(std::lower_bound(c.array.begin(),
+                                                           c.array.end(), low) -
+                                          c.array.begin());
+  size_t below = 0;
+  for (size_t w = 0; w < low / 64u; ++w)
+    below += PopCount(c.bits[w]);
+  const uint64_t mask = (uint64_t{1} << (low % 64)) - 1;
+  return c.before + below + PopCount(c.bits[low / 64] & mask);
+}
+
+bool RowSet::Contains(size_t row) const {
+  const Container *c = Find(static_cast<uint64_t>(row >> kContainerBits));
+  if (!c)
+    return false;
+  const uint16_t low = static_cast<uint16_t>(row & (kContainerRows - 1));
+  if (c->bits.empty())
+    return std::binary_search(c->array.begin(), c->array.end(), low);
+  return (c->bits[low / 64] >> (low % 64)) & 1u;
+}
+
+size_t RowSet::MemoryBytes() const {
+  size_t bytes = containers_.capacity() * sizeof(Container);
+  for (const Container &c : containers_)
+    bytes += c.array.capacity() * sizeof(uint16_t) +
+             c.bits.capacity() * sizeof(uint64_t);
+  return bytes;
+}
+
+void RowSet::ToBits(const Container &c, std::vector<uint64_t> &bits) {
+  if (!c.bits.empty()) {
+    bits = c.bits;
+    return;
+  }
+  bits.assign(kBitmapWords, 0);
+  for (uint16_t v : c.array)
+    bits[v / 64] |= uint64_t{1} << (v % 64);
+}
+
+void RowSet::AppendBits(uint64_t key, const std::vector<uint64_t> &bits) {
+  size_t count = 0;
+  for (uint64_t word : bits)
+    count += PopCount(word);
+  if (count == 0)
+    return;
+
+  Container c;
+  c.key = key;
+  c.before = size_;
+  c.count = count;
+  if (count > kMaxArrayEntries) {
+    c.bits = bits;
+  } else {
+    c.array.reserve(count);
+    for (size_t w = 0; w < bits.size(); ++w) {
+      uint64_t word = bits[w];
+      while (word != 0) {
+        c.array.push_back(
+            static_cast<uint16_t>(w * 64 + static_cast<size_t>(__builtin_ctzll(word))));
+        word &= word - 1;
+      }
+    }
+  }
+  size_ += count;
+  containers_.push_back(std::move(c));
+}
+
+// Both walk the two container lists in step, combining a bitmap's worth of
+// rows at a time. Going through a bitmap even for two short lists is not the
+// fastest way to merge them, but it is one path rather than four, and it is
+// still a few thousand word operations per 65 536 rows.
+RowSet RowSet::Intersect(const RowSet &a, const RowSet &b) {
+  RowSet out;
+  std::vector<uint64_t> left;
+  std::vector<uint64_t> right;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.containers_.size() && j < b.containers_.size()) {
+    const Container &x = a.containers_[i];
+    const Container &y = b.containers_[j];
+    if (x.key < y.key) {
+      ++i;
+    } else if (y.key < x.key) {
+      ++j;
+    } else {
+      ToBits(x, left);
+      ToBits(y, right);
+      for (size_t w = 0; w < kBitmapWords; ++w)
+        left[w] &= right[w];
+      out.AppendBits(x.key, left);
+      ++i;
+      ++j;
+    }
+  }
+  return out;
+}
+
+RowSet RowSet::Union(const RowSet &a, const RowSet &b) {
+  RowSet out;
+  std::vector<uint64_t> left;
+  std::vector<uint64_t> right;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.containers_.size() || j < b.containers_.size()) {
+    const bool take_a = j == b.containers_.size() ||
+                        (i < a.containers_.size() &&
+                         a.containers_[i].key <= b.containers_[j].key);
+    const bool take_b = i == a.containers_.size() ||
+                        (j < b.containers_.size() &&
+                         b.containers_[j].key <= a.containers_[i].key);
+    const uint64_t key = take_a ? a.containers_[i].key : b.containers_[j].key;
+    if (take_a)
+      ToBits(a.containers_[i++], left);
+    else
+      left.assign(kBitmapWords, 0);
+    if (take_b) {
+      ToBits(b.containers_[j++], right);
+      for (size_t w = 0; w < kBitmapWords; ++w)
+        left[w] |= right[w];
+    }
+    out.AppendBits(key, left);
+  }
+  return out;
+}
+
+bool RowSet::operator==(const RowSet &other) const {
+  if (size_ != other.size_ || containers_.size() != other.containers_.size())
+    return false;
+  // Both sides pick the same form for the same contents only when built the
+  // same way, so compare what they hold rather than how.
+  std::vector<uint64_t> left;
+  std::vector<uint64_t> right;
+  for (size_t i = 0; i < containers_.size(); ++i) {
+    const Container &x = containers_[i];
+    const Container &y = other.containers_[i];
+    if (x.key != y.key || x.count != y.count)
+      return false;
+    if (x.bits.empty() && y.bits.empty()) {
+      if (x.array != y.array)
+        return false;
+      continue;
+    }
+    ToBits(x, left);
+    ToBits(y, right);
+    if (left != right)
+      return false;
+  }
+  return true;
+}
+
+} // namespace csvrows
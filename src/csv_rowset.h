@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The rows a filter kept, stored as a set rather than a list.
+//
+// A filter that does not sort keeps its rows in file order, so the view is
+// fully described by which physical rows are in it. Listing them costs eight
+// bytes each, and a broad filter over a large file was refused for wanting
+// gigabytes of what is, underneath, one yes-or-no per row.
+//
+// This is the usual compressed-bitmap layout. Rows are grouped 65 536 to a
+// container by their high bits. A container holding few of its rows lists
+// their low 16 bits, two bytes each; once that would outgrow a plain bitmap of
+// the whole range — 4 096 entries, 8 KB — it becomes that bitmap instead. No
+// container ever costs more than a bit per row it covers, and a sparse one
+// costs far less.
+//
+// Each container also records how many rows come before it, so finding the
+// view's Nth row is a binary search over containers and then, at worst, a
+// popcount over one bitmap — cheap enough to do for every cell on screen.
+namespace csvrows {
+
+class RowSet {
+public:
+  // Appends `row`, which must be greater than every row added so far. The
+  // scan produces rows in file order, so this is the only way in it needs.
+  void Add(size_t row);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // The row at position `rank` in file order; rank must be below size().
+  size_t Select(size_t rank) const;
+  // How many rows in the set come before `row`.
+  size_t Rank(size_t row) const;
+  bool Contains(size_t row) const;
+
+  // Calls f(row) for every row, in ascending order.
+  template <typename F> void ForEach(F &&f) const {
+    for (const Container &c : containers_) {
+      const size_t base = static_cast<size_t>(c.key) << kContainerBits;
+      if (c.bits.empty()) {
+        for (uint16_t low : c.array)
+          f(base + low);
+        continue;
+      }
+      for (size_t w = 0; w < c.bits.size(); ++w) {
+        uint64_t word = c.bits[w];
+        while (word != 0) {
+          f(base + w * 64 + static_cast<size_t>(__builtin_ctzll(word)));
+          word &= word - 1;
+        }
+      }
+    }
+  }
+
+  // What the set occupies, for the model's memory accounting.
+  size_t MemoryBytes() const;
+
+  // Rows in both, or in either. Filters seen earlier can be combined this way
+  // without reading the file again.
+  static RowSet Intersect(const RowSet &a, const RowSet &b);
+  static RowSet Union(const RowSet &a, const RowSet &b);
+
+  bool operator==(const RowSet &other) const;
+  bool operator!=(const RowSet &other) const { return !(*this == other); }
+
+  static constexpr size_t kContainerBits = 16;
+  static constexpr size_t kContainerRows = size_t{1} << kContainerBits;
+  // Past this many entries a list costs more than the bitmap it stands for.
+  static constexpr size_t kMaxArrayEntries = 4096;
+
+private:
+  static constexpr size_t kBitmapWords = kContainerRows / 64;
+
+  struct Container {
+    uint64_t key = 0;    // row >> kContainerBits
+    size_t before = 0;   // rows in the containers ahead of this one
+    size_t count = 0;
+    std::vector<uint16_t> array; // sorted low bits, while sparse
+    std::vector<uint64_t> bits;  // kBitmapWords words, once dense
+  };
+
+  // Appends a container built from a full bitmap, choosing its form.
+  void AppendBits(uint64_t key, const std::vector<uint64_t> &bits);
+  static void ToBits(const Container &c, std::vector<uint64_t> &bits);
+  // The container that holds `row`'s range, or null.
+  const Container *Find(uint64_t key) const;
+
+  std::vector<Container> containers_;
+  size_t size_ = 0;
+};
+
+} // namespace csvrows
@@ -1,12 +1,27 @@
 #include "csv_scan.h"
 
+#include "csv_group.h"
 #include "csv_parser.h"
+#include "csv_sketch.h"
 #include "csv_sortrun.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
 #include <utility>
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 namespace csvscan {
 namespace {
 
@@ -19,42 +34,452 @@ constexpr auto kReportInterval = std::chrono::milliseconds(100);
 
 using csvsort::Key;
 
-} // namespace
+// A profile gives up on fields past this many. A row that wide is not the
+// shape of the file but a stray quote swallowing the rest of it, and each
+// column costs a few kilobytes of sketch.
+constexpr size_t kMaxProfileColumns = 4096;
 
-Outcome Run(const Request &request, Result &out,
-            const std::function<bool()> &cancelled,
-            const std::function<void(const Progress &)> &report) {
-  out = Result{};
+// The sample a pass with `estimate_stats` takes before it reads: this many
+// blocks of up to this many rows, from points spread at random over the file.
+// Blocks rather than single rows because each costs a seek and the rows after
+// it are all but free. Sixty-four seeks are half a second on a spinning disk
+// and a few milliseconds on anything else.
+constexpr size_t kSampleBlocks = 64;
+constexpr size_t kSampleBlockRows = 128;
+// Fixed, so the same file gives the same estimates each time it is asked.
+constexpr std::uint64_t kSampleSeed = 0x5eed5eed5eed5eedull;
+// Standard errors either side of an estimate for a 95% interval.
+constexpr double kConfidence = 1.96;
+
+// What one column's values add up to. The statistics of one column and the
+// profile of all of them are both built from this, so the two cannot
+// disagree about what a number is.
+class ColumnAccumulator {
+public:
+  // Quantiles cost forty-odd kilobytes a column, which one column's
+  // statistics can afford and a profile of hundreds would rather not.
+  explicit ColumnAccumulator(bool quantiles = false) : quantiles_(quantiles) {}
+
+  // What Add made of a value, for a caller that wants it too.
+  struct Reading {
+    bool number = false;
+    bool date = false;
+    double value = 0.0; // the number, when it was one
+  };
+
+  Reading Add(const std::string &value) {
+    Reading reading;
+    ++present_;
+    if (value.empty()) {
+      ++profile_.stats.empty;
+      return reading;
+    }
+
+    size_t length = 0;
+    for (char c : value)
+      length += (static_cast<unsigned char>(c) & 0xC0) != 0x80 ? 1 : 0;
+    if (!any_value_ || length < profile_.min_length)
+      profile_.min_length = length;
+    profile_.max_length = std::max(profile_.max_length, length);
+    any_value_ = true;
+    distinct_.Add(value);
+
+    double number = 0.0;
+    if (csv::ParseNumber(value, number)) {
+      reading.number = true;
+      reading.value = number;
+      ++profile_.stats.numeric;
+      sum_ += number;
+      if (quantiles_)
+        sketch_.Add(number);
+      if (profile_.stats.numeric == 1) {
+        profile_.stats.min = profile_.stats.max = number;
+      } else {
+        profile_.stats.min = std::min(profile_.stats.min, number);
+        profile_.stats.max = std::max(profile_.stats.max, number);
+      }
+      if (csv::IsInteger(value))
+        ++profile_.integers;
+    } else if (csv::IsDate(value)) {
+      reading.date = true;
+      ++profile_.dates;
+    }
+    return reading;
+  }
+
+  // `rows` is how many rows the pass kept. Those too short to reach this
+  // column never called Add, and count as empty.
+  ColumnProfile Finish(size_t rows) const {
+    ColumnProfile out = profile_;
+    out.stats.total = rows;
+    out.stats.empty += rows - std::min(rows, present_);
+    if (out.stats.numeric > 0)
+      out.stats.mean = sum_ / static_cast<double>(out.stats.numeric);
+    if (quantiles_ && sketch_.count() > 0) {
+      out.stats.p50 = sketch_.Quantile(0.5);
+      out.stats.p90 = sketch_.Quantile(0.9);
+      out.stats.p99 = sketch_.Quantile(0.99);
+      out.stats.p999 = sketch_.Quantile(0.999);
+      out.stats.quantiles_exact = sketch_.exact();
+    }
+    const size_t values = present_ - profile_.stats.empty;
+    out.distinct = std::min(
+        values, static_cast<size_t>(std::llround(distinct_.Estimate())));
+    return out;
+  }
+
+  // What has been added so far, before Finish rounds it off: the counts, the
+  // range and the sum, and the sketch the quantiles come from.
+  const ColumnProfile &partial() const { return profile_; }
+  double sum() const { return sum_; }
+  const csvsketch::QuantileSketch &sketch() const { return sketch_; }
+
+private:
+  ColumnProfile profile_;
+  double sum_ = 0.0;
+  size_t present_ = 0;
+  bool any_value_ = false;
+  bool quantiles_ = false;
+  csvsketch::DistinctCounter distinct_;
+  csvsketch::QuantileSketch sketch_;
+};
+
+// Zone maps of a few columns, or of all of them, built as the rows go by.
+class ZoneBuilder {
+public:
+  explicit ZoneBuilder(size_t zone_rows) : zone_rows_(std::max<size_t>(zone_rows, 1)) {}
+
+  void Note(size_t column, bool times, size_t row, double value) {
+    const size_t slot = column * 2 + (times ? 1 : 0);
+    if (slot >= index_.size())
+      index_.resize(slot + 1, kNone);
+    if (index_[slot] == kNone) {
+      index_[slot] = maps_.size();
+      maps_.emplace_back();
+      maps_.back().column = column;
+      maps_.back().times = times;
+    }
+    csvcache::ZoneMap &map = maps_[index_[slot]];
+    const size_t zone = row / zone_rows_;
+    if (zone >= map.min.size())
+      Extend(map, zone + 1);
+    map.min[zone] = std::min(map.min[zone], value);
+    map.max[zone] = std::max(map.max[zone], value);
+  }
+
+  // The maps, every one covering the whole file: zones after a column's
+  // last value are there, and empty.
+  std::vector<csvcache::ZoneMap> Finish(size_t total_rows) {
+    const size_t zones = (total_rows + zone_rows_ - 1) / zone_rows_;
+    for (csvcache::ZoneMap &map : maps_)
+      Extend(map, zones);
+    return std::move(maps_);
+  }
+
+private:
+  static constexpr size_t kNone = static_cast<size_t>(-1);
+
+  static void Extend(csvcache::ZoneMap &map, size_t zones) {
+    if (zones <= map.min.size())
+      return;
+    map.min.resize(zones, std::numeric_limits<double>::infinity());
+    map.max.resize(zones, -std::numeric_limits<double>::infinity());
+  }
+
+  size_t zone_rows_;
+  std::vector<size_t> index_; // column * 2 + times -> position in maps_
+  std::vector<csvcache::ZoneMap> maps_;
+};
+
+// Whether a row passes the request's filter, whichever kind it is.
+bool Keeps(const Request &request, bool ignore_case, const std::string &record,
+           std::string &value, std::string &scratch) {
+  if (request.filter_predicate)
+    return csvpredicate::Matches(request.predicate, record, request.delimiter,
+                                 value, scratch);
+  return csv::RecordContains(record, request.delimiter, request.filter_pattern,
+                             ignore_case, scratch);
+}
+
+// The narrowing pass: re-tests the rows of an existing view and keeps those
+// the filter still accepts, in the view's own order. The view is either a
+// permutation (`refine_rows`) or a set (`refine_set`), and the result takes
+// the same form.
+//
+// The rows are visited in file order, a chunk at a time, whatever order the
+// view has them in. A chunk holding none of them is never read, and one that
+// follows straight on from the last is read without seeking, so narrowing a
+// view of a few thousand rows out of millions costs a few thousand rows.
+Outcome Refine(const Request &request, Result &out,
+               const std::function<bool()> &cancelled,
+               const std::function<void(const Progress &)> &report) {
+  const csvcache::ChunkOffsets &offsets = request.refine_offsets;
+  const size_t chunk_size = std::max<size_t>(request.chunk_size, 1);
+  const csvrows::RowSet *set = request.refine_set.get();
+  const size_t view_rows =
+      set ? set->size() : request.refine_rows ? request.refine_rows->size() : 0;
 
   std::ifstream file(request.path, std::ios::binary);
   if (!file.is_open())
     return Outcome::Failed;
-  file.seekg(request.data_offset);
-  if (!file)
-    return Outcome::Failed;
 
-  out.offsets.push_back(request.data_offset);
+  // One bit per physical row: set for the rows still in the running, cleared
+  // as they fail. The view's order is only needed again at the end.
+  size_t limit = 0;
+  if (set) {
+    if (!set->empty())
+      limit = set->Select(set->size() - 1) + 1;
+  } else if (request.refine_rows) {
+    for (size_t row : *request.refine_rows)
+      limit = std::max(limit, row + 1);
+  }
+  if (limit > 0 && (limit - 1) / chunk_size >= offsets.size())
+    return Outcome::Failed; // the table does not reach that far
+  std::vector<bool> wanted(limit, false);
+  if (set) {
+    set->ForEach([&wanted](size_t row) { wanted[row] = true; });
+  } else if (request.refine_rows) {
+    for (size_t row : *request.refine_rows)
+      wanted[row] = true;
+  }
 
   const bool filtering = request.filter && !request.filter_pattern.empty();
   const bool ignore_case =
       filtering && csv::SmartCaseInsensitive(request.filter_pattern);
 
-  const bool counting = !request.count_pattern.empty();
-  const bool count_ignore_case =
-      counting && csv::SmartCaseInsensitive(request.count_pattern);
+  std::string record;
+  std::string value;
+  std::string scratch;
+  size_t examined = 0;
+  size_t kept = 0;
+  size_t since_report = 0;
+  auto last_report = std::chrono::steady_clock::now();
 
+  const auto publish = [&](bool final) {
+    if (!report)
+      return;
+    Progress progress;
+    progress.rows = examined;
+    progress.kept = kept;
+    progress.phase = Phase::Reading;
+    progress.fraction =
+        final || view_rows == 0
+            ? 1.0
+            : static_cast<double>(examined) / static_cast<double>(view_rows);
+    report(progress);
+    last_report = std::chrono::steady_clock::now();
+  };
+
+  // The row the stream stands at, if it stands anywhere useful.
+  size_t at = static_cast<size_t>(-1);
+  for (size_t first = 0; first < limit; first += chunk_size) {
+    size_t last = std::min(first + chunk_size, limit);
+    while (last > first && !wanted[last - 1])
+      --last;
+    if (last == first)
+      continue; // nothing of the view lives here
+
+    if (at != first) {
+      file.clear();
+      file.seekg(offsets[first / chunk_size]);
+      if (!file)
+        return Outcome::Failed;
+      at = first;
+    }
+
+    while (at < last) {
+      if (cancelled && cancelled())
+        return Outcome::Cancelled;
+      // The offsets promised a row here. Running out means they describe some
+      // other version of the file.
+      if (!csv::ReadRecord(file, record))
+        return Outcome::Failed;
+      const size_t row = at++;
+      if (!wanted[row])
+        continue;
+
+      ++examined;
+      if (!filtering || Keeps(request, ignore_case, record, value, scratch))
+        ++kept;
+      else
+        wanted[row] = false;
+
+      if (++since_report >= kRowsBetweenClockChecks) {
+        since_report = 0;
+        if (std::chrono::steady_clock::now() - last_report >= kReportInterval)
+          publish(false);
+      }
+    }
+  }
+
+  if (set) {
+    set->ForEach([&](size_t row) {
+      if (wanted[row])
+        out.rows.Add(row);
+    });
+    out.has_rows = true;
+  } else {
+    if (!out.order.Reserve(kept, limit, request.order_memory_budget,
+                           csvsort::TempDirectory(), out.error))
+      return Outcome::Failed;
+    for (size_t row : *request.refine_rows) {
+      if (wanted[row] && !out.order.push_back(row)) {
+        out.error = "refining the view kept more rows than it counted";
+        return Outcome::Failed;
+      }
+    }
+    out.has_order = true;
+  }
+
+  publish(true);
+  return Outcome::Done;
+}
+
+// Everything one full pass accumulates, and none of the reading. A pass is fed
+// its rows by whoever reads the file: Run, for a pass on its own, or the
+// scanner's shared read, which feeds several at once. Rows arrive in file
+// order, except for a pass that joined a read part way down, which sees the
+// rest of the file first and the top of it after.
+class Pass {
+public:
+  Pass(const Request &request, Result &out, std::function<bool()> cancelled,
+       std::function<void(const Progress &)> report);
+  ~Pass();
+
+  bool cancelled() const { return cancelled_ && cancelled_(); }
+
+  // Feeds one row. False when the pass cannot go on, with the reason in the
+  // result.
+  bool Row(size_t index, const std::string &record);
+  // Reports progress, at most once per interval. `fraction` is how much of
+  // the file this pass has seen; what it has still to see runs from `here`
+  // to the end and round from the top to `joined`, or straight to `joined`
+  // once it has gone round.
+  void Tick(double fraction, std::streampos here, std::streampos joined);
+  // Every row has been seen: sorts, merges and hands over. The offsets and
+  // the row count belong to the read rather than to any one pass.
+  Outcome Finish(const std::vector<std::streampos> &offsets, size_t total_rows);
+
+private:
+  // Rows read from one point of the file ahead of the pass, for estimating
+  // the statistics of the part it has not reached.
+  struct SampleBlock {
+    std::streampos offset; // where its first row starts
+    double bytes = 0.0;    // what its rows span, kept by the filter or not
+    double sum = 0.0;
+    std::vector<double> numbers; // the column's, in the rows the filter kept
+  };
+
+  void Publish(double fraction, bool final);
+  std::vector<size_t> LeadingRows();
+  bool Keeps(size_t index, const std::string &record);
+  void NoteTrigrams(size_t index, const std::string &record);
+  void Sample();
+  bool Unseen(std::streampos offset) const;
+  StatsEstimate Estimate(double fraction) const;
+
+  const Request request_;
+  Result &out_;
+  std::function<bool()> cancelled_;
+  std::function<void(const Progress &)> report_;
+
+  bool filtering_ = false;
+  bool ignore_case_ = false;
+  bool counting_ = false;
+  bool count_ignore_case_ = false;
   // Only one of these is ever populated: a sort needs a key per row, a plain
   // filter needs just the row numbers, and a stats pass needs neither.
-  const bool collecting_keys = request.want_order && request.sort;
-  const bool collecting_rows = request.want_order && !request.sort && filtering;
+  bool collecting_keys_ = false;
+  bool collecting_rows_ = false;
+
+  csvsort::Order order_;
+  csvsort::RunStore runs_;
+  csvrows::RowSet kept_;    // rows surviving the filter, in file order
+  csvrows::RowSet wrapped_; // the same, once round the end to the top
+  std::vector<Key> keys_;   // one per row of the sorted view, until it spills
+  size_t kept_count_ = 0;   // counted separately: `kept_` may not be in use
+  size_t key_bytes_ = 0;    // approximate footprint of `keys_`
+  size_t rows_ = 0;         // rows seen
+  size_t last_index_ = 0;
+  bool wrapped_around_ = false;
+
+  ColumnAccumulator stats_{true};
+  csvsketch::FrequencyCounter frequencies_;
+  std::unique_ptr<csvgroup::Aggregator> groups_;
+  std::string group_key_; // reused, like value_
+  std::vector<ColumnAccumulator> profile_;
+  // Zone maps, for a pass that will see every row: a skimming pass does not,
+  // and a filtered profile does not look at the rows it leaves out.
+  std::unique_ptr<ZoneBuilder> zones_;
+  bool zoning_profile_ = false;
+  // Trigram filters, likewise only for a pass that sees every row.
+  std::shared_ptr<csvcache::GramFilters> grams_;
+  // The search index, the same. `gram_set_` gathers the zone being read, and
+  // goes to the builder when the rows move on to another.
+  std::unique_ptr<csvcache::GramIndexBuilder> gram_index_;
+  csvsketch::TrigramSet gram_set_;
+  size_t gram_zone_ = 0;
+  std::string scratch_; // reused by the field walker: no allocation per row
+  std::string value_;   // the extracted stats cell, likewise reused
+
+  // The sample is taken on a thread of its own: its seeks would otherwise
+  // hold up the shared read, and every other pass riding it, before the
+  // first row. `sample_` is the sampler's until `sampled_` is set.
+  bool estimating_ = false;
+  double span_ = 0.0; // bytes of data, header excluded
+  std::vector<SampleBlock> sample_;
+  std::atomic<bool> sampled_{false};
+  std::atomic<bool> stop_sampling_{false};
+  std::thread sampler_;
+  bool estimate_shown_ = false; // the first is published as soon as it can be
+  // The part of the file still to be read, as at the last tick (see Tick).
+  // Unset before the first, when all of it is.
+  std::streampos unseen_from_{-1};
+  std::streampos unseen_to_{-1};
+
+  // The best keys seen so far, kept as a heap whose top is the next to give
+  // way. One comparison per row while it is full, which is nothing beside
+  // extracting the key, and a copy only for a row that gets in.
+  size_t leading_limit_ = 0;
+  std::vector<Key> leading_;
+  bool leading_changed_ = false;
 
-  std::vector<size_t> kept; // rows surviving the filter, in file order
-  std::vector<Key> keys;    // one per row of the sorted view, until it spills
-  size_t kept_count = 0;    // counted separately: `kept` may not be in use
+  // Matches not yet reported. Never more than one report interval's worth:
+  // the full set is in `kept_`, and this is only the news.
+  bool streaming_ = false;
+  std::vector<size_t> fresh_;
 
-  const csvsort::Order order{request.sort_descending};
-  csvsort::RunStore runs(csvsort::TempDirectory());
-  size_t key_bytes = 0; // approximate footprint of `keys`
+  std::chrono::steady_clock::time_point last_report_;
+};
+
+Pass::Pass(const Request &request, Result &out, std::function<bool()> cancelled,
+           std::function<void(const Progress &)> report)
+    : request_(request), out_(out), cancelled_(std::move(cancelled)),
+      report_(std::move(report)), order_{request.sort_descending},
+      runs_(csvsort::TempDirectory()),
+      frequencies_(request.frequency_memory_budget) {
+  if (request_.want_groups)
+    groups_ = std::make_unique<csvgroup::Aggregator>(
+        csvsort::TempDirectory(), request_.group_memory_budget);
+  filtering_ = request_.filter && !request_.filter_pattern.empty();
+  const bool whole =
+      request_.skim_chunks.empty() && request_.resume_offsets.empty();
+  zoning_profile_ = whole && request_.want_profile && !filtering_;
+  if (whole && (zoning_profile_ || (filtering_ && request_.filter_predicate)))
+    zones_ = std::make_unique<ZoneBuilder>(
+        std::max<size_t>(request_.chunk_size, 1) * csvcache::kChunksPerZone);
+  if (whole && request_.gram_bits > 0 && request_.gram_bits % 64 == 0) {
+    grams_ = std::make_shared<csvcache::GramFilters>();
+    grams_->bits = request_.gram_bits;
+  }
+  if (whole && request_.want_gram_index)
+    gram_index_ = std::make_unique<csvcache::GramIndexBuilder>();
+  ignore_case_ = filtering_ && csv::SmartCaseInsensitive(request_.filter_pattern);
+  counting_ = !request_.count_pattern.empty();
+  count_ignore_case_ =
+      counting_ && csv::SmartCaseInsensitive(request_.count_pattern);
+  collecting_keys_ = request_.want_order && request_.sort;
+  collecting_rows_ = request_.want_order && !request_.sort && filtering_;
 
   // Size the key vector once rather than doubling it a dozen times: during a
   // doubling both buffers are live, and on a large file that copy is the peak
@@ -65,267 +490,1329 @@ Outcome Run(const Request &request, Result &out,
   // usually keeps a small fraction, and reserving the whole file for it would
   // waste far more than the growth it avoids. And never past the budget, which
   // is the whole point of having one.
-  if (request.expected_rows > 0 && collecting_keys && !filtering) {
-    size_t want = request.expected_rows;
-    if (request.sort_memory_budget > 0)
-      want = std::min(want, request.sort_memory_budget / sizeof(Key));
-    keys.reserve(want);
+  if (request_.expected_rows > 0 && collecting_keys_ && !filtering_) {
+    size_t want = request_.expected_rows;
+    if (request_.sort_memory_budget > 0)
+      want = std::min(want, request_.sort_memory_budget / sizeof(Key));
+    keys_.reserve(want);
   }
 
-  double sum = 0.0;
-  bool first_number = true;
+  const bool reporting = static_cast<bool>(report_);
+  leading_limit_ = collecting_keys_ && reporting ? request_.provisional_rows : 0;
+  streaming_ = collecting_rows_ && request_.stream_matches && reporting;
+  last_report_ = std::chrono::steady_clock::now();
 
-  std::string record;
-  std::string scratch; // reused by the field walker: no allocation per row
-  std::string value;   // the extracted stats cell, likewise reused
-  size_t rows = 0;
-  size_t since_report = 0;
-  const size_t chunk_size = std::max<size_t>(request.chunk_size, 1);
+  span_ = static_cast<double>(request_.file_size) -
+          static_cast<double>(static_cast<std::streamoff>(request_.data_offset));
+  estimating_ = request_.want_stats && request_.estimate_stats && reporting;
+  if (estimating_)
+    sampler_ = std::thread([this] { Sample(); });
+}
 
-  auto last_report = std::chrono::steady_clock::now();
+Pass::~Pass() {
+  stop_sampling_.store(true, std::memory_order_relaxed);
+  if (sampler_.joinable())
+    sampler_.join();
+}
 
-  const auto publish = [&](bool final) {
-    if (!report)
+// Samples blocks from across the file the way
+// CSVModel::RefineAverageRecordBytes probes it for record length: seek, read
+// to the end of the line to land on a record boundary, and read from there. A
+// newline inside a quoted field can put the boundary in the wrong place,
+// which costs one block some mis-split rows rather than the estimate. Until
+// it is done the readout has the rows read and no estimate.
+void Pass::Sample() {
+  if (span_ <= 0.0)
+    return;
+  std::ifstream file(request_.path, std::ios::binary);
+  if (!file.is_open())
+    return; // no estimate, then; the read proper will say what is wrong
+
+  std::mt19937_64 random(kSampleSeed);
+  std::uniform_real_distribution<double> where(0.0, span_);
+  std::vector<double> points(kSampleBlocks);
+  for (double &point : points)
+    point = where(random);
+  std::sort(points.begin(), points.end()); // so the seeks all go one way
+
+  // Its own buffers: `value_` and `scratch_` are the read's. Nor does it ask
+  // cancelled(), which belongs to the read's thread too; a pass cancelled
+  // ends, and stops it on the way out.
+  std::vector<SampleBlock> sample;
+  std::string discard;
+  std::string record;
+  std::string value;
+  std::string scratch;
+  for (double point : points) {
+    if (stop_sampling_.load(std::memory_order_relaxed))
       return;
-    Progress progress;
-    progress.rows = rows;
-    progress.kept = kept_count;
-    progress.phase = Phase::Reading;
-    if (final) {
-      progress.fraction = 1.0;
-    } else {
-      const std::streampos here = file.tellg();
-      if (request.file_size > 0 && here != std::streampos(-1)) {
-        progress.fraction =
-            std::min(1.0, static_cast<double>(here) /
-                              static_cast<double>(request.file_size));
+    file.clear();
+    file.seekg(request_.data_offset + static_cast<std::streamoff>(point));
+    if (!file || !std::getline(file, discard))
+      continue;
+
+    SampleBlock block;
+    block.offset = file.tellg();
+    if (block.offset == std::streampos(-1))
+      continue;
+    size_t rows = 0;
+    while (rows < kSampleBlockRows && csv::ReadRecord(file, record)) {
+      ++rows;
+      if (filtering_ &&
+          !csvscan::Keeps(request_, ignore_case_, record, value, scratch))
+        continue;
+      csv::ExtractField(record, request_.delimiter, request_.stats_column,
+                        value, scratch);
+      double number = 0.0;
+      if (csv::ParseNumber(value, number)) {
+        block.numbers.push_back(number);
+        block.sum += number;
       }
     }
-    report(progress);
-    last_report = std::chrono::steady_clock::now();
-  };
+    // Having read to the end, the stream no longer says where it is.
+    const double end = file.eof() ? static_cast<double>(request_.file_size)
+                                  : static_cast<double>(file.tellg());
+    block.bytes = end - static_cast<double>(block.offset);
+    if (rows > 0 && block.bytes > 0.0)
+      sample.push_back(std::move(block));
+  }
+  sample_ = std::move(sample);
+  sampled_.store(true, std::memory_order_release);
+}
 
-  while (true) {
-    if (cancelled && cancelled())
-      return Outcome::Cancelled;
+bool Pass::Unseen(std::streampos offset) const {
+  if (unseen_from_ == std::streampos(-1))
+    return true;
+  if (unseen_from_ < unseen_to_)
+    return offset >= unseen_from_ && offset < unseen_to_;
+  return offset >= unseen_from_ || offset < unseen_to_;
+}
 
-    if (!csv::ReadRecord(file, record))
-      break;
-    const size_t index = rows;
-    ++rows;
-    ++since_report;
+// Rows read are exact, and the sample blocks in the part not yet read stand
+// for it, scaled by the bytes left. The estimate is theirs combined: a mean
+// weighted by how many numbers each side holds or is thought to, and
+// quantiles of the two distributions pooled, the sketch's for the rows read
+// and the sample's for the rest. As the read goes on the sample's share
+// shrinks, and with it the intervals, until the read is exact and they close.
+StatsEstimate Pass::Estimate(double fraction) const {
+  StatsEstimate out;
+  out.covered = fraction;
 
-    if (rows % chunk_size == 0) {
-      const std::streampos here = file.tellg();
-      if (here == std::streampos(-1))
+  // Near the end there may be no block left in the sliver still to read, and
+  // then the whole sample stands for it.
+  std::vector<const SampleBlock *> standing;
+  for (const SampleBlock &block : sample_)
+    if (Unseen(block.offset))
+      standing.push_back(&block);
+  if (standing.empty())
+    for (const SampleBlock &block : sample_)
+      standing.push_back(&block);
+
+  double bytes = 0.0;
+  double sum = 0.0;
+  std::vector<double> pooled;
+  for (const SampleBlock *block : standing) {
+    bytes += block->bytes;
+    sum += block->sum;
+    pooled.insert(pooled.end(), block->numbers.begin(), block->numbers.end());
+  }
+  std::sort(pooled.begin(), pooled.end());
+  const double sampled = static_cast<double>(pooled.size());
+
+  const Stats &read = stats_.partial().stats;
+  const double exact = static_cast<double>(read.numeric);
+  const double rest =
+      bytes > 0.0 ? sampled / bytes * (1.0 - fraction) * span_ : 0.0;
+  const double total = exact + rest;
+  out.sampled = pooled.size();
+
+  bool any = read.numeric > 0;
+  if (any) {
+    out.min = read.min;
+    out.max = read.max;
+  }
+  for (const SampleBlock &block : sample_) {
+    for (double number : block.numbers) {
+      out.min = any ? std::min(out.min, number) : number;
+      out.max = any ? std::max(out.max, number) : number;
+      any = true;
+    }
+  }
+  out.numeric = any;
+  if (!any || total <= 0.0)
+    return out;
+
+  // The mean, and its standard error from the sample's side. Rows come in
+  // blocks of neighbours, which resemble one another more than rows drawn
+  // one at a time would, so the variance is taken between blocks, as for a
+  // ratio estimate, rather than between values; taken between values it
+  // would claim a precision the sample does not have.
+  const double rest_mean = sampled > 0.0 ? sum / sampled : 0.0;
+  double variance = 0.0; // of rest_mean
+  double spread = 0.0;   // of the values themselves
+  if (standing.size() > 1 && sampled > 1.0) {
+    const double blocks = static_cast<double>(standing.size());
+    const double per_block = sampled / blocks;
+    double between = 0.0;
+    for (const SampleBlock *block : standing) {
+      const double deviation =
+          block->sum - rest_mean * static_cast<double>(block->numbers.size());
+      between += deviation * deviation;
+    }
+    variance = between / (blocks * (blocks - 1.0) * per_block * per_block);
+    for (double number : pooled)
+      spread += (number - rest_mean) * (number - rest_mean);
+    spread /= sampled - 1.0;
+  }
+  const double rest_share = rest / total;
+  const double half = kConfidence * std::sqrt(variance) * rest_share;
+  out.mean.value = (stats_.sum() + rest * rest_mean) / total;
+  out.mean.low = out.mean.value - half;
+  out.mean.high = out.mean.value + half;
+
+  // Quantiles of the two pooled: the smallest value with at least q of the
+  // combined weight at or below it, found by halving the range.
+  const std::vector<std::pair<double, std::uint64_t>> ranks =
+      stats_.sketch().Ranks();
+  const auto below = [&](double x) {
+    double weight = 0.0;
+    if (!ranks.empty()) {
+      auto it = std::upper_bound(
+          ranks.begin(), ranks.end(), x,
+          [](double v, const std::pair<double, std::uint64_t> &entry) {
+            return v < entry.first;
+          });
+      if (it != ranks.begin())
+        weight += exact * static_cast<double>(std::prev(it)->second) /
+                  static_cast<double>(ranks.back().second);
+    }
+    if (sampled > 0.0)
+      weight += rest *
+                static_cast<double>(
+                    std::upper_bound(pooled.begin(), pooled.end(), x) -
+                    pooled.begin()) /
+                sampled;
+    return weight / total;
+  };
+  const auto quantile = [&](double q) {
+    double low = out.min;
+    double high = out.max;
+    if (below(low) >= q)
+      return low;
+    for (int i = 0; i < 64 && low < high; ++i) {
+      const double middle = low + (high - low) / 2.0;
+      if (middle <= low || middle >= high)
         break;
-      out.offsets.push_back(here);
-    }
-
-    // Does this row belong to the view being built?
-    const bool keep =
-        !filtering || csv::RecordContains(record, request.delimiter,
-                                          request.filter_pattern, ignore_case,
-                                          scratch);
-
-    if (keep) {
-      ++kept_count;
-      if (counting &&
-          csv::RecordContains(record, request.delimiter, request.count_pattern,
-                              count_ignore_case, scratch))
-        ++out.matches;
-      if (collecting_keys) {
-        Key key;
-        key.row = index;
-        csv::ExtractField(record, request.delimiter, request.sort_column,
-                          key.text, scratch);
-        key.numeric = csv::ParseNumber(key.text, key.number);
-        key_bytes += csvsort::KeyBytes(key);
-        keys.push_back(std::move(key));
-
-        // Buffer full: sort what we have, write it out, and start again. This
-        // is what stops a sort's memory from following the file's size.
-        if (request.sort_memory_budget > 0 &&
-            key_bytes >= request.sort_memory_budget) {
-          if (!runs.Spill(keys, order)) {
-            out.error = runs.error();
-            return Outcome::Failed;
-          }
-          key_bytes = 0;
-        }
-      } else if (collecting_rows) {
-        kept.push_back(index);
+      (below(middle) >= q ? high : low) = middle;
+    }
+    return high;
+  };
+  // The rank uncertainty of a quantile of independent values, widened by
+  // how much the blocks inflate the mean's variance over that of
+  // independent values, and scaled by the share of the whole the sample
+  // stands for.
+  double design = 1.0;
+  if (spread > 0.0)
+    design = std::max(1.0, variance * sampled / spread);
+  const auto interval = [&](double q) {
+    Interval result;
+    result.value = quantile(q);
+    const double slack =
+        sampled > 0.0 ? kConfidence *
+                            std::sqrt(q * (1.0 - q) * design / sampled) *
+                            rest_share
+                      : 0.0;
+    result.low = slack > 0.0 ? quantile(std::max(0.0, q - slack)) : result.value;
+    result.high = slack > 0.0 ? quantile(std::min(1.0, q + slack)) : result.value;
+    return result;
+  };
+  out.p50 = interval(0.5);
+  out.p90 = interval(0.9);
+  out.p99 = interval(0.99);
+  return out;
+}
+
+std::vector<size_t> Pass::LeadingRows() {
+  std::vector<Key> sorted = leading_;
+  std::sort(sorted.begin(), sorted.end(), order_);
+  std::vector<size_t> rows;
+  rows.reserve(sorted.size());
+  for (const Key &key : sorted)
+    rows.push_back(key.row);
+  leading_changed_ = false;
+  return rows;
+}
+
+void Pass::Publish(double fraction, bool final) {
+  if (!report_)
+    return;
+  Progress progress;
+  progress.rows = rows_;
+  progress.kept = kept_count_;
+  progress.phase = Phase::Reading;
+  progress.fraction = fraction;
+  if (leading_changed_ && !final)
+    progress.provisional = LeadingRows();
+  if (streaming_) {
+    progress.matched = std::move(fresh_);
+    fresh_.clear();
+  }
+  if (estimating_ && !final && sampled_.load(std::memory_order_acquire)) {
+    progress.estimated = true;
+    progress.estimate = Estimate(fraction);
+    estimate_shown_ = true;
+  }
+  report_(progress);
+  last_report_ = std::chrono::steady_clock::now();
+}
+
+void Pass::Tick(double fraction, std::streampos here, std::streampos joined) {
+  unseen_from_ = here;
+  unseen_to_ = joined;
+  const bool first_estimate = estimating_ && !estimate_shown_ &&
+                              sampled_.load(std::memory_order_acquire);
+  if (report_ &&
+      (first_estimate ||
+       std::chrono::steady_clock::now() - last_report_ >= kReportInterval))
+    Publish(fraction, false);
+}
+
+bool Pass::Row(size_t index, const std::string &record) {
+  // A pass that joined late and has now gone round the end of the file. Its
+  // rows from here on are below the ones it has, so they go to a set of their
+  // own and the two are joined at the end. What it streamed so far would not
+  // be the start of the view, so it never streams at all. A skimming pass
+  // starts wherever the first chunk it reads does, and still in file order.
+  if (rows_ == 0 && index != 0 && request_.skim_chunks.empty())
+    streaming_ = false;
+  if (rows_ > 0 && index < last_index_)
+    wrapped_around_ = true;
+  last_index_ = index;
+  ++rows_;
+  if (grams_ || gram_index_)
+    NoteTrigrams(index, record);
+
+  // Does this row belong to the view being built?
+  if (filtering_ && !Keeps(index, record))
+    return true;
+
+  ++kept_count_;
+  if (counting_ &&
+      csv::RecordContains(record, request_.delimiter, request_.count_pattern,
+                          count_ignore_case_, scratch_))
+    ++out_.matches;
+
+  if (collecting_keys_) {
+    Key key;
+    key.row = index;
+    csv::ExtractField(record, request_.delimiter, request_.sort_column, key.text,
+                      scratch_);
+    key.numeric = csv::ParseNumber(key.text, key.number);
+    if (leading_limit_ > 0 &&
+        (leading_.size() < leading_limit_ || order_(key, leading_.front()))) {
+      if (leading_.size() == leading_limit_) {
+        std::pop_heap(leading_.begin(), leading_.end(), order_);
+        leading_.back() = key;
+      } else {
+        leading_.push_back(key);
       }
+      std::push_heap(leading_.begin(), leading_.end(), order_);
+      leading_changed_ = true;
+    }
+    key_bytes_ += csvsort::KeyBytes(key);
+    keys_.push_back(std::move(key));
 
-      if (request.want_stats) {
-        ++out.stats.total;
-        csv::ExtractField(record, request.delimiter, request.stats_column,
-                          value, scratch);
-        if (value.empty()) {
-          ++out.stats.empty;
-        } else {
-          double number = 0.0;
-          if (csv::ParseNumber(value, number)) {
-            ++out.stats.numeric;
-            sum += number;
-            if (first_number) {
-              out.stats.min = out.stats.max = number;
-              first_number = false;
-            } else {
-              out.stats.min = std::min(out.stats.min, number);
-              out.stats.max = std::max(out.stats.max, number);
-            }
-          }
-        }
+    // Buffer full: sort what we have, write it out, and start again. This
+    // is what stops a sort's memory from following the file's size.
+    if (request_.sort_memory_budget > 0 &&
+        key_bytes_ >= request_.sort_memory_budget) {
+      if (!runs_.Spill(keys_, order_)) {
+        out_.error = runs_.error();
+        return false;
       }
+      key_bytes_ = 0;
     }
+  } else if (collecting_rows_) {
+    (wrapped_around_ ? wrapped_ : kept_).Add(index);
+    if (streaming_)
+      fresh_.push_back(index);
+  }
 
-    if (since_report >= kRowsBetweenClockChecks) {
-      since_report = 0;
-      if (std::chrono::steady_clock::now() - last_report >= kReportInterval)
-        publish(false);
+  if (request_.want_stats) {
+    csv::ExtractField(record, request_.delimiter, request_.stats_column, value_,
+                      scratch_);
+    stats_.Add(value_);
+  }
+
+  if (request_.want_frequencies) {
+    csv::ExtractField(record, request_.delimiter, request_.frequency_column,
+                      value_, scratch_);
+    frequencies_.Add(value_);
+  }
+
+  if (groups_) {
+    // Both fields in one walk, which stops at whichever comes last.
+    const size_t last =
+        std::max(request_.group_column, request_.group_value_column);
+    group_key_.clear();
+    value_.clear();
+    csv::detail::ForEachField(
+        record, request_.delimiter, scratch_,
+        [this, last](size_t column, const std::string &value) {
+          if (column == request_.group_column)
+            group_key_ = value;
+          if (column == request_.group_value_column)
+            value_ = value;
+          return column < last;
+        });
+    if (!groups_->Add(group_key_, value_)) {
+      out_.error = groups_->error();
+      return false;
     }
   }
 
-  out.total_rows = rows;
-  if (out.stats.numeric > 0)
-    out.stats.mean = sum / static_cast<double>(out.stats.numeric);
+  if (request_.want_profile) {
+    csv::detail::ForEachField(
+        record, request_.delimiter, scratch_,
+        [this, index](size_t column, const std::string &value) {
+          if (column >= kMaxProfileColumns)
+            return false;
+          if (column >= profile_.size())
+            profile_.resize(column + 1);
+          const ColumnAccumulator::Reading reading = profile_[column].Add(value);
+          if (zoning_profile_) {
+            double time = 0.0;
+            if (reading.number)
+              zones_->Note(column, false, index, reading.value);
+            else if (reading.date && csv::ParseTime(value, time))
+              zones_->Note(column, true, index, time);
+          }
+          return true;
+        });
+  }
+  return true;
+}
+
+bool Pass::Keeps(size_t index, const std::string &record) {
+  if (!request_.filter_predicate || !zones_)
+    return csvscan::Keeps(request_, ignore_case_, record, value_, scratch_);
+  // The predicate's columns are being read anyway, so their zone maps cost
+  // only the comparisons. Every clause is looked at, including those after
+  // one that failed: a zone map with gaps would be worse than none.
+  bool keep = true;
+  for (const csvpredicate::Clause &clause : request_.predicate.clauses) {
+    csv::ExtractField(record, request_.delimiter, clause.column, value_,
+                      scratch_);
+    double number = 0.0;
+    if (clause.kind == csvpredicate::Kind::Text ||
+        !csvpredicate::Value(clause, value_, number)) {
+      keep = keep && csvpredicate::Holds(clause, value_);
+      continue;
+    }
+    zones_->Note(clause.column, clause.kind == csvpredicate::Kind::Time, index,
+                 number);
+    keep = keep && csvpredicate::Holds(clause, number);
+  }
+  return keep;
+}
 
-  if (collecting_keys) {
-    out.order.reserve(kept_count);
-    if (runs.empty()) {
+void Pass::NoteTrigrams(size_t index, const std::string &record) {
+  const size_t chunk = index / std::max<size_t>(request_.chunk_size, 1);
+  std::uint64_t *bits = nullptr;
+  if (grams_) {
+    const size_t words = grams_->bits / 64;
+    if ((chunk + 1) * words > grams_->words.size())
+      grams_->words.resize((chunk + 1) * words);
+    bits = &grams_->words[chunk * words];
+  }
+  if (gram_index_) {
+    const size_t zone = chunk / csvcache::kChunksPerZone;
+    if (zone != gram_zone_ && !gram_set_.empty())
+      gram_index_->Add(gram_zone_, gram_set_.Take());
+    gram_zone_ = zone;
+  }
+  const auto note = [this, bits](const char *text, size_t size) {
+    if (bits != nullptr)
+      csvsketch::AddTrigrams(text, size, bits, grams_->bits);
+    if (gram_index_)
+      gram_set_.Add(text, size);
+  };
+  // A search matches within one field's value, quotes undone. Without a
+  // quote in it the record is those values and the delimiters between, and
+  // the trigrams spanning a delimiter only set bits no search asks about; so
+  // the record is taken whole, which is most of them and far the cheapest.
+  if (record.find('"') == std::string::npos) {
+    note(record.data(), record.size());
+    return;
+  }
+  csv::detail::ForEachField(record, request_.delimiter, scratch_,
+                            [&note](size_t, const std::string &value) {
+                              note(value.data(), value.size());
+                              return true;
+                            });
+}
+
+Outcome Pass::Finish(const std::vector<std::streampos> &offsets,
+                     size_t total_rows) {
+  out_.offsets = offsets;
+  out_.total_rows = total_rows;
+  if (zones_)
+    out_.zones = zones_->Finish(total_rows);
+  if (grams_) {
+    const size_t chunk_size = std::max<size_t>(request_.chunk_size, 1);
+    grams_->words.resize((total_rows + chunk_size - 1) / chunk_size *
+                         (grams_->bits / 64));
+    out_.grams = std::move(grams_);
+  }
+  if (gram_index_) {
+    if (!gram_set_.empty())
+      gram_index_->Add(gram_zone_, gram_set_.Take());
+    const size_t zone_rows =
+        std::max<size_t>(request_.chunk_size, 1) * csvcache::kChunksPerZone;
+    out_.gram_index = std::make_shared<const csvcache::GramIndex>(
+        gram_index_->Finish((total_rows + zone_rows - 1) / zone_rows));
+    gram_index_.reset();
+  }
+  if (request_.want_stats)
+    out_.stats = stats_.Finish(kept_count_).stats;
+  if (request_.want_frequencies) {
+    out_.frequencies = frequencies_.Top(kTopValues);
+    out_.frequencies_exact = frequencies_.exact();
+    out_.frequency_rows = frequencies_.count();
+    out_.distinct_values = frequencies_.distinct();
+  }
+  if (groups_) {
+    if (!groups_->Write(request_.group_output, request_.group_key_name,
+                        request_.group_value_name, request_.delimiter,
+                        cancelled_)) {
+      if (groups_->error().empty())
+        return Outcome::Cancelled;
+      out_.error = groups_->error();
+      return Outcome::Failed;
+    }
+    out_.groups = groups_->groups();
+    out_.group_spills = groups_->spills();
+    groups_.reset(); // its partitions are gone; so should its table be
+  }
+  if (request_.want_profile) {
+    out_.profile.reserve(profile_.size());
+    for (const ColumnAccumulator &column : profile_)
+      out_.profile.push_back(column.Finish(kept_count_));
+  }
+
+  // Every row has been read, so the leading rows are now the sort's own first
+  // rows. Hand them over before the sort proper, which on a large file takes
+  // as long again.
+  if (leading_limit_ > 0) {
+    Progress progress;
+    progress.rows = rows_;
+    progress.kept = kept_count_;
+    progress.fraction = 1.0;
+    progress.provisional = LeadingRows();
+    progress.provisional_exact = true;
+    report_(progress);
+    last_report_ = std::chrono::steady_clock::now();
+    leading_.clear();
+    leading_.shrink_to_fit();
+  }
+
+  if (collecting_keys_) {
+    if (!out_.order.Reserve(kept_count_, total_rows,
+                            request_.order_memory_budget,
+                            csvsort::TempDirectory(), out_.error))
+      return Outcome::Failed;
+    if (runs_.empty()) {
       // Everything fit: no spilling, no merge, no temporary files.
-      std::sort(keys.begin(), keys.end(), order);
-      for (const Key &key : keys)
-        out.order.push_back(key.row);
+      std::sort(keys_.begin(), keys_.end(), order_);
+      for (const Key &key : keys_) {
+        if (!out_.order.push_back(key.row)) {
+          out_.error = "sort produced more rows than it counted";
+          return Outcome::Failed;
+        }
+      }
     } else {
-      out.spilled_runs = runs.run_count() + (keys.empty() ? 0 : 1);
+      out_.spilled_runs = runs_.run_count() + (keys_.empty() ? 0 : 1);
       // Merging tens of millions of keys takes seconds of its own. Reporting
       // it separately is the difference between a progress bar and a program
       // that appears to have stopped at 100%.
-      const size_t expected = kept_count;
+      const size_t expected = kept_count_;
       auto merge_report =
-          report ? std::function<void(size_t)>([&](size_t merged) {
+          report_ ? std::function<void(size_t)>([&](size_t merged) {
             // Same rate limit as the read. The merge offers a tick every few
             // thousand rows, which on a large sort is hundreds a second — far
             // more redraws than anyone can see, and each one wakes the UI.
             const auto now = std::chrono::steady_clock::now();
-            if (merged != expected && now - last_report < kReportInterval)
+            if (merged != expected && now - last_report_ < kReportInterval)
               return;
-            last_report = now;
+            last_report_ = now;
 
             Progress progress;
-            progress.rows = rows;
+            progress.rows = rows_;
             progress.kept = merged;
             progress.phase = Phase::Merging;
             progress.fraction =
                 expected == 0 ? 1.0
                               : std::min(1.0, static_cast<double>(merged) /
                                                   static_cast<double>(expected));
-            report(progress);
+            report_(progress);
           })
-                 : std::function<void(size_t)>();
+                  : std::function<void(size_t)>();
 
-      if (!runs.Merge(keys, order, out.order, cancelled, merge_report)) {
-        if (!runs.error().empty()) {
-          out.error = runs.error();
+      if (!runs_.Merge(keys_, order_, out_.order, cancelled_, merge_report)) {
+        if (!runs_.error().empty()) {
+          out_.error = runs_.error();
           return Outcome::Failed;
         }
         return Outcome::Cancelled;
       }
     }
-    keys.clear();
-    keys.shrink_to_fit();
-    out.has_order = true;
-  } else if (collecting_rows) {
-    out.order = std::move(kept);
-    out.has_order = true;
+    keys_.clear();
+    keys_.shrink_to_fit();
+    out_.has_order = true;
+  } else if (collecting_rows_) {
+    out_.rows = wrapped_.empty() ? std::move(kept_)
+                                 : csvrows::RowSet::Union(wrapped_, kept_);
+    out_.has_rows = true;
   }
   // Neither sorting nor filtering: the view is the file in its own order, and
   // the model represents that as no index at all.
 
-  publish(true);
+  Publish(1.0, true);
   return Outcome::Done;
 }
 
+// A pass riding a read, and what the read knows about it.
+struct Rider {
+  std::unique_ptr<Pass> pass;
+  std::function<void(Outcome)> done; // told how the pass ended, once
+  std::streampos joined{0};          // where in the file it got on
+  size_t seen = 0;                   // rows it has been fed
+  bool wrapped = false;              // gone round the end to the top again
+};
+
+// Called between rows with the riders so far, to add any waiting to get on.
+// With `closing` set the read is about to end for want of riders, and the
+// callback must either add some or see to it that no more will come.
+using Boarding = std::function<void(std::vector<Rider> &riders, bool closing)>;
+
+// Reads the file for every rider, each from where it got on, round the end
+// and back to that point. The first riders get on at the top; others join
+// between rows, and the read goes round again for as long as one of them has
+// rows still to see. Returns when none are left.
+//
+// A rider that has seen every row is finished there and then, on this thread.
+// For a large sort that includes its merge, and anyone else on the read waits
+// for it: simpler than handing the pass to another thread, and the merge is
+// rarely more than the read took.
+void Read(const Request &request, std::vector<Rider> riders,
+          const Boarding &board) {
+  const auto end = [&riders](size_t i, Outcome outcome) {
+    Rider rider = std::move(riders[i]);
+    riders.erase(riders.begin() + static_cast<std::ptrdiff_t>(i));
+    rider.done(outcome);
+  };
+  // Everyone on the read, and everyone still waiting to get on.
+  const auto fail_all = [&] {
+    while (true) {
+      while (!riders.empty())
+        end(riders.size() - 1, Outcome::Failed);
+      if (!board)
+        return;
+      board(riders, true);
+      if (riders.empty())
+        return;
+    }
+  };
+
+  std::ifstream file(request.path, std::ios::binary);
+  if (!file.is_open())
+    return fail_all();
+  file.seekg(request.data_offset);
+  if (!file)
+    return fail_all();
+  for (Rider &rider : riders)
+    rider.joined = request.data_offset;
+
+  std::vector<std::streampos> offsets{request.data_offset};
+  const size_t chunk_size = std::max<size_t>(request.chunk_size, 1);
+  bool counted = false; // the read has reached the end of the file once
+  size_t total = 0;     // how many rows it found there
+  size_t row = 0;       // the next row to be read
+  size_t since_tick = 0;
+  std::string record;
+
+  const double span =
+      static_cast<double>(request.file_size) -
+      static_cast<double>(static_cast<std::streamoff>(request.data_offset));
+  const auto fraction = [&](const Rider &rider, std::streampos here) {
+    if (span <= 0.0 || here == std::streampos(-1))
+      return 0.0;
+    const double at = static_cast<double>(here - request.data_offset);
+    const double from = static_cast<double>(rider.joined - request.data_offset);
+    const double covered = rider.wrapped ? span - from + at : at - from;
+    return std::min(1.0, std::max(0.0, covered / span));
+  };
+
+  while (true) {
+    const size_t aboard = riders.size();
+    if (board)
+      board(riders, riders.empty());
+    if (riders.empty())
+      return;
+    if (riders.size() > aboard) {
+      const std::streampos here = file.tellg();
+      for (size_t i = aboard; i < riders.size(); ++i)
+        riders[i].joined = here;
+    }
+
+    // Let off the cancelled, and whoever has now seen every row.
+    for (size_t i = 0; i < riders.size();) {
+      if (riders[i].pass->cancelled())
+        end(i, Outcome::Cancelled);
+      else if (counted && riders[i].seen == total)
+        end(i, riders[i].pass->Finish(offsets, total));
+      else
+        ++i;
+    }
+    if (riders.empty())
+      continue; // to close, unless someone got on meanwhile
+
+    // Past the first time round, the end is where it was found to be.
+    bool at_end = false;
+    if (counted) {
+      at_end = row == total;
+      if (!at_end && !csv::ReadRecord(file, record))
+        return fail_all(); // shorter than it was: the file changed under us
+    } else {
+      at_end = !csv::ReadRecord(file, record);
+    }
+    if (at_end) {
+      counted = true;
+      total = row;
+      // Round to the top for anyone who got on part way down.
+      for (Rider &rider : riders)
+        rider.wrapped = true;
+      file.clear();
+      file.seekg(request.data_offset);
+      if (!file)
+        return fail_all();
+      row = 0;
+      continue;
+    }
+
+    const size_t index = row++;
+    if (!counted && row % chunk_size == 0) {
+      const std::streampos here = file.tellg();
+      if (here == std::streampos(-1))
+        return fail_all();
+      offsets.push_back(here);
+    }
+
+    for (size_t i = 0; i < riders.size();) {
+      if (riders[i].pass->Row(index, record)) {
+        ++riders[i].seen;
+        ++i;
+      } else {
+        end(i, Outcome::Failed);
+      }
+    }
+
+    if (++since_tick >= kRowsBetweenClockChecks) {
+      since_tick = 0;
+      const std::streampos here = file.tellg();
+      for (const Rider &rider : riders)
+        rider.pass->Tick(fraction(rider, here), here, rider.joined);
+    }
+  }
+}
+
+// Reads only the chunks `skim_chunks` flags, feeding their rows to one pass
+// as the full read would, numbered as in the file. The chunks are visited in
+// order and a run of them is read without seeking, so the cost is the chunks
+// that might hold a match, plus a seek for every gap between them.
+Outcome Skim(const Request &request, Result &out,
+             const std::function<bool()> &cancelled,
+             const std::function<void(const Progress &)> &report) {
+  const csvcache::ChunkOffsets &offsets = request.refine_offsets;
+  const size_t chunk_size = std::max<size_t>(request.chunk_size, 1);
+  const size_t total = request.skim_total_rows;
+  const size_t chunks = std::min(offsets.size(), request.skim_chunks.size());
+  if (total > 0 && (total - 1) / chunk_size >= offsets.size())
+    return Outcome::Failed; // the table does not reach that far
+
+  std::ifstream file(request.path, std::ios::binary);
+  if (!file.is_open())
+    return Outcome::Failed;
+
+  size_t wanted = 0;
+  for (size_t c = 0; c < chunks; ++c)
+    wanted += request.skim_chunks[c] ? 1 : 0;
+
+  Pass pass(request, out, cancelled, report);
+  std::string record;
+  size_t done = 0;
+  size_t since_tick = 0;
+  size_t at = static_cast<size_t>(-1); // the row the stream stands at
+  for (size_t c = 0; c < chunks; ++c) {
+    if (!request.skim_chunks[c])
+      continue;
+    const size_t first = c * chunk_size;
+    const size_t last = std::min(first + chunk_size, total);
+    if (at != first) {
+      file.clear();
+      file.seekg(offsets[c]);
+      if (!file)
+        return Outcome::Failed;
+      at = first;
+    }
+    while (at < last) {
+      if (pass.cancelled())
+        return Outcome::Cancelled;
+      // The offsets promised a row here. Running out means they describe
+      // some other version of the file.
+      if (!csv::ReadRecord(file, record))
+        return Outcome::Failed;
+      if (!pass.Row(at++, record))
+        return Outcome::Failed;
+      if (++since_tick >= kRowsBetweenClockChecks) {
+        since_tick = 0;
+        pass.Tick(static_cast<double>(done) / static_cast<double>(wanted),
+                  std::streampos(-1), std::streampos(-1));
+      }
+    }
+    ++done;
+  }
+  return pass.Finish(std::vector<std::streampos>(), total);
+}
+
+// Reads from the last of `resume_offsets` to the end of the file, carrying
+// the table on as the full read would and numbering rows as in the file.
+// What was appended to a 12 GB log costs the append, not the log; what was
+// rewritten in the middle of a report costs the rewrite, when the count
+// meets `resume_tail` on a chunk boundary and the rows past it are known.
+Outcome Resume(const Request &request, Result &out,
+               const std::function<bool()> &cancelled,
+               const std::function<void(const Progress &)> &report) {
+  const csvcache::ChunkOffsets &known = request.resume_offsets;
+  const std::vector<std::streampos> &tail = request.resume_tail;
+  const size_t chunk_size = std::max<size_t>(request.chunk_size, 1);
+
+  std::ifstream file(request.path, std::ios::binary);
+  if (!file.is_open())
+    return Outcome::Failed;
+  const std::streampos from = known.back();
+  file.seekg(from);
+  if (!file)
+    return Outcome::Failed;
+
+  std::vector<std::streampos> offsets;
+  offsets.reserve(known.size());
+  for (size_t c = 0; c < known.size(); ++c)
+    offsets.push_back(known[c]);
+
+  Pass pass(request, out, cancelled, report);
+  const double span = static_cast<double>(request.file_size) -
+                      static_cast<double>(static_cast<std::streamoff>(from));
+  std::string record;
+  size_t row = (known.size() - 1) * chunk_size;
+  size_t since_tick = 0;
+  while (true) {
+    if (pass.cancelled())
+      return Outcome::Cancelled;
+    if (!csv::ReadRecord(file, record))
+      break;
+    // The same rule the spooler writes by: a record is whole once a line
+    // break ends it with its quotes paired, which one read up to the end of
+    // the file without one never was.
+    if (request.whole_records && file.eof()) {
+      out.partial = true;
+      break;
+    }
+    if (!pass.Row(row++, record))
+      return Outcome::Failed;
+    if (row % chunk_size == 0) {
+      const std::streampos here = file.tellg();
+      if (here == std::streampos(-1))
+        return Outcome::Failed;
+      if (!tail.empty() && here == tail.front()) {
+        offsets.insert(offsets.end(), tail.begin(), tail.end());
+        row += request.resume_tail_rows;
+        break;
+      }
+      offsets.push_back(here);
+    }
+    if (++since_tick >= kRowsBetweenClockChecks) {
+      since_tick = 0;
+      const std::streampos here = file.tellg();
+      const double read =
+          here == std::streampos(-1) ? 0.0 : static_cast<double>(here - from);
+      pass.Tick(span > 0.0 ? std::min(1.0, read / span) : 0.0,
+                std::streampos(-1), std::streampos(-1));
+    }
+  }
+  return pass.Finish(offsets, row);
+}
+
+} // namespace
+
+bool CanShareRead(const Request &a, const Request &b) {
+  const auto full = [](const Request &r) {
+    return !r.refine_rows && !r.refine_set && r.skim_chunks.empty() &&
+           r.resume_offsets.empty();
+  };
+  return full(a) && full(b) && !a.background && !b.background &&
+         a.path == b.path &&
+         a.data_offset == b.data_offset && a.delimiter == b.delimiter &&
+         a.chunk_size == b.chunk_size;
+}
+
+Outcome Run(const Request &request, Result &out,
+            const std::function<bool()> &cancelled,
+            const std::function<void(const Progress &)> &report) {
+  out = Result{};
+  if (request.refine_rows || request.refine_set)
+    return Refine(request, out, cancelled, report);
+  if (!request.skim_chunks.empty())
+    return Skim(request, out, cancelled, report);
+  if (!request.resume_offsets.empty())
+    return Resume(request, out, cancelled, report);
+
+  Outcome outcome = Outcome::Failed;
+  std::vector<Rider> riders(1);
+  riders[0].pass.reset(new Pass(request, out, cancelled, report));
+  riders[0].done = [&outcome](Outcome how) { outcome = how; };
+  Read(request, std::move(riders), nullptr);
+  return outcome;
+}
+
 } // namespace csvscan
 
+namespace {
+
+// How long a background pass sleeps before looking again at whether it may
+// go on. Short enough that it picks up again as soon as the user's pass ends,
+// long enough that waiting costs nothing.
+constexpr auto kBackgroundPause = std::chrono::milliseconds(50);
+
+#if defined(__linux__)
+constexpr int kWhoProcess = 1;      // IOPRIO_WHO_PROCESS
+constexpr int kIdleClass = 3 << 13; // IOPRIO_CLASS_IDLE
+// IOPRIO_CLASS_BE, at the level a thread has when nothing sets one.
+constexpr int kBestEffortClass = (2 << 13) | 4;
+#endif
+
+// Puts the calling thread at the back of the queue, for the CPU and for the
+// disk: niced as far as it goes, and in the idle I/O class, which the kernel
+// serves only when no one else wants the disk. Returns the nice value it had,
+// for RaisePriority. Best-effort: a system that refuses leaves the pass at
+// normal priority, paused all the same.
+int LowerPriority() {
+#if defined(__linux__)
+  const pid_t thread = static_cast<pid_t>(::syscall(SYS_gettid));
+  errno = 0;
+  int nice = ::getpriority(PRIO_PROCESS, static_cast<id_t>(thread));
+  if (errno != 0)
+    nice = 0;
+  ::setpriority(PRIO_PROCESS, static_cast<id_t>(thread), 19);
+  ::syscall(SYS_ioprio_set, kWhoProcess, thread, kIdleClass);
+  return nice;
+#elif defined(__APPLE__)
+  ::setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+  return 0;
+#else
+  return 0;
+#endif
+}
+
+// Undoes LowerPriority for a pass someone is now waiting for. The I/O class
+// matters most, since an idle one is served only when the disk has nothing
+// else to do, and any thread may move itself back to best-effort. Only the
+// nice value needs privileges to go back down; refused, the pass runs niced,
+// which costs it nothing on a machine with CPU to spare.
+void RaisePriority(int nice) {
+#if defined(__linux__)
+  const pid_t thread = static_cast<pid_t>(::syscall(SYS_gettid));
+  ::syscall(SYS_ioprio_set, kWhoProcess, thread, kBestEffortClass);
+  ::setpriority(PRIO_PROCESS, static_cast<id_t>(thread), nice);
+#elif defined(__APPLE__)
+  (void)nice;
+  ::setpriority(PRIO_DARWIN_THREAD, 0, 0);
+#else
+  (void)nice;
+#endif
+}
+
+} // namespace
+
+// One pass. Its progress is published through atomics, and what it hands
+// back through `mutex`; `scanned` belongs to the worker until the pass ends.
+struct CSVScanner::Slot {
+  PassId id = 0;
+  Request request;
+  std::function<void()> notify;
+  // Kept in the scanner's count of foreground passes while it runs, unless
+  // it is a background pass not promoted (see CSVScanner::Promote).
+  enum Priority { Foreground, Background, Ended };
+  std::atomic<size_t> *foreground = nullptr;
+  std::atomic<int> priority{Foreground};
+
+  std::atomic<State> state{State::Running};
+  std::atomic<bool> cancel{false};
+  std::atomic<double> progress{0.0};
+  std::atomic<size_t> rows_seen{0};
+  std::atomic<size_t> rows_kept{0};
+  std::atomic<csvscan::Phase> phase{csvscan::Phase::Reading};
+
+  Result scanned;
+
+  std::mutex mutex; // guards everything below
+  std::string error;
+  Result result;
+  std::vector<size_t> provisional;
+  bool provisional_exact = false;
+  bool provisional_fresh = false;
+  std::vector<size_t> matched;
+  csvscan::StatsEstimate estimate;
+  bool estimate_fresh = false;
+
+  void Report(const csvscan::Progress &update) {
+    rows_seen.store(update.rows, std::memory_order_relaxed);
+    rows_kept.store(update.kept, std::memory_order_relaxed);
+    progress.store(update.fraction, std::memory_order_relaxed);
+    phase.store(update.phase, std::memory_order_relaxed);
+    if (!update.provisional.empty() || !update.matched.empty() ||
+        update.estimated) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (update.estimated) {
+        estimate = update.estimate;
+        estimate_fresh = true;
+      }
+      if (!update.provisional.empty()) {
+        provisional = update.provisional;
+        provisional_exact = update.provisional_exact;
+        provisional_fresh = true;
+      }
+      matched.insert(matched.end(), update.matched.begin(),
+                     update.matched.end());
+    }
+    if (notify)
+      notify();
+  }
+
+  void End(csvscan::Outcome outcome) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (outcome == csvscan::Outcome::Done)
+        result = std::move(scanned);
+      else
+        error = std::move(scanned.error);
+    }
+    scanned = Result{};
+    if (priority.exchange(Ended) == Foreground)
+      foreground->fetch_sub(1, std::memory_order_release);
+    switch (outcome) {
+    case csvscan::Outcome::Done:
+      state.store(State::Done, std::memory_order_release);
+      break;
+    case csvscan::Outcome::Cancelled:
+      state.store(State::Cancelled, std::memory_order_release);
+      break;
+    case csvscan::Outcome::Failed:
+      state.store(State::Failed, std::memory_order_release);
+      break;
+    }
+    if (notify)
+      notify();
+  }
+};
+
+// One worker thread and its read of the file. `open` and `boarding` are the
+// scanner's to guard; the thread only looks at `boarding` once `waiting`
+// says there is something in it, which keeps the lock off the per-row path.
+struct CSVScanner::Reader {
+  std::thread thread;
+  Request request;     // what any pass joining it must be able to share
+  bool shared = false; // a whole-file read, which later passes may join
+  bool open = true;    // still taking passes
+  std::vector<std::shared_ptr<Slot>> boarding;
+  std::atomic<bool> waiting{false};
+  std::atomic<bool> finished{false}; // the thread has nothing left to do
+};
+
 CSVScanner::~CSVScanner() {
   Cancel();
   Join();
 }
 
-void CSVScanner::Start(Request request, std::function<void()> notify) {
-  if (state() == State::Running)
-    return;
-  Join(); // reap a previous run
+CSVScanner::PassId CSVScanner::Start(Request request,
+                                     std::function<void()> notify) {
+  Reap();
+
+  auto slot = std::make_shared<Slot>();
+  slot->request = std::move(request);
+  slot->notify = std::move(notify);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  slot->id = next_pass_++;
+  slots_.push_back(slot);
+  slot->foreground = &foreground_;
+  if (slot->request.background)
+    slot->priority.store(Slot::Background, std::memory_order_relaxed);
+  else
+    foreground_.fetch_add(1, std::memory_order_release);
+
+  for (const std::shared_ptr<Reader> &reader : readers_) {
+    if (reader->shared && reader->open &&
+        csvscan::CanShareRead(reader->request, slot->request)) {
+      reader->boarding.push_back(slot);
+      reader->waiting.store(true, std::memory_order_release);
+      return slot->id;
+    }
+  }
 
-  request_ = request;
-  error_.clear();
-  phase_.store(csvscan::Phase::Reading, std::memory_order_relaxed);
-  cancel_.store(false, std::memory_order_release);
-  progress_.store(0.0, std::memory_order_relaxed);
-  rows_seen_.store(0, std::memory_order_relaxed);
-  rows_kept_.store(0, std::memory_order_relaxed);
-  state_.store(State::Running, std::memory_order_release);
+  auto reader = std::make_shared<Reader>();
+  reader->request = slot->request;
+  reader->shared = csvscan::CanShareRead(slot->request, slot->request);
+  readers_.push_back(reader);
+  reader->thread = std::thread(&CSVScanner::Work, this, reader, slot);
+  return slot->id;
+}
 
-  worker_ =
-      std::thread(&CSVScanner::Run, this, std::move(request), std::move(notify));
+void CSVScanner::Promote(PassId pass) {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  if (!slot)
+    return;
+  // Counted before it is promoted, so that the pass ending in between never
+  // takes the count below zero; taken back if it had already ended.
+  foreground_.fetch_add(1, std::memory_order_release);
+  int background = Slot::Background;
+  if (!slot->priority.compare_exchange_strong(background, Slot::Foreground))
+    foreground_.fetch_sub(1, std::memory_order_release);
 }
 
-void CSVScanner::Cancel() { cancel_.store(true, std::memory_order_release); }
+void CSVScanner::Cancel(PassId pass) {
+  if (std::shared_ptr<Slot> slot = Find(pass))
+    slot->cancel.store(true, std::memory_order_release);
+}
+
+void CSVScanner::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::shared_ptr<Slot> &slot : slots_)
+    slot->cancel.store(true, std::memory_order_release);
+}
 
 void CSVScanner::Join() {
-  if (worker_.joinable())
-    worker_.join();
+  std::vector<std::shared_ptr<Reader>> readers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    readers.swap(readers_);
+  }
+  for (const std::shared_ptr<Reader> &reader : readers) {
+    if (reader->thread.joinable())
+      reader->thread.join();
+  }
+}
+
+void CSVScanner::Reap() {
+  std::vector<std::shared_ptr<Reader>> finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < readers_.size();) {
+      if (readers_[i]->finished.load(std::memory_order_acquire)) {
+        finished.push_back(std::move(readers_[i]));
+        readers_.erase(readers_.begin() + static_cast<std::ptrdiff_t>(i));
+      } else {
+        ++i;
+      }
+    }
+  }
+  for (const std::shared_ptr<Reader> &reader : finished)
+    reader->thread.join();
+}
+
+void CSVScanner::Forget(PassId pass) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    if (slots_[i]->id == pass) {
+      // The worker holds its own reference, so it can go on winding down.
+      slots_[i]->cancel.store(true, std::memory_order_release);
+      slots_.erase(slots_.begin() + static_cast<std::ptrdiff_t>(i));
+      return;
+    }
+  }
+}
+
+std::shared_ptr<CSVScanner::Slot> CSVScanner::Find(PassId pass) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::shared_ptr<Slot> &slot : slots_) {
+    if (slot->id == pass)
+      return slot;
+  }
+  return nullptr;
+}
+
+CSVScanner::State CSVScanner::state(PassId pass) const {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  return slot ? slot->state.load(std::memory_order_acquire) : State::Idle;
+}
+
+bool CSVScanner::running() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::shared_ptr<Slot> &slot : slots_) {
+    if (slot->state.load(std::memory_order_acquire) == State::Running)
+      return true;
+  }
+  return false;
 }
 
-bool CSVScanner::Take(Result &out) {
-  if (state() != State::Done)
+double CSVScanner::progress(PassId pass) const {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  return slot ? slot->progress.load(std::memory_order_relaxed) : 0.0;
+}
+
+size_t CSVScanner::rows_seen(PassId pass) const {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  return slot ? slot->rows_seen.load(std::memory_order_relaxed) : 0;
+}
+
+size_t CSVScanner::rows_kept(PassId pass) const {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  return slot ? slot->rows_kept.load(std::memory_order_relaxed) : 0;
+}
+
+csvscan::Phase CSVScanner::phase(PassId pass) const {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  return slot ? slot->phase.load(std::memory_order_relaxed)
+              : csvscan::Phase::Reading;
+}
+
+std::string CSVScanner::error(PassId pass) const {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  if (!slot)
+    return std::string();
+  std::lock_guard<std::mutex> lock(slot->mutex);
+  return slot->error;
+}
+
+bool CSVScanner::TakeProvisional(PassId pass, std::vector<size_t> &rows,
+                                 bool &exact) {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  if (!slot)
+    return false;
+  std::lock_guard<std::mutex> lock(slot->mutex);
+  if (!slot->provisional_fresh)
+    return false;
+  rows = std::move(slot->provisional);
+  exact = slot->provisional_exact;
+  slot->provisional.clear();
+  slot->provisional_fresh = false;
+  return true;
+}
+
+bool CSVScanner::TakeMatches(PassId pass, std::vector<size_t> &rows) {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  if (!slot)
+    return false;
+  std::lock_guard<std::mutex> lock(slot->mutex);
+  if (slot->matched.empty())
+    return false;
+  if (rows.empty())
+    rows.swap(slot->matched);
+  else
+    rows.insert(rows.end(), slot->matched.begin(), slot->matched.end());
+  slot->matched.clear();
+  return true;
+}
+
+bool CSVScanner::TakeEstimate(PassId pass,
+                              csvscan::StatsEstimate &estimate) {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  if (!slot)
+    return false;
+  std::lock_guard<std::mutex> lock(slot->mutex);
+  if (!slot->estimate_fresh)
+    return false;
+  estimate = slot->estimate;
+  slot->estimate_fresh = false;
+  return true;
+}
+
+bool CSVScanner::Take(PassId pass, Result &out) {
+  const std::shared_ptr<Slot> slot = Find(pass);
+  if (!slot || slot->state.load(std::memory_order_acquire) != State::Done)
     return false;
-  Join();
   {
-    std::lock_guard<std::mutex> lock(result_mutex_);
-    out = std::move(result_);
-    result_ = Result{};
+    std::lock_guard<std::mutex> lock(slot->mutex);
+    out = std::move(slot->result);
+    slot->result = Result{};
   }
-  state_.store(State::Idle, std::memory_order_release);
+  Forget(pass);
   return true;
 }
 
-void CSVScanner::Run(Request request, std::function<void()> notify) {
-  Result scanned;
-  const csvscan::Outcome outcome = csvscan::Run(
-      request, scanned, [this] { return cancel_.load(std::memory_order_acquire); },
-      [this, &notify](const csvscan::Progress &progress) {
-        rows_seen_.store(progress.rows, std::memory_order_relaxed);
-        rows_kept_.store(progress.kept, std::memory_order_relaxed);
-        progress_.store(progress.fraction, std::memory_order_relaxed);
-        phase_.store(progress.phase, std::memory_order_relaxed);
-        if (notify)
-          notify();
-      });
-
-  if (outcome == csvscan::Outcome::Done) {
-    std::lock_guard<std::mutex> lock(result_mutex_);
-    result_ = std::move(scanned);
+void CSVScanner::Work(std::shared_ptr<Reader> reader,
+                      std::shared_ptr<Slot> first) {
+  const auto cancelled = [](const std::shared_ptr<Slot> &slot) {
+    return [slot] { return slot->cancel.load(std::memory_order_acquire); };
+  };
+  const auto report = [](const std::shared_ptr<Slot> &slot) {
+    return [slot](const csvscan::Progress &update) { slot->Report(update); };
+  };
+
+  if (first->request.background) {
+    const int nice = LowerPriority();
+    bool raised = false;
+    // Polled every row: waits out whatever else is running, and carries on
+    // from the same row when it is over. Once promoted it takes its priority
+    // back, here, since only the thread itself may.
+    const auto idle = [this, first, nice, &raised] {
+      while (first->priority.load(std::memory_order_acquire) ==
+                 Slot::Background &&
+             foreground_.load(std::memory_order_acquire) > 0 &&
+             !first->cancel.load(std::memory_order_acquire))
+        std::this_thread::sleep_for(kBackgroundPause);
+      if (!raised && first->priority.load(std::memory_order_acquire) ==
+                         Slot::Foreground) {
+        RaisePriority(nice);
+        raised = true;
+      }
+      return first->cancel.load(std::memory_order_acquire);
+    };
+    first->End(csvscan::Run(first->request, first->scanned, idle,
+                            report(first)));
+  } else if (!reader->shared) {
+    // A refinement or a skim reads only the rows it needs, which is no use
+    // to anyone else, so it has the thread to itself.
+    first->End(csvscan::Run(first->request, first->scanned, cancelled(first),
+                            report(first)));
   } else {
-    // Written before the state is published, so a reader that sees Failed
-    // sees the reason too.
-    error_ = std::move(scanned.error);
-  }
-
-  switch (outcome) {
-  case csvscan::Outcome::Done:
-    state_.store(State::Done, std::memory_order_release);
-    break;
-  case csvscan::Outcome::Cancelled:
-    state_.store(State::Cancelled, std::memory_order_release);
-    break;
-  case csvscan::Outcome::Failed:
-    state_.store(State::Failed, std::memory_order_release);
-    break;
-  }
-  if (notify)
-    notify();
+    const auto ride = [&](const std::shared_ptr<Slot> &slot) {
+      csvscan::Rider rider;
+      rider.pass.reset(new csvscan::Pass(slot->request, slot->scanned,
+                                         cancelled(slot), report(slot)));
+      rider.done = [slot](csvscan::Outcome outcome) { slot->End(outcome); };
+      return rider;
+    };
+    std::vector<csvscan::Rider> riders;
+    riders.push_back(ride(first));
+    csvscan::Read(reader->request, std::move(riders),
+                  [&](std::vector<csvscan::Rider> &aboard, bool closing) {
+                    if (!closing &&
+                        !reader->waiting.load(std::memory_order_acquire))
+                      return;
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (const std::shared_ptr<Slot> &slot : reader->boarding)
+                      aboard.push_back(ride(slot));
+                    reader->boarding.clear();
+                    reader->waiting.store(false, std::memory_order_relaxed);
+                    if (closing && aboard.empty())
+                      reader->open = false;
+                  });
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reader->open = false;
+  }
+  reader->finished.store(true, std::memory_order_release);
 }
@@ -4,11 +4,18 @@
 #include <cstddef>
 #include <fstream>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "csv_cache.h"
+#include "csv_predicate.h"
+#include "csv_roworder.h"
+#include "csv_rowset.h"
+#include "csv_sketch.h"
+
 // One streaming pass over a CSV file.
 //
 // Everything that has to look at every row goes through here: counting,
@@ -23,6 +30,9 @@
 // miserable bug to find.
 namespace csvscan {
 
+// How many of a column's most frequent values a pass reports.
+constexpr size_t kTopValues = 200;
+
 struct Stats {
   size_t total = 0;
   size_t empty = 0;
@@ -30,6 +40,58 @@ struct Stats {
   double min = 0.0;
   double max = 0.0;
   double mean = 0.0;
+  // Percentiles of the numeric values, from a csvsketch::QuantileSketch: each
+  // is within QuantileSketch::RankError() of its rank unless
+  // `quantiles_exact`, which holds while the column has few enough numbers
+  // to keep them all. A mean says little about a latency column whose tail
+  // is the point. Not filled in for a profile.
+  double p50 = 0.0;
+  double p90 = 0.0;
+  double p99 = 0.0;
+  double p999 = 0.0;
+  bool quantiles_exact = true;
+};
+
+// A statistic not yet known exactly: the best guess, and the range the truth
+// lies in with 95% confidence.
+struct Interval {
+  double value = 0.0;
+  double low = 0.0;
+  double high = 0.0;
+};
+
+// Column statistics before the pass has read every row. What it has read is
+// exact; what it has not is estimated from blocks of rows sampled at random
+// across the file before the read began, so the first estimate is there in
+// the time a few dozen seeks take and the intervals close in on the exact
+// figures as the read goes on. Counts are left out: a sample of blocks says
+// little about how many rows are in the rest of the file.
+struct StatsEstimate {
+  double covered = 0.0; // the share of the file read exactly
+  size_t sampled = 0;   // numbers in the sample standing for the rest
+  bool numeric = false; // any number found, by either means
+  Interval mean;
+  // The smallest and largest numbers found so far. The true extremes can
+  // only lie further out, so these are bounds rather than estimates.
+  double min = 0.0;
+  double max = 0.0;
+  Interval p50;
+  Interval p90;
+  Interval p99;
+};
+
+// One column of a profile: its statistics, and what kind of values it holds.
+// Counts of kinds are over the non-empty values; `stats.empty` includes rows
+// too short to have the column at all.
+struct ColumnProfile {
+  Stats stats;
+  size_t integers = 0;   // numeric values with no fraction or exponent
+  size_t dates = 0;      // values that read as an ISO date
+  size_t min_length = 0; // in characters, over non-empty values
+  size_t max_length = 0;
+  // Distinct non-empty values, estimated: within a few percent either way
+  // (see csvsketch::DistinctCounter), and all but exact for small counts.
+  size_t distinct = 0;
 };
 
 // Describes the view to produce, not the operation to perform: the scanner is
@@ -44,6 +106,11 @@ struct Request {
 
   bool filter = false;
   std::string filter_pattern;
+  // The filter is a predicate on column values (see csvpredicate) rather than
+  // text to find anywhere in the row. `filter_pattern` is still its text, for
+  // whoever shows it; `predicate` is what the pass tests.
+  bool filter_predicate = false;
+  csvpredicate::Predicate predicate;
 
   bool sort = false;
   size_t sort_column = 0;
@@ -55,6 +122,34 @@ struct Request {
 
   bool want_stats = false;
   size_t stats_column = 0;
+  // Sample blocks of rows from across the file, on a thread of its own while
+  // the read starts, and report StatsEstimate with the progress once it is
+  // in. The sample costs a few dozen seeks, which on a file read in a second
+  // or two is time better spent reading it; the caller decides by its size.
+  bool estimate_stats = false;
+  // Profile every column at once: each record is split into fields once and
+  // every field goes to its column's accumulators, so forty columns cost one
+  // pass rather than forty.
+  bool want_profile = false;
+  // Count how often each value of one column occurs, and report the most
+  // frequent. Exact while the distinct values fit in the budget; past it the
+  // counts become bounds (see csvsketch::FrequencyCounter). Zero budget keeps
+  // every value, which is right for the tests.
+  bool want_frequencies = false;
+  size_t frequency_column = 0;
+  size_t frequency_memory_budget = 0;
+  // Group rows by one column and summarise another, writing the table of
+  // groups as CSV with the same delimiter (see csvgroup) over `group_output`,
+  // which the caller creates: removing it abandons the table for good.
+  // The names head its columns. Past `group_memory_budget` the groups are
+  // partitioned to temporary files; zero keeps them all in memory.
+  bool want_groups = false;
+  size_t group_column = 0;
+  size_t group_value_column = 0;
+  std::string group_key_name;
+  std::string group_value_name;
+  std::string group_output;
+  size_t group_memory_budget = 0;
 
   // Count rows that match this as well as the filter, without building an
   // ordering. Used to answer "how many matches" after a search: the search
@@ -74,16 +169,123 @@ struct Request {
   // cost of a sort from the size of the file. Zero keeps every key in memory,
   // which is right for small files and for the tests.
   size_t sort_memory_budget = 0;
+  // How much memory a sorted view's row numbers may take. Past it they are
+  // written to a mapped file in the temporary directory instead, which is what
+  // lets a sort larger than memory finish rather than be refused. Zero keeps
+  // them in memory whatever their size.
+  size_t order_memory_budget = 0;
+
+  // Keep this many of the sort's leading rows on the side while reading, and
+  // report them with the progress. The whole sort cannot finish before the
+  // read and the merge do, but the first screen of it can be shown long
+  // before: provisionally while rows are still arriving, and exactly as soon
+  // as the last one has been read. Zero keeps nothing.
+  size_t provisional_rows = 0;
+  // Report the rows a plain filter keeps as it finds them, a batch with each
+  // progress report, so they can be shown before the pass ends. The first
+  // matches are usually in the first megabyte of a file that takes a minute
+  // to read.
+  bool stream_matches = false;
+
+  // Narrows an existing view instead of reading the whole file: only these
+  // rows are tested against the filter, and the survivors keep the order they
+  // are given in. Set when the new filter is known to keep a subset of the
+  // current view — "err" typed on to "error", or a filter added over a sort,
+  // whose order then survives without sorting again. Any sort requested
+  // alongside is ignored for that reason.
+  //
+  // Shared rather than copied: it is the model's own view, which the worker
+  // only reads while the UI goes on scrolling through it.
+  std::shared_ptr<const csvrows::RowOrder> refine_rows;
+  // The same for a view that is only filtered, whose rows are a set in file
+  // order. At most one of the two is set.
+  std::shared_ptr<const csvrows::RowSet> refine_set;
+  // Where every chunk starts, so the rows above can be reached by seeking
+  // rather than by reading everything in between.
+  csvcache::ChunkOffsets refine_offsets;
+
+  // Reads only the chunks flagged here, one flag per entry of
+  // `refine_offsets`, the others being known from zone maps to hold no row
+  // the filter keeps. Rows keep their numbers in the file, whose count the
+  // pass cannot learn having skipped, so `skim_total_rows` gives it. Empty
+  // reads the whole file, as usual.
+  std::vector<bool> skim_chunks;
+  size_t skim_total_rows = 0;
+
+  // Counts on from the last of these offsets instead of reading from the top:
+  // the rows before it are taken as counted, and the pass reads the rest,
+  // returning the table completed and the count of the whole file. Set for a
+  // file that has only grown since it was indexed (see csvcache::LoadGrown),
+  // when the rest is the part appended. The pass sees only those rows, so
+  // a count and the table are all it is good for.
+  csvcache::ChunkOffsets resume_offsets;
+  // For a file edited in its middle (see csvcache::LoadEdited), where the
+  // chunks past the edit start now, and the rows from the first of them to
+  // the end. A resumed count that reaches the first on a chunk boundary takes
+  // the rest of the table from here and stops; one that passes it reads on.
+  std::vector<std::streampos> resume_tail;
+  size_t resume_tail_rows = 0;
+  // Stops a resumed count at the last record a line break ends, for a file
+  // still being written to: what follows it may be half a record, which would
+  // be counted, and matched, as if it were whole. Result::partial says
+  // whether anything was left.
+  bool whole_records = false;
+
+  // Build a trigram filter of this many bits for every chunk, when the pass
+  // reads every row (see csvcache::GramFilters). Zero builds none: the
+  // caller already has them, or the file is too small to be worth it.
+  size_t gram_bits = 0;
+  // Build the search index too (see csvcache::GramIndex), when the pass reads
+  // every row. Asked for only by a pass of its own, at the user's request: it
+  // costs a good deal more than the filters, to build and to keep.
+  bool want_gram_index = false;
+
+  // Read only while nothing else is: at the lowest CPU and I/O priority the
+  // system allows, and paused while any pass without this set runs. For work
+  // nobody asked for yet, such as indexing a file the moment it opens, which
+  // must never slow down anything the user did ask for. Shares its read with
+  // no one, since whoever joined it would be held to its pace.
+  bool background = false;
 };
 
 struct Result {
+  // Empty after a refinement or a skim, which read too little of the file to
+  // say, and were handed the table anyway. Whole after a resumed count.
   std::vector<std::streampos> offsets;
   size_t total_rows = 0;
+  // The count stopped short of a record still being written (see
+  // Request::whole_records), so it is not yet the count of the whole file.
+  bool partial = false;
   // Physical row indices in view order. Empty when the view is the file in its
   // own order, which the model stores as "no index at all".
-  std::vector<size_t> order;
+  csvrows::RowOrder order;
   bool has_order = false;
+  // A view that is filtered but not sorted arrives here instead of in `order`:
+  // its rows are in file order anyway, and as a set they cost a bit or two
+  // each rather than eight bytes.
+  csvrows::RowSet rows;
+  bool has_rows = false;
   Stats stats;
+  // One entry per column, as many as the widest row had.
+  std::vector<ColumnProfile> profile;
+  // The most frequent values, most frequent first, at most kTopValues.
+  std::vector<csvsketch::Frequency> frequencies;
+  bool frequencies_exact = true;
+  size_t frequency_rows = 0;  // the rows counted, which the filter decides
+  size_t distinct_values = 0; // how many the exact count saw; 0 once it gave up
+  // Rows in the table written to `group_output`, and how often the groups
+  // had to be written out to make room.
+  size_t groups = 0;
+  size_t group_spills = 0;
+  // Zone maps built along the way, when the pass read every row: of the
+  // predicate's columns by a predicate filter, which reads them anyway, and of
+  // every column by a profile of the whole file, which reads all of them.
+  std::vector<csvcache::ZoneMap> zones;
+  // The trigram filters asked for with `gram_bits`, when the pass read every
+  // row; null otherwise.
+  std::shared_ptr<const csvcache::GramFilters> grams;
+  // The search index asked for with `want_gram_index`, likewise.
+  std::shared_ptr<const csvcache::GramIndex> gram_index;
   // Rows matching `count_pattern`, within the filter if there was one.
   size_t matches = 0;
   // How many sorted runs the sort had to spill. Zero means it fit in memory.
@@ -104,6 +306,19 @@ struct Progress {
   size_t kept = 0;     // of those, how many the filter accepted
   double fraction = 0; // 0..1, within the current phase
   Phase phase = Phase::Reading;
+  // The sort's leading rows among those read so far, in order, when asked for
+  // with `provisional_rows` and changed since the last report. Exact once
+  // every row has been read, which `provisional_exact` says.
+  std::vector<size_t> provisional;
+  bool provisional_exact = false;
+  // Rows the filter kept since the last report, in file order, when asked for
+  // with `stream_matches`. Concatenated, the batches are the view so far,
+  // and by the final report the whole of it.
+  std::vector<size_t> matched;
+  // The statistics so far, for a pass with `estimate_stats`, until the last
+  // row is read.
+  bool estimated = false;
+  StatsEstimate estimate;
 };
 
 enum class Outcome { Done, Cancelled, Failed };
@@ -114,13 +329,31 @@ Outcome Run(const Request &request, Result &out,
             const std::function<bool()> &cancelled,
             const std::function<void(const Progress &)> &report);
 
+// Whether two passes can be served by one read of the file: both read all of
+// it, and see it the same way. A refinement reads only the rows it needs, in
+// its own order, and a skim only the chunks it needs; neither shares, nor
+// does a resumed count, which starts where the table ends, nor a background
+// pass.
+bool CanShareRead(const Request &a, const Request &b);
+
 } // namespace csvscan
 
-// Drives csvscan::Run on a worker thread.
+// Drives csvscan passes on worker threads.
+//
+// A worker opens its own file handle and touches no model state; a result is
+// handed over only when the UI thread calls Take(). The read path therefore
+// needs no locks, and the UI stays live while a multi-gigabyte file is
+// scanned.
 //
-// The worker opens its own file handle and touches no model state; the result
-// is handed over only when the UI thread calls Take(). The read path therefore
-// needs no locks, and the UI stays live while a multi-gigabyte file is scanned.
+// Several passes can be running at once, and those that read the whole file
+// share one read of it. A pass started while another is reading gets on
+// where that read stands, with accumulators of its own, and the read goes on
+// past the end and round to the top until the newcomer has seen every row as
+// well. Asking for a column's statistics in the middle of a sort therefore
+// costs one extra read of the part already sorted, rather than throwing the
+// sort away or waiting for it to end. Each pass finishes, fails or is
+// cancelled on its own. A background pass (see csvscan::Request::background)
+// has a thread of its own, and waits whenever any other pass is running.
 class CSVScanner {
 public:
   enum class State { Idle, Running, Done, Cancelled, Failed };
@@ -128,6 +361,8 @@ public:
   using Request = csvscan::Request;
   using Result = csvscan::Result;
   using Stats = csvscan::Stats;
+  // Names one pass. Never reused; zero is never a pass.
+  using PassId = size_t;
 
   CSVScanner() = default;
   ~CSVScanner();
@@ -135,45 +370,72 @@ public:
   CSVScanner(const CSVScanner &) = delete;
   CSVScanner &operator=(const CSVScanner &) = delete;
 
-  // `notify` is called from the worker thread whenever progress advances; use
+  // Starts a pass, on a read already under way when it can share one.
+  // `notify` is called from a worker thread whenever the pass progresses; use
   // it to wake the UI. It must be safe to call from another thread.
-  void Start(Request request, std::function<void()> notify);
+  PassId Start(Request request, std::function<void()> notify);
+  // Makes a background pass an ordinary one from here on: it stops waiting
+  // for the others, and they start waiting for it, and its thread moves back
+  // to the best-effort I/O class from the idle one. Its nice value goes back
+  // too where the system allows it, which without privileges it does not;
+  // on a machine with CPU to spare that costs it nothing.
+  void Promote(PassId pass);
+  // Stops one pass; any others on the same read carry on.
+  void Cancel(PassId pass);
+  // Stops every pass.
   void Cancel();
+  // Waits for every pass to end.
   void Join();
+  // Stops the pass if it is still running and forgets it. Its state reads as
+  // Idle afterwards.
+  void Forget(PassId pass);
 
-  State state() const { return state_.load(std::memory_order_acquire); }
-  bool running() const { return state() == State::Running; }
+  // Idle for a pass that was never started, or has been taken or forgotten.
+  State state(PassId pass) const;
+  bool running(PassId pass) const { return state(pass) == State::Running; }
+  // Whether any pass is running.
+  bool running() const;
   // 0..1, derived from bytes consumed.
-  double progress() const { return progress_.load(std::memory_order_relaxed); }
-  size_t rows_seen() const { return rows_seen_.load(std::memory_order_relaxed); }
+  double progress(PassId pass) const;
+  // Rows this pass has read so far.
+  size_t rows_seen(PassId pass) const;
   // Rows kept by the filter so far. Equals rows_seen() when not filtering.
-  size_t rows_kept() const { return rows_kept_.load(std::memory_order_relaxed); }
-  csvscan::Phase phase() const { return phase_.load(std::memory_order_relaxed); }
+  size_t rows_kept(PassId pass) const;
+  csvscan::Phase phase(PassId pass) const;
 
-  // What this pass was asked for, so the UI can name it while it runs.
-  const Request &request() const { return request_; }
+  // Why the pass failed. Only meaningful once its state is Failed.
+  std::string error(PassId pass) const;
 
-  // Why the pass failed. Only meaningful once state() == Failed; safe to read
-  // then, because it is written before the state is published.
-  const std::string &error() const { return error_; }
+  // Moves out the latest leading rows of a sort, if any arrived since the
+  // last call; `exact` says whether every row had been read by then. Safe
+  // while the worker runs, which is the point.
+  bool TakeProvisional(PassId pass, std::vector<size_t> &rows, bool &exact);
+  // Appends to `rows` the matches found since the last call, for a pass with
+  // `stream_matches` set. Returns false when there were none.
+  bool TakeMatches(PassId pass, std::vector<size_t> &rows);
+  // The latest estimate of a pass with `estimate_stats`, if one arrived since
+  // the last call.
+  bool TakeEstimate(PassId pass, csvscan::StatsEstimate &estimate);
 
-  // Moves the finished result out. Only valid once state() == Done; returns
-  // false otherwise. Leaves the scanner Idle.
-  bool Take(Result &out);
+  // Moves the finished result out. Only valid once the pass is Done; returns
+  // false otherwise. The pass is forgotten.
+  bool Take(PassId pass, Result &out);
 
 private:
-  void Run(Request request, std::function<void()> notify);
-
-  std::thread worker_;
-  std::atomic<State> state_{State::Idle};
-  std::atomic<bool> cancel_{false};
-  std::atomic<double> progress_{0.0};
-  std::atomic<size_t> rows_seen_{0};
-  std::atomic<size_t> rows_kept_{0};
-  std::atomic<csvscan::Phase> phase_{csvscan::Phase::Reading};
-
-  Request request_; // written before the worker starts, read-only after
-  std::string error_; // written before state_ becomes Failed
-  std::mutex result_mutex_;
-  Result result_;
+  struct Slot;   // one pass: its request, its progress, what it hands back
+  struct Reader; // one worker thread, and the passes riding its read
+
+  std::shared_ptr<Slot> Find(PassId pass) const;
+  void Work(std::shared_ptr<Reader> reader, std::shared_ptr<Slot> first);
+  void Reap();
+
+  // Passes running that are not background ones, or have been promoted.
+  // Looked at by a background pass every row, so kept out from under the
+  // lock.
+  std::atomic<size_t> foreground_{0};
+
+  mutable std::mutex mutex_; // guards everything below
+  std::vector<std::shared_ptr<Slot>> slots_;
+  std::vector<std::shared_ptr<Reader>> readers_;
+  PassId next_pass_ = 1;
 };
@@ -0,0 +1,373 @@
+#include "csv_sketch.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace csvsketch {
+
+std::uint64_t Hash(const std::string &value) {
+  // FNV-1a over the bytes, then the MurmurHash3 finaliser. FNV alone leaves
+  // the high bits poorly mixed for short values, and the high bits are
+  // exactly what the registers are chosen by.
+  std::uint64_t hash = 1469598103934665603ull;
+  for (char c : value) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+void DistinctCounter::AddHash(std::uint64_t hash) {
+  if (registers_.empty())
+    registers_.assign(kRegisters, 0);
+  const size_t index = static_cast<size_t>(hash >> (64 - kPrecisionBits));
+  const std::uint64_t rest = hash << kPrecisionBits;
+  // Position of the first set bit among those left, counting from one; all
+  // of them clear is the longest run there can be.
+  const std::uint8_t rank =
+      rest == 0 ? static_cast<std::uint8_t>(64 - kPrecisionBits + 1)
+                : static_cast<std::uint8_t>(__builtin_clzll(rest) + 1);
+  registers_[index] = std::max(registers_[index], rank);
+}
+
+void DistinctCounter::Merge(const DistinctCounter &other) {
+  if (other.registers_.empty())
+    return;
+  if (registers_.empty()) {
+    registers_ = other.registers_;
+    return;
+  }
+  for (size_t i = 0; i < kRegisters; ++i)
+    registers_[i] = std::max(registers_[i], other.registers_[i]);
+}
+
+double DistinctCounter::Estimate() const {
+  if (registers_.empty())
+    return 0.0;
+  const double m = static_cast<double>(kRegisters);
+  double sum = 0.0;
+  size_t zeros = 0;
+  for (std::uint8_t r : registers_) {
+    sum += std::ldexp(1.0, -static_cast<int>(r));
+    if (r == 0)
+      ++zeros;
+  }
+  const double alpha = 0.7213 / (1.0 + 1.079 / m);
+  const double raw = alpha * m * m / sum;
+  // Small counts: the raw estimate is biased upwards, and the empty
+  // registers are the better witness.
+  if (raw <= 2.5 * m && zeros > 0)
+    return m * std::log(m / static_cast<double>(zeros));
+  return raw;
+}
+
+double DistinctCounter::RelativeError() {
+  return 1.04 / std::sqrt(static_cast<double>(kRegisters));
+}
+
+// --- quantiles -------------------------------------------------------------
+
+void QuantileSketch::Grow() {
+  levels_.emplace_back();
+  // The top level holds kAccuracy, each below it two thirds of the one above,
+  // and none fewer than two. Adding a level on top shifts every one of them.
+  capacities_.resize(levels_.size());
+  limit_ = 0;
+  for (size_t h = 0; h < levels_.size(); ++h) {
+    const double depth = static_cast<double>(levels_.size() - h - 1);
+    const double capacity = std::ceil(static_cast<double>(kAccuracy) *
+                                      std::pow(2.0 / 3.0, depth));
+    capacities_[h] = std::max<size_t>(2, static_cast<size_t>(capacity));
+    limit_ += capacities_[h];
+  }
+}
+
+void QuantileSketch::Add(double value) {
+  if (levels_.empty())
+    Grow();
+  levels_[0].push_back(value);
+  ++count_;
+  if (++held_ >= limit_)
+    Compress();
+}
+
+void QuantileSketch::Compress() {
+  while (held_ >= limit_) {
+    size_t h = 0;
+    while (h < levels_.size() && levels_[h].size() < capacities_[h])
+      ++h;
+    if (h == levels_.size())
+      return;
+    if (h + 1 == levels_.size())
+      Grow();
+
+    std::vector<double> &level = levels_[h];
+    std::sort(level.begin(), level.end());
+    // An odd value out stays behind, so the weights still add up to the
+    // count.
+    double leftover = 0.0;
+    const bool odd = level.size() % 2 != 0;
+    if (odd) {
+      leftover = level.back();
+      level.pop_back();
+    }
+    coin_ ^= coin_ << 13;
+    coin_ ^= coin_ >> 7;
+    coin_ ^= coin_ << 17;
+    const size_t offset = static_cast<size_t>(coin_ & 1);
+    std::vector<double> &above = levels_[h + 1];
+    for (size_t i = offset; i < level.size(); i += 2)
+      above.push_back(level[i]);
+    held_ -= level.size() / 2;
+    level.clear();
+    if (odd)
+      level.push_back(leftover);
+  }
+}
+
+void QuantileSketch::Merge(const QuantileSketch &other) {
+  while (levels_.size() < other.levels_.size())
+    Grow();
+  for (size_t h = 0; h < other.levels_.size(); ++h)
+    levels_[h].insert(levels_[h].end(), other.levels_[h].begin(),
+                      other.levels_[h].end());
+  count_ += other.count_;
+  held_ += other.held_;
+  Compress();
+}
+
+std::vector<std::pair<double, std::uint64_t>> QuantileSketch::Ranks() const {
+  std::vector<std::pair<double, std::uint64_t>> ranks;
+  ranks.reserve(held_);
+  for (size_t h = 0; h < levels_.size(); ++h)
+    for (double value : levels_[h])
+      ranks.emplace_back(value, std::uint64_t{1} << h);
+  std::sort(ranks.begin(), ranks.end());
+  std::uint64_t seen = 0;
+  for (auto &entry : ranks) {
+    seen += entry.second;
+    entry.second = seen;
+  }
+  return ranks;
+}
+
+double QuantileSketch::Quantile(double q) const {
+  if (count_ == 0)
+    return 0.0;
+  const std::vector<std::pair<double, std::uint64_t>> ranks = Ranks();
+  // The nearest rank: the first value with at least q of the weight at or
+  // below it.
+  const double target = std::max(0.0, std::min(1.0, q)) *
+                        static_cast<double>(ranks.back().second);
+  for (const auto &entry : ranks) {
+    if (static_cast<double>(entry.second) >= target)
+      return entry.first;
+  }
+  return ranks.back().first;
+}
+
+double QuantileSketch::RankError() {
+  return 2.296 / std::pow(static_cast<double>(kAccuracy), 0.9723);
+}
+
+// --- frequencies -----------------------------------------------------------
+
+namespace {
+
+// What a hash table entry costs beyond its key: node, bucket, count and the
+// string's own header, near enough.
+constexpr size_t kEntryOverhead = 64;
+
+bool MoreFrequent(const Frequency &a, const Frequency &b) {
+  return a.count != b.count ? a.count > b.count : a.value < b.value;
+}
+
+} // namespace
+
+void FrequencyCounter::Add(const std::string &value) {
+  ++count_;
+  if (heap_.empty()) {
+    auto found = exact_.find(value);
+    if (found != exact_.end()) {
+      ++found->second;
+      return;
+    }
+    exact_.emplace(value, 1);
+    exact_bytes_ += value.size() + kEntryOverhead;
+    if (budget_ > 0 && exact_bytes_ > budget_ && exact_.size() > kTracked)
+      SwitchToApproximate();
+    return;
+  }
+
+  auto found = position_.find(value);
+  if (found != position_.end()) {
+    ++heap_[found->second].count;
+    SiftDown(found->second);
+    return;
+  }
+  // Not tracked: it takes the smallest counter's place, and its count. It
+  // may have been seen that many times before, uncounted, and cannot have
+  // been seen more — the smallest count only grows.
+  Frequency &smallest = heap_.front();
+  position_.erase(smallest.value);
+  smallest.error = smallest.count;
+  ++smallest.count;
+  smallest.value = value;
+  position_.emplace(value, 0);
+  SiftDown(0);
+}
+
+void FrequencyCounter::SwitchToApproximate() {
+  // Keep the largest exact counts, error-free. A value dropped here has a
+  // count no larger than the smallest kept, so if it comes back, inheriting
+  // that count covers what it had.
+  std::vector<Frequency> kept;
+  kept.reserve(exact_.size());
+  for (auto &entry : exact_)
+    kept.push_back({entry.first, entry.second, 0});
+  std::unordered_map<std::string, size_t>().swap(exact_);
+  exact_bytes_ = 0;
+  std::nth_element(kept.begin(), kept.begin() + kTracked - 1, kept.end(),
+                   MoreFrequent);
+  kept.resize(kTracked);
+
+  heap_ = std::move(kept);
+  position_.reserve(heap_.size());
+  for (size_t i = 0; i < heap_.size(); ++i)
+    position_.emplace(heap_[i].value, i);
+  for (size_t i = heap_.size() / 2; i-- > 0;)
+    SiftDown(i);
+}
+
+void FrequencyCounter::Place(size_t at) { position_[heap_[at].value] = at; }
+
+void FrequencyCounter::SiftDown(size_t at) {
+  for (;;) {
+    const size_t left = 2 * at + 1;
+    const size_t right = left + 1;
+    size_t smallest = at;
+    if (left < heap_.size() && heap_[left].count < heap_[smallest].count)
+      smallest = left;
+    if (right < heap_.size() && heap_[right].count < heap_[smallest].count)
+      smallest = right;
+    if (smallest == at)
+      return;
+    std::swap(heap_[at], heap_[smallest]);
+    Place(at);
+    Place(smallest);
+    at = smallest;
+  }
+}
+
+size_t FrequencyCounter::MaxError() const {
+  return heap_.empty() ? 0 : heap_.front().count;
+}
+
+std::vector<Frequency> FrequencyCounter::Top(size_t n) const {
+  std::vector<Frequency> out;
+  if (heap_.empty()) {
+    out.reserve(exact_.size());
+    for (const auto &entry : exact_)
+      out.push_back({entry.first, entry.second, 0});
+  } else {
+    out = heap_;
+  }
+  if (out.size() > n) {
+    std::partial_sort(out.begin(), out.begin() + n, out.end(), MoreFrequent);
+    out.resize(n);
+  } else {
+    std::sort(out.begin(), out.end(), MoreFrequent);
+  }
+  return out;
+}
+
+// --- trigrams --------------------------------------------------------------
+
+namespace {
+
+std::uint32_t Fold(char c) {
+  const auto byte = static_cast<unsigned char>(c);
+  return byte >= 'A' && byte <= 'Z' ? byte + ('a' - 'A') : byte;
+}
+
+// A trigram's 24 bits mixed into 32, whose top bits then pick the bit.
+std::uint32_t Scatter(std::uint32_t gram) {
+  std::uint64_t hash = gram * 0x9e3779b97f4a7c15ull;
+  hash ^= hash >> 29;
+  return static_cast<std::uint32_t>(hash >> 32);
+}
+
+size_t Position(std::uint32_t hash, size_t bit_count) {
+  return static_cast<size_t>((static_cast<std::uint64_t>(hash) * bit_count) >>
+                             32);
+}
+
+} // namespace
+
+std::vector<std::uint32_t> Trigrams(const std::string &pattern) {
+  std::vector<std::uint32_t> out;
+  for (size_t i = 2; i < pattern.size(); ++i)
+    out.push_back(Fold(pattern[i - 2]) << 16 | Fold(pattern[i - 1]) << 8 |
+                  Fold(pattern[i]));
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return out;
+}
+
+void AddTrigrams(const char *text, size_t size, std::uint64_t *bits,
+                 size_t bit_count) {
+  if (size < 3 || bit_count == 0)
+    return;
+  std::uint32_t gram = Fold(text[0]) << 8 | Fold(text[1]);
+  for (size_t i = 2; i < size; ++i) {
+    gram = (gram << 8 | Fold(text[i])) & 0xffffff;
+    const size_t at = Position(Scatter(gram), bit_count);
+    bits[at / 64] |= std::uint64_t{1} << (at % 64);
+  }
+}
+
+bool MayHoldTrigrams(const std::uint64_t *bits, size_t bit_count,
+                     const std::vector<std::uint32_t> &trigrams) {
+  if (bit_count == 0)
+    return true;
+  for (std::uint32_t gram : trigrams) {
+    const size_t at = Position(Scatter(gram), bit_count);
+    if ((bits[at / 64] & (std::uint64_t{1} << (at % 64))) == 0)
+      return false;
+  }
+  return true;
+}
+
+void TrigramSet::Add(const char *text, size_t size) {
+  if (size < 3)
+    return;
+  if (seen_.empty())
+    seen_.assign((size_t{1} << 24) / 64, 0);
+  std::uint32_t gram = Fold(text[0]) << 8 | Fold(text[1]);
+  for (size_t i = 2; i < size; ++i) {
+    gram = (gram << 8 | Fold(text[i])) & 0xffffff;
+    std::uint64_t &word = seen_[gram / 64];
+    const std::uint64_t bit = std::uint64_t{1} << (gram % 64);
+    if ((word & bit) != 0)
+      continue;
+    word |= bit;
+    grams_.push_back(gram);
+  }
+}
+
+std::vector<std::uint32_t> TrigramSet::Take() {
+  // Clearing only the bits that were set keeps a sparse stretch cheap.
+  for (std::uint32_t gram : grams_)
+    seen_[gram / 64] &= ~(std::uint64_t{1} << (gram % 64));
+  std::vector<std::uint32_t> out = std::move(grams_);
+  grams_.clear();
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+} // namespace csvsketch
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Fixed-size summaries of a column's values.
+//
+// A pass over the file sees every value once and cannot keep them: a column
+// of a billion rows does not fit anywhere a count of its distinct values
+// could be computed exactly. These answer approximately instead, in memory
+// that does not grow with the file, and say how approximately. Two sketches
+// built over different parts of a file merge into the one the whole file
+// would have built.
+namespace csvsketch {
+
+// 64 well-mixed bits of `value`. Stable across runs and machines, so a
+// sketch's contents mean the same thing wherever it was built.
+std::uint64_t Hash(const std::string &value);
+
+// How many different values were added, to within a few percent. This is
+// HyperLogLog: each value's hash picks one of 4096 one-byte registers, which
+// remembers the longest run of leading zero bits any hash sent its way has
+// had. Long runs are rare, so the runs seen say how many hashes it took to
+// find them. Four kilobytes, however many values.
+class DistinctCounter {
+public:
+  static constexpr unsigned kPrecisionBits = 12;
+  static constexpr size_t kRegisters = size_t{1} << kPrecisionBits;
+
+  void Add(const std::string &value) { AddHash(Hash(value)); }
+  void AddHash(std::uint64_t hash);
+  void Merge(const DistinctCounter &other);
+
+  // The estimated count. Within a value or so for the first few hundred,
+  // where most registers are still empty and are counted instead.
+  double Estimate() const;
+  // The estimate's standard error, as a fraction of it: 1.04 / sqrt(4096),
+  // about 1.6%.
+  static double RelativeError();
+
+private:
+  std::vector<std::uint8_t> registers_; // allocated by the first Add
+};
+
+// Approximate quantiles of a stream of numbers: the median, p99, any of them,
+// to within a stated error in rank. This is a KLL sketch. Values collect in
+// a buffer; when it fills it is sorted and every other value is promoted to
+// the level above, where each stands for two. Levels fill and promote in
+// turn, capacities shrinking by a third going down, so the sketch holds
+// about three times kAccuracy values however many it has seen. Which half is
+// promoted alternates by a fixed sequence, so the same input gives the same
+// answer every run.
+class QuantileSketch {
+public:
+  static constexpr size_t kAccuracy = 2048;
+
+  void Add(double value);
+  void Merge(const QuantileSketch &other);
+
+  size_t count() const { return count_; }
+  // True until the first compaction: below about kAccuracy values everything
+  // is still held, and quantiles are exact.
+  bool exact() const { return levels_.size() <= 1; }
+
+  // The value at fraction `q` of the way through the sorted values, so 0.5
+  // is the median. The true rank of the answer is within RankError() of q,
+  // with 99% confidence. Zero when nothing has been added.
+  double Quantile(double q) const;
+  // 2.296 / kAccuracy^0.9723, about 0.14% of the count: the bound worked out
+  // for KLL sketches by the Apache DataSketches project. So a reported p99.9
+  // is somewhere between the true p99.76 and the maximum.
+  static double RankError();
+
+  // The values held, in order, each paired with how many of those added lie
+  // at or below it: the sketch's whole picture of the distribution, for
+  // combining it with one from elsewhere. The last rank is count().
+  std::vector<std::pair<double, std::uint64_t>> Ranks() const;
+
+private:
+  void Grow();
+  void Compress();
+
+  std::vector<std::vector<double>> levels_; // level h values each weigh 2^h
+  std::vector<size_t> capacities_;          // per level, for this many levels
+  size_t limit_ = 0;                        // their sum: compress on reaching it
+  size_t count_ = 0;
+  size_t held_ = 0;
+  std::uint64_t coin_ = 0x9e3779b97f4a7c15ull; // the promotion sequence
+};
+
+// One value and how often it occurred. When counting was exact `error` is
+// zero; otherwise the true count lies between `count - error` and `count`.
+struct Frequency {
+  std::string value;
+  size_t count = 0;
+  size_t error = 0;
+};
+
+// The most common values. Every distinct value gets an exact count while they
+// fit in `budget_bytes`; a column of a few thousand codes or customers never
+// leaves that. Past it, counting switches to Space-Saving: kTracked counters,
+// each value not among them taking over the smallest and inheriting its count
+// as its error. A value occurring more than count()/kTracked times is then
+// certain to be listed, and no count is off by more than that.
+class FrequencyCounter {
+public:
+  static constexpr size_t kTracked = 8192;
+
+  explicit FrequencyCounter(size_t budget_bytes = 0) : budget_(budget_bytes) {}
+
+  void Add(const std::string &value);
+
+  size_t count() const { return count_; }
+  bool exact() const { return heap_.empty(); }
+  // Distinct values seen, while exact; zero after.
+  size_t distinct() const { return exact_.size(); }
+  // The most any reported count can be too high by: zero while exact.
+  size_t MaxError() const;
+  // The `n` most frequent values, most frequent first and equal counts in
+  // byte order.
+  std::vector<Frequency> Top(size_t n) const;
+
+private:
+  void SwitchToApproximate();
+  void SiftDown(size_t at);
+  void Place(size_t at);
+
+  size_t budget_; // zero: exact whatever it costs
+  size_t count_ = 0;
+  size_t exact_bytes_ = 0;
+  std::unordered_map<std::string, size_t> exact_;
+  // Space-Saving: a min-heap of counters by count, and where each value is.
+  std::vector<Frequency> heap_;
+  std::unordered_map<std::string, size_t> position_;
+};
+
+// Which three-byte sequences a stretch of text holds, as a Bloom filter over
+// an array of bits the caller keeps: every sequence, ASCII letters folded to
+// lower case, sets the one bit its hash picks. A pattern with a sequence
+// whose bit is clear cannot occur in the text, in either case, so the text
+// need not be read to know it. One whose bits are all set probably does; how
+// probably depends on how full the bits are, which is the caller's choice,
+// and on how many sequences the pattern has — each is another chance to be
+// ruled out.
+//
+// The sequences of a pattern, distinct and sorted, each as its three folded
+// bytes in the low 24 bits. Empty for a pattern shorter than three bytes,
+// which rules nothing out.
+std::vector<std::uint32_t> Trigrams(const std::string &pattern);
+// Sets the bits of every sequence in `text`.
+void AddTrigrams(const char *text, size_t size, std::uint64_t *bits,
+                 size_t bit_count);
+// False when `text` cannot hold a pattern with these sequences.
+bool MayHoldTrigrams(const std::uint64_t *bits, size_t bit_count,
+                     const std::vector<std::uint32_t> &trigrams);
+
+// The distinct sequences of a stretch of text, exactly rather than hashed,
+// for an index that lists where each one occurs (see csvcache::GramIndex).
+// A bit for each of the 2^24 possible sequences says which are in already, so
+// adding text costs one test per byte whatever it repeats; 2 MB, taken on the
+// first Add.
+class TrigramSet {
+public:
+  void Add(const char *text, size_t size);
+  bool empty() const { return grams_.empty(); }
+  // The sequences added since the last Take, sorted, leaving the set empty.
+  std::vector<std::uint32_t> Take();
+
+private:
+  std::vector<std::uint64_t> seen_;
+  std::vector<std::uint32_t> grams_;
+};
+
+} // namespace csvsketch
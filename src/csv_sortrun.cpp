@@ -160,7 +160,7 @@ bool RunStore::Spill(std::vector<Key> &keys, const Order &order) {
 }
 
 bool RunStore::Merge(std::vector<Key> &tail, const Order &order,
-                     std::vector<size_t> &out,
+                     csvrows::RowOrder &out,
                      const std::function<bool()> &cancelled,
                      const std::function<void(size_t)> &report) {
   std::sort(tail.begin(), tail.end(), order);
@@ -218,7 +218,10 @@ bool RunStore::Merge(std::vector<Key> &tail, const Order &order,
 
     Head head = heap.top();
     heap.pop();
-    out.push_back(head.key.row);
+    if (!out.push_back(head.key.row)) {
+      error_ = "sort produced more rows than it counted";
+      return false;
+    }
     ++merged;
 
     if (head.source == tail_source) {
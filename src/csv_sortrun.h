@@ -6,6 +6,8 @@
 #include <string>
 #include <vector>
 
+#include "csv_roworder.h"
+
 // Sorting a file larger than memory.
 //
 // Holding one key per row is fine until the row count gets large: at roughly
@@ -15,9 +17,10 @@
 // back together at the end — and it turns the cost of a sort from one
 // proportional to the file into one you choose in advance.
 //
-// What stays in memory is the answer itself: one row number per row, eight
-// bytes. That is a sixth of what a key costs, and it is what the model needs
-// in order to show you row 4 000 000 without reading everything before it.
+// What stays is the answer itself: one row number per row, four bytes. That
+// is a fourteenth of what a key costs, and it is what the model needs in order
+// to show you row 4 000 000 without reading everything before it. When even
+// that is too much it goes to a mapped file too (see csvrows::RowOrder).
 namespace csvsort {
 
 // One row's sort key. The column value is extracted once so that comparison
@@ -86,11 +89,13 @@ public:
   bool Spill(std::vector<Key> &keys, const Order &order);
 
   // Merges every run, plus `tail` (the unspilled remainder, sorted here),
-  // appending row numbers to `out` in order. `cancelled` is polled and
+  // appending row numbers to `out` in order. `out` should have been reserved
+  // for the total, which is what lets it be a mapped file written straight
+  // through rather than an array that has to fit in memory first. `cancelled` is polled and
   // `report` is called with the running total every few thousand rows; either
   // may be empty. Merging a large sort is slow enough to need saying so.
   bool Merge(std::vector<Key> &tail, const Order &order,
-             std::vector<size_t> &out, const std::function<bool()> &cancelled,
+             csvrows::RowOrder &out, const std::function<bool()> &cancelled,
              const std::function<void(size_t)> &report = {});
 
 private:
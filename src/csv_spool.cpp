@@ -0,0 +1,208 @@
+#include "csv_spool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+namespace csvspool {
+
+namespace {
+
+// Big enough that a fast producer costs few wakeups, small enough that a
+// slow one's rows are written as soon as a line of them is there.
+constexpr size_t kReadBytes = 256u * 1024;
+
+} // namespace
+
+Spooler::Spooler(int in, int out, size_t chunk_size)
+    : in_(in), out_(out), chunk_size_(chunk_size == 0 ? 1 : chunk_size) {
+  if (::pipe(wake_) != 0)
+    wake_[0] = wake_[1] = -1;
+  // The first record starts the file, whatever it turns out to hold.
+  offsets_.push_back(std::streampos(0));
+  thread_ = std::thread([this] { Run(); });
+}
+
+Spooler::~Spooler() {
+  SetNotify(nullptr);
+  stop_ = true;
+  if (wake_[1] >= 0) {
+    const char byte = 0;
+    const ssize_t written = ::write(wake_[1], &byte, 1);
+    (void)written;
+  }
+  if (thread_.joinable())
+    thread_.join();
+  // Closing the pipe early tells whatever is writing to it that nobody is
+  // reading any more, rather than leaving it blocked on a full one.
+  for (int fd : {in_, out_, wake_[0], wake_[1]})
+    if (fd >= 0)
+      ::close(fd);
+}
+
+void Spooler::WaitForRecords(size_t records, std::chrono::milliseconds patience) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  arrived_.wait_for(lock, patience,
+                    [&] { return finished_.load() || records_.load() >= records; });
+  arrived_.wait(lock, [&] { return finished_.load() || records_.load() >= 1; });
+}
+
+void Spooler::SetNotify(std::function<void()> notify) {
+  // Under the lock, so that once this returns an old callback is not still
+  // running on the spooler's thread.
+  std::lock_guard<std::mutex> lock(mutex_);
+  notify_ = std::move(notify);
+}
+
+std::string Spooler::error() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return error_;
+}
+
+bool Spooler::Index(bool has_header, std::vector<std::streampos> &offsets,
+                    size_t &rows) const {
+  // The tables belong to the spooler's thread until it has finished.
+  if (!finished_.load() || !error().empty())
+    return false;
+  const size_t records = records_.load();
+  if (!has_header) {
+    offsets = offsets_;
+    rows = records;
+    return true;
+  }
+  // A header with no line break after it leaves nowhere for rows to start.
+  if (header_offsets_.empty())
+    return false;
+  offsets = header_offsets_;
+  rows = records - 1;
+  return true;
+}
+
+void Spooler::Run() {
+  std::string buffer(kReadBytes, '\0');
+  while (true) {
+    // Output owed to the viewer is what the clock waits for; otherwise only
+    // input, or the end of the wait, wakes this.
+    int timeout = -1;
+    if (notify_owed_) {
+      const auto since = std::chrono::steady_clock::now() - last_notify_;
+      timeout = static_cast<int>(std::max<long long>(
+          0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                 kNotifyInterval - since)
+                 .count()));
+    }
+    struct pollfd fds[2] = {{wake_[0], POLLIN, 0}, {in_, POLLIN, 0}};
+    const int ready = ::poll(fds, 2, timeout);
+    if (stop_)
+      return;
+    if (ready < 0 && errno != EINTR) {
+      Finish(std::string("cannot wait for stdin: ") + std::strerror(errno));
+      return;
+    }
+
+    if (ready > 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+      const ssize_t bytes = ::read(in_, &buffer[0], buffer.size());
+      if (bytes < 0 && errno != EINTR && errno != EAGAIN) {
+        Finish(std::string("cannot read stdin: ") + std::strerror(errno));
+        return;
+      }
+      if (bytes == 0) {
+        if (Flush(true))
+          Finish(std::string());
+        return;
+      }
+      if (bytes > 0) {
+        pending_.append(buffer, 0, static_cast<size_t>(bytes));
+        if (!Flush(false))
+          return;
+      }
+    }
+
+    if (notify_owed_ &&
+        std::chrono::steady_clock::now() - last_notify_ >= kNotifyInterval)
+      Notify();
+  }
+}
+
+bool Spooler::Flush(bool at_end) {
+  // The same rule csv::ReadRecord reads by: a line break ends a record when
+  // the quotes before it pair up.
+  size_t cut = 0;
+  size_t complete = records_.load();
+  for (size_t i = scanned_; i < pending_.size(); ++i) {
+    const char c = pending_[i];
+    if (c == '"') {
+      in_quotes_ = !in_quotes_;
+    } else if (c == '\n' && !in_quotes_) {
+      cut = i + 1;
+      ++complete;
+      NoteRecordStart(written_ + static_cast<long long>(cut), complete);
+    }
+  }
+  scanned_ = pending_.size();
+  // What follows the last line break is a record too once nothing more can
+  // be added to it, unterminated quote and all.
+  if (at_end && cut < pending_.size()) {
+    cut = pending_.size();
+    ++complete;
+  }
+  if (cut == 0)
+    return true;
+
+  size_t done = 0;
+  while (done < cut) {
+    const ssize_t chunk = ::write(out_, pending_.data() + done, cut - done);
+    if (chunk < 0 && errno == EINTR)
+      continue;
+    if (chunk <= 0) {
+      Finish(std::string("cannot write the temporary file: ") +
+             std::strerror(errno));
+      return false;
+    }
+    done += static_cast<size_t>(chunk);
+  }
+  written_ += static_cast<long long>(cut);
+  pending_.erase(0, cut);
+  scanned_ -= cut;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.store(complete);
+  }
+  arrived_.notify_all();
+  changed_ = true;
+  notify_owed_ = true;
+  return true;
+}
+
+void Spooler::NoteRecordStart(long long offset, size_t record) {
+  // Chunks count rows from the first record without a header and from the
+  // second with one. Which it is is up to the model, so both are kept.
+  if (record % chunk_size_ == 0)
+    offsets_.push_back(std::streampos(offset));
+  if ((record - 1) % chunk_size_ == 0)
+    header_offsets_.push_back(std::streampos(offset));
+}
+
+void Spooler::Finish(const std::string &error) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = error;
+    finished_ = true;
+  }
+  arrived_.notify_all();
+  changed_ = true;
+  Notify();
+}
+
+void Spooler::Notify() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  last_notify_ = std::chrono::steady_clock::now();
+  notify_owed_ = false;
+  if (notify_)
+    notify_();
+}
+
+} // namespace csvspool
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <ios>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reading piped input into a file while it is being shown.
+//
+// The viewer needs random access, which a pipe does not give, so everything
+// read from it is written to a temporary file that the model opens like any
+// other. Copying it all before the first frame meant `zcat big.csv.gz |
+// csvtui` showed nothing until decompression was done; the spooler copies on
+// a thread of its own instead, and the file grows while it is on screen.
+//
+// It writes whole records only, holding back whatever follows the last line
+// break outside quotes, so that the model never reads half a record as a
+// short one. Since it has to find those line breaks anyway, it builds the
+// chunk offset table a count would, and the count is exact the moment input
+// ends rather than one pass over the file later.
+namespace csvspool {
+
+// How often, at most, the viewer is told that more has arrived.
+constexpr auto kNotifyInterval = std::chrono::milliseconds(100);
+
+class Spooler {
+public:
+  // Starts copying everything read from `in` to `out`, on a thread of its
+  // own, noting where every `chunk_size`-th record starts. Takes both
+  // descriptors and closes them when done.
+  Spooler(int in, int out, size_t chunk_size);
+  ~Spooler();
+
+  Spooler(const Spooler &) = delete;
+  Spooler &operator=(const Spooler &) = delete;
+
+  // Blocks until `records` records are in the file or input has ended, and
+  // once `patience` has passed, until there is one at all: a first frame of
+  // a few rows beats none, but a frame of none is not worth drawing.
+  void WaitForRecords(size_t records, std::chrono::milliseconds patience);
+  // `notify` is called from the spooler's thread when more has arrived, at
+  // most every kNotifyInterval, and once when input ends. It must be safe to
+  // call from there; an empty one stops the calls.
+  void SetNotify(std::function<void()> notify);
+
+  // Whether more has arrived, or input has ended, since the last call.
+  bool TakeChange() { return changed_.exchange(false); }
+  bool finished() const { return finished_.load(); }
+  // Why spooling stopped short of the end of input; empty if it did not.
+  // Everything written before then is still whole records.
+  std::string error() const;
+  size_t records() const { return records_.load(); }
+
+  // Once input has ended without error: the offset of every chunk, counting
+  // rows from the first record or, with a header, from the second — the
+  // table a full pass over the file would have built — and how many rows
+  // that makes. False before then.
+  bool Index(bool has_header, std::vector<std::streampos> &offsets,
+             size_t &rows) const;
+
+private:
+  void Run();
+  // Finds the record boundaries in what has been read but not written, and
+  // writes out everything up to the last of them. `at_end` writes the rest.
+  bool Flush(bool at_end);
+  // Notes that record number `record` starts at `offset`.
+  void NoteRecordStart(long long offset, size_t record);
+  void Finish(const std::string &error);
+  void Notify();
+
+  int in_ = -1;
+  int out_ = -1;
+  size_t chunk_size_;
+  int wake_[2] = {-1, -1}; // written to on destruction, to end the wait
+
+  // Only the spooler's thread touches these.
+  std::string pending_;     // read, not yet written: an unfinished record
+  size_t scanned_ = 0;      // how much of pending_ has been looked at
+  bool in_quotes_ = false;  // at the end of what has been looked at
+  long long written_ = 0;   // bytes in the file
+  std::chrono::steady_clock::time_point last_notify_{};
+  bool notify_owed_ = false;
+
+  // Chunk starts counting from the first record, and from the second. The
+  // thread's alone until it has finished.
+  std::vector<std::streampos> offsets_;
+  std::vector<std::streampos> header_offsets_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable arrived_;
+  std::function<void()> notify_;
+  std::string error_;
+
+  std::atomic<size_t> records_{0};
+  std::atomic<bool> changed_{false};
+  std::atomic<bool> finished_{false};
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+} // namespace csvspool
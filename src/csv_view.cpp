@@ -31,6 +31,51 @@ std::string FormatCount(size_t value) {
   return out;
 }
 
+// Lines of the profile overlay that are not columns: its frame, its heading
+// and the hint beneath.
+constexpr int kProfileChrome = 6;
+
+std::string FormatNumber(double value) {
+  std::ostringstream out;
+  out.precision(6);
+  out << value;
+  return out.str();
+}
+
+// What a column holds, as shares of its non-empty values, largest first and
+// leaving out kinds it has none of: "int 97% · text 3%".
+std::string DescribeKinds(const csvscan::ColumnProfile &column) {
+  const size_t values = column.stats.total - column.stats.empty;
+  if (values == 0)
+    return "empty";
+  const size_t decimals = column.stats.numeric - column.integers;
+  const size_t text = values - column.stats.numeric - column.dates;
+  std::vector<std::pair<size_t, const char *>> kinds = {
+      {column.integers, "int"},
+      {decimals, "num"},
+      {column.dates, "date"},
+      {text, "text"}};
+  std::stable_sort(kinds.begin(), kinds.end(),
+                   [](const auto &a, const auto &b) { return a.first > b.first; });
+
+  std::string out;
+  for (const auto &kind : kinds) {
+    if (kind.first == 0)
+      continue;
+    if (kind.first == values)
+      return kind.second;
+    if (!out.empty())
+      out += " · ";
+    const double share = 100.0 * static_cast<double>(kind.first) /
+                         static_cast<double>(values);
+    out += std::string(kind.second) + " " +
+           (share < 1.0 ? std::string("<1")
+                        : std::to_string(static_cast<int>(share + 0.5))) +
+           "%";
+  }
+  return out;
+}
+
 } // namespace
 
 CSVView::CSVView(CSVModel &model) : model_(model) {}
@@ -42,19 +87,79 @@ void CSVView::ToggleTabularMode() { tabular_mode_ = !tabular_mode_; }
 
 void CSVView::ToggleHelp() {
   show_help_ = !show_help_;
-  if (show_help_)
+  if (show_help_) {
     show_cell_detail_ = false;
+    show_profile_ = false;
+    show_frequencies_ = false;
+  }
 }
 
 void CSVView::ToggleCellDetail() {
   show_cell_detail_ = !show_cell_detail_;
-  if (show_cell_detail_)
+  if (show_cell_detail_) {
     show_help_ = false;
+    show_profile_ = false;
+    show_frequencies_ = false;
+  }
 }
 
 void CSVView::CloseOverlays() {
   show_help_ = false;
   show_cell_detail_ = false;
+  show_profile_ = false;
+  show_frequencies_ = false;
+}
+
+void CSVView::ShowProfile(std::vector<csvscan::ColumnProfile> profile) {
+  profile_ = std::move(profile);
+  profile_start_ = 0;
+  show_profile_ = true;
+  show_help_ = false;
+  show_cell_detail_ = false;
+  show_frequencies_ = false;
+}
+
+void CSVView::ScrollProfile(int delta) {
+  const size_t fits =
+      static_cast<size_t>(std::max(last_height_ - kProfileChrome, 1));
+  const size_t last = profile_.size() > fits ? profile_.size() - fits : 0;
+  if (delta < 0)
+    profile_start_ -= std::min(profile_start_, static_cast<size_t>(-delta));
+  else
+    profile_start_ = std::min(last, profile_start_ + static_cast<size_t>(delta));
+}
+
+void CSVView::ShowFrequencies(size_t col,
+                              std::vector<csvsketch::Frequency> values,
+                              bool exact, size_t rows) {
+  frequencies_ = std::move(values);
+  frequency_column_ = col;
+  frequencies_exact_ = exact;
+  frequency_rows_ = rows;
+  frequency_selected_ = 0;
+  frequency_start_ = 0;
+  show_frequencies_ = true;
+  show_help_ = false;
+  show_cell_detail_ = false;
+  show_profile_ = false;
+}
+
+void CSVView::MoveFrequencySelection(int delta) {
+  if (frequencies_.empty())
+    return;
+  if (delta < 0)
+    frequency_selected_ -=
+        std::min(frequency_selected_, static_cast<size_t>(-delta));
+  else
+    frequency_selected_ = std::min(frequencies_.size() - 1,
+                                   frequency_selected_ +
+                                       static_cast<size_t>(delta));
+}
+
+const csvsketch::Frequency *CSVView::SelectedFrequency() const {
+  return frequency_selected_ < frequencies_.size()
+             ? &frequencies_[frequency_selected_]
+             : nullptr;
 }
 
 void CSVView::SetCursor(size_t row, size_t col) {
@@ -92,6 +197,12 @@ void CSVView::ShowAllColumns() {
   column_width_overrides_.clear();
 }
 
+void CSVView::ResetColumns() {
+  ShowAllColumns();
+  frozen_columns_ = 0;
+  first_column_ = 0;
+}
+
 bool CSVView::ColumnHidden(size_t col) const {
   return hidden_columns_.count(col) > 0;
 }
@@ -313,7 +424,11 @@ Element CSVView::RenderStatusBar(int width) {
   const int percent =
       static_cast<int>(std::lround(100.0 * model_.PositionFraction(cursor_row_)));
 
-  std::string position = " row " + FormatCount(cursor_row_ + 1);
+  // A "~" on the row itself means it was reached by jumping to a place in an
+  // uncounted file, and its number is a guess until the count catches up.
+  std::string position = " row " +
+                         std::string(model_.RowIsApproximate(cursor_row_) ? "~" : "") +
+                         FormatCount(cursor_row_ + 1);
   if (known) {
     position += "/" + FormatCount(model_.RowCount());
   } else {
@@ -321,6 +436,9 @@ Element CSVView::RenderStatusBar(int width) {
     // number anybody counted.
     const size_t estimate = model_.EstimatedRowCount();
     position += estimate > 0 ? "/~" + FormatCount(estimate) : "/…";
+    // Piped input still coming in: that is only what has arrived.
+    if (estimate > 0 && model_.arriving())
+      position += "+";
   }
   position += " (" + std::to_string(percent) + "%)";
   segments.push_back({position + " ", Color::White, false, 1});
@@ -351,7 +469,9 @@ Element CSVView::RenderStatusBar(int width) {
     // Ranked above the column indicator on purpose. A filter changes which
     // rows exist; losing it to make room left the row count as the only hint
     // that what is on screen is not the whole file.
-    segments.push_back({" filter '" + model_.filter_pattern() + "' ",
+    segments.push_back({model_.filter_predicate()
+                            ? " where " + model_.filter_pattern() + " "
+                            : " filter '" + model_.filter_pattern() + "' ",
                         Color::MagentaLight, true, 2});
   }
 
@@ -422,10 +542,12 @@ Element CSVView::RenderHelp() const {
       {"PgDn / PgUp", "full page"},
       {"gg / G", "first / last row"},
       {"<n>G", "go to row n"},
+      {"<n>%", "go n% into the file"},
       {"0 / $", "first / last column"},
       {"/ then Enter", "search forward"},
       {"n / N", "next / prev match"},
       {"f then Enter", "filter rows"},
+      {"F then Enter", "filter by value"},
       {"w then Enter", "write view to a file"},
       {"s / S", "sort by column"},
       {"u", "clear sort / filter"},
@@ -436,6 +558,9 @@ Element CSVView::RenderHelp() const {
       {"Enter", "show full cell"},
       {"y", "copy cell"},
       {"c", "column statistics"},
+      {"p", "profile all columns"},
+      {"v", "most frequent values"},
+      {"a … a", "group by / summarise"},
       {"H", "pin / unpin header"},
       {"t", "aligned / raw mode"},
       {"?", "toggle this help"},
@@ -497,6 +622,123 @@ Element CSVView::RenderCellDetail() const {
          center;
 }
 
+Element CSVView::RenderProfile(int height) const {
+  const size_t fits = static_cast<size_t>(std::max(height - kProfileChrome, 1));
+  const size_t end = std::min(profile_.size(), profile_start_ + fits);
+
+  struct Cell {
+    std::string value;
+    int width;
+  };
+  const auto line = [](const std::vector<Cell> &cells) {
+    std::vector<Element> out;
+    for (const Cell &cell : cells)
+      out.push_back(text(csv::TruncateToWidth(cell.value, cell.width)) |
+                    size(WIDTH, EQUAL, cell.width + 1));
+    return hbox(std::move(out));
+  };
+
+  std::vector<Element> body;
+  body.push_back(line({{"column", 18},
+                       {"kind", 22},
+                       {"empty", 9},
+                       {"≈distinct", 10},
+                       {"min", 11},
+                       {"max", 11},
+                       {"mean", 11},
+                       {"length", 9}}) |
+                 bold);
+  for (size_t col = profile_start_; col < end; ++col) {
+    const csvscan::ColumnProfile &column = profile_[col];
+    const bool numeric = column.stats.numeric > 0;
+    const std::string length =
+        column.stats.total == column.stats.empty
+            ? std::string()
+            : std::to_string(column.min_length) + "–" +
+                  std::to_string(column.max_length);
+    Element row = line({{model_.ColumnName(col), 18},
+                        {DescribeKinds(column), 22},
+                        {FormatCount(column.stats.empty), 9},
+                        {FormatCount(column.distinct), 10},
+                        {numeric ? FormatNumber(column.stats.min) : "", 11},
+                        {numeric ? FormatNumber(column.stats.max) : "", 11},
+                        {numeric ? FormatNumber(column.stats.mean) : "", 11},
+                        {length, 9}});
+    if (col == cursor_col_)
+      row = row | color(Color::Cyan);
+    body.push_back(std::move(row));
+  }
+
+  std::string hint = "j / k to scroll, Esc to close";
+  if (profile_.size() > fits)
+    hint = "columns " + std::to_string(profile_start_ + 1) + "–" +
+           std::to_string(end) + " of " + std::to_string(profile_.size()) +
+           " · " + hint;
+  body.push_back(text(""));
+  body.push_back(text(hint) | dim);
+
+  const size_t rows = profile_.empty() ? 0 : profile_.front().stats.total;
+  const std::string title = " profile — " + FormatCount(rows) + " rows ";
+  return window(text(title) | bold, vbox(std::move(body))) |
+         bgcolor(Color::Black) | clear_under | center;
+}
+
+Element CSVView::RenderFrequencies(int height) {
+  // The window follows the selection, as the grid follows the cursor.
+  const size_t fits = static_cast<size_t>(std::max(height - kProfileChrome, 1));
+  if (frequency_selected_ < frequency_start_)
+    frequency_start_ = frequency_selected_;
+  else if (frequency_selected_ >= frequency_start_ + fits)
+    frequency_start_ = frequency_selected_ - fits + 1;
+  const size_t end = std::min(frequencies_.size(), frequency_start_ + fits);
+
+  std::vector<Element> body;
+  for (size_t i = frequency_start_; i < end; ++i) {
+    const csvsketch::Frequency &entry = frequencies_[i];
+    const double share =
+        frequency_rows_ == 0 ? 0.0
+                             : 100.0 * static_cast<double>(entry.count) /
+                                   static_cast<double>(frequency_rows_);
+    std::ostringstream percent;
+    percent.precision(share < 10.0 ? 2 : 3);
+    percent << share << "%";
+    std::string count = FormatCount(entry.count);
+    if (entry.error > 0)
+      count = "≤" + count;
+
+    Element value =
+        entry.value.empty()
+            ? text("(empty)") | dim
+            : text(csv::TruncateToWidth(csv::SanitizeForDisplay(entry.value),
+                                        40));
+    Element line = hbox({
+        std::move(value) | size(WIDTH, EQUAL, 41),
+        text(count) | size(WIDTH, EQUAL, 14),
+        text(percent.str()) | size(WIDTH, EQUAL, 8),
+    });
+    if (i == frequency_selected_)
+      line = line | inverted;
+    body.push_back(std::move(line));
+  }
+  if (frequencies_.empty())
+    body.push_back(text("(no rows)") | dim);
+
+  body.push_back(text(""));
+  if (!frequencies_exact_)
+    body.push_back(text("Too many distinct values to count them all: counts "
+                        "marked ≤ may be high.") |
+                   dim);
+  body.push_back(text("j / k to move, Enter to filter on the value, Esc to "
+                      "close") |
+                 dim);
+
+  const std::string title = " " + model_.ColumnName(frequency_column_) +
+                            " — most frequent of " +
+                            FormatCount(frequency_rows_) + " rows ";
+  return window(text(title) | bold, vbox(std::move(body))) |
+         bgcolor(Color::Black) | clear_under | center;
+}
+
 // --- main render ------------------------------------------------------------
 
 Element CSVView::Render(int width, int height) {
@@ -507,6 +749,7 @@ Element CSVView::Render(int width, int height) {
   const Layout layout = ComputeLayout(available_width);
   last_truncated_left_ = layout.truncated_left;
   last_truncated_right_ = layout.truncated_right;
+  last_height_ = height;
   const int visible_rows = RowsThatFit(height);
   const auto rows = model_.GetRows(viewport_start_, static_cast<size_t>(visible_rows));
 
@@ -559,6 +802,10 @@ Element CSVView::Render(int width, int height) {
     table = dbox({table, RenderHelp()});
   else if (show_cell_detail_)
     table = dbox({table, RenderCellDetail()});
+  else if (show_profile_)
+    table = dbox({table, RenderProfile(height)});
+  else if (show_frequencies_)
+    table = dbox({table, RenderFrequencies(height)});
 
   // Bottom line: whatever is being typed, otherwise the last message. Long
   // messages (column statistics, for instance) get a full row instead of being
@@ -7,6 +7,8 @@
 #include <string>
 #include <vector>
 
+#include "csv_scan.h"
+
 class CSVModel;
 
 // Renders the grid. The view owns presentation state only; the controller owns
@@ -30,7 +32,27 @@ public:
   bool TabularMode() const { return tabular_mode_; }
   bool HelpVisible() const { return show_help_; }
   bool CellDetailVisible() const { return show_cell_detail_; }
-  bool AnyOverlayVisible() const { return show_help_ || show_cell_detail_; }
+  bool AnyOverlayVisible() const {
+    return show_help_ || show_cell_detail_ || show_profile_ ||
+           show_frequencies_;
+  }
+
+  // A table of every column's profile, one line each, scrolled with j and k
+  // when there are more columns than lines.
+  void ShowProfile(std::vector<csvscan::ColumnProfile> profile);
+  void ScrollProfile(int delta);
+  bool ProfileVisible() const { return show_profile_; }
+
+  // A column's most frequent values, one selected: j and k move the
+  // selection, and the controller filters on the selected value.
+  void ShowFrequencies(size_t col, std::vector<csvsketch::Frequency> values,
+                       bool exact, size_t rows);
+  void MoveFrequencySelection(int delta);
+  bool FrequenciesVisible() const { return show_frequencies_; }
+  // Null when nothing is listed.
+  const csvsketch::Frequency *SelectedFrequency() const;
+  // The column whose values are listed.
+  size_t FrequencyColumn() const { return frequency_column_; }
 
   void SetCursor(size_t row, size_t col);
   void SetViewportStart(size_t row);
@@ -51,6 +73,9 @@ public:
 
   void ToggleColumnHidden(size_t col);
   void ShowAllColumns();
+  // Forgets everything said about columns — hidden, resized, frozen, scrolled
+  // — for when the grid starts showing a different table.
+  void ResetColumns();
   bool ColumnHidden(size_t col) const;
   void SetFrozenColumns(size_t count);
   size_t FrozenColumns() const { return frozen_columns_; }
@@ -73,6 +98,17 @@ private:
   bool tabular_mode_ = true;
   bool show_help_ = false;
   bool show_cell_detail_ = false;
+  bool show_profile_ = false;
+  std::vector<csvscan::ColumnProfile> profile_;
+  size_t profile_start_ = 0;
+  int last_height_ = 0; // the profile's scrolling needs to know what fits
+  bool show_frequencies_ = false;
+  std::vector<csvsketch::Frequency> frequencies_;
+  size_t frequency_column_ = 0;
+  size_t frequency_rows_ = 0;
+  bool frequencies_exact_ = true;
+  size_t frequency_selected_ = 0;
+  size_t frequency_start_ = 0;
 
   size_t cursor_row_ = 0;
   size_t cursor_col_ = 0;
@@ -102,4 +138,6 @@ private:
   ftxui::Element RenderStatusBar(int width);
   ftxui::Element RenderHelp() const;
   ftxui::Element RenderCellDetail() const;
+  ftxui::Element RenderProfile(int height) const;
+  ftxui::Element RenderFrequencies(int height);
 };
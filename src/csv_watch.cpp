@@ -0,0 +1,141 @@
+#include "csv_watch.h"
+
+#include <cstdint>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace csvwatch {
+
+namespace {
+
+#ifdef __linux__
+constexpr std::uint32_t kFileEvents =
+    IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF;
+constexpr std::uint32_t kDirectoryEvents = IN_CREATE | IN_MOVED_TO;
+#endif
+
+std::string DirectoryOf(const std::string &path) {
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos)
+    return ".";
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+} // namespace
+
+// What a change to the file's contents changes, and which file is under the
+// name. One replaced by another of the same size and age, in the same inode,
+// is missed, which rotation never produces.
+struct Watcher::Seen {
+  long long size = -1;
+  long long mtime = -1;
+  long long mtime_ns = -1;
+  unsigned long long device = 0;
+  unsigned long long inode = 0;
+  bool operator!=(const Seen &other) const {
+    return size != other.size || mtime != other.mtime ||
+           mtime_ns != other.mtime_ns || device != other.device ||
+           inode != other.inode;
+  }
+};
+
+Watcher::Seen Watcher::Look(const std::string &path) {
+  Seen seen;
+  struct stat info {};
+  if (::stat(path.c_str(), &info) != 0)
+    return seen;
+  seen.size = static_cast<long long>(info.st_size);
+  seen.mtime = static_cast<long long>(info.st_mtime);
+  seen.device = static_cast<unsigned long long>(info.st_dev);
+  seen.inode = static_cast<unsigned long long>(info.st_ino);
+#ifdef __APPLE__
+  seen.mtime_ns = static_cast<long long>(info.st_mtimespec.tv_nsec);
+#else
+  seen.mtime_ns = static_cast<long long>(info.st_mtim.tv_nsec);
+#endif
+  return seen;
+}
+
+Watcher::Watcher(const std::string &path, std::function<void()> notify)
+    : path_(path), notify_(std::move(notify)) {
+  if (::pipe(wake_) != 0)
+    wake_[0] = wake_[1] = -1;
+#ifdef __linux__
+  inotify_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_ >= 0) {
+    file_watch_ = ::inotify_add_watch(inotify_, path_.c_str(), kFileEvents);
+    if (file_watch_ < 0) {
+      ::close(inotify_);
+      inotify_ = -1;
+    }
+  }
+  // Best-effort: a directory that cannot be watched leaves a rotation to the
+  // clock.
+  if (inotify_ >= 0)
+    directory_watch_ = ::inotify_add_watch(
+        inotify_, DirectoryOf(path_).c_str(), kDirectoryEvents);
+#endif
+  // Looked at here rather than on the thread, so that a write made as soon as
+  // this returns is a change whenever the thread gets round to it.
+  thread_ = std::thread([this, last = Look(path_)] { Run(last); });
+}
+
+Watcher::~Watcher() {
+  stop_ = true;
+  if (wake_[1] >= 0) {
+    const char byte = 0;
+    const ssize_t written = ::write(wake_[1], &byte, 1);
+    (void)written;
+  }
+  if (thread_.joinable())
+    thread_.join();
+  for (int fd : {inotify_, wake_[0], wake_[1]})
+    if (fd >= 0)
+      ::close(fd);
+}
+
+void Watcher::Run(Seen last) {
+  // With inotify the clock is only a backstop, for events that never come.
+  const int timeout = static_cast<int>(
+      (inotify_ >= 0 ? kPollInterval * 4 : kPollInterval).count());
+  while (true) {
+    struct pollfd fds[2] = {{wake_[0], POLLIN, 0}, {inotify_, POLLIN, 0}};
+    const nfds_t count = inotify_ >= 0 ? 2 : 1;
+    // A descriptor that could not be had is -1, which poll passes over.
+    const int ready = ::poll(fds, count, timeout);
+    if (stop_)
+      return;
+    if (ready > 0 && count == 2 && (fds[1].revents & POLLIN) != 0) {
+      // Only that there were events matters; drain them all.
+      char events[4096];
+      while (::read(inotify_, events, sizeof(events)) > 0) {
+      }
+    }
+
+    const Seen now = Look(path_);
+#ifdef __linux__
+    // Rotated, or deleted and written again: the watch is on a file no
+    // longer under the name. One not there yet is watched once the
+    // directory says it has been created.
+    if (inotify_ >= 0 && now.size >= 0 &&
+        (now.device != last.device || now.inode != last.inode)) {
+      if (file_watch_ >= 0)
+        ::inotify_rm_watch(inotify_, file_watch_);
+      file_watch_ = ::inotify_add_watch(inotify_, path_.c_str(), kFileEvents);
+    }
+#endif
+    if (now != last) {
+      last = now;
+      changed_ = true;
+      if (notify_)
+        notify_();
+    }
+  }
+}
+
+} // namespace csvwatch
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Noticing a file being written to, so that a view of it can follow along
+// the way `tail -f` does.
+//
+// On Linux the watcher waits on inotify, which wakes it the moment anything
+// is written. Elsewhere, and wherever inotify cannot be had — the process has
+// used up its watches, or the file is on a network mount that never sends
+// events — it looks at the file's size and modification time twice a second
+// instead. It checks them after an event too, and so only ever reports a
+// change to what is in the file, never a write that left it as it was. What
+// changed is for the model to find out: the watcher says only that something
+// did.
+//
+// A watch follows the file rather than the name, so a log rotated by renaming
+// it would leave the watch on the old one. The directory is watched too, for
+// a file created or moved in under the name, and when the name turns out to
+// belong to another file the watch moves to it.
+namespace csvwatch {
+
+// How often the file is looked at when nothing wakes the watcher sooner.
+constexpr auto kPollInterval = std::chrono::milliseconds(500);
+
+class Watcher {
+public:
+  // Starts watching `path` on a thread of its own. `notify` is called from
+  // that thread after every change, and must be safe to call from there.
+  Watcher(const std::string &path, std::function<void()> notify);
+  ~Watcher();
+
+  Watcher(const Watcher &) = delete;
+  Watcher &operator=(const Watcher &) = delete;
+
+  // Whether the file has changed since the last call.
+  bool TakeChange() { return changed_.exchange(false); }
+  // Whether inotify is doing the waiting, rather than the clock.
+  bool notified() const { return inotify_ >= 0; }
+
+private:
+  struct Seen;
+  static Seen Look(const std::string &path);
+  // Watches until destroyed, reporting any change from `last`, which is the
+  // file as it was when the watcher was made.
+  void Run(Seen last);
+
+  std::string path_;
+  std::function<void()> notify_;
+  std::atomic<bool> changed_{false};
+  std::atomic<bool> stop_{false};
+  int inotify_ = -1;
+  int file_watch_ = -1; // on the file, which is replaced by a rotation
+  int directory_watch_ = -1;
+  int wake_[2] = {-1, -1}; // written to on destruction, to end the wait
+  std::thread thread_;
+};
+
+} // namespace csvwatch
@@ -1,8 +1,10 @@
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
 #include <sys/stat.h>
@@ -13,6 +15,7 @@
 
 #include "csv_controller.h"
 #include "csv_model.h"
+#include "csv_spool.h"
 #include "csv_view.h"
 
 namespace {
@@ -22,6 +25,12 @@ namespace {
 #endif
 constexpr const char *kVersion = CSVTUI_VERSION;
 
+// Piped input is shown once this much of it is there: a chunk and its
+// header, enough to size the columns by. A slow writer gets the first frame
+// after a moment with whatever it has written by then.
+constexpr size_t kFirstRecords = CSVModel::kChunkSize + 1;
+constexpr auto kFirstRecordsPatience = std::chrono::milliseconds(300);
+
 void PrintUsage(std::ostream &out, const char *program) {
   out << "csvtui " << kVersion << " — a terminal viewer for CSV files\n\n"
       << "Usage:\n"
@@ -32,6 +41,9 @@ void PrintUsage(std::ostream &out, const char *program) {
       << "                          Use 'tab' or '\\t' for tab-separated files.\n"
       << "      --no-header         Treat the first row as data, not a header.\n"
       << "      --header            Force the first row to be a header (default).\n"
+      << "      --search-index      Index the file's text in the background, once,\n"
+      << "                          so later searches read only what can match.\n"
+      << "  -f, --follow            Show rows appended to the file as they arrive.\n"
       << "  -h, --help              Show this help and exit.\n"
       << "  -V, --version           Show the version and exit.\n\n"
       << "Keys (press ? inside the viewer for the full list):\n"
@@ -63,41 +75,42 @@ bool StdinHasData() {
   return S_ISFIFO(info.st_mode) || S_ISREG(info.st_mode);
 }
 
-// Copies stdin into a temporary file so the viewer keeps random access, then
-// reconnects stdin to the terminal so keystrokes still reach the UI.
-bool SpoolStdin(std::string &path_out, std::string &error) {
+// Starts copying stdin into a temporary file on a thread of its own, so the
+// viewer keeps random access without waiting for the end of it, and
+// reconnects stdin to the terminal so keystrokes still reach the UI. Returns
+// once the first rows are in the file, or input has ended.
+std::unique_ptr<csvspool::Spooler> StartSpool(std::string &path_out,
+                                              std::string &error) {
   char tmpl[] = "/tmp/csvtui-stdin-XXXXXX";
   const int fd = ::mkstemp(tmpl);
   if (fd < 0) {
     error = std::string("cannot create a temporary file: ") + std::strerror(errno);
-    return false;
+    return nullptr;
   }
 
-  char buffer[65536];
-  ssize_t bytes = 0;
-  while ((bytes = ::read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
-    ssize_t written = 0;
-    while (written < bytes) {
-      const ssize_t chunk = ::write(fd, buffer + written, bytes - written);
-      if (chunk <= 0) {
-        ::close(fd);
-        ::unlink(tmpl);
-        error = "cannot write the temporary file";
-        return false;
-      }
-      written += chunk;
-    }
+  // The pipe is read from a descriptor of its own, since stdin is about to
+  // become the terminal.
+  const int input = ::dup(STDIN_FILENO);
+  if (input < 0) {
+    ::close(fd);
+    ::unlink(tmpl);
+    error = std::string("cannot read stdin: ") + std::strerror(errno);
+    return nullptr;
   }
-  ::close(fd);
 
   if (std::freopen("/dev/tty", "r", stdin) == nullptr) {
+    ::close(input);
+    ::close(fd);
     ::unlink(tmpl);
     error = "no terminal available to read keys from (is this a pipe on both ends?)";
-    return false;
+    return nullptr;
   }
 
   path_out = tmpl;
-  return true;
+  auto spooler =
+      std::make_unique<csvspool::Spooler>(input, fd, CSVModel::kChunkSize);
+  spooler->WaitForRecords(kFirstRecords, kFirstRecordsPatience);
+  return spooler;
 }
 
 } // namespace
@@ -107,6 +120,8 @@ int main(int argc, char **argv) {
 
   std::optional<char> delimiter;
   std::optional<bool> has_header;
+  bool search_index = false;
+  bool follow = false;
   std::string path;
 
   for (int i = 1; i < argc; ++i) {
@@ -127,6 +142,14 @@ int main(int argc, char **argv) {
       has_header = true;
       continue;
     }
+    if (arg == "--search-index") {
+      search_index = true;
+      continue;
+    }
+    if (arg == "-f" || arg == "--follow") {
+      follow = true;
+      continue;
+    }
     if (arg == "-d" || arg == "--delimiter") {
       if (i + 1 >= argc) {
         std::cerr << "csvtui: " << arg << " needs a value\n";
@@ -164,9 +187,11 @@ int main(int argc, char **argv) {
   // No path given: read from a pipe if there is one, otherwise show usage.
   const bool from_stdin = (path == "-") || (path.empty() && StdinHasData());
   std::string spooled;
+  std::unique_ptr<csvspool::Spooler> spooler;
   if (from_stdin) {
     std::string error;
-    if (!SpoolStdin(spooled, error)) {
+    spooler = StartSpool(spooled, error);
+    if (!spooler) {
       std::cerr << "csvtui: " << error << "\n";
       return 1;
     }
@@ -177,9 +202,16 @@ int main(int argc, char **argv) {
   }
 
   CSVModel model;
+  // Before opening, so that the end of what has arrived so far is not taken
+  // for the end of the file.
+  model.SetArriving(spooler != nullptr);
   const std::string error = model.Open(path, delimiter, has_header);
   if (!error.empty()) {
-    std::cerr << "csvtui: " << error << "\n";
+    // A pipe that failed says why better than the empty file it left.
+    const std::string reason =
+        spooler && !spooler->error().empty() ? spooler->error() : error;
+    std::cerr << "csvtui: " << reason << "\n";
+    spooler.reset();
     if (!spooled.empty())
       ::unlink(spooled.c_str());
     return 1;
@@ -187,17 +219,26 @@ int main(int argc, char **argv) {
 
   if (!spooled.empty())
     model.SetDisplayName("(stdin)");
+  model.SetBuildSearchIndex(search_index);
 
   {
     CSVView view(model);
     auto screen = ScreenInteractive::Fullscreen();
     screen.TrackMouse(true);
     CSVController controller(model, view, screen);
+    // Piped input grows while it is read, and is followed that way until it
+    // ends; after that it will not grow.
+    if (spooler)
+      controller.Spool(*spooler);
+    else if (follow)
+      controller.Follow();
     // Loop() restores the terminal on the way out, which is exactly why the
     // controller calls screen.Exit() instead of ::exit().
     screen.Loop(controller.GetComponent());
   }
 
+  // Stops reading a pipe that has not ended yet, which lets its writer go.
+  spooler.reset();
   if (!spooled.empty())
     ::unlink(spooled.c_str());
   return 0;
@@ -2,10 +2,14 @@
 
 #include "csv_cache.h"
 #include "csv_model.h"
+#include "csv_scan.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <dirent.h>
 #include <iterator>
 #include <fstream>
 #include <string>
@@ -68,12 +72,81 @@ std::string BigEnoughCsv(size_t rows) {
   return out;
 }
 
+// Rows numbered on from `first`, as BigEnoughCsv writes them, appended the
+// way a log grows.
+void AppendRows(const std::string &path, size_t first, size_t count) {
+  std::ofstream out(path, std::ios::binary | std::ios::app);
+  const std::string padding(200, 'x');
+  for (size_t i = first; i < first + count; ++i)
+    out << i << ",name" << i << ',' << padding << '\n';
+}
+
+// Replaces row `row`, as BigEnoughCsv writes it, with `with` — nothing at
+// all removes it — in place, the way a regenerated partition is written.
+void RewriteRow(const std::string &path, size_t row, const std::string &with) {
+  std::string contents;
+  {
+    std::ifstream in(path, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+  }
+  const std::string id = std::to_string(row);
+  const size_t at = contents.find("\n" + id + ",name" + id + ",") + 1;
+  const size_t end = contents.find('\n', at) + 1;
+  contents.replace(at, end - at, with);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << contents;
+}
+
+// Indexes `path` with a full pass, as the model would on its first session.
+csvcache::Index IndexOf(const std::string &path) {
+  CSVModel model;
+  CHECK_EQ(model.Open(path, {}, {}), std::string(""));
+  csvscan::Request request;
+  model.DescribeScan(request);
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  csvcache::Index index;
+  index.offsets = result.offsets;
+  index.total_rows = result.total_rows;
+  return index;
+}
+
 csvcache::Key KeyFor(const std::string &path) {
   csvcache::Key key;
   CHECK(csvcache::DescribeFile(path, ',', true, CSVModel::kChunkSize, key));
   return key;
 }
 
+// The bytes of every file in `directory`, ours or not.
+std::uint64_t BytesIn(const std::string &directory) {
+  std::uint64_t total = 0;
+  DIR *listing = ::opendir(directory.c_str());
+  while (listing != nullptr) {
+    const dirent *found = ::readdir(listing);
+    if (found == nullptr)
+      break;
+    struct stat info {};
+    if (::stat((directory + "/" + found->d_name).c_str(), &info) == 0 &&
+        S_ISREG(info.st_mode))
+      total += static_cast<std::uint64_t>(info.st_size);
+  }
+  if (listing != nullptr)
+    ::closedir(listing);
+  return total;
+}
+
+// Makes everything cached for `key` look `seconds` older than it is.
+void Backdate(const csvcache::Key &key, long seconds) {
+  const std::string index = csvcache::PathFor(key);
+  const std::string stem = index.substr(0, index.size() - 4);
+  const std::time_t when = std::time(nullptr) - seconds;
+  const struct utimbuf times = {when, when};
+  for (const char *extension : {".idx", ".sum", ".cols"})
+    ::utime((stem + extension).c_str(), &times);
+}
+
 } // namespace
 
 TEST(CacheRoundTripsAnIndex) {
@@ -189,8 +262,12 @@ TEST(CacheRejectsAnImpossibleOffsetCount) {
   }
   CHECK(!bytes.empty());
 
-  // The count is the last 8-byte field before the offsets themselves.
-  const size_t count_at = bytes.size() - sizeof(std::int64_t) - sizeof(std::uint64_t);
+  // The count follows the magic, the version, the key, the row count and the
+  // path, itself a length and its bytes.
+  const size_t count_at = 8 + 4 + 26 + 8 + 8 + key.path.size();
+  std::uint64_t count = 0;
+  std::memcpy(&count, bytes.data() + count_at, sizeof(count));
+  CHECK_EQ(count, std::uint64_t{1});
   const std::uint64_t absurd = 1ull << 60;
   std::memcpy(bytes.data() + count_at, &absurd, sizeof(absurd));
   {
@@ -202,6 +279,365 @@ TEST(CacheRejectsAnImpossibleOffsetCount) {
   CHECK(!csvcache::Load(key, read));
 }
 
+TEST(CacheMapsAPackedOffsetTableAndChecksIt) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  const csvcache::Key key = KeyFor(file.path());
+
+  // Gaps of every size, so that blocks pack to different widths and offsets
+  // straddle the words they are packed in.
+  csvcache::Index written;
+  written.total_rows = 1000 * 512;
+  long long at = 15;
+  for (int i = 0; i < 1000; ++i) {
+    written.offsets.push_back(std::streampos(at));
+    at += (i % 7 == 0) ? 1 : (i % 64) * 997 + (i / 64) * 31;
+  }
+  CHECK(csvcache::Save(key, written));
+
+  csvcache::Index read;
+  CHECK(csvcache::Load(key, read));
+  CHECK(read.offsets.mapped());
+  CHECK(read.offsets == written.offsets);
+  CHECK_EQ(read.total_rows, size_t{1000 * 512});
+
+  // Read in place; going on past it copies it out first.
+  const csvcache::ChunkOffsets shared = read.offsets;
+  read.offsets.push_back(std::streampos(at));
+  CHECK(!read.offsets.mapped());
+  CHECK_EQ(read.offsets.size(), size_t{1001});
+  CHECK(read.offsets[999] == written.offsets[999]);
+  CHECK(shared.mapped());
+  CHECK(shared[500] == written.offsets[500]);
+
+  // One byte changed deep in the table is caught by the checksum, though
+  // every count still agrees with the rest.
+  const std::string path = csvcache::PathFor(key);
+  std::vector<char> bytes;
+  {
+    std::ifstream in(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+  }
+  bytes[bytes.size() - 100] ^= 0x10;
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+  }
+  CHECK(!csvcache::Load(key, read));
+}
+
+TEST(CacheCountsOnFromTheIndexOfAFileThatGrew) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  csvscan::Request request;
+  model.DescribeScan(request);
+  csvscan::Result before;
+  CHECK(csvscan::Run(request, before, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  csvcache::Index index;
+  index.offsets = before.offsets;
+  index.total_rows = before.total_rows;
+  CHECK(csvcache::Save(KeyFor(file.path()), index));
+
+  AppendRows(file.path(), 200000, 1000);
+  csvcache::Index grown;
+  CHECK(!csvcache::Load(KeyFor(file.path()), grown));
+  CHECK(csvcache::LoadGrown(KeyFor(file.path()), grown));
+  CHECK(grown.offsets == index.offsets);
+
+  // Counting on from the last offset finds what reading it all would.
+  request.resume_offsets = grown.offsets;
+  csvscan::Result resumed;
+  CHECK(csvscan::Run(request, resumed, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  request.resume_offsets.clear();
+  csvscan::Result after;
+  CHECK(csvscan::Run(request, after, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(resumed.total_rows, size_t{201000});
+  CHECK_EQ(resumed.total_rows, after.total_rows);
+  CHECK(resumed.offsets == after.offsets);
+}
+
+TEST(CacheSavesAGrownIndexWithTheHashesItWouldHaveFromScratch) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  CHECK(csvcache::Save(KeyFor(file.path()), IndexOf(file.path())));
+
+  // Saved over the index of the file before it grew, whose hashes it keeps.
+  AppendRows(file.path(), 200000, 1000);
+  const csvcache::Index grown = IndexOf(file.path());
+  CHECK(csvcache::Save(KeyFor(file.path()), grown));
+  const std::string sum_path = csvcache::SumPathFor(KeyFor(file.path()));
+  const auto read = [&sum_path] {
+    std::ifstream in(sum_path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+  };
+  const std::string extended = read();
+  CHECK(!extended.empty());
+
+  CHECK_EQ(::unlink(csvcache::PathFor(KeyFor(file.path())).c_str()), 0);
+  CHECK(csvcache::Save(KeyFor(file.path()), grown));
+  CHECK(read() == extended);
+}
+
+TEST(CacheWriterSavesOnItsOwnThread) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  const csvcache::Index index = IndexOf(file.path());
+  csvcache::Index read;
+  {
+    csvcache::Writer writer;
+    writer.Save(KeyFor(file.path()), index);
+    writer.Wait();
+    CHECK(csvcache::Load(KeyFor(file.path()), read));
+    CHECK(read.offsets == index.offsets);
+
+    // What is still waiting when it goes is saved all the same.
+    CHECK_EQ(::unlink(csvcache::PathFor(KeyFor(file.path())).c_str()), 0);
+    writer.Save(KeyFor(file.path()), index);
+  }
+  CHECK(csvcache::Load(KeyFor(file.path()), read));
+
+  // Trimming goes there too.
+  csvcache::Writer trimmer;
+  trimmer.Trim(0);
+  trimmer.Wait();
+  CHECK(!csvcache::Load(KeyFor(file.path()), read));
+}
+
+TEST(CacheRefusesTheIndexOfAFileChangedBeforeItsEnd) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  csvscan::Request request;
+  model.DescribeScan(request);
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  csvcache::Index index;
+  index.offsets = result.offsets;
+  index.total_rows = result.total_rows;
+  CHECK(csvcache::Save(KeyFor(file.path()), index));
+
+  // A row rewritten near the end of what was indexed, and then more added:
+  // the file grew, but not only by growing, and the rows may have moved.
+  const std::streamoff last = index.offsets.back();
+  {
+    std::fstream edit(file.path(),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    edit.seekp(last - 10);
+    edit.put('y');
+  }
+  AppendRows(file.path(), 200000, 1000);
+  csvcache::Index grown;
+  CHECK(!csvcache::LoadGrown(KeyFor(file.path()), grown));
+
+  // Nor is a file that shrank to be counted on from an end it no longer has.
+  CHECK_EQ(::truncate(file.path().c_str(), last / 2), 0);
+  CHECK(!csvcache::LoadGrown(KeyFor(file.path()), grown));
+}
+
+TEST(CacheSplicesTheIndexAroundAnEditInTheMiddle) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  const csvcache::Index before = IndexOf(file.path());
+  CHECK(csvcache::Save(KeyFor(file.path()), before));
+
+  // Longer, but the same rows: everything past it is where it was, moved.
+  RewriteRow(file.path(), 100000, "100000,renamed,short\n");
+  csvcache::Index kept;
+  csvcache::Splice splice;
+  CHECK(!csvcache::Load(KeyFor(file.path()), kept));
+  CHECK(!csvcache::LoadGrown(KeyFor(file.path()), kept));
+  CHECK(csvcache::LoadEdited(KeyFor(file.path()), kept, splice));
+  // Counting starts again at the chunk holding the edit, and can stop at the
+  // next one.
+  CHECK_EQ(kept.offsets.size(), size_t{100000 / 512 + 1});
+  CHECK_EQ(splice.tail.size(), before.offsets.size() - kept.offsets.size());
+  CHECK_EQ(splice.tail_rows, size_t{200000} - kept.offsets.size() * 512);
+
+  csvcache::Index after = IndexOf(file.path());
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  csvscan::Request request;
+  model.DescribeScan(request);
+  request.resume_offsets = kept.offsets;
+  request.resume_tail = splice.tail;
+  request.resume_tail_rows = splice.tail_rows;
+  csvscan::Result spliced;
+  CHECK(csvscan::Run(request, spliced, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(spliced.total_rows, after.total_rows);
+  CHECK(csvcache::ChunkOffsets(spliced.offsets) == after.offsets);
+
+  // A row taken out puts every chunk after it a row out of step, so the
+  // count reads past where the old chunks start and on to the end — and
+  // still agrees with reading it all.
+  CHECK(csvcache::Save(KeyFor(file.path()), after));
+  RewriteRow(file.path(), 150000, "");
+  CHECK(csvcache::LoadEdited(KeyFor(file.path()), kept, splice));
+  CHECK_EQ(kept.offsets.size(), size_t{150000 / 512 + 1});
+  request.resume_offsets = kept.offsets;
+  request.resume_tail = splice.tail;
+  request.resume_tail_rows = splice.tail_rows;
+  CHECK(csvscan::Run(request, spliced, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  after = IndexOf(file.path());
+  CHECK_EQ(spliced.total_rows, size_t{199999});
+  CHECK(csvcache::ChunkOffsets(spliced.offsets) == after.offsets);
+}
+
+TEST(CacheFindsTheIndexOfACopyByItsContents) {
+  ScopedCacheDir cache;
+  const std::string contents = BigEnoughCsv(200000);
+  TempCSV file(contents);
+  const csvcache::Index index = IndexOf(file.path());
+  CHECK(csvcache::Save(KeyFor(file.path()), index));
+
+  // Elsewhere, and written later, but the same bytes.
+  TempCSV copy(contents);
+  csvcache::Index found;
+  CHECK(!csvcache::Load(KeyFor(copy.path()), found));
+  CHECK(csvcache::LoadCopy(KeyFor(copy.path()), found));
+  CHECK(found.offsets == index.offsets);
+  CHECK_EQ(found.total_rows, size_t{200000});
+
+  CSVModel model;
+  CHECK_EQ(model.Open(copy.path(), {}, {}), std::string(""));
+  CHECK(model.row_count_came_from_cache());
+  CHECK_EQ(model.RowCount(), size_t{200000});
+
+  // The same size with other rows in it is not a copy: at the start, which
+  // the lookup samples, nor in a chunk only the check after it reads.
+  std::string other = contents;
+  other.replace(other.find("name0,"), 6, "NAME0,");
+  TempCSV impostor(other);
+  CHECK(!csvcache::LoadCopy(KeyFor(impostor.path()), found));
+  other = contents;
+  other.replace(other.find("\n6144,name6144,") + 6, 4, "NAME");
+  TempCSV subtler(other);
+  CHECK(!csvcache::LoadCopy(KeyFor(subtler.path()), found));
+  // Nor is the file read another way.
+  csvcache::Key tabs = KeyFor(copy.path());
+  tabs.delimiter = '\t';
+  CHECK(!csvcache::LoadCopy(tabs, found));
+}
+
+TEST(CacheTrimSweepsWhatNoLongerHasAFile) {
+  ScopedCacheDir cache;
+  csvcache::Index index;
+  index.total_rows = 200000;
+  for (int i = 0; i < 400; ++i)
+    index.offsets.push_back(std::streampos(i * 1000));
+
+  std::string orphan;
+  {
+    TempCSV gone(BigEnoughCsv(200000));
+    CHECK(csvcache::Save(KeyFor(gone.path()), index));
+    orphan = csvcache::PathFor(KeyFor(gone.path()));
+  }
+  CHECK_EQ(::access(orphan.c_str(), F_OK), 0);
+
+  // A sweep takes what the deleted file left, however far under the limit.
+  TempCSV kept(BigEnoughCsv(200001));
+  const csvcache::Key key = KeyFor(kept.path());
+  CHECK(csvcache::Save(key, index));
+  CHECK(csvcache::Trim(csvcache::kDefaultLimit) > 0);
+  CHECK(::access(orphan.c_str(), F_OK) != 0);
+  CHECK(csvcache::Load(key, index));
+
+  // A write that never finished goes; what the cache did not write stays.
+  const std::string abandoned = csvcache::PathFor(key) + ".999-0.tmp";
+  const std::string foreign = cache.path() + "/notes.txt";
+  std::ofstream(abandoned) << "half an ind";
+  std::ofstream(foreign) << "mine";
+  CHECK(csvcache::Trim(csvcache::kDefaultLimit) > 0);
+  CHECK(::access(abandoned.c_str(), F_OK) != 0);
+  CHECK_EQ(::access(foreign.c_str(), F_OK), 0);
+  csvcache::Index read;
+  CHECK(csvcache::Load(key, read));
+}
+
+TEST(CacheTrimLetsGoOfTheLeastRecentlyUsedFirst) {
+  ScopedCacheDir cache;
+  TempCSV older(BigEnoughCsv(200000));
+  TempCSV newer(BigEnoughCsv(200001));
+  CHECK(csvcache::Save(KeyFor(older.path()), IndexOf(older.path())));
+  CHECK(csvcache::Save(KeyFor(newer.path()), IndexOf(newer.path())));
+
+  // Written first, but opened since, which is what counts.
+  Backdate(KeyFor(older.path()), 200);
+  Backdate(KeyFor(newer.path()), 100);
+  csvcache::Index read;
+  CHECK(csvcache::Load(KeyFor(older.path()), read));
+
+  CHECK(csvcache::Trim(BytesIn(cache.path()) - 1) > 0);
+  CHECK(csvcache::Load(KeyFor(older.path()), read));
+  CHECK(!csvcache::Load(KeyFor(newer.path()), read));
+  // Its columns went with its index.
+  csvcache::ColumnLayout layout;
+  CHECK(!csvcache::LoadLayout(KeyFor(newer.path()), layout));
+  CHECK(csvcache::LoadLayout(KeyFor(older.path()), layout));
+
+  // The limit is read from the environment.
+  ::setenv("CSVTUI_CACHE_LIMIT", "1", 1);
+  CHECK_EQ(csvcache::Limit(), std::uint64_t{1});
+  ::setenv("CSVTUI_CACHE_LIMIT", "512m", 1);
+  CHECK_EQ(csvcache::Limit(), std::uint64_t{512} << 20);
+  ::setenv("CSVTUI_CACHE_LIMIT", "3G", 1);
+  CHECK_EQ(csvcache::Limit(), std::uint64_t{3} << 30);
+  // Anything else is not taken for the number in front of it.
+  for (const char *wrong : {"2GB", "2 G", "2X", "-1", "0", "G"}) {
+    ::setenv("CSVTUI_CACHE_LIMIT", wrong, 1);
+    CHECK_EQ(csvcache::Limit(), csvcache::kDefaultLimit);
+  }
+  ::unsetenv("CSVTUI_CACHE_LIMIT");
+  CHECK_EQ(csvcache::Limit(), csvcache::kDefaultLimit);
+  CHECK(csvcache::Trim(0) > 0);
+  CHECK(!csvcache::Load(KeyFor(older.path()), read));
+}
+
+TEST(ModelReopensWithTheColumnsItMeasuredBefore) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  std::vector<int> widths;
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    widths = model.ColumnWidths();
+  }
+  csvcache::ColumnLayout layout;
+  CHECK(csvcache::LoadLayout(KeyFor(file.path()), layout));
+  CHECK(layout.widths == widths);
+  CHECK(layout.numeric[0]);
+  CHECK(!layout.numeric[1]);
+  CHECK(layout.record_bytes > 200.0);
+
+  // What is cached is what is used, without sampling to check.
+  layout.widths[0] = 17;
+  CHECK(csvcache::SaveLayout(KeyFor(file.path()), layout));
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    CHECK_EQ(model.ColumnWidths()[0], 17);
+    CHECK(model.ColumnIsNumeric(0));
+  }
+
+  // Until the file changes.
+  AppendRows(file.path(), 200000, 10);
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK(model.ColumnWidths() == widths);
+}
+
 TEST(CacheSkipsFilesTooSmallToBeWorthIt) {
   ScopedCacheDir cache;
   TempCSV file("id,name\n1,a\n2,b\n");
@@ -215,6 +651,122 @@ TEST(CacheSkipsFilesTooSmallToBeWorthIt) {
   CHECK(!csvcache::Load(KeyFor(file.path()), read));
 }
 
+TEST(CacheRoundTripsAProfileUnderTheSameKey) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  const csvcache::Key key = KeyFor(file.path());
+
+  std::vector<csvscan::ColumnProfile> written(3);
+  written[0].stats.total = 200000;
+  written[0].stats.numeric = 200000;
+  written[0].stats.max = 199999;
+  written[0].stats.mean = 99999.5;
+  written[0].integers = 200000;
+  written[0].distinct = 201337; // an estimate, and stored as one
+  written[2].max_length = 200;
+
+  CHECK(csvcache::SaveProfile(key, written));
+  std::vector<csvscan::ColumnProfile> read;
+  CHECK(csvcache::LoadProfile(key, read));
+  CHECK_EQ(read.size(), size_t{3});
+  CHECK_EQ(read[0].stats.mean, 99999.5);
+  CHECK_EQ(read[0].distinct, size_t{201337});
+  CHECK_EQ(read[2].max_length, size_t{200});
+
+  // The same checks as an index: a different reading of the file misses.
+  csvcache::Key other = key;
+  other.delimiter = ';';
+  CHECK(!csvcache::LoadProfile(other, read));
+  // And the two files do not trample each other.
+  CHECK(csvcache::ProfilePathFor(key) != csvcache::PathFor(key));
+}
+
+TEST(CacheRoundTripsZoneMapsUnderTheSameKey) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  const csvcache::Key key = KeyFor(file.path());
+
+  std::vector<csvcache::ZoneMap> written(2);
+  written[0].column = 0;
+  written[0].min = {0, 8192};
+  written[0].max = {8191, 16383};
+  written[1].column = 2;
+  written[1].times = true;
+  written[1].min = {1.5, 1.0};
+  written[1].max = {-1.0, 2.0}; // a zone with no timestamps in it
+
+  CHECK(csvcache::SaveZones(key, written));
+  std::vector<csvcache::ZoneMap> read;
+  CHECK(csvcache::LoadZones(key, read));
+  CHECK_EQ(read.size(), size_t{2});
+  CHECK_EQ(read[0].max[1], 16383.0);
+  CHECK(read[1].times);
+  CHECK_EQ(read[1].column, size_t{2});
+  CHECK(read[1].min[0] > read[1].max[0]);
+
+  csvcache::Key other = key;
+  other.has_header = !key.has_header;
+  CHECK(!csvcache::LoadZones(other, read));
+  CHECK(csvcache::ZonePathFor(key) != csvcache::PathFor(key));
+}
+
+TEST(SearchIndexListsTheZonesHoldingEveryTrigram) {
+  // Zones arrive out of order, as from a pass that joined a read part-way,
+  // and zone 2 in two halves.
+  const auto grams = [](const std::string &text) {
+    csvsketch::TrigramSet set;
+    set.Add(text.data(), text.size());
+    return set.Take();
+  };
+  csvcache::GramIndexBuilder builder;
+  builder.Add(2, grams("red fox"));
+  builder.Add(300, grams("red hen"));
+  builder.Add(0, grams("Red Fox"));
+  builder.Add(2, grams("blue hen"));
+  const csvcache::GramIndex index = builder.Finish(301);
+  CHECK_EQ(index.zones, size_t{301});
+  CHECK(std::is_sorted(index.grams.begin(), index.grams.end()));
+
+  const auto holding = [&index](const std::string &text) {
+    return index.ZonesHolding(csvsketch::Trigrams(text));
+  };
+  CHECK(holding("fox") == std::vector<size_t>({0, 2}));
+  CHECK(holding("hen") == std::vector<size_t>({2, 300}));
+  CHECK(holding("red hen") == std::vector<size_t>({300}));
+  CHECK(holding("RED") == std::vector<size_t>({0, 2, 300}));
+  CHECK(holding("blue fox").empty()); // each half of it, but not in one zone
+  CHECK(holding("wolf").empty());
+  CHECK_EQ(holding("ox").size(), size_t{301}); // too short to rule out
+}
+
+TEST(CacheRoundTripsTheSearchIndexUnderTheSameKey) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  const csvcache::Key key = KeyFor(file.path());
+
+  csvcache::GramIndexBuilder builder;
+  const std::vector<std::uint32_t> needle = csvsketch::Trigrams("needle");
+  builder.Add(7, needle);
+  builder.Add(20, csvsketch::Trigrams("haystack"));
+  const csvcache::GramIndex written = builder.Finish(25);
+
+  CHECK(!csvcache::HasGramIndex(key));
+  CHECK(csvcache::SaveGramIndex(key, written));
+  CHECK(csvcache::HasGramIndex(key));
+  csvcache::GramIndex read;
+  CHECK(csvcache::LoadGramIndex(key, read));
+  CHECK_EQ(read.zones, size_t{25});
+  CHECK(read.grams == written.grams);
+  CHECK(read.postings == written.postings);
+  CHECK(read.ZonesHolding(needle) == std::vector<size_t>({7}));
+
+  csvcache::Key other = key;
+  other.mtime += 1;
+  CHECK(!csvcache::HasGramIndex(other));
+  CHECK(!csvcache::LoadGramIndex(other, read));
+  CHECK(csvcache::GramIndexPathFor(key) != csvcache::GramPathFor(key));
+}
+
 // --- what the model does with it ---------------------------------------------
 
 TEST(ModelSavesAndReloadsItsIndex) {
@@ -249,6 +801,134 @@ TEST(ModelSavesAndReloadsItsIndex) {
   }
 }
 
+TEST(ModelSkipsZonesARangeFilterCannotMatch) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    // The first range filter on a column reads everything, and maps it.
+    CHECK_EQ(model.ApplyFilter("id >= 199000", true), size_t{1000});
+    CHECK(model.SaveIndex());
+  }
+  const std::string zones = csvcache::ZonePathFor(KeyFor(file.path()));
+  CHECK(std::ifstream(zones).good());
+
+  // Another session skims only the last zone, and finds the same rows.
+  CSVModel reopened;
+  CHECK_EQ(reopened.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(reopened.ApplyFilter("id >= 199000 and id < 199500", true),
+           size_t{500});
+  std::vector<std::string> fields;
+  CHECK(reopened.GetRow(0, fields));
+  CHECK_EQ(fields[0], std::string("199000"));
+  CHECK(reopened.filter_predicate());
+}
+
+TEST(ModelSearchesOnlyTheChunksThatMightMatch) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    CHECK(!model.has_grams());
+    // Any full pass builds the trigram filters as it goes.
+    CHECK_EQ(model.ApplyFilter("name199990"), size_t{1});
+    CHECK(model.has_grams());
+    CHECK(model.SaveIndex());
+  }
+
+  CSVModel reopened;
+  CHECK_EQ(reopened.Open(file.path(), {}, {}), std::string(""));
+  CHECK(reopened.has_grams());
+  csvscan::Request request;
+  reopened.DescribeScan(request);
+  CHECK_EQ(request.gram_bits, size_t{0}); // nothing left to build
+
+  // A filter reads a handful of the 391 chunks, not all of them.
+  CSVModel::ViewState view = reopened.CurrentViewState();
+  view.filter_active = true;
+  view.filter_pattern = "name199990";
+  reopened.DescribeFilter(view, request);
+  const size_t read = static_cast<size_t>(
+      std::count(request.skim_chunks.begin(), request.skim_chunks.end(), true));
+  CHECK(!request.skim_chunks.empty());
+  CHECK(read >= 1 && read <= 10);
+
+  // And a search, both ways, lands on the same row.
+  auto hit = reopened.FindNext("name199990", 0, 0, false);
+  CHECK(hit.has_value());
+  if (hit)
+    CHECK_EQ(hit->row, size_t{199990});
+  hit = reopened.FindPrev("name1999", 199995, 0, false);
+  CHECK(hit.has_value());
+  if (hit)
+    CHECK_EQ(hit->row, size_t{199994});
+  hit = reopened.FindPrev("name199990", 199995, 0, false);
+  CHECK(hit.has_value());
+  if (hit)
+    CHECK_EQ(hit->row, size_t{199990});
+  CHECK(!reopened.FindNext("name-absent", 0, 0, true).has_value());
+}
+
+TEST(ModelReadsOnlyTheZonesItsSearchIndexAllows) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    CHECK(!model.WantsSearchIndex()); // not asked for
+    model.SetBuildSearchIndex(true);
+    CHECK(model.WantsSearchIndex());
+
+    csvscan::Request request;
+    model.DescribeScan(request);
+    request.want_gram_index = true;
+    csvscan::Result result;
+    CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+          csvscan::Outcome::Done);
+    CHECK(result.gram_index != nullptr);
+    model.AdoptIndex(std::move(result.offsets), result.total_rows);
+    CHECK(model.SaveIndex());
+    model.AdoptGramIndex(std::move(result.gram_index));
+    CHECK(model.has_gram_index());
+    CHECK(!model.WantsSearchIndex()); // built once
+  }
+
+  CSVModel reopened;
+  CHECK_EQ(reopened.Open(file.path(), {}, {}), std::string(""));
+  CHECK(reopened.has_gram_index());
+  CHECK(!reopened.has_grams()); // the index alone does the skipping here
+
+  // Four zones of 8 192 rows hold every trigram of the pattern — "name1999"
+  // and "name19990" have them all too — and within those every chunk is
+  // read, there being no filters to go further.
+  csvscan::Request request;
+  reopened.DescribeScan(request);
+  CSVModel::ViewState view = reopened.CurrentViewState();
+  view.filter_active = true;
+  view.filter_pattern = "name199990";
+  reopened.DescribeFilter(view, request);
+  CHECK_EQ(request.skim_chunks.size(), size_t{391});
+  const size_t read = static_cast<size_t>(
+      std::count(request.skim_chunks.begin(), request.skim_chunks.end(), true));
+  CHECK_EQ(read, size_t{3 * 16 + 7});
+  CHECK(request.skim_chunks.back());
+
+  auto hit = reopened.FindNext("name199990", 0, 0, false);
+  CHECK(hit.has_value());
+  if (hit)
+    CHECK_EQ(hit->row, size_t{199990});
+  hit = reopened.FindPrev("name12345", 199999, 0, false);
+  CHECK(hit.has_value());
+  if (hit)
+    CHECK_EQ(hit->row, size_t{123459});
+  CHECK(!reopened.FindNext("name-absent", 0, 0, true).has_value());
+}
+
 TEST(ModelDoesNotRewriteAnIndexItJustLoaded) {
   ScopedCacheDir cache;
   TempCSV file(BigEnoughCsv(200000));
@@ -289,3 +969,97 @@ TEST(ModelIgnoresAnIndexForAModifiedFile) {
   CHECK(!reopened.row_count_came_from_cache());
   CHECK_EQ(reopened.EnsureTotalRowCount(), size_t{200001});
 }
+
+TEST(ModelCountsOnlyWhatWasAppendedSinceItsIndex) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    CHECK(!model.IndexOutgrown());
+    csvscan::Request request;
+    model.DescribeScan(request);
+    csvscan::Result result;
+    CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+          csvscan::Outcome::Done);
+    model.AdoptIndex(std::move(result.offsets), result.total_rows);
+    CHECK(model.SaveIndex());
+  }
+
+  AppendRows(file.path(), 200000, 600);
+
+  {
+    CSVModel grown;
+    CHECK_EQ(grown.Open(file.path(), {}, {}), std::string(""));
+    CHECK(!grown.RowCountIsExact());
+    CHECK(grown.IndexOutgrown());
+    // The rows the old index placed are reachable straight away.
+    std::vector<std::string> fields;
+    CHECK(grown.GetRow(150000, fields));
+    CHECK_EQ(fields[1], std::string("name150000"));
+
+    csvscan::Request request;
+    grown.DescribeResume(request);
+    CHECK(!request.resume_offsets.empty());
+    csvscan::Result result;
+    CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+          csvscan::Outcome::Done);
+    grown.AdoptIndex(std::move(result.offsets), result.total_rows);
+    CHECK(!grown.IndexOutgrown());
+    CHECK_EQ(grown.RowCount(), size_t{200600});
+    CHECK(grown.GetRow(200599, fields));
+    CHECK_EQ(fields[1], std::string("name200599"));
+    CHECK(grown.SaveIndex());
+  }
+
+  CSVModel reopened;
+  CHECK_EQ(reopened.Open(file.path(), {}, {}), std::string(""));
+  CHECK(reopened.row_count_came_from_cache());
+  CHECK_EQ(reopened.RowCount(), size_t{200600});
+  // Counting it again finds what the index says, which is nothing to write.
+  csvscan::Request request;
+  reopened.DescribeScan(request);
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  reopened.AdoptIndex(std::move(result.offsets), result.total_rows);
+  CHECK(!reopened.SaveIndex());
+}
+
+TEST(ModelCountsOnlyTheEditSinceItsIndex) {
+  ScopedCacheDir cache;
+  TempCSV file(BigEnoughCsv(200000));
+  {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+    csvscan::Request request;
+    model.DescribeScan(request);
+    csvscan::Result result;
+    CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+          csvscan::Outcome::Done);
+    model.AdoptIndex(std::move(result.offsets), result.total_rows);
+    CHECK(model.SaveIndex());
+  }
+
+  RewriteRow(file.path(), 50000, "50000,a good deal longer than it was,x\n");
+
+  CSVModel edited;
+  CHECK_EQ(edited.Open(file.path(), {}, {}), std::string(""));
+  CHECK(!edited.row_count_came_from_cache());
+  CHECK(edited.IndexEdited());
+  csvscan::Request request;
+  edited.DescribeResume(request);
+  CHECK(!request.resume_tail.empty());
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  edited.AdoptIndex(std::move(result.offsets), result.total_rows);
+  CHECK(!edited.IndexOutgrown());
+  CHECK_EQ(edited.RowCount(), size_t{200000});
+  std::vector<std::string> fields;
+  CHECK(edited.GetRow(50000, fields));
+  CHECK_EQ(fields[1], std::string("a good deal longer than it was"));
+  CHECK(edited.GetRow(199999, fields));
+  CHECK_EQ(fields[1], std::string("name199999"));
+}
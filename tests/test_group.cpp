@@ -0,0 +1,152 @@
+#include "test_util.h"
+
+#include "csv_group.h"
+#include "csv_scan.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Outputs are created by the caller, as the controller does with mkstemp.
+std::string Touch(const std::string &path) {
+  std::ofstream(path, std::ios::trunc).flush();
+  return path;
+}
+
+std::vector<std::string> LinesOf(const std::string &path) {
+  std::ifstream in(path);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(in, line))
+    lines.push_back(line);
+  return lines;
+}
+
+// A directory of its own, so a test can see that nothing was left in it.
+class ScratchDir {
+public:
+  ScratchDir() {
+    char pattern[] = "/tmp/csvtui-group-test-XXXXXX";
+    const char *made = ::mkdtemp(pattern);
+    path_ = made != nullptr ? made : "/tmp";
+  }
+  ~ScratchDir() {
+    const std::string command = "rm -rf " + path_;
+    const int status = std::system(command.c_str());
+    (void)status;
+  }
+  const std::string &path() const { return path_; }
+  size_t Entries() const {
+    const std::string command = "ls -A " + path_ + " | wc -l";
+    FILE *pipe = ::popen(command.c_str(), "r");
+    char buffer[32] = {0};
+    size_t found = 0;
+    if (pipe != nullptr && std::fgets(buffer, sizeof(buffer), pipe) != nullptr)
+      found = static_cast<size_t>(std::strtoul(buffer, nullptr, 10));
+    if (pipe != nullptr)
+      ::pclose(pipe);
+    return found;
+  }
+
+private:
+  std::string path_;
+};
+
+} // namespace
+
+TEST(GroupsSummariseTheirValues) {
+  ScratchDir scratch;
+  csvgroup::Aggregator groups(scratch.path(), 0);
+  CHECK(groups.Add("b", "10"));
+  CHECK(groups.Add("a", "1"));
+  CHECK(groups.Add("b", "30"));
+  CHECK(groups.Add("a", "n/a")); // counted, but not a number
+  CHECK(groups.Add("c", ""));
+
+  const std::string out = Touch(scratch.path() + "/groups.csv");
+  CHECK(groups.Write(out, "key", "value", ',', nullptr));
+  CHECK_EQ(groups.groups(), size_t{3});
+  CHECK_EQ(groups.spills(), size_t{0});
+
+  const std::vector<std::string> lines = LinesOf(out);
+  CHECK_EQ(lines.size(), size_t{4});
+  CHECK_EQ(lines[0], std::string("key,count,sum(value),mean(value),"
+                                 "min(value),max(value)"));
+  CHECK_EQ(lines[1], std::string("a,2,1,1,1,1"));
+  CHECK_EQ(lines[2], std::string("b,2,40,20,10,30"));
+  CHECK_EQ(lines[3], std::string("c,1,,,,")); // no numbers, nothing to add up
+}
+
+TEST(GroupsSpilledToPartitionsAddUpTheSame) {
+  ScratchDir scratch;
+  // Ten thousand keys, each seen three times, with a budget a few hundred of
+  // them would exhaust.
+  csvgroup::Aggregator spilled(scratch.path(), 16 * 1024);
+  csvgroup::Aggregator whole(scratch.path(), 0);
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 10000; ++i) {
+      const std::string key = "k" + std::to_string(i);
+      const std::string value = std::to_string(i * (round + 1));
+      CHECK(spilled.Add(key, value));
+      CHECK(whole.Add(key, value));
+    }
+  }
+  CHECK(spilled.spills() > 0);
+
+  const std::string a = Touch(scratch.path() + "/spilled.csv");
+  const std::string b = Touch(scratch.path() + "/whole.csv");
+  CHECK(spilled.Write(a, "k", "v", ',', nullptr));
+  CHECK(whole.Write(b, "k", "v", ',', nullptr));
+  CHECK_EQ(spilled.groups(), size_t{10000});
+
+  // The same groups, though partitions put them in a different order.
+  std::vector<std::string> left = LinesOf(a);
+  std::vector<std::string> right = LinesOf(b);
+  std::sort(left.begin(), left.end());
+  std::sort(right.begin(), right.end());
+  CHECK(left == right);
+
+  // Nothing but the two outputs remains.
+  CHECK_EQ(scratch.Entries(), size_t{2});
+}
+
+TEST(ScanWritesATableOfGroupsHonouringTheFilter) {
+  ScratchDir scratch;
+  TempCSV file("region,amount,note\n"
+               "north,10,x\n"
+               "south,5,x\n"
+               "north,20,y\n"
+               "east,,x\n");
+  csvscan::Request request;
+  request.path = file.path();
+  request.data_offset = std::streampos(std::string("region,amount,note\n").size());
+  request.want_groups = true;
+  request.group_column = 0;
+  request.group_value_column = 1;
+  request.group_key_name = "region";
+  request.group_value_name = "amount";
+  request.group_output = Touch(scratch.path() + "/out.csv");
+
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(result.groups, size_t{3});
+  std::vector<std::string> lines = LinesOf(request.group_output);
+  CHECK_EQ(lines.size(), size_t{4});
+  CHECK_EQ(lines[1], std::string("east,1,,,,"));
+  CHECK_EQ(lines[2], std::string("north,2,30,15,10,20"));
+
+  request.filter = true;
+  request.filter_pattern = "x";
+  csvscan::Result filtered;
+  CHECK(csvscan::Run(request, filtered, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  lines = LinesOf(request.group_output);
+  CHECK_EQ(filtered.groups, size_t{3});
+  CHECK_EQ(lines[2], std::string("north,1,10,10,10,10"));
+}
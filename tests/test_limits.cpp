@@ -54,7 +54,8 @@ TEST(RowCountEstimateIsCloseWithoutScanning) {
 }
 
 // Sorting a huge file must refuse rather than exhaust memory. Since keys spill
-// to disk, the only thing that has to fit is the resulting order.
+// to disk, and the order follows them when it must, only the working buffer
+// has to fit.
 TEST(SortIsRefusedWhenItWouldNotFit) {
   TempCSV file(ManyRows(5000));
   CSVModel model;
@@ -82,7 +83,7 @@ TEST(AVeryLargeSortIsNoLongerRefusedOutright) {
   const size_t answer_only = rows * CSVModel::kSortOutputBytesPerRow;
 
   // Holding every key would have wanted about nine gigabytes; the answer alone
-  // wants a little over one.
+  // wants about six hundred megabytes.
   CHECK(keys_in_memory > 9ull * 1000 * 1000 * 1000);
   CHECK(answer_only < 1400ull * 1000 * 1000);
 
@@ -113,18 +114,51 @@ TEST(SortBudgetIsWhatIsLeftAfterTheAnswer) {
         budget == CSVModel::kMinSortBufferBytes);
 }
 
+TEST(RecentViewsStayInsideTheirBudget) {
+  TempCSV file(ManyRows(5000));
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+
+  CHECK_EQ(model.ViewCacheBudget(64ull * 1024 * 1024 * 1024),
+           CSVModel::kMaxViewCacheBytes);
+  // The view on screen comes first: with less to spare than it holds,
+  // nothing else is remembered.
+  model.SortByColumn(0, true);
+  CHECK_EQ(model.ViewCacheBudget(5000 * sizeof(uint32_t)), size_t{0});
+
+  // However many views go by, only a bounded few are kept.
+  for (size_t i = 10; i < 10 + 2 * CSVModel::kMaxRecentViews; ++i)
+    model.ApplyFilter("name" + std::to_string(i));
+  CHECK(model.RecentViewCount() <= CSVModel::kMaxRecentViews);
+  CHECK(model.RecentViewBytes() <= model.ViewCacheBudget());
+}
+
+// The answer no longer has to fit either: past its share of the budget it is
+// written to a mapped file, and the sort goes ahead.
+TEST(SortOrderTakesWhatTheBufferLeaves) {
+  TempCSV file(ManyRows(5000));
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+
+  CHECK_EQ(model.OrderMemoryBudget(0), size_t{0}); // unknown: no limit
+  const size_t roomy = 4ull * 1024 * 1024 * 1024;
+  CHECK(model.OrderMemoryBudget(roomy) > model.EstimatedSortBytes());
+  // Less than the floor of the sort buffer: nothing left, but still a limit.
+  CHECK_EQ(model.OrderMemoryBudget(40u * 1024 * 1024), size_t{1});
+}
+
 // Sorting used to hold a key per row and so cost several times what filtering
 // did. Spilling changed the shape of that: what a sort keeps is the answer,
-// which is smaller per row than a filter's index, and what it adds instead is
-// one fixed working buffer that does not grow with the file.
+// and what it adds instead is one fixed working buffer that does not grow with
+// the file. A filter keeps less again — a set of rows, not a list of them.
 TEST(SortCostsAFixedBufferRatherThanMorePerRow) {
-  CHECK(CSVModel::kSortOutputBytesPerRow < CSVModel::kFilterBytesPerRow);
-  CHECK(CSVModel::kSortKeyBytesPerRow > CSVModel::kFilterBytesPerRow);
+  CHECK(CSVModel::kFilterBitsPerRow < 8 * CSVModel::kSortOutputBytesPerRow);
+  CHECK(CSVModel::kSortKeyBytesPerRow > CSVModel::kSortOutputBytesPerRow);
 
   TempCSV file(ManyRows(5000));
   CSVModel model;
   CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
-  CHECK(model.EstimatedSortBytes() < model.EstimatedFilterBytes());
+  CHECK(model.EstimatedFilterBytes() < model.EstimatedSortBytes());
 
   // On a small machine the fixed buffer is what a sort gets refused for, while
   // a filter of the same file still goes ahead.
@@ -159,12 +193,12 @@ TEST(ModelAdoptsABackgroundIndex) {
   model.DescribeScan(request);
 
   CSVScanner scanner;
-  scanner.Start(request, nullptr);
+  const CSVScanner::PassId pass = scanner.Start(request, nullptr);
   scanner.Join();
-  CHECK(scanner.state() == CSVScanner::State::Done);
+  CHECK(scanner.state(pass) == CSVScanner::State::Done);
 
   CSVScanner::Result result;
-  CHECK(scanner.Take(result));
+  CHECK(scanner.Take(pass, result));
   CHECK_EQ(result.total_rows, size_t{3000});
   // One offset for the start plus one per completed chunk.
   CHECK_EQ(result.offsets.size(), size_t{3000 / CSVModel::kChunkSize + 1});
@@ -199,16 +233,16 @@ TEST(ModelAdoptsABackgroundSort) {
   request.want_order = true;
 
   CSVScanner scanner;
-  scanner.Start(request, nullptr);
+  const CSVScanner::PassId pass = scanner.Start(request, nullptr);
   scanner.Join();
   CSVScanner::Result result;
-  CHECK(scanner.Take(result));
+  CHECK(scanner.Take(pass, result));
 
   CSVModel::ViewState state;
   state.sort_active = true;
   state.sort_column = 1;
   background.AdoptIndex(std::move(result.offsets), result.total_rows);
-  background.AdoptView(state, std::move(result.order), result.has_order);
+  background.AdoptView(state, result);
 
   CHECK_EQ(background.RowCount(), inline_model.RowCount());
   std::vector<std::string> here, there;
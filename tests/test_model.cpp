@@ -1,9 +1,11 @@
 #include "test_util.h"
 
 #include "csv_model.h"
+#include "csv_scan.h"
 
 #include <cstdio>
 #include <fstream>
+#include <optional>
 #include <string>
 #include <unistd.h>
 
@@ -229,6 +231,38 @@ TEST(FilterSelectsMatchingRows) {
   CHECK_EQ(model.RowCount(), size_t{3});
 }
 
+// What filtering on a value picked from a column's frequencies builds: the
+// cell exactly, which a typed pattern could not always say.
+TEST(FilterOnBuiltClausesTakesTheValueAsItIs) {
+  TempCSV file("id,city\n1,Bath and Wells\n2,\"say \"\"hi\"\"\"\n3,\n"
+               "4,Bath\n5,1.0\n6,1\n");
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  const auto equal = [](const std::string &text) {
+    csvpredicate::Clause clause;
+    clause.column = 1;
+    clause.op = csvpredicate::Op::Equal;
+    clause.kind = csvpredicate::Kind::Text;
+    clause.text = text;
+    csvpredicate::Predicate built;
+    built.clauses.push_back(clause);
+    return built;
+  };
+
+  CHECK_EQ(model.ApplyFilter("city = \"Bath and Wells\"",
+                             equal("Bath and Wells")),
+           size_t{1});
+  CHECK_EQ(Cell(model, 0, 0), std::string("1"));
+  CHECK_EQ(model.ApplyFilter("city = \"say \"hi\"\"", equal("say \"hi\"")),
+           size_t{1});
+  CHECK_EQ(Cell(model, 0, 0), std::string("2"));
+  CHECK_EQ(model.ApplyFilter("city = \"\"", equal("")), size_t{1});
+  CHECK_EQ(Cell(model, 0, 0), std::string("3"));
+  // As text, so a number is not another way of writing it.
+  CHECK_EQ(model.ApplyFilter("city = \"1\"", equal("1")), size_t{1});
+  CHECK_EQ(Cell(model, 0, 0), std::string("6"));
+}
+
 TEST(FilterAndSortCombine) {
   TempCSV file("id,name,score\n1,alpha,30\n2,beta,5\n3,alphabet,10\n");
   CSVModel model;
@@ -240,6 +274,144 @@ TEST(FilterAndSortCombine) {
   CHECK_EQ(Cell(model, 1, 2), std::string("30"));
 }
 
+// Typing more of a pattern narrows the view it already has rather than
+// reading the file again, and must land on the same rows a fresh filter would.
+TEST(NarrowingAFilterMatchesFilteringAfresh) {
+  TempCSV file("id,name\n1,err\n2,error\n3,Errors\n4,ok\n5,terror\n");
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(model.ApplyFilter("err"), size_t{4});
+
+  CSVModel::ViewState target = model.CurrentViewState();
+  target.filter_pattern = "erro";
+  CHECK(model.Refines(target));
+  // Case counts under the old pattern's rule: "err" matched "Errors", so
+  // "Erro" can only keep a subset of what it kept.
+  target.filter_pattern = "Erro";
+  CHECK(model.Refines(target));
+  // Not narrower: a different word, and a shorter one.
+  target.filter_pattern = "ok";
+  CHECK(!model.Refines(target));
+  target.filter_pattern = "er";
+  CHECK(!model.Refines(target));
+
+  CHECK_EQ(model.ApplyFilter("error"), size_t{3});
+  CHECK_EQ(Cell(model, 0, 1), std::string("error"));
+  CHECK_EQ(Cell(model, 1, 1), std::string("Errors"));
+  CHECK_EQ(Cell(model, 2, 1), std::string("terror"));
+
+  CSVModel fresh;
+  CHECK_EQ(fresh.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(fresh.ApplyFilter("error"), size_t{3});
+}
+
+TEST(FilteringASortedViewKeepsItsOrder) {
+  TempCSV file("id,name,score\n1,alpha,30\n2,beta,5\n3,alphabet,10\n"
+               "4,alpine,20\n");
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  model.SortByColumn(2, false);
+
+  CSVModel::ViewState target = model.CurrentViewState();
+  target.filter_active = true;
+  target.filter_pattern = "alp";
+  CHECK(model.Refines(target));
+
+  CHECK_EQ(model.ApplyFilter("alp"), size_t{3});
+  CHECK(model.sort_active());
+  CHECK_EQ(Cell(model, 0, 2), std::string("10"));
+  CHECK_EQ(Cell(model, 1, 2), std::string("20"));
+  CHECK_EQ(Cell(model, 2, 2), std::string("30"));
+}
+
+TEST(ClearingASortRecallsTheFilterUnderIt) {
+  TempCSV file("id,name,score\n1,alpha,30\n2,beta,5\n3,alphabet,10\n"
+               "4,alpine,20\n");
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(model.ApplyFilter("alp"), size_t{3});
+  CHECK(!model.view_came_from_cache());
+  model.SortByColumn(2, true);
+  CHECK_EQ(Cell(model, 0, 2), std::string("30"));
+  CHECK_EQ(model.RecentViewCount(), size_t{1});
+
+  model.ClearSort();
+  CHECK(model.view_came_from_cache());
+  CHECK(model.filter_active());
+  CHECK_EQ(model.RowCount(), size_t{3});
+  CHECK_EQ(Cell(model, 0, 0), std::string("1"));
+  CHECK_EQ(Cell(model, 2, 0), std::string("4"));
+
+  // And the sort it just left is there to come back to.
+  model.SortByColumn(2, true);
+  CHECK(model.view_came_from_cache());
+  CHECK_EQ(Cell(model, 0, 2), std::string("30"));
+  CHECK_EQ(Cell(model, 2, 2), std::string("10"));
+}
+
+TEST(AProvisionalSortNeverReplacesTheViewUnderIt) {
+  TempCSV file("id,name,score\n1,alpha,30\n2,beta,5\n3,alphabet,10\n"
+               "4,alpine,20\n");
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(model.ApplyFilter("alp"), size_t{3});
+
+  CSVModel::ViewState sorted = model.CurrentViewState();
+  sorted.sort_active = true;
+  sorted.sort_column = 2;
+  model.ShowProvisional(sorted, {2});
+  CHECK(model.showing_provisional());
+  CHECK_EQ(model.RowCount(), size_t{1});
+  CHECK_EQ(Cell(model, 0, 2), std::string("10"));
+
+  // Cancelled: the filter comes back as it was.
+  model.DropProvisional();
+  CHECK(!model.showing_provisional());
+  CHECK(!model.sort_active());
+  CHECK_EQ(model.RowCount(), size_t{3});
+
+  // Finished: the filter, not the glimpse, is what can be gone back to.
+  model.ShowProvisional(sorted, {2});
+  model.AdoptView(sorted, {2, 3, 0}, true);
+  CHECK(!model.showing_provisional());
+  CHECK_EQ(model.RecentViewCount(), size_t{1});
+  model.ClearSort();
+  CHECK(model.view_came_from_cache());
+  CHECK_EQ(model.RowCount(), size_t{3});
+}
+
+TEST(StreamedMatchesGrowInPlaceUntilTheFilterFinishes) {
+  TempCSV file("id,name\n1,alpha\n2,beta\n3,alphabet\n4,alpine\n");
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+
+  CSVModel::ViewState filtered = model.CurrentViewState();
+  filtered.filter_active = true;
+  filtered.filter_pattern = "alp";
+  model.AppendProvisional(filtered, {0});
+  CHECK(model.showing_provisional());
+  CHECK(model.filter_active());
+  CHECK_EQ(model.RowCount(), size_t{1});
+  model.AppendProvisional(filtered, {2, 3});
+  CHECK_EQ(model.RowCount(), size_t{3});
+  CHECK_EQ(Cell(model, 0, 1), std::string("alpha"));
+  CHECK_EQ(Cell(model, 2, 1), std::string("alpine"));
+
+  // Cancelled part way: the whole file again, unfiltered.
+  model.DropProvisional();
+  CHECK(!model.showing_provisional());
+  CHECK(!model.filter_active());
+  CHECK_EQ(model.RowCount(), size_t{4});
+
+  // A second filter starts from nothing rather than the first one's rows.
+  model.AppendProvisional(filtered, {3});
+  CHECK_EQ(model.RowCount(), size_t{1});
+  CHECK_EQ(Cell(model, 0, 1), std::string("alpine"));
+  model.AdoptView(filtered, {0, 2, 3}, true);
+  CHECK_EQ(model.RowCount(), size_t{3});
+  CHECK(!model.showing_provisional());
+}
+
 TEST(ColumnStatsSummariseNumbers) {
   TempCSV file("id,score\n1,10\n2,20\n3,\n4,oops\n");
   CSVModel model;
@@ -272,3 +444,172 @@ TEST(RaggedRowsAreTolerated) {
   CHECK_EQ(Cell(model, 1, 1), std::string("<no col>"));
   CHECK(model.ColumnCount() >= size_t{4});
 }
+
+TEST(GoingToAPercentageOfACountedFileIsExact) {
+  std::string contents = "id,name\n";
+  for (int i = 0; i < 1000; ++i)
+    contents += std::to_string(i) + ",row\n";
+  TempCSV file(contents);
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  const std::optional<size_t> row = model.LandAt(0.5);
+  CHECK(row.has_value());
+  CHECK_EQ(*row, size_t{500});
+  CHECK(!model.RowIsApproximate(*row));
+  CHECK_EQ(model.LandAt(1.0).value_or(0), size_t{999});
+}
+
+TEST(LandingMidFileFindsARecordAndTakesItsNumberLater) {
+  // Every record spans two lines and quotes a delimiter, so a landing that
+  // trusted the first line break it saw would start half way through one.
+  std::string contents = "id,note,tail\n";
+  const int rows = 300000;
+  for (int i = 0; i < rows; ++i)
+    contents += std::to_string(i) + ",\"first, of " + std::to_string(i) +
+                "\nsecond \"\"line\"\"\",end\n";
+  TempCSV file(contents);
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK(!model.RowCountIsExact());
+
+  const std::optional<size_t> row = model.LandAt(0.5);
+  CHECK(row.has_value());
+  CHECK(model.RowIsApproximate(*row));
+  const long long id = std::stoll(Cell(model, *row, 0));
+  CHECK(id > rows / 2 - rows / 50 && id < rows / 2 + rows / 50);
+  CHECK_EQ(Cell(model, *row, 2), std::string("end"));
+  CHECK_EQ(Cell(model, *row + 1, 0), std::to_string(id + 1));
+  // The chunk before the landing, read backwards from it.
+  CHECK_EQ(Cell(model, *row - 1, 0), std::to_string(id - 1));
+  CHECK_EQ(Cell(model, *row - 600, 0), std::to_string(id - 600));
+
+  long long shift = 0;
+  CHECK(!model.TakeRenumbering(shift));
+  csvscan::Request request;
+  model.DescribeScan(request);
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  model.AdoptIndex(std::move(result.offsets), result.total_rows);
+
+  CHECK(model.TakeRenumbering(shift));
+  CHECK_EQ(static_cast<long long>(*row) + shift, id);
+  CHECK(!model.RowIsApproximate(static_cast<size_t>(id)));
+  CHECK_EQ(Cell(model, static_cast<size_t>(id), 0), std::to_string(id));
+}
+
+// Piped input is shown while it is read in: until it ends, the end of the
+// file is only where it has got to.
+TEST(AnArrivingFileIsNotCountedAtItsEnd) {
+  std::string contents = "id,name\n";
+  for (int i = 0; i < 100; ++i)
+    contents += std::to_string(i) + ",row\n";
+  TempCSV file(contents);
+  CSVModel model;
+  model.SetArriving(true);
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(Cell(model, 99, 0), std::string("99"));
+  std::vector<std::string> row;
+  CHECK(!model.GetRow(100, row));
+  model.EnsureTotalRowCount();
+  CHECK(!model.RowCountIsExact());
+
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    for (int i = 100; i < 1100; ++i)
+      out << i << ",row\n";
+  }
+  CHECK(model.CheckGrowth() == CSVModel::Growth::Grown);
+  CHECK_EQ(Cell(model, 100, 0), std::string("100")); // the chunk read short
+  CHECK_EQ(Cell(model, 1099, 0), std::string("1099"));
+  CHECK(!model.RowCountIsExact());
+
+  // A pass over what has arrived keeps its offsets but not its count.
+  csvscan::Request request;
+  model.DescribeScan(request);
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  std::vector<std::streampos> offsets = result.offsets;
+  model.AdoptIndex(std::move(result.offsets), result.total_rows);
+  CHECK(!model.RowCountIsExact());
+
+  model.SetArriving(false);
+  model.AdoptIndex(std::move(offsets), 1100);
+  CHECK(model.RowCountIsExact());
+  CHECK_EQ(model.RowCount(), size_t{1100});
+  // Nor does a count that began before the end undo the one made after it.
+  model.AdoptIndex({model.DataOffset()}, 100);
+  CHECK_EQ(model.RowCount(), size_t{1100});
+}
+
+// Rows appended while the file is open are read from where the table stops,
+// and join an unsorted filter without it being run again.
+TEST(FollowingReadsOnlyWhatWasAppended) {
+  std::string contents = "id,name\n";
+  for (int i = 0; i < 1200; ++i)
+    contents += std::to_string(i) + (i % 10 == 0 ? ",keep\n" : ",skip\n");
+  TempCSV file(contents);
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  CHECK_EQ(model.EnsureTotalRowCount(), size_t{1200});
+  CHECK_EQ(Cell(model, 1199, 0), std::string("1199")); // the last chunk, short
+  CHECK_EQ(model.ApplyFilter("keep"), size_t{120});
+  CHECK(model.CheckGrowth() == CSVModel::Growth::None);
+
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    for (int i = 1200; i < 1300; ++i)
+      out << i << (i % 10 == 0 ? ",keep\n" : ",skip\n");
+  }
+  CHECK(model.CheckGrowth() == CSVModel::Growth::Grown);
+  csvscan::Request request;
+  model.DescribeAppended(request);
+  CHECK(!request.resume_offsets.empty());
+  CHECK(request.filter);
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  const CSVModel::ViewState view = model.CurrentViewState();
+  model.AdoptIndex(std::move(result.offsets), result.total_rows);
+  model.AdoptAppended(view, result);
+
+  CHECK_EQ(model.RowCount(), size_t{130});
+  CHECK_EQ(Cell(model, 129, 0), std::string("1290"));
+
+  // A record caught half written matches, but is not yet a row.
+  const auto follow = [&] {
+    CHECK(model.CheckGrowth() == CSVModel::Growth::Grown);
+    csvscan::Request appended;
+    model.DescribeAppended(appended);
+    csvscan::Result read;
+    CHECK(csvscan::Run(appended, read, nullptr, nullptr) ==
+          csvscan::Outcome::Done);
+    const CSVModel::ViewState before = model.CurrentViewState();
+    const bool partial = read.partial;
+    model.AdoptIndex(std::move(read.offsets), read.total_rows);
+    model.AdoptAppended(before, read);
+    return partial;
+  };
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    out << "1300,\"keep\nit";
+  }
+  CHECK(follow());
+  CHECK_EQ(model.RowCount(), size_t{130});
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    out << "\"\n";
+  }
+  CHECK(!follow());
+  CHECK_EQ(model.RowCount(), size_t{131});
+  CHECK_EQ(Cell(model, 130, 0), std::string("1300"));
+
+  model.ClearFilter();
+  CHECK_EQ(model.RowCount(), size_t{1301});
+  CHECK_EQ(Cell(model, 1299, 0), std::string("1299"));
+
+  // Cut short, it is no longer the file the table describes.
+  CHECK_EQ(::truncate(file.path().c_str(), 20), 0);
+  CHECK(model.CheckGrowth() == CSVModel::Growth::Shrunk);
+}
@@ -82,6 +82,23 @@ TEST(ReadRecordAtEofWithUnterminatedQuote) {
   CHECK(!csv::ReadRecord(in, record));
 }
 
+TEST(FindRecordStartSkipsLineBreaksInsideQuotes) {
+  // Opened in the middle of a quoted field that spans lines.
+  const std::string text =
+      "ond line\nthird, line\",tail\n42,\"opening\",x\n";
+  size_t start = 0;
+  CHECK(csv::FindRecordStart(text, ',', start));
+  CHECK_EQ(text.substr(start, 3), std::string("42,"));
+}
+
+TEST(FindRecordStartFromOutsideQuotes) {
+  const std::string text = "b,c\n\"x\ny\",d\nz\n";
+  size_t start = 0;
+  CHECK(csv::FindRecordStart(text, ',', start));
+  CHECK_EQ(start, size_t{4});
+  CHECK(!csv::FindRecordStart("no line break", ',', start));
+}
+
 TEST(StripBomRemovesMarker) {
   std::string with_bom = "\xEF\xBB\xBFid,name";
   csv::StripBom(with_bom);
@@ -125,6 +142,46 @@ TEST(NumberDetection) {
   CHECK(!csv::IsNumeric("N/A"));
 }
 
+TEST(IntegerAndDateDetection) {
+  CHECK(csv::IsInteger("42"));
+  CHECK(csv::IsInteger(" -7 "));
+  CHECK(!csv::IsInteger("3.0"));
+  CHECK(!csv::IsInteger("1e3"));
+  CHECK(!csv::IsInteger("-"));
+
+  CHECK(csv::IsDate("2024-02-29"));
+  CHECK(csv::IsDate("2024-02-29T13:45:00Z"));
+  CHECK(csv::IsDate("2024-02-29 13:45"));
+  CHECK(!csv::IsDate("2024-13-01"));
+  CHECK(!csv::IsDate("2024-1-01"));
+  CHECK(!csv::IsDate("20240101"));
+}
+
+TEST(TimestampsReadAsSecondsSinceTheEpoch) {
+  double seconds = 0.0;
+  CHECK(csv::ParseTime("1970-01-02", seconds));
+  CHECK_EQ(seconds, 86400.0);
+  CHECK(csv::ParseTime("2000-03-01T00:00:00Z", seconds));
+  CHECK_EQ(seconds, 951868800.0);
+  CHECK(csv::ParseTime("1970-01-01 01:30", seconds));
+  CHECK_EQ(seconds, 5400.0);
+  CHECK(csv::ParseTime("1970-01-01T00:00:01.25", seconds));
+  CHECK_EQ(seconds, 1.25);
+
+  // The same instant written in two zones compares equal.
+  double utc = 0.0, paris = 0.0, new_york = 0.0;
+  CHECK(csv::ParseTime("2024-03-07T12:00:00Z", utc));
+  CHECK(csv::ParseTime("2024-03-07T13:00:00+01:00", paris));
+  CHECK(csv::ParseTime("2024-03-07T07:00:00-0500", new_york));
+  CHECK_EQ(paris, utc);
+  CHECK_EQ(new_york, utc);
+
+  CHECK(!csv::ParseTime("2024-03-07T25:00", seconds));
+  CHECK(!csv::ParseTime("2024-03-07T12", seconds));
+  CHECK(!csv::ParseTime("2024-03-07T12:00 later", seconds));
+  CHECK(!csv::ParseTime("1000", seconds));
+}
+
 TEST(SmartCaseSearch) {
   CHECK(csv::SmartCaseInsensitive("alice"));
   CHECK(!csv::SmartCaseInsensitive("Alice"));
@@ -0,0 +1,121 @@
+#include "test_util.h"
+
+#include "csv_predicate.h"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+const std::vector<std::string> kColumns = {"id", "Price", "time", "name"};
+
+csvpredicate::Predicate MustParse(const std::string &text) {
+  csvpredicate::Predicate predicate;
+  std::string error;
+  if (!csvpredicate::Parse(text, kColumns, predicate, error)) {
+    ++Failures();
+    std::cerr << "    FAIL '" << text << "' did not parse: " << error << "\n";
+  }
+  return predicate;
+}
+
+bool Keeps(const csvpredicate::Predicate &predicate,
+           const std::string &record) {
+  std::string value, scratch;
+  return csvpredicate::Matches(predicate, record, ',', value, scratch);
+}
+
+} // namespace
+
+TEST(PredicateNamesColumnsByNameCaseOrNumber) {
+  csvpredicate::Predicate predicate = MustParse("Price > 10");
+  CHECK_EQ(predicate.clauses.size(), size_t{1});
+  CHECK_EQ(predicate.clauses[0].column, size_t{1});
+  CHECK(predicate.clauses[0].op == csvpredicate::Op::Greater);
+  CHECK(predicate.clauses[0].kind == csvpredicate::Kind::Number);
+  CHECK_EQ(predicate.clauses[0].bound, 10.0);
+
+  predicate = MustParse("price>=10");
+  CHECK_EQ(predicate.clauses[0].column, size_t{1});
+  predicate = MustParse("4 = 'bob'");
+  CHECK_EQ(predicate.clauses[0].column, size_t{3});
+  CHECK(predicate.clauses[0].kind == csvpredicate::Kind::Text);
+  CHECK_EQ(predicate.clauses[0].text, std::string("bob"));
+  CHECK(MustParse("time < 2024-03-01").clauses[0].kind ==
+        csvpredicate::Kind::Time);
+}
+
+TEST(PredicateJoinsClausesWithAnd) {
+  const csvpredicate::Predicate predicate =
+      MustParse("time >= 2024-03-01 AND time < 2024-04-01 and name != brand");
+  CHECK_EQ(predicate.clauses.size(), size_t{3});
+  // "brand" holds "and" but not as a word of its own.
+  CHECK_EQ(predicate.clauses[2].text, std::string("brand"));
+
+  // Nor does a quoted value, whatever it holds.
+  const csvpredicate::Predicate quoted =
+      MustParse("name = \"Bath and Wells\" and id > 3");
+  CHECK_EQ(quoted.clauses.size(), size_t{2});
+  CHECK_EQ(quoted.clauses[0].text, std::string("Bath and Wells"));
+  CHECK(Keeps(quoted, "4,0,0,Bath and Wells"));
+  CHECK_EQ(MustParse("name != 'rock and roll'").clauses.size(), size_t{1});
+  // An apostrophe inside a word quotes nothing.
+  const csvpredicate::Predicate apostrophe =
+      MustParse("name = O'Brien and id > 3");
+  CHECK_EQ(apostrophe.clauses.size(), size_t{2});
+  CHECK_EQ(apostrophe.clauses[0].text, std::string("O'Brien"));
+}
+
+TEST(PredicateSaysWhatIsWrong) {
+  csvpredicate::Predicate predicate;
+  std::string error;
+  CHECK(!csvpredicate::Parse("cost > 3", kColumns, predicate, error));
+  CHECK(error.find("cost") != std::string::npos);
+  CHECK(!csvpredicate::Parse("price 3", kColumns, predicate, error));
+  CHECK(!csvpredicate::Parse("price >", kColumns, predicate, error));
+  CHECK(!csvpredicate::Parse("> 3", kColumns, predicate, error));
+  CHECK(!csvpredicate::Parse("price ! 3", kColumns, predicate, error));
+  CHECK(!csvpredicate::Parse("9 = 3", kColumns, predicate, error));
+  CHECK(!csvpredicate::Parse("99999999999999999999 = 3", kColumns,
+                             predicate, error));
+}
+
+TEST(PredicateComparesByTheKindOfItsValue) {
+  // As numbers: "9" is less than "10", which as text it is not.
+  CHECK(Keeps(MustParse("price < 10"), "1,9,2024-03-01,a"));
+  CHECK(!Keeps(MustParse("price < 10"), "1,10,2024-03-01,a"));
+  // A cell of another kind never matches, even under !=.
+  CHECK(!Keeps(MustParse("price != 10"), "1,n/a,2024-03-01,a"));
+  CHECK(!Keeps(MustParse("price < 10"), "1,,2024-03-01,a"));
+
+  // As instants, so an offset counts.
+  const csvpredicate::Predicate window =
+      MustParse("time >= 2024-03-01 and time < 2024-03-02");
+  CHECK(Keeps(window, "1,1,2024-03-01T10:00:00Z,a"));
+  CHECK(!Keeps(window, "1,1,2024-03-01T00:30:00+01:00,a"));
+  CHECK(!Keeps(window, "1,1,2024-03-02,a"));
+
+  CHECK(Keeps(MustParse("name = \"o, k\""), "1,1,2024-03-01,\"o, k\""));
+  CHECK(!Keeps(MustParse("name = ok"), "1,1,2024-03-01,OK"));
+}
+
+TEST(PredicateRulesOutRangesThatCannotMatch) {
+  const csvpredicate::Clause above = MustParse("price > 100").clauses[0];
+  CHECK(!csvpredicate::CouldMatch(above, 0, 100));
+  CHECK(csvpredicate::CouldMatch(above, 0, 100.5));
+
+  const csvpredicate::Clause equal = MustParse("price = 5").clauses[0];
+  CHECK(csvpredicate::CouldMatch(equal, 5, 5));
+  CHECK(!csvpredicate::CouldMatch(equal, 6, 9));
+
+  const csvpredicate::Clause other = MustParse("price != 5").clauses[0];
+  CHECK(!csvpredicate::CouldMatch(other, 5, 5));
+  CHECK(csvpredicate::CouldMatch(other, 5, 6));
+
+  // A zone with no values of the kind holds no match.
+  const double none = std::numeric_limits<double>::infinity();
+  CHECK(!csvpredicate::CouldMatch(above, none, -none));
+  // Text has no range to rule out.
+  CHECK(csvpredicate::CouldMatch(MustParse("name = x").clauses[0], 1, 0));
+}
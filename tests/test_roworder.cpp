@@ -0,0 +1,54 @@
+#include "test_util.h"
+
+#include "csv_roworder.h"
+#include "csv_sortrun.h"
+
+#include <string>
+#include <vector>
+
+using csvrows::RowOrder;
+
+TEST(RowOrderIsNarrowUnlessARowNeedsMore) {
+  RowOrder order(std::vector<size_t>{4, 0, 7});
+  CHECK(!order.wide());
+  CHECK_EQ(order.size(), size_t{3});
+  CHECK_EQ(order[2], size_t{7});
+  CHECK_EQ(order.MemoryBytes(), 3 * sizeof(uint32_t));
+
+  // A row past four billion widens what is already there without losing it.
+  const size_t far = size_t{5} * 1000 * 1000 * 1000;
+  order.push_back(far);
+  CHECK(order.wide());
+  CHECK(order.ToVector() == (std::vector<size_t>{4, 0, 7, far}));
+}
+
+TEST(RowOrderReservedPastItsBudgetIsMapped) {
+  RowOrder order;
+  std::string error;
+  CHECK(order.Reserve(10000, 10000, 1024, csvsort::TempDirectory(), error));
+  CHECK_EQ(error, std::string(""));
+  CHECK(order.mapped());
+  for (size_t i = 0; i < 10000; ++i)
+    CHECK(order.push_back(9999 - i));
+  // Only what was reserved fits; one more is refused, not written past the
+  // end, and says so.
+  CHECK(!order.push_back(1));
+  CHECK(!order.push_back(2));
+  CHECK_EQ(order.size(), size_t{10000});
+  CHECK_EQ(order[0], size_t{9999});
+  CHECK_EQ(order[9999], size_t{0});
+
+  // Moving hands over the mapping rather than copying or unmapping it.
+  RowOrder moved(std::move(order));
+  CHECK(moved.mapped());
+  CHECK_EQ(moved[1], size_t{9998});
+  CHECK(order.empty());
+}
+
+TEST(RowOrderThatCannotMapSaysWhy) {
+  RowOrder order;
+  std::string error;
+  CHECK(!order.Reserve(10000, 10000, 1024, "/nonexistent/csvtui", error));
+  CHECK(error.find("/nonexistent/csvtui") != std::string::npos);
+  CHECK(!order.mapped());
+}
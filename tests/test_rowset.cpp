@@ -0,0 +1,96 @@
+#include "test_util.h"
+
+#include "csv_rowset.h"
+
+#include <random>
+#include <vector>
+
+using csvrows::RowSet;
+
+namespace {
+
+RowSet FromRows(const std::vector<size_t> &rows) {
+  RowSet set;
+  for (size_t row : rows)
+    set.Add(row);
+  return set;
+}
+
+// Rows spread over several containers, some sparse enough to stay lists and
+// one dense enough to become a bitmap, with the boundaries between them hit.
+std::vector<size_t> Mixed() {
+  std::vector<size_t> rows = {0, 1, 2, 65535};
+  for (size_t row = 65536; row < 65536 + 20000; row += 2)
+    rows.push_back(row); // 10 000 in one container: a bitmap
+  rows.push_back(3 * 65536 + 7);
+  rows.push_back(5 * 65536);
+  rows.push_back(5 * 65536 + 65535);
+  return rows;
+}
+
+} // namespace
+
+TEST(RowSetSelectsAndRanksEveryRow) {
+  const std::vector<size_t> rows = Mixed();
+  const RowSet set = FromRows(rows);
+  CHECK_EQ(set.size(), rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    CHECK_EQ(set.Select(i), rows[i]);
+    CHECK_EQ(set.Rank(rows[i]), i);
+    CHECK(set.Contains(rows[i]));
+  }
+  CHECK(!set.Contains(3));
+  CHECK(!set.Contains(65537));
+  CHECK(!set.Contains(2 * 65536));
+  CHECK_EQ(set.Rank(4 * 65536), rows.size() - 2);
+  CHECK_EQ(set.Rank(100 * 65536), rows.size());
+
+  std::vector<size_t> seen;
+  set.ForEach([&seen](size_t row) { seen.push_back(row); });
+  CHECK(seen == rows);
+}
+
+TEST(RowSetCostsABitARowAtWorst) {
+  // Every row kept: the worst case for a set, which is still an eighth of the
+  // eight bytes a row a list of them costs. The allowance is the part-used
+  // last container, which is paid for in full.
+  RowSet all;
+  const size_t rows = 1000000;
+  for (size_t row = 0; row < rows; ++row)
+    all.Add(row);
+  CHECK(all.MemoryBytes() < rows / 8 + 16384);
+
+  // Sparse: two bytes a row and no more.
+  RowSet sparse;
+  for (size_t row = 0; row < rows; row += 100)
+    sparse.Add(row);
+  CHECK(sparse.MemoryBytes() < (rows / 100) * 2 + 16384);
+}
+
+TEST(RowSetCombinesWithoutTheFile) {
+  std::mt19937 rng(7);
+  std::vector<bool> in_a(300000), in_b(300000);
+  RowSet a, b;
+  for (size_t row = 0; row < in_a.size(); ++row) {
+    // Dense in places and sparse in others, so every pairing of forms meets.
+    const bool dense = (row >> 16) % 2 == 0;
+    in_a[row] = rng() % (dense ? 2 : 50) == 0;
+    in_b[row] = rng() % (dense ? 3 : 40) == 0;
+    if (in_a[row])
+      a.Add(row);
+    if (in_b[row])
+      b.Add(row);
+  }
+
+  RowSet both, either;
+  for (size_t row = 0; row < in_a.size(); ++row) {
+    if (in_a[row] && in_b[row])
+      both.Add(row);
+    if (in_a[row] || in_b[row])
+      either.Add(row);
+  }
+  CHECK(RowSet::Intersect(a, b) == both);
+  CHECK(RowSet::Union(a, b) == either);
+  CHECK(RowSet::Intersect(a, RowSet()).empty());
+  CHECK(RowSet::Union(a, RowSet()) == a);
+}
@@ -4,8 +4,15 @@
 #include "csv_scan.h"
 
 #include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 namespace {
@@ -219,12 +226,13 @@ TEST(ScanFiltersToMatchingRows) {
   csvscan::Result result;
   CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
         csvscan::Outcome::Done);
-  CHECK(result.has_order);
-  CHECK_EQ(result.order.size(), size_t{25}); // one row in four
+  // Filtered but not sorted: the view is a set of rows, not a permutation.
+  CHECK(result.has_rows);
+  CHECK(!result.has_order);
+  CHECK_EQ(result.rows.size(), size_t{25}); // one row in four
   // Counting is unaffected by the filter: it still sees the whole file.
   CHECK_EQ(result.total_rows, size_t{100});
-  for (size_t row : result.order)
-    CHECK_EQ(row % 4, size_t{1});
+  result.rows.ForEach([](size_t row) { CHECK_EQ(row % 4, size_t{1}); });
 }
 
 TEST(ScanSortsWithinAFilterInOnePass) {
@@ -266,6 +274,12 @@ TEST(ScanComputesColumnStatsHonouringTheFilter) {
   CHECK_EQ(all.stats.min, 1.0);
   CHECK_EQ(all.stats.max, 100.0);
   CHECK_EQ(all.stats.mean, 50.5);
+  // Few enough values to keep them all, so the percentiles are exact.
+  CHECK(all.stats.quantiles_exact);
+  CHECK_EQ(all.stats.p50, 50.0);
+  CHECK_EQ(all.stats.p90, 90.0);
+  CHECK_EQ(all.stats.p99, 99.0);
+  CHECK_EQ(all.stats.p999, 100.0);
 
   request.filter = true;
   request.filter_pattern = "alpha"; // rows 1, 5, 9, … scoring 99, 95, 91, …
@@ -277,6 +291,47 @@ TEST(ScanComputesColumnStatsHonouringTheFilter) {
   CHECK_EQ(filtered.stats.max, 99.0);
 }
 
+TEST(ScanEstimatesStatsFromASampleWhileReading) {
+  // Scores fall steadily down the file, so a sample that kept to the top, or
+  // an interval that ignored how alike neighbouring rows are, would miss.
+  const std::string csv = Generate(200000);
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.file_size = static_cast<long long>(csv.size());
+  request.want_stats = true;
+  request.stats_column = 2;
+  request.estimate_stats = true;
+
+  std::vector<csvscan::StatsEstimate> estimates;
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr,
+                     [&](const csvscan::Progress &progress) {
+                       if (progress.estimated)
+                         estimates.push_back(progress.estimate);
+                     }) == csvscan::Outcome::Done);
+  CHECK(!estimates.empty());
+
+  // The first comes as soon as the sample is in, which its own thread takes
+  // while the read begins, and long before the read ends.
+  const csvscan::StatsEstimate &first = estimates.front();
+  CHECK(first.covered < 0.5);
+  CHECK(first.numeric);
+  CHECK(first.sampled > 1000);
+  CHECK(first.mean.low <= 100000.5 && 100000.5 <= first.mean.high);
+  CHECK(first.mean.high - first.mean.low < 40000.0);
+  CHECK(first.p50.low <= 100000.0 && 100000.0 <= first.p50.high);
+  CHECK(first.p90.low <= 180000.0 && 180000.0 <= first.p90.high);
+  CHECK(first.min >= 1.0 && first.max <= 200000.0);
+
+  // Every estimate is bounded by what is there, and the exact figures end it.
+  for (const csvscan::StatsEstimate &estimate : estimates)
+    CHECK(estimate.mean.low <= estimate.mean.value &&
+          estimate.mean.value <= estimate.mean.high);
+  CHECK_EQ(result.stats.mean, 100000.5);
+  CHECK_EQ(result.stats.numeric, size_t{200000});
+}
+
 TEST(ScanCountsEmptyCellsSeparatelyFromNonNumericOnes) {
   TempCSV file("id,value\na,\nb,x\nc,3\n");
   csvscan::Request request;
@@ -293,6 +348,84 @@ TEST(ScanCountsEmptyCellsSeparatelyFromNonNumericOnes) {
   CHECK_EQ(result.stats.numeric, size_t{1});
 }
 
+TEST(ScanProfilesEveryColumnInOnePass) {
+  TempCSV file("id,when,price,note\n"
+               "1,2024-01-02,3.5,caf\xc3\xa9\n"
+               "2,2024-01-03,4,tea\n"
+               "3,,x,tea\n"
+               "4,2024-01-05\n"); // short row: the last two count as empty
+  csvscan::Request request;
+  request.path = file.path();
+  request.data_offset = std::streampos(std::string("id,when,price,note\n").size());
+  request.want_profile = true;
+
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(result.profile.size(), size_t{4});
+
+  const csvscan::ColumnProfile &id = result.profile[0];
+  CHECK_EQ(id.stats.total, size_t{4});
+  CHECK_EQ(id.integers, size_t{4});
+  CHECK_EQ(id.distinct, size_t{4});
+  CHECK_EQ(id.stats.mean, 2.5);
+
+  const csvscan::ColumnProfile &when = result.profile[1];
+  CHECK_EQ(when.dates, size_t{3});
+  CHECK_EQ(when.stats.empty, size_t{1});
+  CHECK_EQ(when.min_length, size_t{10});
+
+  const csvscan::ColumnProfile &price = result.profile[2];
+  CHECK_EQ(price.stats.numeric, size_t{2});
+  CHECK_EQ(price.integers, size_t{1});
+  CHECK_EQ(price.stats.empty, size_t{1});
+  CHECK_EQ(price.stats.min, 3.5);
+  CHECK_EQ(price.stats.max, 4.0);
+
+  const csvscan::ColumnProfile &note = result.profile[3];
+  CHECK_EQ(note.stats.empty, size_t{1});
+  CHECK_EQ(note.distinct, size_t{2});
+  CHECK_EQ(note.min_length, size_t{3});
+  CHECK_EQ(note.max_length, size_t{4}); // "café": characters, not bytes
+
+  // Like the statistics of one column, a profile describes what the filter
+  // leaves.
+  request.filter = true;
+  request.filter_pattern = "tea";
+  csvscan::Result filtered;
+  CHECK(csvscan::Run(request, filtered, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(filtered.profile[0].stats.total, size_t{2});
+  CHECK_EQ(filtered.profile[3].distinct, size_t{1});
+}
+
+TEST(ScanCountsTheMostFrequentValuesOfAColumn) {
+  TempCSV file("id,code\n1,E42\n2,OK\n3,E42\n4,\n5,E42\n6,OK\n7,E7\n");
+  csvscan::Request request;
+  request.path = file.path();
+  request.data_offset = std::streampos(std::string("id,code\n").size());
+  request.want_frequencies = true;
+  request.frequency_column = 1;
+
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(result.frequencies_exact);
+  CHECK_EQ(result.frequency_rows, size_t{7});
+  CHECK_EQ(result.distinct_values, size_t{4}); // the empty value counts
+  CHECK_EQ(result.frequencies[0].value, std::string("E42"));
+  CHECK_EQ(result.frequencies[0].count, size_t{3});
+  CHECK_EQ(result.frequencies[1].value, std::string("OK"));
+
+  request.filter = true;
+  request.filter_pattern = "OK";
+  csvscan::Result filtered;
+  CHECK(csvscan::Run(request, filtered, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(filtered.frequencies.size(), size_t{1});
+  CHECK_EQ(filtered.frequencies[0].count, size_t{2});
+}
+
 TEST(ScanStopsWhenCancelled) {
   const std::string csv = Generate(5000);
   TempCSV file(csv);
@@ -329,6 +462,61 @@ TEST(ScanReportsProgressWhileRunning) {
   CHECK_EQ(last_rows, size_t{20});
 }
 
+TEST(ScanHandsOverTheFirstRowsOfASortBeforeItEnds) {
+  const std::string csv = Generate(300);
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.sort = true;
+  request.sort_column = 2;
+  request.want_order = true;
+  request.provisional_rows = 10;
+
+  std::vector<size_t> leading;
+  bool exact = false;
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr,
+                     [&](const csvscan::Progress &progress) {
+                       if (progress.provisional.empty())
+                         return;
+                       leading = progress.provisional;
+                       exact = progress.provisional_exact;
+                     }) == csvscan::Outcome::Done);
+
+  // Once every row is read the leading rows are the sort's own, so what was
+  // shown early is exactly what the finished view begins with.
+  CHECK(exact);
+  CHECK_EQ(leading.size(), size_t{10});
+  for (size_t i = 0; i < leading.size(); ++i)
+    CHECK_EQ(leading[i], result.order[i]);
+}
+
+TEST(ScanStreamsAFiltersMatchesAsItFindsThem) {
+  const std::string csv = Generate(300);
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.filter = true;
+  request.filter_pattern = "alpha";
+  request.want_order = true;
+  request.stream_matches = true;
+
+  std::vector<size_t> streamed;
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr,
+                     [&](const csvscan::Progress &progress) {
+                       streamed.insert(streamed.end(), progress.matched.begin(),
+                                       progress.matched.end());
+                     }) == csvscan::Outcome::Done);
+
+  // Nothing shown early is ever taken back or reordered: the batches, in
+  // the order they came, are the finished view.
+  std::vector<size_t> kept;
+  result.rows.ForEach([&kept](size_t row) { kept.push_back(row); });
+  CHECK_EQ(kept.size(), size_t{75});
+  CHECK(streamed == kept);
+}
+
 TEST(ScanFailsCleanlyOnAMissingFile) {
   csvscan::Request request;
   request.path = "csvtui-no-such-file-here.csv";
@@ -352,8 +540,188 @@ TEST(ScanHandlesRecordsSpanningTwoLines) {
   CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
         csvscan::Outcome::Done);
   CHECK_EQ(result.total_rows, size_t{2});
-  CHECK_EQ(result.order.size(), size_t{1});
-  CHECK_EQ(result.order[0], size_t{0});
+  CHECK_EQ(result.rows.size(), size_t{1});
+  CHECK_EQ(result.rows.Select(0), size_t{0});
+}
+
+TEST(ScanRefinesAViewWithoutSortingAgain) {
+  const std::string csv = Generate(200);
+  TempCSV file(csv);
+
+  // A sorted view, and the offsets that came with it.
+  csvscan::Request request = RequestFor(file.path());
+  request.sort = true;
+  request.sort_column = 2; // score, the reverse of file order
+  request.want_order = true;
+  csvscan::Result sorted;
+  CHECK(csvscan::Run(request, sorted, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+
+  // What a full pass would give for the filter over that sort.
+  request.filter = true;
+  request.filter_pattern = "alpha";
+  csvscan::Result expected;
+  CHECK(csvscan::Run(request, expected, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+
+  // Narrowing the sorted view must arrive at exactly the same rows in exactly
+  // the same order, having been handed only that view.
+  csvscan::Request refine = RequestFor(file.path());
+  refine.filter = true;
+  refine.filter_pattern = "alpha";
+  refine.want_order = true;
+  refine.refine_rows =
+      std::make_shared<const csvrows::RowOrder>(std::move(sorted.order));
+  refine.refine_offsets = sorted.offsets;
+
+  csvscan::Result narrowed;
+  CHECK(csvscan::Run(refine, narrowed, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(narrowed.has_order);
+  CHECK(narrowed.order == expected.order);
+  // It read too little of the file to describe it.
+  CHECK(narrowed.offsets.empty());
+}
+
+TEST(ScanMapsTheRangeOfAPredicatesColumnByZone) {
+  const std::string csv = Generate(200);
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.filter = true;
+  request.filter_pattern = "id >= 150";
+  request.filter_predicate = true;
+  std::string error;
+  CHECK(csvpredicate::Parse(request.filter_pattern, {"id", "name", "score"},
+                            request.predicate, error));
+  request.want_order = true;
+
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(result.rows.size(), size_t{50});
+  result.rows.ForEach([](size_t row) { CHECK(row >= 150); });
+
+  // Eight-row chunks, so zones of 128 rows: all of the first, and the 72
+  // left over. Rows the filter rejected count towards the range too.
+  CHECK_EQ(result.zones.size(), size_t{1});
+  const csvcache::ZoneMap &map = result.zones[0];
+  CHECK_EQ(map.column, size_t{0});
+  CHECK(!map.times);
+  CHECK_EQ(map.min.size(), size_t{2});
+  CHECK_EQ(map.min[0], 0.0);
+  CHECK_EQ(map.max[0], 127.0);
+  CHECK_EQ(map.min[1], 128.0);
+  CHECK_EQ(map.max[1], 199.0);
+}
+
+TEST(ScanSkimsOnlyTheChunksItIsGiven) {
+  const std::string csv = Generate(200);
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.filter = true;
+  request.filter_pattern = "id >= 150";
+  request.filter_predicate = true;
+  std::string error;
+  CHECK(csvpredicate::Parse(request.filter_pattern, {"id", "name", "score"},
+                            request.predicate, error));
+  request.want_order = true;
+  csvscan::Result full;
+  CHECK(csvscan::Run(request, full, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+
+  // Only the second zone's chunks, as the zone map above would choose.
+  request.refine_offsets = full.offsets;
+  request.skim_total_rows = full.total_rows;
+  request.skim_chunks.assign(full.offsets.size(), false);
+  for (size_t c = 16; c < request.skim_chunks.size(); ++c)
+    request.skim_chunks[c] = true;
+
+  csvscan::Result skimmed;
+  CHECK(csvscan::Run(request, skimmed, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(skimmed.rows == full.rows);
+  CHECK_EQ(skimmed.total_rows, size_t{200});
+  // A skim sees too little of the file to map it.
+  CHECK(skimmed.zones.empty());
+
+  // Flagging the wrong chunks shows that the others really were not read.
+  request.skim_chunks.assign(full.offsets.size(), false);
+  request.skim_chunks[0] = true;
+  csvscan::Result wrong;
+  CHECK(csvscan::Run(request, wrong, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(wrong.rows.size(), size_t{0});
+}
+
+TEST(ScanBuildsATrigramFilterForEveryChunk) {
+  std::string csv = Generate(200);
+  // One row with a rare word, one with it inside a quoted, escaped value.
+  csv += "200,needle,1\n";
+  csv += "201,\"say \"\"hi\"\"\",1\n";
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.gram_bits = 4096;
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(result.grams != nullptr);
+  if (!result.grams)
+    return;
+  CHECK_EQ(result.grams->bits, size_t{4096});
+  CHECK_EQ(result.grams->chunks(), size_t{26}); // 202 rows of 8
+
+  const std::vector<std::uint32_t> needle = csvsketch::Trigrams("NEEDLE");
+  const std::vector<std::uint32_t> quoted = csvsketch::Trigrams("say \"hi\"");
+  for (size_t c = 0; c < result.grams->chunks(); ++c) {
+    const std::uint64_t *bits = result.grams->Chunk(c);
+    CHECK_EQ(csvsketch::MayHoldTrigrams(bits, 4096, needle), c == 25);
+    CHECK_EQ(csvsketch::MayHoldTrigrams(bits, 4096, quoted), c == 25);
+  }
+
+  // A pass that skips chunks cannot say what is in them.
+  request.refine_offsets = result.offsets;
+  request.skim_total_rows = result.total_rows;
+  request.skim_chunks.assign(result.offsets.size(), true);
+  csvscan::Result skimmed;
+  CHECK(csvscan::Run(request, skimmed, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(skimmed.grams == nullptr);
+}
+
+TEST(ScanIndexesTheTrigramsOfEveryZone) {
+  std::string csv = Generate(300);
+  csv += "300,needle,1\n";
+  csv += "301,\"say \"\"hi\"\"\",1\n";
+  TempCSV file(csv);
+
+  csvscan::Request request = RequestFor(file.path());
+  request.want_gram_index = true;
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(result.grams == nullptr); // asked for the index alone
+  CHECK(result.gram_index != nullptr);
+  if (!result.gram_index)
+    return;
+  // 302 rows in zones of 16 chunks of 8.
+  const csvcache::GramIndex &index = *result.gram_index;
+  CHECK_EQ(index.zones, size_t{3});
+  CHECK(index.ZonesHolding(csvsketch::Trigrams("Needle")) ==
+        std::vector<size_t>({2}));
+  CHECK(index.ZonesHolding(csvsketch::Trigrams("say \"hi\"")) ==
+        std::vector<size_t>({2}));
+  CHECK(index.ZonesHolding(csvsketch::Trigrams("needles")).empty());
+
+  request.refine_offsets = result.offsets;
+  request.skim_total_rows = result.total_rows;
+  request.skim_chunks.assign(result.offsets.size(), true);
+  csvscan::Result skimmed;
+  CHECK(csvscan::Run(request, skimmed, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(skimmed.gram_index == nullptr);
 }
 
 // --- the worker --------------------------------------------------------------
@@ -373,19 +741,20 @@ TEST(ScannerRunsOnAThreadAndHandsBackTheSameResult) {
 
   std::atomic<int> notifications{0};
   CSVScanner scanner;
-  scanner.Start(request, [&] { ++notifications; });
+  const CSVScanner::PassId pass =
+      scanner.Start(request, [&] { ++notifications; });
   scanner.Join();
 
-  CHECK(scanner.state() == CSVScanner::State::Done);
+  CHECK(scanner.state(pass) == CSVScanner::State::Done);
   CSVScanner::Result actual;
-  CHECK(scanner.Take(actual));
+  CHECK(scanner.Take(pass, actual));
   CHECK_EQ(actual.total_rows, expected.total_rows);
   CHECK(actual.order == expected.order);
   CHECK(notifications.load() >= 1);
 
-  // Take() leaves it reusable.
-  CHECK(scanner.state() == CSVScanner::State::Idle);
-  CHECK(!scanner.Take(actual));
+  // Take() is once only.
+  CHECK(scanner.state(pass) == CSVScanner::State::Idle);
+  CHECK(!scanner.Take(pass, actual));
 }
 
 TEST(ScannerCancelsPromptly) {
@@ -397,15 +766,15 @@ TEST(ScannerCancelsPromptly) {
   request.sort = true;
 
   CSVScanner scanner;
-  scanner.Start(request, nullptr);
+  const CSVScanner::PassId pass = scanner.Start(request, nullptr);
   scanner.Cancel();
   scanner.Join();
 
-  CHECK(scanner.state() == CSVScanner::State::Cancelled);
+  CHECK(scanner.state(pass) == CSVScanner::State::Cancelled);
   // A cancelled pass yields nothing, so a caller cannot mistake a partial
   // ordering for a complete one.
   CSVScanner::Result result;
-  CHECK(!scanner.Take(result));
+  CHECK(!scanner.Take(pass, result));
 }
 
 TEST(ScannerReportsFailureWithoutBlocking) {
@@ -413,7 +782,141 @@ TEST(ScannerReportsFailureWithoutBlocking) {
   request.path = "csvtui-no-such-file-here.csv";
 
   CSVScanner scanner;
-  scanner.Start(request, nullptr);
+  const CSVScanner::PassId pass = scanner.Start(request, nullptr);
   scanner.Join();
-  CHECK(scanner.state() == CSVScanner::State::Failed);
+  CHECK(scanner.state(pass) == CSVScanner::State::Failed);
+}
+
+namespace {
+
+// Starts `first`, and once it has read some of the file, `later` alongside.
+// The join point depends on timing; the results must not.
+std::vector<CSVScanner::Result>
+RunAlongside(const csvscan::Request &first,
+             const std::vector<csvscan::Request> &later) {
+  CSVScanner scanner;
+  std::vector<CSVScanner::PassId> passes;
+  passes.push_back(scanner.Start(first, nullptr));
+  while (scanner.running(passes[0]) && scanner.rows_seen(passes[0]) == 0)
+    std::this_thread::yield();
+  for (const csvscan::Request &request : later)
+    passes.push_back(scanner.Start(request, nullptr));
+  scanner.Join();
+
+  std::vector<CSVScanner::Result> results(passes.size());
+  for (size_t i = 0; i < passes.size(); ++i)
+    CHECK(scanner.Take(passes[i], results[i]));
+  return results;
+}
+
+} // namespace
+
+TEST(ScannerPassesThatJoinARunningReadGetTheWholeFile) {
+  const std::string csv = Generate(300000);
+  TempCSV file(csv);
+
+  csvscan::Request sort = RequestFor(file.path());
+  sort.sort = true;
+  sort.sort_column = 2;
+  sort.want_order = true;
+
+  csvscan::Request filter = RequestFor(file.path());
+  filter.filter = true;
+  filter.filter_pattern = "alpha";
+  filter.want_order = true;
+
+  csvscan::Request stats = RequestFor(file.path());
+  stats.want_stats = true;
+  stats.stats_column = 2;
+  stats.count_pattern = "beta";
+
+  const std::vector<CSVScanner::Result> shared =
+      RunAlongside(sort, {filter, stats});
+
+  // Each the same as it would have been on a read of its own.
+  csvscan::Result alone;
+  CHECK(csvscan::Run(sort, alone, nullptr, nullptr) == csvscan::Outcome::Done);
+  CHECK(shared[0].order == alone.order);
+  CHECK(shared[0].offsets == alone.offsets);
+
+  CHECK(csvscan::Run(filter, alone, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(shared[1].rows == alone.rows);
+  CHECK_EQ(shared[1].total_rows, size_t{300000});
+  CHECK(shared[1].offsets == alone.offsets);
+
+  CHECK(csvscan::Run(stats, alone, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(shared[2].stats.total, alone.stats.total);
+  CHECK_EQ(shared[2].stats.min, alone.stats.min);
+  CHECK_EQ(shared[2].stats.max, alone.stats.max);
+  CHECK_EQ(shared[2].matches, alone.matches);
+}
+
+TEST(ScannerCancelsOnePassWithoutTheOthers) {
+  const std::string csv = Generate(200000);
+  TempCSV file(csv);
+
+  csvscan::Request sort = RequestFor(file.path());
+  sort.sort = true;
+  sort.want_order = true;
+  csvscan::Request count = RequestFor(file.path());
+
+  CSVScanner scanner;
+  const CSVScanner::PassId sorting = scanner.Start(sort, nullptr);
+  const CSVScanner::PassId counting = scanner.Start(count, nullptr);
+  scanner.Cancel(sorting);
+  scanner.Join();
+
+  CHECK(scanner.state(sorting) == CSVScanner::State::Cancelled);
+  CHECK(scanner.state(counting) == CSVScanner::State::Done);
+  CSVScanner::Result result;
+  CHECK(scanner.Take(counting, result));
+  CHECK_EQ(result.total_rows, size_t{200000});
+}
+
+TEST(ScannerHoldsABackgroundPassWhileAnotherRuns) {
+  TempCSV file(Generate(2000));
+  // A pass reading a pipe runs until something is written to it, which is a
+  // pass that runs for exactly as long as the test needs.
+  char directory[] = "/tmp/csvtui-fifo-XXXXXX";
+  CHECK(::mkdtemp(directory) != nullptr);
+  const std::string fifo = std::string(directory) + "/rows";
+  CHECK_EQ(::mkfifo(fifo.c_str(), 0600), 0);
+
+  csvscan::Request idle = RequestFor(file.path());
+  idle.background = true;
+  CHECK(!csvscan::CanShareRead(idle, RequestFor(file.path())));
+
+  CSVScanner scanner;
+  const CSVScanner::PassId stuck = scanner.Start(RequestFor(fifo), nullptr);
+  const CSVScanner::PassId waiting = scanner.Start(idle, nullptr);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  CHECK(scanner.running(waiting));
+
+  // Promoted, it waits for nothing.
+  scanner.Promote(waiting);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (scanner.running(waiting) &&
+         std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  CHECK(scanner.running(stuck));
+  CSVScanner::Result result;
+  CHECK(scanner.Take(waiting, result));
+  CHECK_EQ(result.total_rows, size_t{2000});
+
+  // Another waits only until the pass ahead of it ends.
+  const CSVScanner::PassId later = scanner.Start(idle, nullptr);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  CHECK(scanner.running(later));
+  // Opening the other end lets the stuck pass go; what it then makes of the
+  // pipe does not matter here.
+  ::close(::open(fifo.c_str(), O_WRONLY));
+  scanner.Join();
+  CHECK(scanner.Take(later, result));
+  CHECK_EQ(result.total_rows, size_t{2000});
+
+  ::unlink(fifo.c_str());
+  ::rmdir(directory);
 }
@@ -0,0 +1,199 @@
+#include "test_util.h"
+
+#include "csv_sketch.h"
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+TEST(DistinctCounterIsNearlyExactForSmallCounts) {
+  csvsketch::DistinctCounter counter;
+  CHECK_EQ(counter.Estimate(), 0.0);
+  for (int repeat = 0; repeat < 3; ++repeat)
+    for (int i = 0; i < 50; ++i)
+      counter.Add("value" + std::to_string(i));
+  // Two values can share a register, so not quite exact; but a small count is
+  // read from how many registers are still empty, which is good to about one.
+  CHECK(std::fabs(counter.Estimate() - 50) <= 1.0);
+}
+
+TEST(DistinctCounterStaysWithinItsStatedError) {
+  csvsketch::DistinctCounter counter;
+  const int distinct = 100000;
+  for (int i = 0; i < distinct; ++i) {
+    counter.Add(std::to_string(i));
+    counter.Add(std::to_string(i)); // duplicates change nothing
+  }
+  // Four standard errors: a hash that failed this would be badly broken, not
+  // merely unlucky.
+  const double error = std::fabs(counter.Estimate() - distinct) / distinct;
+  CHECK(error < 4 * csvsketch::DistinctCounter::RelativeError());
+}
+
+TEST(DistinctCountersMergeIntoTheWholeCount) {
+  csvsketch::DistinctCounter first, second, whole;
+  for (int i = 0; i < 30000; ++i) {
+    const std::string value = "k" + std::to_string(i);
+    (i < 20000 ? first : second).Add(value);
+    if (i >= 10000 && i < 20000)
+      second.Add(value); // an overlap counted once
+    whole.Add(value);
+  }
+  first.Merge(second);
+  CHECK_EQ(first.Estimate(), whole.Estimate());
+}
+
+// --- quantiles ---------------------------------------------------------------
+
+namespace {
+
+// The true rank of `value` among 0 … n-1 shuffled, as a fraction.
+double RankOf(double value, size_t n) { return value / static_cast<double>(n); }
+
+// 0 … n-1 in a scrambled but repeatable order: a sketch fed sorted input
+// would be tested on its easiest case.
+std::vector<double> Scrambled(size_t n) {
+  std::vector<double> values(n);
+  for (size_t i = 0; i < n; ++i)
+    values[i] = static_cast<double>((i * 7919) % n); // 7919 is prime, n is not
+  return values;
+}
+
+} // namespace
+
+TEST(QuantileSketchIsExactWhileItHoldsEverything) {
+  csvsketch::QuantileSketch sketch;
+  CHECK_EQ(sketch.Quantile(0.5), 0.0);
+  for (int i = 1; i <= 101; ++i)
+    sketch.Add(static_cast<double>(102 - i));
+  CHECK(sketch.exact());
+  CHECK_EQ(sketch.Quantile(0.5), 51.0);
+  CHECK_EQ(sketch.Quantile(0.0), 1.0);
+  CHECK_EQ(sketch.Quantile(1.0), 101.0);
+}
+
+TEST(QuantileSketchStaysWithinItsRankError) {
+  const size_t n = 1000000;
+  csvsketch::QuantileSketch sketch;
+  for (double value : Scrambled(n))
+    sketch.Add(value);
+  CHECK(!sketch.exact());
+  CHECK_EQ(sketch.count(), n);
+
+  const double bound = csvsketch::QuantileSketch::RankError();
+  for (double q : {0.5, 0.9, 0.99, 0.999}) {
+    const double error = std::fabs(RankOf(sketch.Quantile(q), n) - q);
+    CHECK(error <= bound);
+  }
+}
+
+TEST(QuantileSketchesMergeAcrossPartitions) {
+  // Two halves of a file, sketched apart and merged, as a split scan would.
+  const size_t n = 400000;
+  const std::vector<double> values = Scrambled(n);
+  csvsketch::QuantileSketch first, second;
+  for (size_t i = 0; i < n; ++i)
+    (i < n / 2 ? first : second).Add(values[i]);
+  first.Merge(second);
+
+  CHECK_EQ(first.count(), n);
+  const double bound = csvsketch::QuantileSketch::RankError();
+  for (double q : {0.5, 0.99})
+    CHECK(std::fabs(RankOf(first.Quantile(q), n) - q) <= 2 * bound);
+}
+
+// --- frequencies -------------------------------------------------------------
+
+TEST(FrequencyCounterIsExactWithinItsBudget) {
+  csvsketch::FrequencyCounter counter;
+  for (int i = 0; i < 1000; ++i)
+    counter.Add(i % 10 == 0 ? "ten" : (i % 2 == 0 ? "even" : "odd"));
+  CHECK(counter.exact());
+  CHECK_EQ(counter.distinct(), size_t{3});
+
+  const std::vector<csvsketch::Frequency> top = counter.Top(2);
+  CHECK_EQ(top.size(), size_t{2});
+  CHECK_EQ(top[0].value, std::string("odd"));
+  CHECK_EQ(top[0].count, size_t{500});
+  CHECK_EQ(top[1].value, std::string("even"));
+  CHECK_EQ(top[1].count, size_t{400});
+  CHECK_EQ(top[1].error, size_t{0});
+}
+
+TEST(FrequencyCounterKeepsHeavyHittersPastItsBudget) {
+  // A budget a few thousand values would exhaust, against half a million
+  // distinct ones, with three values far more common than the rest.
+  csvsketch::FrequencyCounter counter(1024 * 1024);
+  const size_t rows = 600000;
+  for (size_t i = 0; i < rows; ++i) {
+    if (i % 20 == 0)
+      counter.Add("heavy-a");
+    else if (i % 50 == 1)
+      counter.Add("heavy-b");
+    else if (i % 100 == 3)
+      counter.Add("heavy-c");
+    else
+      counter.Add("rare-" + std::to_string(i));
+  }
+  CHECK(!counter.exact());
+  CHECK_EQ(counter.count(), rows);
+  // Space-Saving's promise: no count off by more than count()/kTracked.
+  CHECK(counter.MaxError() <= rows / csvsketch::FrequencyCounter::kTracked);
+
+  const std::vector<csvsketch::Frequency> top = counter.Top(3);
+  CHECK_EQ(top[0].value, std::string("heavy-a"));
+  CHECK_EQ(top[1].value, std::string("heavy-b"));
+  CHECK_EQ(top[2].value, std::string("heavy-c"));
+  for (const csvsketch::Frequency &entry : top) {
+    const size_t truth = entry.value == "heavy-a"   ? rows / 20
+                         : entry.value == "heavy-b" ? rows / 50
+                                                    : rows / 100;
+    CHECK(entry.count >= truth);
+    CHECK(entry.count - entry.error <= truth);
+  }
+}
+
+TEST(TrigramFilterNeverMissesWhatTheTextHolds) {
+  std::vector<std::uint64_t> bits(64); // 4096 bits
+  const std::string text = "2024-03-07,checkout,Payment DECLINED by issuer";
+  csvsketch::AddTrigrams(text.data(), text.size(), bits.data(), 4096);
+
+  for (const char *present : {"checkout", "payment declined", "DECLINED",
+                              "Declined", "2024-03", "issuer"})
+    CHECK(csvsketch::MayHoldTrigrams(bits.data(), 4096,
+                                     csvsketch::Trigrams(present)));
+  // Absent text is ruled out, bar the odd collision this test was checked
+  // not to have.
+  for (const char *absent : {"refund", "approved", "2023-"})
+    CHECK(!csvsketch::MayHoldTrigrams(bits.data(), 4096,
+                                      csvsketch::Trigrams(absent)));
+  // Too short to have a trigram: nothing can be ruled out.
+  CHECK(csvsketch::Trigrams("zq").empty());
+  CHECK(csvsketch::MayHoldTrigrams(bits.data(), 4096, csvsketch::Trigrams("zq")));
+}
+
+TEST(TrigramFilterRulesOutMostTextAtABitPerFourBytes) {
+  // A chunk's worth of log-like rows, with the filter sized as the model
+  // sizes it, then words the rows do not contain.
+  std::string chunk;
+  for (int i = 0; i < 512; ++i)
+    chunk += std::to_string(1700000000 + i * 37) + ",host-" +
+             std::to_string(i % 23) + ",GET /api/v2/orders/" +
+             std::to_string(i * 7919 % 100000) + ",200," +
+             std::to_string(i * 13 % 997) + "ms\n";
+  const size_t bit_count = (chunk.size() / 4) / 64 * 64;
+  std::vector<std::uint64_t> bits(bit_count / 64);
+  csvsketch::AddTrigrams(chunk.data(), chunk.size(), bits.data(), bit_count);
+
+  size_t passed = 0;
+  const size_t words = 1000;
+  for (size_t i = 0; i < words; ++i) {
+    const std::string word = "user" + std::to_string(i * 7 + 1000) + "x";
+    passed += csvsketch::MayHoldTrigrams(bits.data(), bit_count,
+                                         csvsketch::Trigrams(word))
+                  ? 1
+                  : 0;
+  }
+  CHECK(passed < words / 20);
+}
@@ -186,7 +186,7 @@ TEST(SpilledSortKeepsEveryRowExactlyOnce) {
         csvscan::Outcome::Done);
   CHECK_EQ(result.order.size(), size_t{2500});
 
-  std::vector<size_t> seen = result.order;
+  std::vector<size_t> seen = result.order.ToVector();
   std::sort(seen.begin(), seen.end());
   for (size_t i = 0; i < seen.size(); ++i)
     CHECK_EQ(seen[i], i);
@@ -212,6 +212,30 @@ TEST(SpilledSortRemovesItsTemporaryFiles) {
   CHECK_EQ(RunFilesIn(directory), before);
 }
 
+// Spilled keys and an answer too big for its budget: the whole sort happens
+// on disk, and gives the same rows as one done entirely in memory.
+TEST(SortLargerThanItsBudgetFinishesOnDisk) {
+  const std::string csv = Generate(3000, 23);
+  TempCSV file(csv);
+  csvscan::Request request = RequestFor(file.path(), csv);
+  request.sort_column = 1;
+
+  csvscan::Result in_memory;
+  CHECK(csvscan::Run(request, in_memory, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(!in_memory.order.mapped());
+  CHECK(!in_memory.order.wide());
+
+  request.sort_memory_budget = 4 * 1024;
+  request.order_memory_budget = 1024; // 3000 rows want 12 kB
+  csvscan::Result on_disk;
+  CHECK(csvscan::Run(request, on_disk, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(on_disk.order.mapped());
+  CHECK_EQ(on_disk.order.MemoryBytes(), size_t{0});
+  CHECK(on_disk.order == in_memory.order);
+}
+
 TEST(CancelledSpilledSortLeavesNothingBehind) {
   const std::string directory = csvsort::TempDirectory();
   const size_t before = RunFilesIn(directory);
@@ -247,6 +271,25 @@ TEST(SortRunReportsWhereItCannotWrite) {
   CHECK(store.error().find("/definitely/not/a/directory") != std::string::npos);
 }
 
+TEST(MergeFailsRatherThanDropRowsPastTheReservation) {
+  csvsort::RunStore store(csvsort::TempDirectory());
+  std::vector<csvsort::Key> keys(8);
+  for (size_t i = 0; i < keys.size(); ++i)
+    keys[i].row = i;
+  CHECK(store.Spill(keys, csvsort::Order{}));
+
+  // Reserved for fewer rows than the runs hold, and mapped.
+  csvrows::RowOrder order;
+  std::string error;
+  CHECK(order.Reserve(5, 8, 1, csvsort::TempDirectory(), error));
+  CHECK(order.mapped());
+  std::vector<csvsort::Key> tail(3);
+  for (size_t i = 0; i < tail.size(); ++i)
+    tail[i].row = 8 + i;
+  CHECK(!store.Merge(tail, csvsort::Order{}, order, nullptr));
+  CHECK(!store.error().empty());
+}
+
 TEST(TempDirectoryHonoursTheOverride) {
   const char *previous = ::getenv("CSVTUI_TMPDIR");
   const std::string saved = previous ? previous : "";
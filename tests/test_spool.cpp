@@ -0,0 +1,162 @@
+#include "test_util.h"
+
+#include "csv_model.h"
+#include "csv_scan.h"
+#include "csv_spool.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Waits for `done` to hold, for far longer than a spooler should take.
+template <typename Condition> bool Eventually(Condition done) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (done())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return false;
+}
+
+void WriteAll(int fd, const std::string &text) {
+  size_t done = 0;
+  while (done < text.size()) {
+    const ssize_t chunk = ::write(fd, text.data() + done, text.size() - done);
+    if (chunk <= 0)
+      return;
+    done += static_cast<size_t>(chunk);
+  }
+}
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+} // namespace
+
+TEST(SpoolerWritesWholeRecordsAndIndexesThem) {
+  std::string contents = "id,note\n";
+  for (int i = 0; i < 1300; ++i)
+    contents += std::to_string(i) +
+                (i % 7 == 0 ? ",\"two\nlines, \"\"quoted\"\"\"\n" : ",plain\n");
+  contents += "1300,no line break at the end";
+
+  TempCSV file("");
+  int pipe_fds[2];
+  CHECK_EQ(::pipe(pipe_fds), 0);
+  const int out = ::open(file.path().c_str(), O_WRONLY | O_TRUNC);
+  CHECK(out >= 0);
+  csvspool::Spooler spooler(pipe_fds[0], out, CSVModel::kChunkSize);
+
+  // Cut inside the quoted field of row 7: only what comes before it is a
+  // record yet, and only that reaches the file.
+  const size_t cut = contents.find("two\nlines", contents.find("\n7,")) + 5;
+  WriteAll(pipe_fds[1], contents.substr(0, cut));
+  CHECK(Eventually([&] { return spooler.records() == 8; }));
+  CHECK_EQ(ReadFile(file.path()), contents.substr(0, contents.find("\n7,") + 1));
+  CHECK(!spooler.finished());
+  std::vector<std::streampos> offsets;
+  size_t rows = 0;
+  CHECK(!spooler.Index(true, offsets, rows));
+
+  WriteAll(pipe_fds[1], contents.substr(cut));
+  ::close(pipe_fds[1]);
+  CHECK(Eventually([&] { return spooler.finished(); }));
+  CHECK(spooler.TakeChange());
+  CHECK_EQ(spooler.error(), std::string(""));
+  CHECK_EQ(ReadFile(file.path()), contents);
+
+  // The table a full pass over the finished file builds, header or not.
+  for (const bool header : {true, false}) {
+    CSVModel model;
+    CHECK_EQ(model.Open(file.path(), ',', header), std::string(""));
+    csvscan::Request request;
+    model.DescribeScan(request);
+    csvscan::Result result;
+    CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+          csvscan::Outcome::Done);
+    CHECK(spooler.Index(header, offsets, rows));
+    CHECK_EQ(rows, result.total_rows);
+    CHECK_EQ(rows, size_t{header ? 1301u : 1302u});
+    CHECK(offsets == result.offsets);
+  }
+}
+
+TEST(SpoolerWaitsForTheFirstRecords) {
+  TempCSV file("");
+  int pipe_fds[2];
+  CHECK_EQ(::pipe(pipe_fds), 0);
+  const int out = ::open(file.path().c_str(), O_WRONLY | O_TRUNC);
+  csvspool::Spooler spooler(pipe_fds[0], out, CSVModel::kChunkSize);
+
+  // A writer with only a header to give is waited for as long as patience
+  // allows, and then shown.
+  WriteAll(pipe_fds[1], "id,name\n1,al");
+  spooler.WaitForRecords(100, std::chrono::milliseconds(50));
+  CHECK_EQ(spooler.records(), size_t{1});
+  CHECK_EQ(ReadFile(file.path()), std::string("id,name\n"));
+  ::close(pipe_fds[1]);
+  CHECK(Eventually([&] { return spooler.finished(); }));
+  CHECK_EQ(spooler.records(), size_t{2});
+}
+
+// A filter asked for while the input is arriving would match only what has
+// arrived, and say that was the file. Described then and run once the input
+// ends, as the controller does with it, it matches all of it.
+TEST(SpoolerLetsAFilterAskedMeanwhileMatchAllTheInput) {
+  std::string contents = "id,name\n";
+  for (int i = 0; i < 2000; ++i)
+    contents += std::to_string(i) + (i % 10 == 0 ? ",keep\n" : ",skip\n");
+  const size_t half = contents.find("\n1000,") + 1;
+
+  TempCSV file("");
+  int pipe_fds[2];
+  CHECK_EQ(::pipe(pipe_fds), 0);
+  const int out = ::open(file.path().c_str(), O_WRONLY | O_TRUNC);
+  CHECK(out >= 0);
+  csvspool::Spooler spooler(pipe_fds[0], out, CSVModel::kChunkSize);
+  WriteAll(pipe_fds[1], contents.substr(0, half));
+  CHECK(Eventually([&] { return spooler.records() == 1001; }));
+
+  CSVModel model;
+  CHECK_EQ(model.Open(file.path(), {}, {}), std::string(""));
+  model.SetArriving(true);
+  CSVModel::ViewState target = model.CurrentViewState();
+  target.filter_active = true;
+  target.filter_pattern = "keep";
+  csvscan::Request request;
+  model.DescribeScan(request);
+  model.DescribeFilter(target, request);
+  request.want_order = true;
+
+  csvscan::Result early;
+  CHECK(csvscan::Run(request, early, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK_EQ(early.rows.size(), size_t{100});
+
+  WriteAll(pipe_fds[1], contents.substr(half));
+  ::close(pipe_fds[1]);
+  CHECK(Eventually([&] { return spooler.finished(); }));
+  model.CheckGrowth();
+  model.SetArriving(false);
+  std::vector<std::streampos> offsets;
+  size_t rows = 0;
+  CHECK(spooler.Index(true, offsets, rows));
+  model.AdoptIndex(std::move(offsets), rows);
+
+  request.file_size = model.FileSize();
+  csvscan::Result result;
+  CHECK(csvscan::Run(request, result, nullptr, nullptr) ==
+        csvscan::Outcome::Done);
+  CHECK(result.has_rows);
+  CHECK_EQ(result.rows.size(), size_t{200});
+  CHECK_EQ(result.total_rows, size_t{2000});
+}
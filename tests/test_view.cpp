@@ -210,10 +210,11 @@ TEST(ViewHelpShowsEveryBinding) {
   const std::string screen = fixture.Render(80, 24);
 
   for (const char *key : {"h j k l", "Ctrl-D", "Ctrl-F", "PgDn", "gg / G",
-                          "<n>G", "0 / $", "/ then Enter", "n / N",
-                          "f then Enter", "w then Enter", "s / S", "u",
-                          "x / X", "z", "< / >", "=", "Enter", "y", "c", "H",
-                          "t", "?", "Esc", "q", "mouse"}) {
+                          "<n>G", "<n>%", "0 / $", "/ then Enter", "n / N",
+                          "f then Enter", "F then Enter", "w then Enter",
+                          "s / S", "u", "x / X", "z", "< / >", "=", "Enter",
+                          "y", "c", "p", "v", "a … a", "H", "t", "?", "Esc",
+                          "q", "mouse"}) {
     if (screen.find(key) == std::string::npos) {
       ++Failures();
       std::cerr << "    FAIL help overlay does not show \"" << key << "\"\n";
@@ -0,0 +1,75 @@
+#include "test_util.h"
+
+#include "csv_watch.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+// Waits for the watcher to say so, by default for as long as polling could
+// take.
+bool ChangeSeen(csvwatch::Watcher &watcher,
+                std::chrono::milliseconds within = csvwatch::kPollInterval *
+                                                   8) {
+  const auto deadline = std::chrono::steady_clock::now() + within;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (watcher.TakeChange())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+} // namespace
+
+TEST(WatcherNoticesRowsAppended) {
+  TempCSV file("id,name\n1,alpha\n");
+  std::atomic<int> notified{0};
+  csvwatch::Watcher watcher(file.path(), [&notified] { ++notified; });
+  CHECK(!watcher.TakeChange());
+
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    out << "2,beta\n";
+  }
+  CHECK(ChangeSeen(watcher));
+  CHECK(notified.load() >= 1);
+  // Said once, until there is something new to say.
+  CHECK(!watcher.TakeChange());
+
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    out << "3,gamma\n";
+  }
+  CHECK(ChangeSeen(watcher));
+}
+
+// Rotated by renaming, the way logrotate does it by default: the name now
+// belongs to a new file, and what is written to that is noticed as promptly
+// as before, not only when the clock comes round.
+TEST(WatcherFollowsTheNameThroughARotation) {
+  TempCSV file("id,name\n1,alpha\n");
+  csvwatch::Watcher watcher(file.path(), nullptr);
+  const std::string rotated = file.path() + ".1";
+  CHECK_EQ(std::rename(file.path().c_str(), rotated.c_str()), 0);
+  {
+    std::ofstream out(file.path(), std::ios::binary);
+    out << "id,name\n";
+  }
+  CHECK(ChangeSeen(watcher));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  watcher.TakeChange();
+
+  {
+    std::ofstream out(file.path(), std::ios::binary | std::ios::app);
+    out << "2,beta\n";
+  }
+  CHECK(watcher.notified() ? ChangeSeen(watcher, csvwatch::kPollInterval)
+                           : ChangeSeen(watcher));
+  std::remove(rotated.c_str());
+}